@@ -82,4 +82,27 @@ CREATE TABLE IF NOT EXISTS files (
 );
 
 CREATE UNIQUE INDEX IF NOT EXISTS `idx_not_directory_id` ON files(name, group_id) 
-WHERE directory_id IS NULL;
\ No newline at end of file
+WHERE directory_id IS NULL;
+-- create table `uploads` if not exists
+CREATE TABLE IF NOT EXISTS uploads (
+  id INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT,
+  name TEXT NOT NULL,
+  path TEXT NOT NULL,
+  directory_id INTEGER NULL,
+  group_id INTEGER NOT NULL,
+  owner_id INTEGER NOT NULL,
+  created_at DATETIME NOT NULL DEFAULT CURRENT_TIMESTAMP,
+  FOREIGN KEY (directory_id) REFERENCES directories(id) ON DELETE CASCADE,
+  FOREIGN KEY (group_id) REFERENCES groups(id) ON DELETE CASCADE,
+  FOREIGN KEY (owner_id) REFERENCES users(id) ON DELETE CASCADE
+);
+
+-- create table `upload_parts` if not exists
+CREATE TABLE IF NOT EXISTS upload_parts (
+  upload_id INTEGER NOT NULL,
+  part_number INTEGER NOT NULL,
+  size INTEGER NOT NULL,
+  updated_at DATETIME NOT NULL DEFAULT CURRENT_TIMESTAMP,
+  PRIMARY KEY (upload_id, part_number),
+  FOREIGN KEY (upload_id) REFERENCES uploads(id) ON DELETE CASCADE
+);
@@ -0,0 +1,41 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// A block of the memory an arena hands out.
+struct ArenaBlock
+{
+  struct ArenaBlock *next; // The block filled before this one
+  size_t used;             // The bytes of data in use
+  size_t size;             // The bytes of data
+  max_align_t data[];      // The allocations
+};
+
+// Arenas hand out memory by bumping a pointer through large blocks, and free it all at once: the many small
+// allocations that live as long as their owner (a request, a dictionary) cost neither a malloc nor a free each.
+struct Arena
+{
+  /* Private variables */
+
+  struct ArenaBlock *blocks; // The block being filled, then the ones filled before it
+  size_t block_size;         // The size of the blocks; larger allocations get a block of their own
+
+  /* Public methods */
+
+  // Allocates memory aligned for any type, which stays valid until the arena is destroyed.
+  void *(*alloc)(struct Arena *arena, size_t size);
+  // Copies length bytes of a string and NUL terminates the copy.
+  char *(*copy)(struct Arena *arena, const char *string, size_t length);
+  // Formats a string as sprintf does, into memory of the exact size.
+  char *(*format)(struct Arena *arena, const char *format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+// Creating a new arena. No memory is allocated before the first allocation.
+struct Arena arena_constructor(size_t block_size);
+// Freeing every allocation of the arena at once. The arena is left empty and can be used again.
+void arena_destructor(struct Arena *arena);
+// Freeing every allocation of the arena but keeping one block for the next ones, so reusing it costs no malloc.
+void arena_reset(struct Arena *arena);
+
+#endif /* ARENA_H */
@@ -1,34 +1,59 @@
-
-
 #ifndef DICTIONARY_H
 #define DICTIONARY_H
 
-#include "linked_list.h"
+#include "arena.h"
 #include "entry.h"
-#include "binary_search_tree.h"
 #include <stddef.h>
+#include <stdint.h>
+
+/* Setting */
+#define DICTIONARY_GROUP_SIZE 16    // The control bytes of the table probed at once
+#define DICTIONARY_INLINE_KEY 16    // Keys up to this size are kept in their slot rather than in the arena
+#define DICTIONARY_ARENA_BLOCK 4096 // The size of the blocks keys and values are copied into
+
+// An entry of the dictionary, in the order it was inserted.
+struct DictionarySlot
+{
+  uint64_t hash;                          // The hash of the key
+  unsigned long key_size;                 // The size of the key copy
+  void *key;                              // The key copy, in the arena, or NULL when it is inline
+  void *value;                            // The value copy, in the arena
+  char inline_key[DICTIONARY_INLINE_KEY]; // The key copy when it is small
+};
 
-// The dictionary is a collection of entries stored in a BinarySearchTree.
+// The dictionary is a hash table with open addressing: a key is looked up by comparing a group of control bytes with
+// its hash at once, then the full hash and the key of the few slots that match.
 struct Dictionary
 {
   /* Public variables */
 
-  struct BinarySearchTree bst; // Inheriting from the BinarySearchTree object.
-  struct LinkedList keys;      // A linked list to store the dictionary's keys for easy iteration.
+  int length; // The number of entries.
+
+  /* Private variables */
+
+  int string_keys;                // Whether keys are strings, compared up to their NUL as compare_string_keys does
+  uint8_t *control;               // One byte per bucket: 7 bits of the hash of its entry, or empty
+  uint32_t *buckets;              // The index of the entry of each bucket
+  size_t num_buckets;             // The number of buckets, a power of two and a multiple of DICTIONARY_GROUP_SIZE
+  struct DictionarySlot *slots;   // The entries, in the order they were inserted
+  int capacity;                   // The number of entries the slots hold
+  struct Arena arena;             // The memory keys and values are copied into
 
   /* Public methods */
 
   // The search function finds an key in the dictionary, returning its value or NULL if not found.
   void *(*search)(struct Dictionary *dictionary, void *key, unsigned long key_size);
-  // The insert function adds a new entry to the dictionary.  Since memory allocation is handled by the entry constructor, the size of this entry's key and value must be specified.
+  // The insert function adds a new entry to the dictionary, copying its key and value; the size of both must be
+  // specified. A key already in the dictionary keeps its value.
   void (*insert)(struct Dictionary *dictionary, void *key, unsigned long key_size, void *value, unsigned long value_size);
-  // The iterate function iterates over the dictionary's entries, calling the callback function for each entry.
+  // The iterate function iterates over the dictionary's entries in the order they were inserted, calling the callback function for each entry.
   void (*iterate)(struct Dictionary *dictionary, size_t (*key_size)(void *key), void (*callback)(void *key, void *value, void *arg), void *arg);
 };
 
-// Creating a new dictionary.
+// Creating a new dictionary. Keys are strings if compare is compare_string_keys, and compared byte for byte otherwise.
 struct Dictionary dictionary_constructor(int (*compare)(void *key_one, void *key_two));
-// Freeing the memory allocated for the dictionary.
+// Freeing the memory allocated for the dictionary. The callbacks, if any, release what keys and values own; their
+// copies belong to the dictionary.
 void dictionary_destructor(struct Dictionary *dictionary, void (*free_key)(void *key), void (*free_value)(void *value));
 
 // The compare_string_keys function is used to compare the keys of two entries.
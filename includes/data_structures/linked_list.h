@@ -3,6 +3,7 @@
 #ifndef LINKED_LIST_H
 #define LINKED_LIST_H
 
+#include "utils/json_writer.h"
 #include "node.h"
 
 // LinkedLists are used to move between and manipulate related nodes in an organized fashion.
@@ -25,8 +26,8 @@ struct LinkedList
   void (*sort)(struct LinkedList *list, int (*compare)(void *a, void *b));
   // Binary search. (requires sorted list)
   short (*search)(struct LinkedList *list, void *query, int (*compare)(void *a, void *b));
-  // Convert to json format
-  char *(*to_json)(struct LinkedList *list, char *(*to_json)(void *data));
+  // Write as a json array, each element with the given function.
+  void (*to_json)(struct LinkedList *list, void (*to_json)(void *data, struct JSONWriter *writer), struct JSONWriter *writer);
 };
 
 // Creating a new linked list.
@@ -5,8 +5,57 @@
 #include "vendor/sqlite3/sqlite3.h"
 #include "data_structures/dictionary.h"
 
+#include <pthread.h>
+
+/* Setting */
+#define DATABASE_POOL_SIZE 8           // The number of read-only connections of a pool
+#define DATABASE_CHECKOUT_TIMEOUT 5000 // Milliseconds a query waits for a free connection
+#define DATABASE_BUSY_TIMEOUT 5000     // Milliseconds SQLite retries a locked database before giving up
+#define DATABASE_MMAP_SIZE 268435456   // Bytes of the database file each connection maps into memory
+#define DATABASE_CACHE_SIZE -8192      // The page cache of each connection, in KiB when negative
+#define DATABASE_STATEMENT_CACHE_SIZE 32 // The number of prepared statements each connection keeps
+
+/* Types of a DatabaseValue */
+#define DATABASE_NULL 0
+#define DATABASE_INT64 1
+#define DATABASE_TEXT 2
+
 /**
- * Database pool
+ * A value bound to a parameter of a query. Build one with db_int64, db_text, db_text_len or db_null; text is bound
+ * without a copy, so it must stay valid until exec returns.
+ */
+struct DatabaseValue
+{
+  int type;              // one of DATABASE_NULL, DATABASE_INT64 or DATABASE_TEXT
+  sqlite3_int64 integer; // the value of a DATABASE_INT64
+  const char *text;      // the value of a DATABASE_TEXT
+  int length;            // the length of text in bytes, or -1 if it is null terminated
+};
+
+/**
+ * A prepared statement kept by a connection, keyed by its SQL text
+ */
+struct DatabaseStatement
+{
+  char *sql;                // the SQL text
+  unsigned long hash;       // the hash of the SQL text
+  sqlite3_stmt *stmt;       // the prepared statement, reset after each use
+  unsigned long last_used;  // when the statement was last used, for eviction
+};
+
+/**
+ * The prepared statements of one connection. Only the thread holding the connection touches it.
+ */
+struct DatabaseStatementCache
+{
+  struct DatabaseStatement entries[DATABASE_STATEMENT_CACHE_SIZE];
+  int count;           // the number of entries in use
+  unsigned long clock; // incremented on each use
+};
+
+/**
+ * Database pool: one connection for writes and DATABASE_POOL_SIZE read-only ones, all in WAL mode, so that readers
+ * never wait for a write. Connections are opened without SQLite's own mutexes and used by one thread at a time.
  */
 struct DatabasePool
 {
@@ -14,7 +63,17 @@ struct DatabasePool
 
   char *path;        // database path
   char *name;        // database name
-  sqlite3 *db;       // database connection
+  sqlite3 *writer;   // the connection all writes go through
+  sqlite3 *readers[DATABASE_POOL_SIZE]; // the read-only connections
+
+  /* Private member variables */
+
+  sqlite3 *idle[DATABASE_POOL_SIZE]; // the read-only connections not checked out
+  int num_idle;                      // their number
+  pthread_mutex_t lock;              // protects the idle connections
+  pthread_cond_t released;           // signalled when a read-only connection is checked in
+  pthread_mutex_t write_lock;        // held while the writer is checked out
+  struct DatabaseStatementCache statements[DATABASE_POOL_SIZE + 1]; // the statements of the writer, then the readers
 
   /* Public methods */
 
@@ -22,8 +81,15 @@ struct DatabasePool
   int (*open)(struct DatabasePool *pool);
   // close connection to database
   int (*close)(struct DatabasePool *pool);
-  // execute query
+  // execute query, on the writer unless it is a SELECT; the num arguments are struct DatabaseValue
   int (*exec)(struct DatabasePool *pool, void (*callback)(sqlite3_stmt *res, void *arg), void *arg, const char *sql, int num, ...);
+  // take a connection, the writer or a reader, waiting at most DATABASE_CHECKOUT_TIMEOUT; NULL on timeout. A thread
+  // that already holds a suitable connection gets it again.
+  sqlite3 *(*checkout)(struct DatabasePool *pool, int write);
+  // give back a connection taken with checkout
+  void (*checkin)(struct DatabasePool *pool, sqlite3 *db);
+  // the rowid of the last row the calling thread inserted through this pool
+  sqlite3_int64 (*last_insert_rowid)(struct DatabasePool *pool);
 };
 
 /**
@@ -45,6 +111,11 @@ struct DatabaseManager
 
 int connect_db(const char *uri, char *name);
 
+struct DatabaseValue db_int64(sqlite3_int64 value);
+struct DatabaseValue db_text(const char *value);
+struct DatabaseValue db_text_len(const char *value, int length);
+struct DatabaseValue db_null();
+
 struct DatabaseManager *get_db_manager();
 void database_manager_destructor(struct DatabaseManager *manager);
 
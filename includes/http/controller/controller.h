@@ -6,5 +6,6 @@
 #include "group_controller.h"
 #include "directory_controller.h"
 #include "file_controller.h"
+#include "upload_controller.h"
 
 #endif
@@ -3,11 +3,19 @@
 #define FILE_CONTROLLER_H
 
 #include "networking/http/http_server.h"
+#include "model/user.h"
 
 char *create_file(struct HTTPServer *server, struct HTTPRequest *request);
 char *save_file(struct HTTPServer *server, struct HTTPRequest *request);
 char *update_file(struct HTTPServer *server, struct HTTPRequest *request);
 char *delete_file(struct HTTPServer *server, struct HTTPRequest *request);
 char *get_file(struct HTTPServer *server, struct HTTPRequest *request);
+char *download_file(struct HTTPServer *server, struct HTTPRequest *request);
+char *upload_file(struct HTTPServer *server, struct HTTPRequest *request);
+
+// Checks that a user may create a file in a group and returns its path relative to UPLOAD_DIR, or NULL and the error
+// response.
+char *new_file_path(struct HTTPRequest *request, struct User *user, char *name, char *group_id, char *directory_id,
+                    long **directory_id_ptr, char **response);
 
 #endif // FILE_CONTROLLER_H
\ No newline at end of file
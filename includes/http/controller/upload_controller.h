@@ -0,0 +1,13 @@
+
+#ifndef UPLOAD_CONTROLLER_H
+#define UPLOAD_CONTROLLER_H
+
+#include "networking/http/http_server.h"
+
+char *initiate_upload(struct HTTPServer *server, struct HTTPRequest *request);
+char *upload_part(struct HTTPServer *server, struct HTTPRequest *request);
+char *list_upload_parts(struct HTTPServer *server, struct HTTPRequest *request);
+char *complete_upload(struct HTTPServer *server, struct HTTPRequest *request);
+char *abort_upload(struct HTTPServer *server, struct HTTPRequest *request);
+
+#endif // UPLOAD_CONTROLLER_H
@@ -4,6 +4,7 @@
 
 #include "model/user.h"
 #include "networking/http/http_request.h"
+#include "utils/json_writer.h"
 
 char *format_404();
 
@@ -11,6 +12,8 @@ char *format_403();
 
 char *format_409();
 
+char *format_413();
+
 char *format_401();
 
 char *format_400();
@@ -25,11 +28,15 @@ char *format_422();
 
 char *format_200();
 
-char *format_200_with_content(char *content);
+char *format_200_with_content(struct HTTPRequest *request, char *content);
+
+char *format_200_with_content_type(struct HTTPRequest *request, char *content, char *content_type);
+
+char *format_200_with_content_type_and_length(struct HTTPRequest *request, char *content, char *content_type, int content_length);
 
-char *format_200_with_content_type(char *content, char *content_type);
+struct JSONWriter json_response_writer(struct HTTPRequest *request);
 
-char *format_200_with_content_type_and_length(char *content, char *content_type, int content_length);
+char *format_200_with_json(struct HTTPRequest *request, struct JSONWriter *json);
 
 struct User *get_user_from_request(struct HTTPRequest *request, char *token);
 
@@ -49,7 +49,7 @@ struct Directory
   struct Group *(*get_group)(struct Directory *);         // get group
   struct Directory *(*get_parent)(struct Directory *);    // get parent directory
   struct LinkedList *(*get_children)(struct Directory *); // get children
-  char *(*to_json)(struct Directory *);                   // convert to json
+  void (*to_json)(struct Directory *, struct JSONWriter *); // write as json
 };
 
 /* Public method */
@@ -58,5 +58,8 @@ struct Directory *directory_new(const char *name, long user_id, long group_id, l
 void directory_free(struct Directory *directory);
 struct Directory *directory_find_by_id(long id);
 struct LinkedList *get_root_node_by_group(long group_id);
+int write_root_node_by_group(long group_id, struct JSONWriter *writer);
+int directory_write_children(struct Directory *directory, struct JSONWriter *writer);
+void fnode_to_json(struct FNode *node, struct JSONWriter *writer);
 
 #endif
@@ -40,13 +40,13 @@ struct File
   struct User *(*get_modified_user)(struct File *);  // get file modified by
   struct Group *(*get_group)(struct File *);         // get file group
   struct Directory *(*get_directory)(struct File *); // get file directory
-  char *(*to_json)(struct File *);                   // convert file to json
+  void (*to_json)(struct File *, struct JSONWriter *); // write file as json
 };
 
 struct File *file_new(char *fullname, long size, long user_id, long group_id, long *directory_id);
 void file_free(struct File *file);
 struct File *file_find_by_id(long id);
-char *file_to_json(struct File *file);
+void file_to_json(struct File *file, struct JSONWriter *writer);
 struct File *file_find_by_name(const char *name, long group_id, long *directory_id);
 
 #endif
\ No newline at end of file
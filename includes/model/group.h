@@ -45,7 +45,7 @@ struct Group
   // Get group members
   struct LinkedList *(*get_members)(struct Group *group);
   // Return group as json
-  char *(*to_json)(struct Group *group);
+  void (*to_json)(struct Group *group, struct JSONWriter *writer);
 };
 
 struct Group *group_new(char *name, char *description, char *avatar, long owner_id);
@@ -55,6 +55,7 @@ struct Group *group_find_by_id(long id);
 struct Group *group_find_by_name(char *name);
 struct Group *group_find_by_code(char *code);
 struct LinkedList *group_find_by_member(long member_id);
-char *group_to_json(struct Group *group);
+int group_write_by_member(long member_id, struct JSONWriter *writer);
+void group_to_json(struct Group *group, struct JSONWriter *writer);
 
 #endif
@@ -4,6 +4,11 @@
 
 #include "user.h"
 
+#include <time.h>
+
+/* Setting */
+#define SESSION_LIFETIME 0 // Seconds a session lasts after its creation, 0 for sessions that never expire
+
 /* Session table */
 struct Session
 {
@@ -28,6 +33,8 @@ struct Session
   struct User *(*get_user)(struct Session *session);
   // Check if session is expired
   int (*is_expired)(struct Session *session);
+  // Get the time the session expires, 0 if it never does
+  time_t (*expires_at)(struct Session *session);
 };
 
 /* Session table functions */
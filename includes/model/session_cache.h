@@ -0,0 +1,36 @@
+#ifndef _MODEL_SESSION_CACHE_H_
+#define _MODEL_SESSION_CACHE_H_
+
+#include "user.h"
+
+#include <time.h>
+
+/* Setting */
+#define SESSION_CACHE_SHARDS 16        // The number of independently locked parts of the cache (a power of two)
+#define SESSION_CACHE_SHARD_SIZE 256   // The number of tokens a shard holds (a multiple of SESSION_CACHE_WAYS)
+#define SESSION_CACHE_WAYS 4           // The number of slots a token may go in
+#define SESSION_CACHE_TTL 60           // Seconds a session found in the database is trusted without asking again, at most until it expires
+#define SESSION_CACHE_NEGATIVE_TTL 5   // Seconds a token missing from the database is rejected without asking again
+#define SESSION_TOKEN_LENGTH 64        // The length of a session token
+
+/* Results of session_cache_get */
+#define SESSION_CACHE_MISS 0     // the token is not cached: ask the database
+#define SESSION_CACHE_HIT 1      // the token belongs to a session, whose user was copied out
+#define SESSION_CACHE_REJECTED 2 // the token was recently found not to belong to any session
+
+/* A token of the cache */
+struct SessionCacheEntry
+{
+  char token[SESSION_TOKEN_LENGTH + 1]; // the token, empty if the slot is free
+  unsigned long hash;                   // the hash of the token
+  int found;                            // whether the token belongs to a session
+  struct User user;                     // the user of the session, when found
+  time_t expires_at;                    // when the entry stops being trusted
+};
+
+int session_cache_get(const char *token, struct User *user, unsigned long *generation);
+void session_cache_put(const char *token, struct User *user, time_t session_expiry, unsigned long generation);
+void session_cache_invalidate_token(const char *token);
+void session_cache_invalidate_user(long user_id);
+
+#endif
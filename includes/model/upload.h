@@ -0,0 +1,48 @@
+#ifndef _MODEL_UPLOAD_H_
+#define _MODEL_UPLOAD_H_
+
+#include "user.h"
+#include "group.h"
+#include "data_structures/linked_list.h"
+
+/* Setting */
+#define UPLOAD_PARTS_DIR ".multipart" // The directory under UPLOAD_DIR holding the parts of pending uploads
+#define UPLOAD_MAX_PARTS 10000        // The highest part number of a multipart upload
+
+/* Part of a multipart upload, as stored in the upload_parts table */
+struct UploadPart
+{
+  int part_number; // part number, from 1
+  long size;       // part size
+};
+
+/* Multipart upload table */
+struct Upload
+{
+  /* Public member variables */
+
+  long id;           // upload id
+  char *name;        // name of the file being uploaded
+  char *path;        // path of the file once complete, relative to UPLOAD_DIR
+  long directory_id; // directory id
+  long group_id;     // group id
+  long owner_id;     // owner id
+  char *created_at;  // created at
+
+  /* Public member functions */
+
+  int (*save)(struct Upload *);                                    // save upload
+  int (*remove)(struct Upload *);                                  // remove upload and its parts
+  int (*save_part)(struct Upload *, int part_number, long size);   // record a part
+  struct LinkedList *(*get_parts)(struct Upload *);                // get parts in order
+  void (*get_part_path)(struct Upload *, int part_number, char *); // get the path of a part
+  void (*to_json)(struct Upload *, struct JSONWriter *);          // write upload as json
+};
+
+struct Upload *upload_new(char *name, char *path, long user_id, long group_id, long *directory_id);
+void upload_free(struct Upload *upload);
+struct Upload *upload_find_by_id(long id);
+void upload_to_json(struct Upload *upload, struct JSONWriter *writer);
+void upload_part_to_json(struct UploadPart *part, struct JSONWriter *writer);
+
+#endif
@@ -2,6 +2,8 @@
 #ifndef _MODEL_USER_H_
 #define _MODEL_USER_H_
 
+#include "utils/json_writer.h"
+
 /**
  * User status
  */
@@ -34,7 +36,7 @@ struct User
   // delete user from database
   int (*remove)(struct User *user);
   // convert user to json format
-  char *(*to_json)(struct User *user);
+  void (*to_json)(struct User *user, struct JSONWriter *writer);
 };
 
 /* Public method */
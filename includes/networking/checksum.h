@@ -1,9 +1,22 @@
 #ifndef __TFTP_CHECKSUM__
 #define __TFTP_CHECKSUM__
 
-#include <string.h>
+#include <stddef.h>
 #include <stdint.h>
 
-uint16_t checksum_(uint16_t len_udp, int padding, const uint16_t *tmp);
+/**
+ * An Internet checksum (RFC 1071) being computed over several buffers, as if they were one: a header and the data
+ * after it need not be copied together first.
+ */
+struct Checksum
+{
+  uint64_t sum; // The sum of the 16-bit words so far, in the byte order of the host
+  int odd;      // Whether the bytes summed so far are of odd length
+};
+
+void checksum_init(struct Checksum *checksum);
+void checksum_update(struct Checksum *checksum, const void *data, size_t length);
+uint16_t checksum_final(const struct Checksum *checksum);
+uint16_t checksum_compute(const void *data, size_t length);
 
 #endif
@@ -0,0 +1,105 @@
+#ifndef HTTP_EVENT_LOOP_H
+#define HTTP_EVENT_LOOP_H
+
+#include <pthread.h>
+#include <netinet/in.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "http_request.h"
+#include "systems/thread_pool.h"
+
+/* Setting */
+#define HTTP_MAX_EVENTS 256           // The maximum number of events handled per epoll_wait call
+#define HTTP_RECV_BUFFER_SIZE 4096    // The initial size of a connection's receive buffer
+#define HTTP_MAX_REQUEST_SIZE 1048576 // The largest request (headers and body) buffered in memory
+#define HTTP_KEEP_ALIVE_TIMEOUT 5     // Seconds an idle or stalled connection is kept open
+#define HTTP_BODY_TIMEOUT 300         // Seconds a streamed body may take to arrive in full
+#define HTTP_KEEP_ALIVE_MAX 100       // The maximum number of requests served on one connection
+#define HTTP_SWEEP_INTERVAL 1000      // Milliseconds between two scans for idle connections
+#define HTTP_STREAM_BUFFER_SIZE 65536 // The room kept after the header block to decode a streamed chunked body
+#define HTTP_SPLICE_SIZE 65536        // The most bytes moved by one splice call
+#define HTTP_MAX_IOVECS 64            // The most response segments gathered into one sendmsg call
+#define HTTP_ZEROCOPY_MIN 65536       // The fewest bytes gathered into one sendmsg call that are sent with MSG_ZEROCOPY
+
+struct HTTPServer;
+struct HTTPEventLoop;
+
+/**
+ * A connection is owned by exactly one side at a time: the event loop while it reads the request or flushes the
+ * response, or a worker while the route callback runs. Only the owner touches the buffers.
+ */
+enum HTTPConnectionState
+{
+  CONNECTION_READING,    // The event loop is reading a request.
+  CONNECTION_PROCESSING, // A worker is running the route callback.
+  CONNECTION_WRITING     // The event loop is flushing the response.
+};
+
+/**
+ * The HTTPConnection struct holds the state of one client socket between non-blocking reads and writes.
+ * Persistent connections serve their requests one at a time, so pipelined responses go out in request order.
+ */
+struct HTTPConnection
+{
+  int socket;                     // The client socket (non-blocking)
+  struct sockaddr_in address;     // The address of the client
+  enum HTTPConnectionState state; // Which side currently owns the connection
+  struct HTTPEventLoop *loop;     // The event loop the connection is registered with
+
+  char *buffer;          // The receive buffer, always NUL terminated
+  size_t length;         // The number of bytes received
+  size_t capacity;       // The size of the receive buffer (without the terminator)
+  size_t request_length; // The length of the complete request, 0 while it is incomplete
+
+  struct HTTPRequest request; // The request being received, parsed as its bytes arrive
+
+  int zerocopy;                // Whether the socket accepts MSG_ZEROCOPY
+  unsigned int zerocopy_sent;  // The number of sendmsg calls made with MSG_ZEROCOPY
+  unsigned int zerocopy_done;  // The number of them the kernel is done with; the response memory is kept until then
+
+  int keep_alive;         // Whether the connection stays open after the current response
+  int peer_closed;        // Whether the client has shut down its side of the connection
+  int requests_served;    // The number of requests handled on this connection
+  time_t last_active;     // When the connection last made progress (monotonic seconds)
+  time_t body_deadline;   // When the streamed body being read must be complete (monotonic seconds)
+
+  struct HTTPConnection *next_done; // Link in the loop's completion queue
+  struct HTTPConnection *prev;      // Links in the loop's list of open connections
+  struct HTTPConnection *next;
+};
+
+/**
+ * The HTTPEventLoop struct is an edge-triggered epoll reactor with its own listening socket.
+ * The HTTP server runs one loop per core; loops only hand complete requests to the worker pool.
+ */
+struct HTTPEventLoop
+{
+  /* Public member variables */
+
+  int epoll;                           // The epoll instance
+  int listener;                        // The listening socket of this loop (SO_REUSEPORT)
+  int notify;                          // An eventfd used by workers to signal finished responses
+  int active;                          // A control switch for the loop
+  int has_thread;                      // Whether the loop runs in a thread of its own
+  time_t last_sweep;                   // When idle connections were last looked for (monotonic seconds)
+  pthread_t thread;                    // The thread running the loop
+  struct HTTPServer *server;           // The server the loop belongs to
+  pthread_mutex_t lock;                // Protects the completion queue
+  struct HTTPConnection *done;         // Connections whose response is ready to be written
+  struct HTTPConnection *connections;  // Connections currently open on this loop
+  struct ThreadJob jobs[HTTP_MAX_EVENTS]; // Complete requests gathered during one iteration, handed to the workers at once
+  int num_jobs;                        // The number of gathered requests
+
+  /* Public member methods */
+
+  // Runs the loop until it is deactivated.
+  void (*run)(struct HTTPEventLoop *loop);
+  // Called by a worker to hand a connection back to its loop once the response is ready.
+  void (*complete)(struct HTTPEventLoop *loop, struct HTTPConnection *connection);
+};
+
+struct HTTPEventLoop *http_event_loop_constructor(struct HTTPServer *server, int listener);
+void http_event_loop_destructor(struct HTTPEventLoop *loop);
+
+#endif // HTTP_EVENT_LOOP_H
@@ -1,25 +1,165 @@
 
-
 #ifndef HTTP_REQUEST_H
 #define HTTP_REQUEST_H
 
-#include "data_structures/dictionary.h"
+#include "data_structures/arena.h"
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Setting */
+#define HTTP_MAX_FIELDS 64        // The maximum number of header, query or body fields in a request
+#define HTTP_MAX_METHOD_LENGTH 16 // The longest method name accepted
+#define HTTP_PARAMS_SIZE 256      // The room for the values of the path parameters of a request
+#define HTTP_ARENA_BLOCK 16384    // The size of the blocks of the arena of a request
+
+/**
+ * The result of feeding bytes to the request parser.
+ */
+enum HTTPParseResult
+{
+  HTTP_PARSE_ERROR = -1,     // The request is malformed.
+  HTTP_PARSE_INCOMPLETE = 0, // More bytes are needed.
+  HTTP_PARSE_COMPLETE = 1,   // A whole request, body included, is buffered.
+  HTTP_PARSE_HEADERS = 2     // The header block just ended; returned once, parse again to wait for the body.
+};
+
+/**
+ * The parts of the request line, indexes of HTTPRequest.spans.
+ */
+enum HTTPRequestLineSpan
+{
+  HTTP_SPAN_METHOD,
+  HTTP_SPAN_URI,
+  HTTP_SPAN_QUERY,
+  HTTP_SPAN_VERSION
+};
+
+/**
+ * The HTTPString struct is a view into the buffer the request was parsed from. Once the request is bound the view is
+ * also NUL terminated in place.
+ */
+struct HTTPString
+{
+  char *data;    // The first character, NULL while the request is not bound
+  size_t length; // The number of characters
+};
 
 /**
- * The HTTPRequest struct contains three dictionaries representing the three components of an HTTP Request.
+ * A key and value pair of the header fields, the query or a form body.
+ */
+struct HTTPField
+{
+  struct HTTPString key;
+  struct HTTPString value;
+};
+
+/**
+ * The HTTPFields struct is a small array of fields searched linearly, which beats any tree for the handful of fields
+ * a request carries.
+ */
+struct HTTPFields
+{
+  /* Public member variables */
+
+  struct HTTPField fields[HTTP_MAX_FIELDS]; // The fields in the order they appear in the request
+  int count;                                // The number of fields
+  int ignore_case;                          // Whether keys are compared case insensitively (header names)
+
+  /* Public member methods */
+
+  // Finds a NUL terminated key and returns its NUL terminated value, or NULL. The key size is not needed and only kept
+  // so that lookups read the same as dictionary lookups.
+  void *(*search)(struct HTTPFields *fields, void *key, unsigned long key_size);
+};
+
+/**
+ * A part of a response: either bytes in memory, which the event loop gathers into one sendmsg call with the parts
+ * next to them, or a range of the request's file, which is sent with sendfile and never copied into user space.
+ */
+struct HTTPSegment
+{
+  char *data;    // The bytes to send, in the arena of the request, or NULL for a range of the file
+  off_t offset;  // The offset of the next byte to send, in the data or in the file
+  size_t length; // The number of bytes left to send
+  struct HTTPSegment *next;
+};
+
+/**
+ * The HTTPRequest struct is filled by a resumable parser working on the receive buffer in place: parse is fed the
+ * buffer each time more bytes arrive and picks up where it stopped, bind then turns the recorded offsets into views.
  */
 struct HTTPRequest
 {
-  struct Dictionary request_line;  // The first line of an HTTP Request is the request line.
-  struct Dictionary header_fields; // The header fields of an HTTP Request are the lines after the request line.
-  struct Dictionary body;          // The body of an HTTP Request is the data after the header fields.
-  struct Dictionary query;         // The query of an HTTP Request is the data after the question mark in the URL.
+  /* Public member variables */
+
+  struct HTTPString method;        // The request method, e.g. GET
+  struct HTTPString uri;           // The path of the request target, without the query
+  struct HTTPString query_string;  // The part of the request target after the question mark
+  struct HTTPString http_version;  // The protocol version, e.g. HTTP/1.1
+  struct HTTPString content;       // The raw body
+  struct HTTPFields header_fields; // The header fields, looked up case insensitively
+  struct HTTPFields query;         // The fields of the query string
+  struct HTTPFields body;          // The fields of a form encoded body
+  struct HTTPFields params;        // The parameters of the path, e.g. id for a route /file/{id}
+  char params_buffer[HTTP_PARAMS_SIZE]; // Their values, NUL terminated
+
+  size_t header_length;  // The length of the request line and the header block, blank line included
+  size_t content_length; // The announced length of the body
+  size_t length;         // The length of the whole request once it is complete; for a streamed body, the number of
+                         // buffered bytes the request used up
+  int is_chunked;        // Whether the body uses the chunked transfer coding
+  int stream_body;       // Whether the body is left on the socket, to be read by the route with save_body
+  size_t max_body_size;  // The largest body save_body accepts
+  int body_consumed;     // Whether a streamed body has been read completely
+
+  struct HTTPSegment *segments;     // The response, sent in order: its head once the route has answered, then the
+                                    // body parts appended by the route
+  struct HTTPSegment *last_segment; // The tail of the segments
+  int file;                         // The file the file segments refer to, -1 if none; closed with the request
+  struct Arena arena;               // The memory the request is answered with: response, JSON, segments. It is freed
+                                    // at once when the response has been sent.
+
+  /* Private member variables */
+
+  int state;                             // The state of the parser
+  size_t position;                       // The offset of the next byte to parse
+  size_t mark;                           // The offset where the token being parsed started
+  size_t spans[4];                       // The offsets of the method, uri, query and version
+  size_t lengths[4];                     // Their lengths
+  size_t key_offsets[HTTP_MAX_FIELDS];   // The offsets and lengths of the header names and values
+  size_t key_lengths[HTTP_MAX_FIELDS];
+  size_t value_offsets[HTTP_MAX_FIELDS];
+  size_t value_lengths[HTTP_MAX_FIELDS];
+  int has_content_length;                // Whether a Content-Length header was seen
+
+  /* Public member methods */
+
+  // Parses the bytes received so far. The buffer may have moved since the previous call, but must start with the same
+  // bytes.
+  int (*parse)(struct HTTPRequest *request, char *buffer, size_t length);
+  // Points the views into the buffer of a complete request and NUL terminates them in place, splitting the query and
+  // a form body into fields. The byte right after a buffered body is overwritten.
+  void (*bind)(struct HTTPRequest *request, char *buffer);
+  // Appends bytes to the response body. The data must live until the response is sent, in the arena of the request.
+  void (*append_data)(struct HTTPRequest *request, char *data, size_t length);
+  // Appends a range of the request's file to the response body.
+  void (*append_file)(struct HTTPRequest *request, off_t offset, size_t length);
+  // Puts bytes in front of the response, to send its head before the body. The same lifetime rules as append_data.
+  void (*prepend_data)(struct HTTPRequest *request, char *data, size_t length);
+  // Drops the segments queued so far, when the response they started is replaced by another one.
+  void (*discard_segments)(struct HTTPRequest *request);
+  // Writes a streamed body to a file descriptor, returning its size or -1 (errno is EFBIG if it exceeds
+  // max_body_size). Set by whoever owns the socket; NULL when the body is buffered.
+  long long (*save_body)(struct HTTPRequest *request, int fd);
 };
 
 /* Constructor and destructor */
 
-struct HTTPRequest http_request_constructor(char *request_string);
+struct HTTPRequest http_request_constructor(void);
 
 void http_request_destructor(struct HTTPRequest *http_request);
+// Empties a request for the next one on the same connection, keeping a block of its arena.
+void http_request_reset(struct HTTPRequest *http_request);
 
 #endif // HTTP_REQUEST_H
@@ -0,0 +1,101 @@
+#ifndef HTTP_ROUTER_H
+#define HTTP_ROUTER_H
+
+#include <stddef.h>
+
+/* Setting */
+#define HTTP_MAX_ROUTE_PARAMS 8 // The maximum number of parameters, e.g. {id}, in the pattern of a route
+
+struct HTTPServer;
+struct HTTPRequest;
+
+/**
+ * The HTTPMethods enum lists the various HTTP methods for easy referral.
+ */
+enum HTTPMethods
+{
+  GET = 1,
+  POST,
+  PUT,
+  DELETE,
+  HEAD,
+  OPTIONS,
+  TRACE,
+  CONNECT,
+  PATCH
+};
+
+/**
+ * A route: the pattern of the paths it serves, the methods it allows and what it needs from a request before its
+ * callback runs.
+ */
+struct HTTPRoute
+{
+  char *pattern;         // The path served; a segment between braces, e.g. /file/{id}, matches any segment
+  int num_segments;      // The number of segments of the pattern
+  unsigned int methods;  // The methods allowed, one bit (1 << HTTPMethods) each
+  int require_auth;      // Whether requests without an Authorization header are refused before the callback runs
+  size_t max_body_size;  // The largest body streamed to the route, 0 if its bodies are buffered
+  // The callback function that will be called when this route is requested
+  char *(*callback)(struct HTTPServer *server, struct HTTPRequest *request);
+};
+
+/**
+ * A node of the compiled route table: one segment of a path. The literal children of a node are contiguous in the
+ * node array and sorted, so that they are binary searched; a parameter child matches any other segment.
+ */
+struct HTTPRouteNode
+{
+  const char *label;   // The segment, a view into the pattern of a route
+  int label_length;    // Its length
+  int route;           // The route of the paths ending at this node, or -1
+  int first_child;     // The first literal child
+  int num_children;    // The number of literal children
+  int param_child;     // The parameter child, or -1
+};
+
+/**
+ * The HTTPRouter struct maps request paths to routes. Routes are added while the server is set up, then the table is
+ * frozen into a radix tree of path segments held in one array; it never changes afterwards, so the workers match
+ * paths concurrently without locks, and matching allocates nothing.
+ */
+struct HTTPRouter
+{
+  /* Public member variables */
+
+  struct HTTPRoute *routes; // The routes, in the order they were added
+  int num_routes;           // Their number
+  int frozen;               // Whether the table is compiled; routes can no longer be added
+
+  /* Private member variables */
+
+  int capacity;                // The number of routes the array holds
+  struct HTTPRouteNode *nodes; // The compiled table, its root first
+  int num_nodes;               // The number of nodes
+
+  /* Public member methods */
+
+  // Adds a route for a pattern and the methods allowed (a mask of 1 << HTTPMethods), or returns NULL once frozen.
+  struct HTTPRoute *(*add)(struct HTTPRouter *router, const char *pattern, unsigned int methods,
+                           char *(*callback)(struct HTTPServer *server, struct HTTPRequest *request));
+  // Finds the route added with a pattern, to set its metadata.
+  struct HTTPRoute *(*find)(struct HTTPRouter *router, const char *pattern);
+  // Compiles the table. Until it is called, match finds nothing.
+  void (*freeze)(struct HTTPRouter *router);
+  // Finds the route of a path, which need not be NUL terminated, and fills the path parameters of the request unless
+  // it is NULL.
+  const struct HTTPRoute *(*match)(const struct HTTPRouter *router, const char *path, size_t length,
+                                   struct HTTPRequest *request);
+};
+
+/* Constructor and destructor */
+
+struct HTTPRouter http_router_constructor(void);
+
+void http_router_destructor(struct HTTPRouter *router);
+
+/* Public helper functions */
+
+int http_method_code(const char *method);
+
+#endif // HTTP_ROUTER_H
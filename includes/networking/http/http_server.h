@@ -5,8 +5,14 @@
 
 #include "networking/server.h"
 #include "http_request.h"
+#include "http_router.h"
+#include "http_event_loop.h"
 #include "systems/thread_pool.h"
 
+/* Setting */
+#define HTTP_NUM_WORKERS 20 // The number of worker threads running route callbacks
+#define HTTP_MAX_RANGES 16  // The maximum number of ranges served from one Range header
+
 /**
  * The HTTPServer struct is the basis for servers intended to read and recieve HTTP protocols.
  * To utilize the server, instantiate an HTTPServer object with the constructor, register routes with the member method, and launch the server.
@@ -16,33 +22,24 @@ struct HTTPServer
   /* Public member variables */
 
   struct Server server;     // A generic server object to connect to the network with the appropriate protocols.
-  struct Dictionary routes; // A dictionary of routes registered on the server with URL's as keys.
-  struct ThreadPool *pool;  // A thread pool to handle incoming requests.
+  struct HTTPRouter router;  // The routes registered on the server, compiled into a table when it is launched.
+  struct ThreadPool *pool;  // A thread pool running the route callbacks of complete requests.
+  struct HTTPEventLoop **loops; // The event loops reading and writing the connections, one per core.
+  int num_loops;                // The number of event loops.
 
   /* Public member methods */
 
   // This method is used to register URL's as routes to the server.
   void (*register_routes)(struct HTTPServer *server, char *(*route_function)(struct HTTPServer *server, struct HTTPRequest *request), char *uri, int num_methods, ...);
+  // Lets a registered route read its request body from the socket with save_body, up to max_body_size bytes, instead
+  // of having it buffered in memory first.
+  void (*stream_body)(struct HTTPServer *server, char *uri, size_t max_body_size);
+  // Makes a registered route refuse requests without an Authorization header before its callback runs.
+  void (*require_auth)(struct HTTPServer *server, char *uri);
   // The launch sequence begins an infinite loop where the server listens for and handles incoming connections.
   void (*launch)(struct HTTPServer *server);
 };
 
-/**
- * The HTTPMethods enum lists the various HTTP methods for easy referral.
- */
-enum HTTPMethods
-{
-  GET = 1,
-  POST,
-  PUT,
-  DELETE,
-  HEAD,
-  OPTIONS,
-  TRACE,
-  CONNECT,
-  PATCH
-};
-
 /* Constructor and destructor */
 
 struct HTTPServer http_server_constructor(u_long interface, int port);
@@ -51,6 +48,8 @@ void http_server_destructor(struct HTTPServer *server);
 
 /* Public helper functions */
 
-char *render_template(int num_templates, ...);
+char *render_template(struct Arena *arena, int num_templates, ...);
+char *serve_file(struct HTTPRequest *request, int file, const char *content_type, const char *filename);
+size_t http_route_body_limit(struct HTTPServer *server, const char *uri, size_t length);
 
 #endif // HTTP_SERVER_H
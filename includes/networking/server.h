@@ -36,6 +36,9 @@ struct ServerRoute
 /* Creates a new server struct and returns a pointer to it. */
 struct Server server_constructor(int domain, int service, int protocol, u_long interface, int port, int backlog);
 
+/* Opens an extra socket bound to the server's address with SO_REUSEPORT. */
+int server_reuseport_socket(struct Server *server);
+
 /* Frees the memory allocated to a server struct. */
 void server_destructor(struct Server *server);
 
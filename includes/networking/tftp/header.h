@@ -11,12 +11,24 @@
 #define ERROR "\000\005" // Error
 #define OACK "\000\006"  // Option acknowledgement
 
+/* TFTP opcodes, in host byte order */
+#define OPCODE_RRQ 1
+#define OPCODE_WRQ 2
+#define OPCODE_DATA 3
+#define OPCODE_ACK 4
+#define OPCODE_ERROR 5
+#define OPCODE_OACK 6
+
 /* Setting */
 #define BLOCK_SIZE 512         // The size of the data block
 #define MAX_RETRIES 10         // The maximum number of retries
 #define TIMEOUT_SECOND 1       // The timeout in seconds
 #define TIMEOUT_USECOND 500000 // The timeout in microseconds
 #define BUF_SIZE 65536         // The size of the buffer
+#define MAX_BLOCK_SIZE 65464   // The largest block size a client may ask for (RFC 2348)
+#define MAX_WINDOW_SIZE 255    // The largest window size a client may ask for
+
+#define TIMEOUT_MILLISECONDS (TIMEOUT_SECOND * 1000 + TIMEOUT_USECOND / 1000)
 
 typedef enum _tfpt_error_codes_
 {
@@ -44,15 +56,6 @@ typedef struct _tftp_packet_
   uint8_t data[BUF_SIZE - sizeof(TFTPHeader)]; // The data of the packet
 } Packet;                                      // The packet
 
-typedef struct _tftp_packet_buffer_
-{
-  Packet packet;                      // The packet
-  ssize_t data_len;                   // The length of the data
-  struct sockaddr_in *client_address; // The address of the client
-  uint8_t _raw_data[BUF_SIZE];        // The raw data of the packet
-  int block_id;                       // The block id of the packet
-} PacketBuffer;
-
 typedef struct _tftp_options_
 {
   char name[256];  // The name of the option
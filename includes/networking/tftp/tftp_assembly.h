@@ -0,0 +1,10 @@
+#ifndef TFTP_ASSEMBLY_H
+#define TFTP_ASSEMBLY_H
+
+/* Setting */
+#define TFTP_ASSEMBLY_LINGER 30 // Seconds more parts of a file are accepted after its last part ended
+
+int tftp_assembly_join(const char *path);
+void tftp_assembly_leave(const char *path);
+
+#endif // TFTP_ASSEMBLY_H
@@ -2,25 +2,101 @@
 #define TFTP_CLIENT_HANDLE_H
 
 #include "header.h"
-#include "tftp_server.h"
+#include "tftp_pacer.h"
 #include "logger/logger.h"
 
-#include <setjmp.h>
+#include <stdint.h>
+#include <netinet/in.h>
+#include <sys/types.h>
 
+/* Setting */
+#define TFTP_CONTROL_PACKET_SIZE 512 // The room kept to resend the last OACK, ACK or ERROR of a transfer
+#define TFTP_MIN_RTO 20              // The smallest retransmission timeout, in milliseconds
+#define TFTP_MAX_RTO 10000           // The largest retransmission timeout, in milliseconds
+#define TFTP_DUP_ACKS 3              // The number of duplicate ACKs that resend the holes of a window again
+#define TFTP_WINDOW_MAP_WORDS 4      // The words of the bitmap of blocks received out of order (MAX_WINDOW_SIZE bits)
+#define TFTP_MAX_OPTIONS 16          // The maximum number of options read from a request, the others are ignored
+
+/* Results of the handler methods */
+#define TFTP_CONTINUE 0 // the transfer goes on
+#define TFTP_FINISHED 1 // the transfer is over and the handler can be freed
+
+struct TFTPEventLoop;
+
+/* The states of a transfer */
+typedef enum _tftp_handler_state_
+{
+  HANDLER_WAIT_OACK_ACK, // RRQ: the OACK was sent, waiting for ACK 0
+  HANDLER_SENDING,       // RRQ: DATA was sent, waiting for its ACK
+  HANDLER_RECEIVING,     // WRQ: ACK or OACK was sent, waiting for DATA
+  HANDLER_DALLYING       // WRQ: the last ACK was sent, kept around to answer a resent last DATA
+} TFTPHandlerState;
+
+/**
+ * A transfer, driven by its event loop: each packet from the client and each expired timer moves it forward, so that
+ * it never blocks and one thread serves many transfers. The client is identified by its address, which is the
+ * transfer id; all transfers of a loop share the loop's socket.
+ */
 typedef struct _tftp_client_handler_
 {
-  struct TFTPServer server;      // The migrate server
-  struct sockaddr_in *_addr;     // The address of the client
-  int _block_size;               // The block size of the packet
-  int _window_size;              // The window size of the packet
-  int _check_addr;               // The flag to check the address
-  PacketBuffer *__last_packet;   // The last packet
-  PacketBuffer *__packet_buffer; // The packet buffer
-  jmp_buf buf;                   // The exception handle signal
+  /* Public member variables */
+
+  struct sockaddr_in addr;    // The address of the client
+  struct TFTPEventLoop *loop; // The event loop serving the transfer
+  TFTPHandlerState state;     // What the transfer is waiting for
+  uint16_t opcode;            // OPCODE_RRQ or OPCODE_WRQ
+  char path[1024];            // The path of the file
+  int fd;                     // The file being read or written
+  off_t file_size;            // The size of the file read
+  const uint8_t *map;         // RRQ: the file mapped in memory, or NULL when it is read with pread
+  off_t _range_start;         // The first byte of the file transferred, 0 unless the "range" option is used
+  off_t _range_end;           // The byte after the last one transferred, or -1 when a WRQ part has no end
+  int _assembling;            // WRQ: whether the file is uploaded in parts, with the "range" option
+  off_t _tsize;               // The size of the file given with the "tsize" option, or -1
+  char _upload_path[1029];    // WRQ: the file written, "<path>.part" until it is complete unless it comes in parts
+  int _block_size;            // The block size of the packet
+  int _window_size;           // The window size of the packet
+  int _rollover;              // The block number sent after 65535, 0 unless the "rollover" option asks for 1
+  long _acked;                // RRQ: the number of blocks acknowledged
+  long _sent;                 // RRQ: the number of blocks sent
+  long _total;                // RRQ: the number of blocks of the file, the last one shorter than _block_size
+  long _highest;              // RRQ: the highest block sent
+  long _recover;              // RRQ: the highest block sent when the holes of the window were last resent
+  int _in_recovery;           // RRQ: whether holes were resent and are not all acknowledged yet
+  int _dup_acks;              // RRQ: the number of ACKs in a row that acknowledged nothing new
+  double _cwnd;               // RRQ: the congestion window, in blocks, from 1 to _window_size
+  int _paced;                 // RRQ: whether the timer waits for the pacers rather than for an ACK
+  struct TFTPPacer _pacer;    // RRQ: the pacer of the transfer alone
+  long _received;             // WRQ: the number of blocks written in order
+  long _last_block;           // WRQ: the number of the short block that ends the file, 0 until it arrives
+  int _pending;               // WRQ: the number of blocks written since the last ACK
+  int _gap_acked;             // WRQ: whether a block out of order was already answered
+  int _sack;                  // Whether ACKs carry the bitmap of the blocks received after the one they acknowledge
+  uint64_t _window_map[TFTP_WINDOW_MAP_WORDS]; // The blocks after the one acknowledged known to be received
+  int _retries;               // The number of timeouts in a row
+
+  long _timed_block;  // The block whose round trip is being timed
+  long _timed_at;     // When it was sent, in microseconds, or 0 when nothing is timed
+  long _srtt;         // The smoothed round-trip time, in microseconds, or -1 before the first sample
+  long _rttvar;       // Its variation, in microseconds
+  int _rto;           // The retransmission timeout, in milliseconds, before any backoff
+
+  uint8_t _last_packet[TFTP_CONTROL_PACKET_SIZE]; // The last OACK, ACK or ERROR sent, resent on timeout
+  size_t _last_length;                            // Its length
+
+  /* Private member variables, managed by the event loop */
+
+  struct _tftp_client_handler_ *_next;       // The next transfer in the same bucket of the loop
+  struct _tftp_client_handler_ *_timer_prev; // The links in the loop's timer wheel
+  struct _tftp_client_handler_ *_timer_next;
+  long _timer_tick; // The tick the timer expires at, or -1 when it is not armed
+  size_t _gso_segment; // The largest packet the path to the client carries unfragmented, 0 to never group its packets
 } TFTPClientHandler;
 
-int handle_client(TFTPClientHandler *handler);
-TFTPClientHandler *create_handler(const uint8_t *initial_buffer, size_t buffer_size, struct sockaddr_in *client_address, struct TFTPServer *server);
+TFTPClientHandler *create_handler(struct TFTPEventLoop *loop, const uint8_t *packet, size_t length, const struct sockaddr_in *client_address);
+int handle_packet(TFTPClientHandler *handler, const uint8_t *packet, size_t length);
+int handle_timeout(TFTPClientHandler *handler);
 void free_handler(TFTPClientHandler *handler);
+void send_error(struct TFTPEventLoop *loop, const struct sockaddr_in *address, TFTPErrorCodes error_code, const char *message);
 
 #endif
@@ -0,0 +1,95 @@
+#ifndef TFTP_EVENT_LOOP_H
+#define TFTP_EVENT_LOOP_H
+
+#include "header.h"
+#include "tftp_client_handle.h"
+
+#include <pthread.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+/* Setting */
+#define TFTP_MAX_EVENTS 64          // The maximum number of events handled per epoll_wait call
+#define TFTP_TRANSFER_BUCKETS 4096  // The number of buckets of a loop's transfer table (a power of two)
+#define TFTP_MAX_TRANSFERS 4096     // The maximum number of transfers one loop serves at once
+#define TFTP_SPARE_HANDLERS 64      // The handlers of finished transfers a loop keeps to start new ones with
+#define TFTP_TIMER_TICK 10          // Milliseconds between two ticks of the timer wheel
+#define TFTP_TIMER_SLOTS 512        // The number of slots of the timer wheel (a power of two)
+#define TFTP_SOCKET_BUFFER 4194304  // The size asked for the send and receive buffers of a loop's socket
+#define TFTP_RECV_BATCH 16          // The maximum number of datagrams read per recvmmsg call
+#define TFTP_SEND_BATCH 64          // The maximum number of packets queued before they are sent
+#define TFTP_SEND_RING_SIZE 1048576 // The size of the ring the queued packets are built in
+#define TFTP_GSO_SEGMENTS 64        // The maximum number of packets sent as one UDP GSO datagram
+#define TFTP_GSO_MAX_BYTES 65507    // The maximum size of a UDP GSO datagram
+#define TFTP_UDP_OVERHEAD 28        // The bytes of the IP and UDP headers in front of a segment
+
+struct TFTPServer;
+
+/**
+ * The TFTPEventLoop struct serves every transfer whose client the kernel steers to its socket. It waits on epoll for
+ * datagrams, hands each one to the transfer of its sender, and runs a timer wheel for retransmissions. The TFTP
+ * server runs one loop per core, each with its own SO_REUSEPORT socket, so a client always reaches the same loop and
+ * loops share no state.
+ */
+struct TFTPEventLoop
+{
+  /* Public member variables */
+
+  int epoll;                 // The epoll instance
+  int socket;                // The UDP socket of this loop (SO_REUSEPORT)
+  int notify;                // An eventfd used to stop the loop
+  int active;                // A control switch for the loop
+  int has_thread;            // Whether the loop runs in a thread of its own
+  int gso;                   // Whether the socket segments packets itself (UDP_SEGMENT)
+  pthread_t thread;          // The thread running the loop
+  struct TFTPServer *server; // The server the loop belongs to
+
+  /* Private member variables */
+
+  TFTPClientHandler *transfers[TFTP_TRANSFER_BUCKETS];          // The transfers, hashed by client address
+  int num_transfers;                                            // Their number
+  TFTPClientHandler *timers[TFTP_TIMER_SLOTS];                  // The armed timers, by the tick they expire at
+  long tick;                                                    // The last tick whose timers were run
+  TFTPClientHandler *spare_handlers;                            // The handlers kept for new transfers, linked by _next
+  int num_spare_handlers;                                       // Their number
+
+  uint8_t buffers[TFTP_RECV_BATCH][BUF_SIZE];                   // The datagrams being handled
+  struct sockaddr_in senders[TFTP_RECV_BATCH];                  // Their senders
+  struct mmsghdr *received;                                     // The recvmmsg descriptions of the datagrams
+  struct iovec receive_iov[TFTP_RECV_BATCH];                    // Their buffers
+
+  uint8_t ring[TFTP_SEND_RING_SIZE];                            // The queued packets
+  size_t ring_used;                                             // The bytes of the ring they use
+  struct iovec pieces[2 * TFTP_SEND_BATCH];                     // The pieces of the queued packets, in order
+  int num_pieces;                                               // Their number
+  int first_piece[TFTP_SEND_BATCH];                             // The first piece of each queued packet
+  size_t lengths[TFTP_SEND_BATCH];                              // The length of each queued packet
+  struct sockaddr_in destinations[TFTP_SEND_BATCH];             // Their destinations
+  int num_queued;                                               // The number of queued packets
+  struct mmsghdr *messages;                                     // The sendmmsg descriptions of the queued packets
+  int first_queued[TFTP_SEND_BATCH];                            // The first packet of each message
+  char controls[TFTP_SEND_BATCH][CMSG_SPACE(sizeof(uint16_t))]; // The UDP_SEGMENT control message of each message
+
+  /* Public member methods */
+
+  // Runs the loop until it is deactivated.
+  void (*run)(struct TFTPEventLoop *loop);
+  // Queues a copy of a packet built from its third byte on; its first two bytes receive the checksum.
+  int (*send)(struct TFTPEventLoop *loop, const struct sockaddr_in *address, uint8_t *packet, size_t length);
+  // Returns room for a packet of at most length bytes in the send ring, to be built there and queued.
+  uint8_t *(*reserve)(struct TFTPEventLoop *loop, size_t length);
+  // Queues a packet built in the room reserve returned, after filling its checksum.
+  void (*queue)(struct TFTPEventLoop *loop, const struct sockaddr_in *address, uint8_t *packet, size_t length);
+  // Queues a packet made of a header built in the send ring and of data sent from where it is, without a copy.
+  void (*queue_slice)(struct TFTPEventLoop *loop, const struct sockaddr_in *address, uint8_t *header,
+                      size_t header_length, const uint8_t *data, size_t data_length);
+  // Sends the queued packets, with as few system calls as possible.
+  void (*flush)(struct TFTPEventLoop *loop);
+  // (Re)arms the timer of a transfer, which calls handle_timeout once it expires.
+  void (*arm_timer)(struct TFTPEventLoop *loop, TFTPClientHandler *handler, int milliseconds);
+};
+
+struct TFTPEventLoop *tftp_event_loop_constructor(struct TFTPServer *server, int socket);
+void tftp_event_loop_destructor(struct TFTPEventLoop *loop);
+
+#endif // TFTP_EVENT_LOOP_H
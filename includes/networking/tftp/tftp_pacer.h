@@ -0,0 +1,25 @@
+#ifndef TFTP_PACER_H
+#define TFTP_PACER_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+/* Setting */
+#define TFTP_PACING_BURST 20 // Milliseconds of traffic a pacer lets through at once after being idle
+
+/**
+ * A token bucket limiting the rate packets are sent at, kept as the time the bucket is full again: sending charges
+ * the bucket by pushing that time forward, and a packet may go as long as it is less than TFTP_PACING_BURST ahead.
+ * One pacer may be shared by the event loops of every core, so it is updated atomically.
+ */
+struct TFTPPacer
+{
+  long rate;        // The bytes per second let through, 0 when unlimited
+  atomic_long full; // When the bucket is full again, in microseconds of the monotonic clock
+};
+
+void tftp_pacer_init(struct TFTPPacer *pacer, long rate);
+long tftp_pacer_delay(struct TFTPPacer *pacer, long now);
+void tftp_pacer_charge(struct TFTPPacer *pacer, size_t bytes, long now);
+
+#endif // TFTP_PACER_H
@@ -2,16 +2,21 @@
 #define TFTP_SERVER_H
 
 #include "networking/server.h"
-#include "systems/thread_pool.h"
+#include "tftp_event_loop.h"
+#include "tftp_pacer.h"
 
 struct TFTPServer
 {
   /* Public variables */
 
-  struct Server server;           // A generic server object to connect to the network with the appropriate protocols.
-  char is_allow_upload;           // Whether or not the server allows clients to upload files.
-  char upload_dir[256];           // The directory to upload files to.
-  struct ThreadPool *thread_pool; // A thread pool to handle clients.
+  struct Server server;         // A generic server object to connect to the network with the appropriate protocols.
+  char is_allow_upload;         // Whether or not the server allows clients to upload files.
+  char upload_dir[256];         // The directory to upload files to.
+  struct TFTPEventLoop **loops; // The event loops serving the transfers, one per core.
+  int num_loops;                // The number of event loops.
+  long transfer_rate;           // The bytes per second one transfer is sent at, at most (0: no limit), set before launch.
+  long total_rate;              // The bytes per second all transfers are sent at, at most (0: no limit), set before launch.
+  struct TFTPPacer *pacer;      // The pacer shared by the loops, which enforces total_rate.
 
   /* Public methods */
 
@@ -2,7 +2,10 @@
 #define _SETTING_H_
 
 #define UPLOAD_DIR "./upload"
+#define UPLOAD_MAX_SIZE 17179869184ULL // The largest file uploaded over HTTP (16 GiB)
 #define DATABASE_URI "test.sqlite"
 #define DATABASE_INIT_FILE "create_table.sql"
+#define TFTP_TRANSFER_RATE 0 // The bytes per second one TFTP transfer is sent at, at most (0: no limit)
+#define TFTP_SERVER_RATE 0   // The bytes per second all TFTP transfers together are sent at, at most (0: no limit)
 
 #endif // _SETTING_H_
\ No newline at end of file
@@ -1,9 +1,17 @@
-
 #ifndef THREAD_POOL_H
 #define THREAD_POOL_H
 
-#include "data_structures/queue.h"
 #include <pthread.h>
+#include <stdatomic.h>
+
+/* Setting */
+#define THREAD_POOL_QUEUE_SIZE 4096 // The capacity of the submission ring shared by all workers (a power of two)
+#define THREAD_POOL_DEQUE_SIZE 256  // The initial capacity of a worker's deque (a power of two); it grows when full
+#define THREAD_POOL_BATCH 32        // The most jobs a worker moves from the submission ring to its deque at once
+#define THREAD_POOL_SPIN 64         // The number of times an idle worker looks for work before going to sleep
+
+/* Options of thread_pool_constructor_with_options */
+#define THREAD_POOL_PIN_CPUS 1 // Pin each worker to one of the CPUs the process may run on, round robin
 
 struct ThreadJob
 {
@@ -11,26 +19,49 @@ struct ThreadJob
   void *arg;               // argument to be passed to the function.
 };
 
+struct ThreadWorker;
+struct ThreadJobRing;
+
+/**
+ * The ThreadPool struct runs jobs on a fixed set of workers without a lock on the hot path. Each worker owns a
+ * Chase-Lev deque: it pushes and pops at the bottom, idle workers steal from the top. Jobs submitted from outside the
+ * pool go through a bounded lock-free ring, from which workers move them to their deque in batches; jobs submitted by
+ * a job go straight to its worker's deque. Workers only sleep once no job is left anywhere, and a job submitted while
+ * every worker is busy is picked up by the first one to finish.
+ */
 struct ThreadPool
 {
   int num_threads;       // number of threads in the pool.
-  int active;            // a control switch for the thread pool.
-  struct Queue work;     // a queue to store works.
-  pthread_t *pool;       // Mutices for making the pool thread-safe.
-  pthread_mutex_t lock;  // Mutices for making the pool thread-safe.
-  pthread_cond_t signal; // Condition variable for making the pool thread-safe.
+  atomic_int active;     // a control switch for the thread pool.
+  pthread_t *pool;       // the threads of the pool.
+  pthread_mutex_t lock;  // Protects the sleeping workers and the threads waiting for the pool to be idle.
+  pthread_cond_t signal; // Wakes sleeping workers.
+  pthread_cond_t idle;   // Wakes threads waiting in wait_all.
+
+  /* Private member variables */
+
+  struct ThreadWorker *workers;   // one deque per worker
+  struct ThreadJobRing *queue;    // jobs submitted from outside the pool
+  atomic_long available;          // jobs submitted and not yet claimed by a worker
+  atomic_long pending;            // jobs submitted and not yet finished
+  atomic_int sleeping;            // workers waiting on signal
 
   // A function for safely adding work to the queue.
   void (*add_work)(struct ThreadPool *thread_pool, struct ThreadJob thread_job);
-  // A function for waiting for all threads to finish.
+  // Adds several jobs at once, waking as many workers as there are jobs.
+  void (*add_work_batch)(struct ThreadPool *thread_pool, struct ThreadJob *thread_jobs, int count);
+  // A function for waiting for all jobs, those added while waiting included, to finish.
   void (*wait_all)(struct ThreadPool *thread_pool);
 };
 
 // A function for creating a thread pool.
 struct ThreadPool *thread_pool_constructor(int num_threads);
+// Creates a thread pool with THREAD_POOL_* options.
+struct ThreadPool *thread_pool_constructor_with_options(int num_threads, int options);
 // A function for creating a thread job.
 struct ThreadJob thread_job_constructor(void *(*job)(void *arg), void *arg);
 
+// Stops taking work, lets the jobs already added finish and stops the threads.
 void thread_pool_destructor(struct ThreadPool *thread_pool);
 
 #endif // THREAD_POOL_H
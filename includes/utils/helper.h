@@ -4,11 +4,6 @@
 
 #include <string.h>
 
-char *convert_int_to_string(int);
-char *convert_float_to_string(float);
-char *convert_double_to_string(double);
-char *convert_long_to_string(long);
-
 char *get_current_time();
 int remove_directory(const char *path);
 int create_directory(const char *path);
@@ -0,0 +1,53 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include "data_structures/arena.h"
+
+#include <stddef.h>
+
+/* Setting */
+#define JSON_CHUNK_SIZE 16384 // The size of the chunks JSON is written into
+
+// JSONWriters write JSON into chunks taken from an arena, escaping strings and placing the commas. A writer with a
+// sink hands each chunk to it once full, so output of any size is written a chunk at a time; a writer without one
+// grows a single string.
+struct JSONWriter
+{
+  /* Public variables */
+
+  size_t length; // The bytes written so far
+
+  /* Private variables */
+
+  struct Arena *arena;                                     // The memory chunks are taken from
+  char *chunk;                                             // The chunk being filled
+  size_t used;                                             // The bytes of the chunk in use
+  size_t size;                                             // The size of the chunk
+  void (*sink)(void *target, char *data, size_t length);   // Takes each full chunk, or NULL
+  void *target;                                            // The first argument of the sink
+  int need_comma;                                          // Whether a value was written in the current container
+
+  /* Public methods */
+
+  // Opening and closing an object or an array.
+  void (*begin_object)(struct JSONWriter *writer);
+  void (*end_object)(struct JSONWriter *writer);
+  void (*begin_array)(struct JSONWriter *writer);
+  void (*end_array)(struct JSONWriter *writer);
+  // Writes the name of the next member of an object.
+  void (*key)(struct JSONWriter *writer, const char *name);
+  // Writes a string value, escaped, or null if the string is NULL.
+  void (*string)(struct JSONWriter *writer, const char *value);
+  // Writes an integer value.
+  void (*integer)(struct JSONWriter *writer, long value);
+  // Writes a member of an object, as key then string or integer do.
+  void (*string_field)(struct JSONWriter *writer, const char *name, const char *value);
+  void (*integer_field)(struct JSONWriter *writer, const char *name, long value);
+  // Ends the output: the last chunk goes to the sink, or the string is NUL terminated and returned.
+  char *(*finish)(struct JSONWriter *writer);
+};
+
+// Creating a new writer. No memory is taken from the arena before the first value.
+struct JSONWriter json_writer_constructor(struct Arena *arena, void (*sink)(void *target, char *data, size_t length), void *target);
+
+#endif /* JSON_WRITER_H */
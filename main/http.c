@@ -89,6 +89,28 @@ int main()
     http_server.register_routes(&http_server, delete_file, "/file/delete", 1, DELETE);
     http_server.register_routes(&http_server, update_file, "/file/update", 1, PUT);
     http_server.register_routes(&http_server, get_file, "/file/info", 1, GET);
+    http_server.register_routes(&http_server, download_file, "/file/download", 2, GET, HEAD);
+    http_server.register_routes(&http_server, upload_file, "/file/upload", 1, POST);
+    http_server.stream_body(&http_server, "/file/upload", UPLOAD_MAX_SIZE);
+
+    // multipart upload
+    http_server.register_routes(&http_server, initiate_upload, "/upload/initiate", 1, POST);
+    http_server.register_routes(&http_server, upload_part, "/upload/part", 1, PUT);
+    http_server.register_routes(&http_server, list_upload_parts, "/upload/parts", 1, GET);
+    http_server.register_routes(&http_server, complete_upload, "/upload/complete", 1, POST);
+    http_server.register_routes(&http_server, abort_upload, "/upload/abort", 1, DELETE);
+    http_server.stream_body(&http_server, "/upload/part", UPLOAD_MAX_SIZE);
+
+    // Every route but logging in, registering and the public user info needs a session.
+    char *public_routes[] = {"/login", "/register", "/user/info"};
+    for (int i = 0; i < http_server.router.num_routes; i++)
+    {
+      int is_public = 0;
+      for (size_t j = 0; j < sizeof(public_routes) / sizeof(public_routes[0]); j++)
+        is_public |= strcmp(http_server.router.routes[i].pattern, public_routes[j]) == 0;
+      if (!is_public)
+        http_server.require_auth(&http_server, http_server.router.routes[i].pattern);
+    }
 
     http_server.launch(&http_server);
   }
@@ -118,21 +140,22 @@ void init_database(struct DatabasePool *pool)
   lseek(fd, 0, SEEK_SET);
 
   // read file
-  char *buffer = malloc(num);
+  char *buffer = malloc(num + 1);
   int ret = read(fd, buffer, num);
 
   if (ret == -1)
   {
     log_error("Can't read file %s", DATABASE_INIT_FILE);
+    free(buffer);
+    close(fd);
     return;
   }
+  buffer[ret] = '\0';
 
   // slipt string by ;
   char *token = strtok(buffer, ";");
   while (token != NULL)
   {
-    // add ; to end of string
-    token[strlen(token)] = ';';
     pool->exec(pool, NULL, NULL, token, 0);
     token = strtok(NULL, ";");
   }
@@ -31,6 +31,8 @@ int main()
       return (ret);
 
     tftp_server = tftp_server_constructor(INADDR_ANY, 8069, 1, UPLOAD_DIR);
+    tftp_server.transfer_rate = TFTP_TRANSFER_RATE;
+    tftp_server.total_rate = TFTP_SERVER_RATE;
     tftp_server.launch(&tftp_server);
   }
   else
@@ -0,0 +1,192 @@
+#include "data_structures/arena.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Private member methods prototypes */
+
+struct ArenaBlock *_new_block(size_t size);
+
+/* Public member methods prototypes */
+
+void *alloc_arena(struct Arena *arena, size_t size);
+char *copy_arena(struct Arena *arena, const char *string, size_t length);
+char *format_arena(struct Arena *arena, const char *format, ...);
+
+/* Constructor */
+
+/**
+ * It creates an empty arena
+ *
+ * @param block_size The size of the blocks memory is taken from.
+ *
+ * @return An arena.
+ */
+struct Arena arena_constructor(size_t block_size)
+{
+  struct Arena arena;
+  arena.blocks = NULL;
+  arena.block_size = (block_size + sizeof(max_align_t) - 1) / sizeof(max_align_t) * sizeof(max_align_t);
+  arena.alloc = alloc_arena;
+  arena.copy = copy_arena;
+  arena.format = format_arena;
+  return arena;
+}
+
+/**
+ * It frees the blocks of the arena, and with them everything allocated from it
+ *
+ * @param arena The arena to be destroyed.
+ */
+void arena_destructor(struct Arena *arena)
+{
+  while (arena->blocks != NULL)
+  {
+    struct ArenaBlock *next = arena->blocks->next;
+    free(arena->blocks);
+    arena->blocks = next;
+  }
+}
+
+/**
+ * It frees every allocation of the arena at once, as arena_destructor does, but keeps a block of the regular size,
+ * emptied, so that an arena reused for the same work does not free and allocate it again. Blocks of a single large
+ * allocation are freed.
+ *
+ * @param arena The arena to be reset.
+ */
+void arena_reset(struct Arena *arena)
+{
+  struct ArenaBlock *kept = NULL;
+  while (arena->blocks != NULL)
+  {
+    struct ArenaBlock *next = arena->blocks->next;
+    if (kept == NULL && arena->blocks->size == arena->block_size)
+      kept = arena->blocks;
+    else
+      free(arena->blocks);
+    arena->blocks = next;
+  }
+  if (kept != NULL)
+  {
+    kept->next = NULL;
+    kept->used = 0;
+  }
+  arena->blocks = kept;
+}
+
+/* Public member methods implementation */
+
+/**
+ * It takes memory from the current block, or from a new one when the current block is full. An allocation larger
+ * than a quarter of a block gets a block of its own, put behind the current one so that its room is not lost.
+ *
+ * @param arena The arena.
+ * @param size The number of bytes.
+ *
+ * @return The memory, aligned for any type.
+ */
+void *alloc_arena(struct Arena *arena, size_t size)
+{
+  size_t room = (size + sizeof(max_align_t) - 1) / sizeof(max_align_t) * sizeof(max_align_t);
+  if (room == 0)
+    room = sizeof(max_align_t);
+
+  struct ArenaBlock *block = arena->blocks;
+  if (block == NULL || block->used + room > block->size)
+  {
+    if (room > arena->block_size / 4)
+    {
+      struct ArenaBlock *own = _new_block(room);
+      own->used = room;
+      if (block != NULL)
+      {
+        own->next = block->next;
+        block->next = own;
+      }
+      else
+        arena->blocks = own;
+      return own->data;
+    }
+    block = _new_block(arena->block_size);
+    block->next = arena->blocks;
+    arena->blocks = block;
+  }
+  void *memory = (char *)block->data + block->used;
+  block->used += room;
+  return memory;
+}
+
+/**
+ * It copies a string into the arena
+ *
+ * @param arena The arena.
+ * @param string The string, which need not be NUL terminated.
+ * @param length The number of bytes to copy.
+ *
+ * @return The NUL terminated copy.
+ */
+char *copy_arena(struct Arena *arena, const char *string, size_t length)
+{
+  char *copy = alloc_arena(arena, length + 1);
+  memcpy(copy, string, length);
+  copy[length] = '\0';
+  return copy;
+}
+
+/**
+ * It formats a string into the arena. The string is written straight into the current block when it fits, and
+ * formatted a second time otherwise.
+ *
+ * @param arena The arena.
+ * @param format The format, as for printf.
+ *
+ * @return The NUL terminated string.
+ */
+char *format_arena(struct Arena *arena, const char *format, ...)
+{
+  struct ArenaBlock *block = arena->blocks;
+  char *free_space = block != NULL ? (char *)block->data + block->used : NULL;
+  size_t free_size = block != NULL ? block->size - block->used : 0;
+
+  va_list arguments;
+  va_start(arguments, format);
+  int length = vsnprintf(free_space, free_size, format, arguments);
+  va_end(arguments);
+  if (length < 0)
+    return copy_arena(arena, "", 0);
+
+  if ((size_t)length < free_size)
+    return alloc_arena(arena, length + 1); // The string is already where this allocation starts.
+
+  char *string = alloc_arena(arena, length + 1);
+  va_start(arguments, format);
+  vsnprintf(string, length + 1, format, arguments);
+  va_end(arguments);
+  return string;
+}
+
+/* Private member methods implementation */
+
+/**
+ * It allocates a block
+ *
+ * @param size The bytes of data of the block.
+ *
+ * @return The block, empty.
+ */
+struct ArenaBlock *_new_block(size_t size)
+{
+  struct ArenaBlock *block = malloc(sizeof(struct ArenaBlock) + size);
+  if (block == NULL)
+  {
+    fprintf(stderr, "Error: Out of memory for arena...\n");
+    exit(1);
+  }
+  block->next = NULL;
+  block->used = 0;
+  block->size = size;
+  return block;
+}
@@ -3,9 +3,25 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Private definitions */
+
+#define CONTROL_EMPTY 0x80     // The control byte of an empty bucket; those of full buckets are below it
+#define MIN_BUCKETS 16         // The number of buckets of a new table
+#define MAX_LOAD(buckets) ((buckets) / 8 * 7) // The number of entries past which the table grows
+
 /* Private member methods prototypes */
 
-void recursive_dictionary_destroy(struct Node *cursor, void (*free_key)(void *key), void (*free_value)(void *value));
+uint64_t _hash_key(const void *key, size_t length);
+size_t _key_length(struct Dictionary *dictionary, const void *key, unsigned long key_size);
+const void *_slot_key(const struct DictionarySlot *slot);
+struct DictionarySlot *_find_slot(struct Dictionary *dictionary, const void *key, size_t length, uint64_t hash);
+uint32_t _match_group(const uint8_t *group, uint8_t control);
+void _place_entry(struct Dictionary *dictionary, uint64_t hash, uint32_t index);
+void _grow_table(struct Dictionary *dictionary);
 
 /* Public member methods prototypes */
 
@@ -16,19 +32,24 @@ void iterate_dict(struct Dictionary *dictionary, size_t (*key_size)(void *key),
 /* Constructor */
 
 /**
- * It creates a dictionary by creating a binary search tree and a linked list, and then it returns the dictionary
+ * It creates an empty dictionary; the table is allocated with the first entry
  *
- * @param compare a function that takes two keys and returns an integer. If the integer is less than 0, then the first key
- * is less than the second key. If the integer is greater than 0, then the first key is greater than the second key. If the
- * integer is 0, then the two keys are
+ * @param compare The function ordering the keys. If it is compare_string_keys, keys are NUL terminated strings, equal
+ * when strcmp says so whatever size they are given with; otherwise keys are compared byte for byte.
  *
  * @return A dictionary.
  */
 struct Dictionary dictionary_constructor(int (*compare)(void *key_one, void *key_two))
 {
   struct Dictionary dictionary;
-  dictionary.bst = binary_search_tree_constructor(compare);
-  dictionary.keys = linked_list_constructor();
+  dictionary.length = 0;
+  dictionary.string_keys = compare == compare_string_keys;
+  dictionary.control = NULL;
+  dictionary.buckets = NULL;
+  dictionary.num_buckets = 0;
+  dictionary.slots = NULL;
+  dictionary.capacity = 0;
+  dictionary.arena = arena_constructor(DICTIONARY_ARENA_BLOCK);
   dictionary.insert = insert_dict;
   dictionary.search = search_dict;
   dictionary.iterate = iterate_dict;
@@ -36,77 +57,56 @@ struct Dictionary dictionary_constructor(int (*compare)(void *key_one, void *key
 }
 
 /**
- * It destroys the linked list of keys, and then it destroys the binary search tree of values
+ * It frees the table and the copies of the keys and values
  *
  * @param dictionary The dictionary to be destroyed.
- * @param free_key A function that frees the memory allocated for the key.
- * @param free_value A function that frees the memory allocated for the value.
+ * @param free_key A function releasing what a key owns, or NULL.
+ * @param free_value A function releasing what a value owns, or NULL.
  */
 void dictionary_destructor(struct Dictionary *dictionary, void (*free_key)(void *key), void (*free_value)(void *value))
 {
-  linked_list_destructor(&dictionary->keys, free_key);
-  recursive_dictionary_destroy(dictionary->bst.head, free_key, free_value);
-}
-
-/* Private member methods implementation */
-
-/**
- * If the current node has a previous node, recursively destroy the previous node. If the current node has a next node,
- * recursively destroy the next node. Then, free the data of the current node and free the current node
- *
- * @param cursor The current node in the tree.
- * @param free_key A function that frees the memory allocated for the key.
- * @param free_value A function that frees the memory allocated for the value.
- */
-void recursive_dictionary_destroy(struct Node *cursor, void (*free_key)(void *key), void (*free_value)(void *value))
-{
-  if (cursor && cursor->prev)
-  {
-    recursive_dictionary_destroy(cursor->prev, free_key, free_value);
-  }
-  if (cursor && cursor->next)
-  {
-    recursive_dictionary_destroy(cursor->next, free_key, free_value);
-  }
-  if (cursor)
+  for (int i = 0; i < dictionary->length; i++)
   {
-    entry_destructor((struct Entry *)cursor->data, free_key, free_value);
-    free(cursor);
+    if (free_key != NULL)
+      free_key((void *)_slot_key(&dictionary->slots[i]));
+    if (free_value != NULL)
+      free_value(dictionary->slots[i].value);
   }
+  arena_destructor(&dictionary->arena);
+  free(dictionary->control);
+  free(dictionary->buckets);
+  free(dictionary->slots);
+  dictionary->control = NULL;
+  dictionary->buckets = NULL;
+  dictionary->slots = NULL;
+  dictionary->num_buckets = 0;
+  dictionary->capacity = 0;
+  dictionary->length = 0;
 }
 
 /* Public member methods implementation */
 
 /**
- * It creates a dummy entry with the given key and value, and then uses the search function of the BinarySearchTree to find
- * the desired element
+ * It finds the value of a key
  *
  * @param dictionary The dictionary to search in.
  * @param key The key to search for.
  * @param key_size The size of the key in bytes.
  *
- * @return The value of the entry that was found.
+ * @return The value of the entry that was found, or NULL.
  */
 void *search_dict(struct Dictionary *dictionary, void *key, unsigned long key_size)
 {
-  int dummy_value = 0;
-  struct Entry searchable = entry_constructor(key, key_size, &dummy_value, sizeof(dummy_value));
-  // Use the iterate function of the BinarySearchTree to find the desired element.
-  void *result = dictionary->bst.search(&dictionary->bst, &searchable);
-
-  if (result)
-  {
-    return ((struct Entry *)result)->value;
-  }
-  else
-  {
+  if (dictionary->length == 0)
     return NULL;
-  }
+  size_t length = _key_length(dictionary, key, key_size);
+  struct DictionarySlot *slot = _find_slot(dictionary, key, length, _hash_key(key, length));
+  return slot != NULL ? slot->value : NULL;
 }
 
 /**
- * It creates a new entry, inserts it into the dictionary's binary search tree, and then inserts the key into the
- * dictionary's key list
+ * It copies a key and its value into the dictionary. As with the tree it replaces, a key already there keeps its
+ * value.
  *
  * @param dictionary The dictionary to insert into.
  * @param key The key to insert into the dictionary.
@@ -116,12 +116,39 @@ void *search_dict(struct Dictionary *dictionary, void *key, unsigned long key_si
  */
 void insert_dict(struct Dictionary *dictionary, void *key, unsigned long key_size, void *value, unsigned long value_size)
 {
-  struct Entry new_entry = entry_constructor(key, key_size, value, value_size);
-  dictionary->bst.insert(&dictionary->bst, &new_entry, sizeof(new_entry));
-  dictionary->keys.insert(&dictionary->keys, dictionary->keys.length, key, key_size);
-}
+  size_t length = _key_length(dictionary, key, key_size);
+  uint64_t hash = _hash_key(key, length);
+  if (dictionary->length > 0 && _find_slot(dictionary, key, length, hash) != NULL)
+    return;
+
+  if ((size_t)dictionary->length + 1 > MAX_LOAD(dictionary->num_buckets))
+    _grow_table(dictionary);
+  if (dictionary->length == dictionary->capacity)
+  {
+    dictionary->capacity = dictionary->capacity == 0 ? MIN_BUCKETS : dictionary->capacity * 2;
+    dictionary->slots = realloc(dictionary->slots, sizeof(struct DictionarySlot) * dictionary->capacity);
+  }
 
-#include <stdio.h>
+  // String keys are kept NUL terminated, whether or not their size counted the NUL.
+  size_t stored = length + (dictionary->string_keys ? 1 : 0);
+  struct DictionarySlot *slot = &dictionary->slots[dictionary->length];
+  slot->hash = hash;
+  slot->key_size = stored;
+  if (stored <= DICTIONARY_INLINE_KEY)
+  {
+    slot->key = NULL;
+    memcpy(slot->inline_key, key, length);
+    if (dictionary->string_keys)
+      slot->inline_key[length] = '\0';
+  }
+  else if (dictionary->string_keys)
+    slot->key = dictionary->arena.copy(&dictionary->arena, key, length);
+  else
+    slot->key = memcpy(dictionary->arena.alloc(&dictionary->arena, length), key, length);
+  slot->value = memcpy(dictionary->arena.alloc(&dictionary->arena, value_size), value, value_size);
+  _place_entry(dictionary, hash, dictionary->length);
+  dictionary->length++;
+}
 
 /* public helper function implementation */
 
@@ -151,18 +178,156 @@ int compare_string_keys(void *entry_one, void *entry_two)
 }
 
 /**
- * It iterates through the dictionary and calls a callback function on each entry
+ * It iterates through the dictionary, in the order the entries were inserted, and calls a callback function on each entry
  *
  * @param dictionary The dictionary to iterate over.
- * @param callback a function pointer to a function that takes a pointer to an Entry and a void pointer as parameters.
+ * @param key_size Unused, kept for the callers of the tree this dictionary replaces.
+ * @param callback a function pointer to a function that takes a key, its value and a void pointer as parameters.
  * @param arg The argument to pass to the callback function.
  */
 void iterate_dict(struct Dictionary *dictionary, size_t (*key_size)(void *key), void (*callback)(void *key, void *value, void *arg), void *arg)
 {
-  for (int i = 0; i < dictionary->keys.length; i++)
+  (void)key_size;
+  for (int i = 0; i < dictionary->length; i++)
+    callback((void *)_slot_key(&dictionary->slots[i]), dictionary->slots[i].value, arg);
+}
+
+/* Private member methods implementation */
+
+/**
+ * It hashes a key 8 bytes at a time, mixing each word in with a multiply and a shift
+ *
+ * @param key The key.
+ * @param length Its length.
+ *
+ * @return The hash: its low 7 bits go to the control bytes, the others choose the group probed first.
+ */
+uint64_t _hash_key(const void *key, size_t length)
+{
+  const uint8_t *bytes = key;
+  uint64_t hash = 0x9E3779B97F4A7C15ULL ^ length;
+  uint64_t word;
+  for (; length >= 8; bytes += 8, length -= 8)
   {
-    void *key = dictionary->keys.retrieve(&dictionary->keys, i);
-    void *value = dictionary->search(dictionary, key, key_size(key));
-    callback(key, value, arg);
+    memcpy(&word, bytes, 8);
+    hash = (hash ^ word) * 0xBF58476D1CE4E5B9ULL;
+    hash ^= hash >> 31;
   }
+  word = 0;
+  memcpy(&word, bytes, length);
+  hash = (hash ^ word) * 0x94D049BB133111EBULL;
+  hash ^= hash >> 29;
+  hash *= 0xBF58476D1CE4E5B9ULL;
+  return hash ^ (hash >> 32);
+}
+
+/**
+ * It gives the length of a key as it is hashed and compared: a string key ends at its NUL, if it comes before its size
+ *
+ * @return The length.
+ */
+size_t _key_length(struct Dictionary *dictionary, const void *key, unsigned long key_size)
+{
+  return dictionary->string_keys ? strnlen(key, key_size) : key_size;
+}
+
+const void *_slot_key(const struct DictionarySlot *slot)
+{
+  return slot->key != NULL ? slot->key : slot->inline_key;
+}
+
+/**
+ * It finds the entry of a key: the groups of buckets are probed from the one the hash chooses, with steps of one more
+ * group each time, until a group with an empty bucket ends the search
+ *
+ * @param dictionary The dictionary, not empty.
+ * @param key The key.
+ * @param length Its length, as _key_length gives it.
+ * @param hash Its hash.
+ *
+ * @return The entry, or NULL if the key is not in the dictionary.
+ */
+struct DictionarySlot *_find_slot(struct Dictionary *dictionary, const void *key, size_t length, uint64_t hash)
+{
+  size_t group_mask = dictionary->num_buckets / DICTIONARY_GROUP_SIZE - 1;
+  size_t group = (hash >> 7) & group_mask;
+  uint8_t control = hash & 0x7F;
+  size_t stored = length + (dictionary->string_keys ? 1 : 0);
+  for (size_t step = 1;; step++)
+  {
+    const uint8_t *controls = dictionary->control + group * DICTIONARY_GROUP_SIZE;
+    for (uint32_t matches = _match_group(controls, control); matches != 0; matches &= matches - 1)
+    {
+      uint32_t index = dictionary->buckets[group * DICTIONARY_GROUP_SIZE + __builtin_ctz(matches)];
+      struct DictionarySlot *slot = &dictionary->slots[index];
+      if (slot->hash == hash && slot->key_size == stored && memcmp(_slot_key(slot), key, length) == 0)
+        return slot;
+    }
+    if (_match_group(controls, CONTROL_EMPTY) != 0)
+      return NULL;
+    group = (group + step) & group_mask;
+  }
+}
+
+/**
+ * It compares the control bytes of a group with one byte
+ *
+ * @param group The DICTIONARY_GROUP_SIZE control bytes.
+ * @param control The byte.
+ *
+ * @return A mask with bit i set if the control byte i is the byte.
+ */
+uint32_t _match_group(const uint8_t *group, uint8_t control)
+{
+#ifdef __SSE2__
+  __m128i bytes = _mm_loadu_si128((const __m128i *)group);
+  return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)control)));
+#else
+  uint32_t mask = 0;
+  for (int i = 0; i < DICTIONARY_GROUP_SIZE; i++)
+    mask |= (uint32_t)(group[i] == control) << i;
+  return mask;
+#endif
+}
+
+/**
+ * It puts an entry in the first empty bucket of the groups its hash probes
+ *
+ * @param dictionary The dictionary, with an empty bucket left.
+ * @param hash The hash of the key of the entry.
+ * @param index The entry.
+ */
+void _place_entry(struct Dictionary *dictionary, uint64_t hash, uint32_t index)
+{
+  size_t group_mask = dictionary->num_buckets / DICTIONARY_GROUP_SIZE - 1;
+  size_t group = (hash >> 7) & group_mask;
+  for (size_t step = 1;; step++)
+  {
+    uint32_t empty = _match_group(dictionary->control + group * DICTIONARY_GROUP_SIZE, CONTROL_EMPTY);
+    if (empty != 0)
+    {
+      size_t bucket = group * DICTIONARY_GROUP_SIZE + __builtin_ctz(empty);
+      dictionary->control[bucket] = hash & 0x7F;
+      dictionary->buckets[bucket] = index;
+      return;
+    }
+    group = (group + step) & group_mask;
+  }
+}
+
+/**
+ * It doubles the number of buckets and places the entries again, from the hashes they keep
+ *
+ * @param dictionary The dictionary.
+ */
+void _grow_table(struct Dictionary *dictionary)
+{
+  dictionary->num_buckets = dictionary->num_buckets == 0 ? MIN_BUCKETS : dictionary->num_buckets * 2;
+  free(dictionary->control);
+  free(dictionary->buckets);
+  dictionary->control = malloc(dictionary->num_buckets);
+  dictionary->buckets = malloc(sizeof(uint32_t) * dictionary->num_buckets);
+  memset(dictionary->control, CONTROL_EMPTY, dictionary->num_buckets);
+  for (int i = 0; i < dictionary->length; i++)
+    _place_entry(dictionary, dictionary->slots[i].hash, i);
 }
@@ -17,7 +17,7 @@ void remove_node_ll(struct LinkedList *list, int index, void (*free_data)(void *
 void *retrieve_ll(struct LinkedList *list, int index);
 void bubble_sort_ll(struct LinkedList *list, int (*compare)(void *a, void *b));
 short binary_search_ll(struct LinkedList *list, void *query, int (*compare)(void *a, void *b));
-char *to_json_ll(struct LinkedList *list, char *(*to_json)(void *data));
+void to_json_ll(struct LinkedList *list, void (*to_json)(void *data, struct JSONWriter *writer), struct JSONWriter *writer);
 
 /* Constructor */
 
@@ -54,7 +54,7 @@ struct LinkedList linked_list_constructor()
  */
 void linked_list_destructor(struct LinkedList *list, void (*free_data)(void *data))
 {
-  for (int i = 0; i < list->length; i++)
+  while (list->length > 0)
   {
     list->remove(list, 0, free_data);
   }
@@ -292,32 +292,17 @@ short binary_search_ll(struct LinkedList *list, void *query, int (*compare)(void
 }
 
 /**
- * It takes a linked list and a function that converts a single element of the linked list to JSON, and
- * returns a string that represents the entire linked list in JSON
+ * It writes a linked list as a JSON array, each element with the given function
  * 
  * @param list The LinkedList to convert to JSON
- * @param to_json a function that takes a pointer to a data structure and returns a JSON string
- * 
- * @return A string containing the JSON representation of the list.
+ * @param to_json a function that writes a single element of the list
+ * @param writer The writer the JSON is written with.
  */
-char *to_json_ll(struct LinkedList *list, char *(*to_json)(void *data))
+void to_json_ll(struct LinkedList *list, void (*to_json)(void *data, struct JSONWriter *writer), struct JSONWriter *writer)
 {
-  char *json = malloc(sizeof(char) * 2);
-  json[0] = '[';
-  json[1] = '\0';
-  for (int i = 0; i < list->length; i++)
-  {
-    void *data = list->retrieve(list, i);
-    char *data_json = to_json(data);
-    json = realloc(json, sizeof(char) * (strlen(json) + strlen(data_json) + 10));
-    strcat(json, data_json);
-    if (i != list->length - 1)
-    {
-      strcat(json, ",");
-    }
-    free(data_json);
-  }
-  json = realloc(json, sizeof(char) * (strlen(json) + 4));
-  strcat(json, "]");
-  return json;
-}
\ No newline at end of file
+  writer->begin_array(writer);
+  int i = 0;
+  for (struct Node *cursor = list->head; cursor != NULL && i < list->length; cursor = cursor->next, i++)
+    to_json(cursor->data, writer);
+  writer->end_array(writer);
+}
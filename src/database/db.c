@@ -1,6 +1,10 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
 
 #include "database/db.h"
 #include "logger/logger.h"
@@ -8,11 +12,29 @@
 /* Public variables */
 static struct DatabaseManager *manager = NULL;
 
+/**
+ * The connections the calling thread has checked out, so that a query run from the callback of another reuses them
+ * instead of waiting for a second one. Only one pool is tracked at a time.
+ */
+struct HeldConnections
+{
+  struct DatabasePool *pool;           // the pool the connections come from
+  sqlite3 *reader;                     // the read-only connection held
+  int reader_depth;                    // the number of checkouts of the reader not checked in yet
+  int writer_depth;                    // the number of checkouts of the writer not checked in yet
+  sqlite3_int64 last_insert_rowid;     // the rowid of the last row inserted by the thread
+};
+
+static _Thread_local struct HeldConnections held = {NULL, NULL, 0, 0, 0};
+
 /* Private helper method prototype */
 
 int open_connect(struct DatabasePool *pool);
 int close_connect(struct DatabasePool *pool);
 int exec(struct DatabasePool *pool, void (*callback)(sqlite3_stmt *res, void *arg), void *arg, const char *sql, int num, ...);
+sqlite3 *checkout(struct DatabasePool *pool, int write);
+void checkin(struct DatabasePool *pool, sqlite3 *db);
+sqlite3_int64 last_insert_rowid(struct DatabasePool *pool);
 
 struct DatabasePool *
 database_pool_constructor(const char *uri, char *name);
@@ -21,6 +43,13 @@ void database_pool_destructor(struct DatabasePool *pool);
 
 size_t _get_key_size(void *key);
 void _db_manager_des_callback(void *key, void *value, void *arg);
+int _configure_connection(sqlite3 *db, int write);
+int _is_select(const char *sql);
+struct DatabaseStatementCache *_get_statements(struct DatabasePool *pool, sqlite3 *db);
+sqlite3_stmt *_prepare_statement(struct DatabaseStatementCache *statements, sqlite3 *db, const char *sql, int *ret);
+void _release_statement(struct DatabaseStatementCache *statements, sqlite3_stmt *stmt);
+void _clear_statements(struct DatabaseStatementCache *statements);
+int _bind_value(sqlite3_stmt *stmt, int index, struct DatabaseValue value);
 
 struct DatabasePool *get_pool(struct DatabaseManager *manager, char *name);
 int add_pool(struct DatabaseManager *manager, char *name, struct DatabasePool *pool);
@@ -43,7 +72,23 @@ struct DatabasePool *database_pool_constructor(const char *uri, char *name)
   pool->open = open_connect;
   pool->close = close_connect;
   pool->exec = exec;
-  pool->db = NULL;
+  pool->checkout = checkout;
+  pool->checkin = checkin;
+  pool->last_insert_rowid = last_insert_rowid;
+  pool->writer = NULL;
+  for (int i = 0; i < DATABASE_POOL_SIZE; i++)
+  {
+    pool->readers[i] = NULL;
+  }
+  pool->num_idle = 0;
+  pool->lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+  pool->released = (pthread_cond_t)PTHREAD_COND_INITIALIZER;
+  pool->write_lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+  for (int i = 0; i <= DATABASE_POOL_SIZE; i++)
+  {
+    pool->statements[i].count = 0;
+    pool->statements[i].clock = 0;
+  }
 
   return (pool);
 }
@@ -55,7 +100,7 @@ struct DatabasePool *database_pool_constructor(const char *uri, char *name)
  */
 void database_pool_destructor(struct DatabasePool *pool)
 {
-  if (pool->db != NULL)
+  if (pool->writer != NULL)
     pool->close(pool);
 
   free(pool->name);
@@ -82,12 +127,12 @@ void _db_manager_des_callback(void *key, void *value, void *arg)
 {
   (void)key;
   (void)arg;
-  database_pool_destructor((struct DatabasePool *)value);
+  database_pool_destructor(*(struct DatabasePool **)value);
 }
 
 size_t _get_key_size(void *key)
 {
-  return sizeof(char[strlen((char *)key)]);
+  return strlen((char *)key) + 1;
 }
 
 /**
@@ -118,7 +163,7 @@ struct DatabaseManager *get_db_manager()
 /* Private helper methods implements */
 
 /**
- * It opens a connection to the database and sets the database connection to the database pool object
+ * It opens the writer connection, which switches the database to WAL mode, then the read-only connections
  *
  * @param pool The database pool object.
  *
@@ -126,19 +171,31 @@ struct DatabaseManager *get_db_manager()
  */
 int open_connect(struct DatabasePool *pool)
 {
-  int ret = sqlite3_open(pool->path, &pool->db);
-  if (ret != SQLITE_OK)
+  int ret = sqlite3_open_v2(pool->path, &pool->writer, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX, NULL);
+  if (ret != SQLITE_OK || _configure_connection(pool->writer, 1) != SQLITE_OK)
   {
-    log_error("Can't open database: %s", sqlite3_errmsg(pool->db));
-    sqlite3_close(pool->db);
+    log_error("Can't open database: %s", sqlite3_errmsg(pool->writer));
+    pool->close(pool);
     return (-1);
   }
-  log_info("Database connection is opened successfully: %s", pool->path);
+  for (int i = 0; i < DATABASE_POOL_SIZE; i++)
+  {
+    ret = sqlite3_open_v2(pool->path, &pool->readers[i], SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL);
+    if (ret != SQLITE_OK || _configure_connection(pool->readers[i], 0) != SQLITE_OK)
+    {
+      log_error("Can't open database: %s", sqlite3_errmsg(pool->readers[i]));
+      pool->close(pool);
+      return (-1);
+    }
+    pool->idle[i] = pool->readers[i];
+  }
+  pool->num_idle = DATABASE_POOL_SIZE;
+  log_info("Database connection is opened successfully: %s (%d readers)", pool->path, DATABASE_POOL_SIZE);
   return (0);
 }
 
 /**
- * It closes the database connection
+ * It closes the database connections
  *
  * @param pool The database pool object.
  *
@@ -146,63 +203,412 @@ int open_connect(struct DatabasePool *pool)
  */
 int close_connect(struct DatabasePool *pool)
 {
-  int ret = sqlite3_close(pool->db);
-  if (ret != SQLITE_OK)
+  int result = 0;
+  for (int i = 0; i <= DATABASE_POOL_SIZE; i++)
   {
-    log_error("Can't close database: %s", sqlite3_errmsg(pool->db));
-    return (-1);
+    _clear_statements(&pool->statements[i]);
   }
-  return (0);
+  for (int i = 0; i < DATABASE_POOL_SIZE; i++)
+  {
+    if (sqlite3_close(pool->readers[i]) != SQLITE_OK)
+    {
+      log_error("Can't close database: %s", sqlite3_errmsg(pool->readers[i]));
+      result = -1;
+    }
+    pool->readers[i] = NULL;
+  }
+  pool->num_idle = 0;
+  if (sqlite3_close(pool->writer) != SQLITE_OK)
+  {
+    log_error("Can't close database: %s", sqlite3_errmsg(pool->writer));
+    result = -1;
+  }
+  pool->writer = NULL;
+  return (result);
 }
 
 /**
- * It executes a query on the database and calls the callback function with the result of the query
+ * It executes a query on the database and calls the callback function with the result of the query. SELECT queries
+ * run on a read-only connection, anything else on the writer. The statement is prepared once per connection and kept
+ * for the next call with the same SQL.
  *
  * @param pool The database pool object.
  * @param callback The callback function that will be called with the result of the query.
  * @param arg The argument that will be passed to the callback function.
  * @param sql The query that will be executed on the database.
  * @param num The number of arguments that will be passed to the query.
- * @param ... The arguments that will be passed to the query.
+ * @param ... The arguments that will be passed to the query, as struct DatabaseValue.
  *
  * @return 0 if the query is executed successfully, otherwise it returns a negative number.
  */
 int exec(struct DatabasePool *pool, void (*callback)(sqlite3_stmt *res, void *arg), void *arg, const char *sql, int num, ...)
 {
-  va_list args;
-  va_start(args, num);
+  int write = !_is_select(sql);
+  sqlite3 *db;
+  struct DatabaseStatementCache *statements;
   sqlite3_stmt *res;
-  int ret = sqlite3_prepare_v2(pool->db, sql, -1, &res, NULL);
-  if (ret != SQLITE_OK)
+  int ret;
+  while (1)
   {
-    log_error("Can't prepare statement: %s", sqlite3_errmsg(pool->db));
-    return (-1);
+    db = pool->checkout(pool, write);
+    if (db == NULL)
+    {
+      log_error("No database connection available for: %s", sql);
+      return (SQLITE_BUSY);
+    }
+    statements = _get_statements(pool, db);
+    res = _prepare_statement(statements, db, sql, &ret);
+    if (ret != SQLITE_OK)
+    {
+      log_error("Can't prepare statement: %s", sqlite3_errmsg(db));
+      pool->checkin(pool, db);
+      return (-1);
+    }
+    // A SELECT that writes, through a function for instance, goes to the writer.
+    if (write || res == NULL || sqlite3_stmt_readonly(res))
+      break;
+    _release_statement(statements, res);
+    pool->checkin(pool, db);
+    write = 1;
   }
+  if (res == NULL)
+  {
+    // Only whitespace or comments
+    pool->checkin(pool, db);
+    return (SQLITE_OK);
+  }
+
+  va_list args;
+  va_start(args, num);
   for (int i = 0; i < num; i++)
   {
-    char *value = va_arg(args, char *);
-    sqlite3_bind_text(res, i + 1, value, -1, SQLITE_STATIC);
+    _bind_value(res, i + 1, va_arg(args, struct DatabaseValue));
   }
   va_end(args);
 
-  log_debug("Query: %s", sqlite3_expanded_sql(res));
+  // Expanding the query is not free, skip it when it would not be logged.
+  if (g_log_lvl >= D_DEBUG)
+  {
+    char *expanded = sqlite3_expanded_sql(res);
+    log_debug("Query: %s", expanded);
+    sqlite3_free(expanded);
+  }
 
-  while ((ret = sqlite3_step(res)) == SQLITE_ROW && callback != NULL)
+  while ((ret = sqlite3_step(res)) == SQLITE_ROW)
   {
-    callback(res, arg);
+    if (callback != NULL)
+      callback(res, arg);
   }
+  if (write)
+    held.last_insert_rowid = sqlite3_last_insert_rowid(db);
 
   if (ret != SQLITE_DONE)
   {
-    log_error("Query error: %s", sqlite3_errmsg(pool->db));
-    sqlite3_finalize(res);
+    log_error("Query error: %s", sqlite3_errmsg(db));
+    _release_statement(statements, res);
+    pool->checkin(pool, db);
     return ret;
   }
 
-  sqlite3_finalize(res);
+  _release_statement(statements, res);
+  pool->checkin(pool, db);
   return (SQLITE_OK);
 }
 
+/**
+ * It takes a connection out of the pool: the writer, or one of the read-only connections. A thread already holding
+ * the writer gets it for reads too, and one holding a reader gets the same reader again, so nested queries never wait
+ * for the thread itself.
+ *
+ * @param pool The database pool object.
+ * @param write Whether the connection is used to write.
+ *
+ * @return The connection, or NULL if none was free within DATABASE_CHECKOUT_TIMEOUT.
+ */
+sqlite3 *checkout(struct DatabasePool *pool, int write)
+{
+  if (held.reader_depth == 0 && held.writer_depth == 0)
+    held.pool = pool;
+  int tracked = held.pool == pool;
+  if (tracked && held.writer_depth > 0)
+  {
+    held.writer_depth++;
+    return pool->writer;
+  }
+  if (tracked && !write && held.reader_depth > 0)
+  {
+    held.reader_depth++;
+    return held.reader;
+  }
+
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += DATABASE_CHECKOUT_TIMEOUT / 1000;
+  deadline.tv_nsec += (DATABASE_CHECKOUT_TIMEOUT % 1000) * 1000000L;
+  if (deadline.tv_nsec >= 1000000000L)
+  {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+
+  if (write)
+  {
+    if (pthread_mutex_timedlock(&pool->write_lock, &deadline) != 0)
+      return NULL;
+    if (tracked)
+      held.writer_depth = 1;
+    return pool->writer;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->num_idle == 0)
+  {
+    if (pthread_cond_timedwait(&pool->released, &pool->lock, &deadline) == ETIMEDOUT)
+    {
+      pthread_mutex_unlock(&pool->lock);
+      return NULL;
+    }
+  }
+  sqlite3 *db = pool->idle[--pool->num_idle];
+  pthread_mutex_unlock(&pool->lock);
+
+  if (tracked)
+  {
+    held.reader = db;
+    held.reader_depth = 1;
+  }
+  return db;
+}
+
+/**
+ * It gives back a connection taken with checkout
+ *
+ * @param pool The database pool object.
+ * @param db The connection.
+ */
+void checkin(struct DatabasePool *pool, sqlite3 *db)
+{
+  int tracked = held.pool == pool;
+  if (db == pool->writer)
+  {
+    if (tracked && --held.writer_depth > 0)
+      return;
+    pthread_mutex_unlock(&pool->write_lock);
+    return;
+  }
+
+  if (tracked && --held.reader_depth > 0)
+    return;
+  pthread_mutex_lock(&pool->lock);
+  pool->idle[pool->num_idle++] = db;
+  pthread_cond_signal(&pool->released);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * It returns the rowid of the last row the calling thread inserted. The rowid is captured while the thread still
+ * holds the writer, so another thread's insert cannot be returned instead.
+ *
+ * @param pool The database pool object.
+ *
+ * @return The rowid.
+ */
+sqlite3_int64 last_insert_rowid(struct DatabasePool *pool)
+{
+  (void)pool;
+  return held.last_insert_rowid;
+}
+
+/**
+ * It sets a connection up: a busy timeout, so that a locked database is retried instead of failing, foreign keys,
+ * memory mapped reads and a larger page cache. The writer also turns WAL on, which is persistent, with NORMAL
+ * synchronous mode, which is durable enough in WAL mode.
+ *
+ * @param db The connection.
+ * @param write Whether it is the writer.
+ *
+ * @return SQLITE_OK on success.
+ */
+int _configure_connection(sqlite3 *db, int write)
+{
+  char pragmas[512];
+  snprintf(pragmas, sizeof(pragmas),
+           "PRAGMA busy_timeout = %d; PRAGMA foreign_keys = ON; PRAGMA mmap_size = %lld; PRAGMA cache_size = %d;%s",
+           DATABASE_BUSY_TIMEOUT, (long long)DATABASE_MMAP_SIZE, DATABASE_CACHE_SIZE,
+           write ? " PRAGMA journal_mode = WAL; PRAGMA synchronous = NORMAL;" : "");
+  return sqlite3_exec(db, pragmas, NULL, NULL, NULL);
+}
+
+/**
+ * It tells whether a query is a SELECT
+ *
+ * @param sql The query.
+ *
+ * @return 1 if the query starts with SELECT, 0 otherwise.
+ */
+int _is_select(const char *sql)
+{
+  while (isspace((unsigned char)*sql))
+    sql++;
+  return strncasecmp(sql, "SELECT", 6) == 0;
+}
+
+/**
+ * It returns the statement cache of a connection of the pool
+ *
+ * @param pool The database pool object.
+ * @param db The connection, the writer or one of the readers.
+ *
+ * @return A pointer to a struct DatabaseStatementCache.
+ */
+struct DatabaseStatementCache *_get_statements(struct DatabasePool *pool, sqlite3 *db)
+{
+  if (db == pool->writer)
+    return &pool->statements[0];
+  for (int i = 0; i < DATABASE_POOL_SIZE; i++)
+  {
+    if (pool->readers[i] == db)
+      return &pool->statements[i + 1];
+  }
+  return NULL;
+}
+
+/**
+ * It returns a prepared statement for the SQL, from the cache of the connection if it has one that is not already
+ * running. A statement still running, because the query is issued again from its own callback, is left alone and a
+ * new one is prepared and finalized after use. When the cache is full, the least recently used statement is evicted.
+ * SQL holding more than one statement is not cached, since only the first one is run.
+ *
+ * @param statements The statement cache of the connection.
+ * @param db The connection.
+ * @param sql The query.
+ * @param ret Where the result of sqlite3_prepare_v3 is written.
+ *
+ * @return The statement, or NULL if the query holds no statement or could not be prepared.
+ */
+sqlite3_stmt *_prepare_statement(struct DatabaseStatementCache *statements, sqlite3 *db, const char *sql, int *ret)
+{
+  // FNV-1a
+  unsigned long hash = 14695981039346656037UL;
+  for (const char *c = sql; *c != '\0'; c++)
+  {
+    hash ^= (unsigned char)*c;
+    hash *= 1099511628211UL;
+  }
+
+  statements->clock++;
+  struct DatabaseStatement *victim = NULL;
+  int running = 0;
+  for (int i = 0; i < statements->count; i++)
+  {
+    struct DatabaseStatement *entry = &statements->entries[i];
+    if (entry->hash == hash && strcmp(entry->sql, sql) == 0)
+    {
+      if (sqlite3_stmt_busy(entry->stmt))
+      {
+        running = 1;
+        break;
+      }
+      *ret = SQLITE_OK;
+      entry->last_used = statements->clock;
+      return entry->stmt;
+    }
+    if (!sqlite3_stmt_busy(entry->stmt) && (victim == NULL || entry->last_used < victim->last_used))
+      victim = entry;
+  }
+
+  sqlite3_stmt *stmt = NULL;
+  const char *tail = NULL;
+  *ret = sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, &stmt, &tail);
+  if (*ret != SQLITE_OK || stmt == NULL || running)
+    return stmt;
+  while (isspace((unsigned char)*tail))
+    tail++;
+  if (*tail != '\0')
+    return stmt;
+
+  struct DatabaseStatement *entry;
+  if (statements->count < DATABASE_STATEMENT_CACHE_SIZE)
+  {
+    entry = &statements->entries[statements->count++];
+  }
+  else if (victim != NULL)
+  {
+    entry = victim;
+    sqlite3_finalize(entry->stmt);
+    free(entry->sql);
+  }
+  else
+  {
+    return stmt;
+  }
+  entry->sql = strdup(sql);
+  entry->hash = hash;
+  entry->stmt = stmt;
+  entry->last_used = statements->clock;
+  return stmt;
+}
+
+/**
+ * It gives back a statement returned by _prepare_statement: a cached one is reset and its bindings cleared, any other
+ * is finalized
+ *
+ * @param statements The statement cache of the connection.
+ * @param stmt The statement.
+ */
+void _release_statement(struct DatabaseStatementCache *statements, sqlite3_stmt *stmt)
+{
+  for (int i = 0; i < statements->count; i++)
+  {
+    if (statements->entries[i].stmt == stmt)
+    {
+      sqlite3_reset(stmt);
+      sqlite3_clear_bindings(stmt);
+      return;
+    }
+  }
+  sqlite3_finalize(stmt);
+}
+
+/**
+ * It finalizes the statements of a cache, which must be done before its connection is closed
+ *
+ * @param statements The statement cache.
+ */
+void _clear_statements(struct DatabaseStatementCache *statements)
+{
+  for (int i = 0; i < statements->count; i++)
+  {
+    sqlite3_finalize(statements->entries[i].stmt);
+    free(statements->entries[i].sql);
+  }
+  statements->count = 0;
+}
+
+/**
+ * It binds a value to a parameter of a statement
+ *
+ * @param stmt The statement.
+ * @param index The index of the parameter, from 1.
+ * @param value The value.
+ *
+ * @return SQLITE_OK on success.
+ */
+int _bind_value(sqlite3_stmt *stmt, int index, struct DatabaseValue value)
+{
+  switch (value.type)
+  {
+  case DATABASE_INT64:
+    return sqlite3_bind_int64(stmt, index, value.integer);
+  case DATABASE_TEXT:
+    if (value.text != NULL)
+      return sqlite3_bind_text(stmt, index, value.text, value.length, SQLITE_STATIC);
+    return sqlite3_bind_null(stmt, index);
+  default:
+    return sqlite3_bind_null(stmt, index);
+  }
+}
+
 /**
  * It returns the database pool object with the given name
  *
@@ -215,7 +621,7 @@ struct DatabasePool *get_pool(struct DatabaseManager *manager, char *name)
 {
   if (name == NULL)
     name = "default";
-  return *(struct DatabasePool **)(manager->pools.search(&manager->pools, name, strlen(name)));
+  return *(struct DatabasePool **)(manager->pools.search(&manager->pools, name, strlen(name) + 1));
 }
 
 /**
@@ -227,12 +633,12 @@ struct DatabasePool *get_pool(struct DatabaseManager *manager, char *name)
  */
 int add_pool(struct DatabaseManager *manager, char *name, struct DatabasePool *pool)
 {
-  if (manager->pools.search(&manager->pools, name, strlen(name)) != NULL)
+  if (manager->pools.search(&manager->pools, name, strlen(name) + 1) != NULL)
   {
     log_error("Database pool with name %s already exists", name);
     return (-1);
   }
-  manager->pools.insert(&manager->pools, name, strlen(name), &pool, sizeof(struct DatabasePool **));
+  manager->pools.insert(&manager->pools, name, strlen(name) + 1, &pool, sizeof(struct DatabasePool **));
   return (0);
 }
 
@@ -260,3 +666,53 @@ int connect_db(const char *uri, char *name)
 
   return pool->open(pool);
 }
+
+/**
+ * It makes an integer value to bind to a query
+ *
+ * @param value The integer.
+ *
+ * @return A struct DatabaseValue.
+ */
+struct DatabaseValue db_int64(sqlite3_int64 value)
+{
+  struct DatabaseValue result = {DATABASE_INT64, value, NULL, 0};
+  return result;
+}
+
+/**
+ * It makes a text value to bind to a query. NULL text is bound as NULL.
+ *
+ * @param value The null terminated text, which must outlive the query.
+ *
+ * @return A struct DatabaseValue.
+ */
+struct DatabaseValue db_text(const char *value)
+{
+  return db_text_len(value, -1);
+}
+
+/**
+ * It makes a text value of a known length to bind to a query. NULL text is bound as NULL.
+ *
+ * @param value The text, which must outlive the query.
+ * @param length The length of the text in bytes.
+ *
+ * @return A struct DatabaseValue.
+ */
+struct DatabaseValue db_text_len(const char *value, int length)
+{
+  struct DatabaseValue result = {DATABASE_TEXT, 0, value, length};
+  return result;
+}
+
+/**
+ * It makes a NULL value to bind to a query
+ *
+ * @return A struct DatabaseValue.
+ */
+struct DatabaseValue db_null()
+{
+  struct DatabaseValue result = {DATABASE_NULL, 0, NULL, 0};
+  return result;
+}
@@ -8,7 +8,6 @@
 #include <stdio.h>
 #include <string.h>
 
-char *node_to_json(void *node);
 
 /**
  * It creates a new directory
@@ -39,7 +38,7 @@ char *make_directory(struct HTTPServer *server, struct HTTPRequest *request)
   long *parent_id_ptr = NULL;
   if (parent_id != NULL)
   {
-    parent_id_ptr = malloc(sizeof(long));
+    parent_id_ptr = request->arena.alloc(&request->arena, sizeof(long));
     *parent_id_ptr = atol(parent_id);
     if (group->has_directory(group, *parent_id_ptr) != 1)
     {
@@ -62,7 +61,6 @@ char *make_directory(struct HTTPServer *server, struct HTTPRequest *request)
       user->id,
       group->id,
       parent_id_ptr);
-  free(parent_id_ptr);
 
   if (directory == NULL)
   {
@@ -79,12 +77,13 @@ char *make_directory(struct HTTPServer *server, struct HTTPRequest *request)
     return format_500();
   }
 
-  char *json = directory->to_json(directory);
+  struct JSONWriter json = json_response_writer(request);
+  directory->to_json(directory, &json);
   directory_free(directory);
   user_free(user);
   group_free(group);
 
-  return format_200_with_content_type(json, "application/json");
+  return format_200_with_json(request, &json);
 }
 
 /**
@@ -173,11 +172,12 @@ char *update_directory(struct HTTPServer *server, struct HTTPRequest *request)
     return format_500();
   }
 
-  char *json = directory->to_json(directory);
+  struct JSONWriter json = json_response_writer(request);
+  directory->to_json(directory, &json);
   directory_free(directory);
   user_free(user);
 
-  return format_200_with_content_type(json, "application/json");
+  return format_200_with_json(request, &json);
 }
 
 /**
@@ -217,52 +217,18 @@ char *get_directory_children(struct HTTPServer *server, struct HTTPRequest *requ
     return format_403();
   }
 
-  struct LinkedList *children = directory->get_children(directory);
-  if (children == NULL)
-  {
-    return format_500();
-  }
-  char *json = children->to_json(children, node_to_json);
+  struct JSONWriter json = json_response_writer(request);
+  int res = directory_write_children(directory, &json);
 
   user_free(user);
   directory_free(directory);
 
-  return format_200_with_content_type(json, "application/json");
-}
-
-/**
- * It takes a pointer to a node, and returns a pointer to a string that contains a JSON representation
- * of the node
- * 
- * @param node the node to be converted to json
- * 
- * @return A string representation of the node.
- */
-char *node_to_json(void *node)
-{
-  struct FNode *n = (struct FNode *)node;
-  char *fjson = NULL;
-  switch (n->type)
+  if (res != 0)
   {
-  case FDIRECTORY:
-    char *dir_js = n->node.directory->to_json(n->node.directory);
-    fjson = malloc(strlen(dir_js) + 100);
-    sprintf(fjson, "{\"node\":%s, \"type\": \"directory\"}", dir_js);
-    free(dir_js);
-    break;
-  case FFILE:
-    char *file_js = n->node.file->to_json(n->node.file);
-    fjson = malloc(strlen(file_js) + 100);
-    sprintf(fjson, "{\"node\":%s, \"type\": \"file\"}", file_js);
-    free(file_js);
-    break;
-  default:
-    fjson = malloc(3);
-    strcpy(fjson, "{}");
-    break;
+    request->discard_segments(request);
+    return format_500();
   }
-
-  return fjson;
+  return format_200_with_json(request, &json);
 }
 
 char *get_group_node_tree(struct HTTPServer *server, struct HTTPRequest *request)
@@ -291,19 +257,18 @@ char *get_group_node_tree(struct HTTPServer *server, struct HTTPRequest *request
     return format_403();
   }
 
-  struct LinkedList *children = get_root_node_by_group(group->id);
-  if (children == NULL)
-  {
-    return format_500();
-  }
-
-  char *json = children->to_json(children, node_to_json);
+  struct JSONWriter json = json_response_writer(request);
+  int res = write_root_node_by_group(group->id, &json);
 
   user_free(user);
   group_free(group);
-  linked_list_destructor(children, NULL);
 
-  return format_200_with_content_type(json, "application/json");
+  if (res != 0)
+  {
+    request->discard_segments(request);
+    return format_500();
+  }
+  return format_200_with_json(request, &json);
 }
 
 char *get_directory_info(struct HTTPServer *server, struct HTTPRequest *request)
@@ -334,10 +299,11 @@ char *get_directory_info(struct HTTPServer *server, struct HTTPRequest *request)
     return format_403();
   }
 
-  char *json = directory->to_json(directory);
+  struct JSONWriter json = json_response_writer(request);
+  directory->to_json(directory, &json);
 
   user_free(user);
   directory_free(directory);
 
-  return format_200_with_content_type(json, "application/json");
+  return format_200_with_json(request, &json);
 }
\ No newline at end of file
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 
 #include "http/controller/file_controller.h"
 #include "model/file.h"
@@ -8,6 +9,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 
 /**
  * It creates a file
@@ -24,7 +27,6 @@ char *create_file(struct HTTPServer *server, struct HTTPRequest *request)
   // char *size = request->body.search(&request->body, "size", 5);
   char *group_id = request->body.search(&request->body, "group_id", 9);
   char *directory_id = request->body.search(&request->body, "directory_id", 13);
-  char path[1024];
 
   if (name == NULL || group_id == NULL)
   {
@@ -37,56 +39,21 @@ char *create_file(struct HTTPServer *server, struct HTTPRequest *request)
     return format_401();
   }
 
-  struct Group *group = group_find_by_id(atol(group_id));
-  if (group == NULL)
-  {
-    return format_404();
-  }
-
-  if (group->is_member(group, user) != 1)
-  {
-    group_free(group);
-    user_free(user);
-    return format_403();
-  }
-
+  char *response = NULL;
   long *directory_id_ptr = NULL;
-  if (directory_id != NULL)
-  {
-    directory_id_ptr = malloc(sizeof(long));
-    *directory_id_ptr = atol(directory_id);
-    struct Directory *directory = directory_find_by_id(*directory_id_ptr);
-    if (directory == NULL || group->has_directory(group, *directory_id_ptr) != 1 || (directory->permission == READ && user->id != directory->owner_id && user->id != group->owner_id))
-    {
-      group_free(group);
-      user_free(user);
-      directory_free(directory);
-      return format_403(); // The user is not allowed to create a file in the directory
-    }
-    sprintf(path, "%s/%s", directory->path, name);
-    directory_free(directory);
-  }
-  else
-  {
-    sprintf(path, "%s/%s", group->code, name);
-  }
-
-  struct File *file = file_find_by_name(name, group->id, directory_id_ptr);
-  if (file != NULL)
+  char *path = new_file_path(request, user, name, group_id, directory_id, &directory_id_ptr, &response);
+  user_free(user);
+  if (path == NULL)
   {
-    group_free(group);
-    user_free(user);
-    return format_409();
+    return response;
   }
 
-  char json[4096];
-  sprintf(json, "{\"path\": \"%s\"}", path);
-
-  user_free(user);
-  group_free(group);
-  free(directory_id_ptr);
+  struct JSONWriter json = json_response_writer(request);
+  json.begin_object(&json);
+  json.string_field(&json, "path", path);
+  json.end_object(&json);
 
-  return format_200_with_content_type(json, "application/json");
+  return format_200_with_json(request, &json);
 }
 
 /**
@@ -210,13 +177,14 @@ char *update_file(struct HTTPServer *server, struct HTTPRequest *request)
     return format_500();
   }
 
-  char *json = file->to_json(file);
+  struct JSONWriter json = json_response_writer(request);
+  file->to_json(file, &json);
 
   file_free(file);
   user_free(user);
   group_free(group);
 
-  return format_200_with_content_type(json, "application/json");
+  return format_200_with_json(request, &json);
 }
 
 char *get_file(struct HTTPServer *server, struct HTTPRequest *request)
@@ -257,13 +225,14 @@ char *get_file(struct HTTPServer *server, struct HTTPRequest *request)
     return format_403();
   }
 
-  char *json = file->to_json(file);
+  struct JSONWriter json = json_response_writer(request);
+  file->to_json(file, &json);
 
   file_free(file);
   user_free(user);
   group_free(group);
 
-  return format_200_with_content_type(json, "application/json");
+  return format_200_with_json(request, &json);
 }
 
 char *save_file(struct HTTPServer *server, struct HTTPRequest *request)
@@ -312,10 +281,225 @@ char *save_file(struct HTTPServer *server, struct HTTPRequest *request)
     return format_500();
   }
 
-  char *json = file->to_json(file);
+  struct JSONWriter json = json_response_writer(request);
+  file->to_json(file, &json);
 
   user_free(user);
   file_free(file);
 
-  return format_200_with_content_type(json, "application/json");
-}
\ No newline at end of file
+  return format_200_with_json(request, &json);
+}
+
+/**
+ * It streams the content of a file to a member of its group. Range requests are supported, so interrupted downloads
+ * can be resumed.
+ *
+ * @param server The server object.
+ * @param request The HTTPRequest object that contains the request information.
+ *
+ * @return A pointer to a string.
+ */
+char *download_file(struct HTTPServer *server, struct HTTPRequest *request)
+{
+  (void)server;
+  char *file_id = request->query.search(&request->query, "file_id", 8);
+  if (file_id == NULL)
+  {
+    return format_422();
+  }
+
+  struct User *user = get_user_from_request(request, NULL);
+  if (user == NULL)
+  {
+    return format_401();
+  }
+
+  struct File *file = file_find_by_id(atol(file_id));
+  if (file == NULL)
+  {
+    user_free(user);
+    return format_404();
+  }
+
+  struct Group *group = group_find_by_id(file->group_id);
+  if (group == NULL)
+  {
+    user_free(user);
+    file_free(file);
+    return format_400();
+  }
+
+  if (group->is_member(group, user) != 1)
+  {
+    user_free(user);
+    group_free(group);
+    file_free(file);
+    return format_403();
+  }
+
+  char fullpath[1024];
+  sprintf(fullpath, "%s/%s", UPLOAD_DIR, file->path);
+  int fd = open(fullpath, O_RDONLY | O_CLOEXEC);
+  char *response = fd < 0 ? NULL : serve_file(request, fd, "application/octet-stream", file->name);
+
+  file_free(file);
+  user_free(user);
+  group_free(group);
+
+  return response != NULL ? response : format_404();
+}
+
+/**
+ * It uploads a file in a single request. The body, sent with a Content-Length or in chunks, is streamed to a temporary
+ * file in the upload directory, which is renamed into place once complete, and the file is recorded.
+ *
+ * @param server The server object.
+ * @param request The HTTPRequest object that contains the request information.
+ *
+ * @return A pointer to a string.
+ */
+char *upload_file(struct HTTPServer *server, struct HTTPRequest *request)
+{
+  (void)server;
+  char *name = request->query.search(&request->query, "name", 5);
+  char *group_id = request->query.search(&request->query, "group_id", 9);
+  char *directory_id = request->query.search(&request->query, "directory_id", 13);
+
+  if (name == NULL || group_id == NULL || request->save_body == NULL)
+  {
+    return format_422();
+  }
+
+  struct User *user = get_user_from_request(request, NULL);
+  if (user == NULL)
+  {
+    return format_401();
+  }
+
+  char *response = NULL;
+  long *directory_id_ptr = NULL;
+  char *path = new_file_path(request, user, name, group_id, directory_id, &directory_id_ptr, &response);
+  if (path == NULL)
+  {
+    user_free(user);
+    return response;
+  }
+
+  // The body goes to a temporary file on the same file system, so that the rename publishing it is atomic.
+  char temppath[1024];
+  sprintf(temppath, "%s/.upload-XXXXXX", UPLOAD_DIR);
+  int fd = mkstemp(temppath);
+  long long size = fd < 0 ? -1 : request->save_body(request, fd);
+  int error = errno;
+
+  // The file is complete on disk before its name is published.
+  char fullpath[1100];
+  snprintf(fullpath, sizeof(fullpath), "%s/%s", UPLOAD_DIR, path);
+  if (size < 0)
+    response = error == EFBIG ? format_413() : format_400();
+  else if (fsync(fd) != 0)
+    response = format_500();
+  else if (renameat2(AT_FDCWD, temppath, AT_FDCWD, fullpath, RENAME_NOREPLACE) != 0)
+    response = errno == EEXIST ? format_409() : format_500();
+  if (fd >= 0)
+    close(fd);
+
+  if (response != NULL)
+  {
+    if (fd >= 0)
+      unlink(temppath); // It was not renamed into place.
+  }
+  else
+  {
+    struct File *file = file_new(name, size, user->id, atol(group_id), directory_id_ptr);
+    file->path = strdup(path);
+    if (file->save(file) != 0)
+    {
+      remove(fullpath);
+      response = format_500();
+    }
+    else
+    {
+      struct JSONWriter json = json_response_writer(request);
+      file->to_json(file, &json);
+      response = format_200_with_json(request, &json);
+    }
+    file_free(file);
+  }
+
+  user_free(user);
+
+  return response;
+}
+
+/**
+ * It checks that a user may create a file in a group, at its root or in one of its directories, and that no file there
+ * has its name yet. Every route creating a file goes through it, so they all enforce the same rules.
+ *
+ * @param request The request creating the file, whose arena holds the results.
+ * @param user The user creating the file.
+ * @param name The name of the file.
+ * @param group_id The id of the group, as sent by the client.
+ * @param directory_id The id of the directory, as sent by the client, or NULL for the root of the group.
+ * @param directory_id_ptr Set to the id of the directory, or NULL for the root of the group.
+ * @param response Set to the error response when no path is returned.
+ *
+ * @return The path of the file relative to UPLOAD_DIR, or NULL.
+ */
+char *new_file_path(struct HTTPRequest *request, struct User *user, char *name, char *group_id, char *directory_id,
+                    long **directory_id_ptr, char **response)
+{
+  *directory_id_ptr = NULL;
+  if (strchr(name, '/') != NULL || strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || strlen(name) > 255)
+  {
+    *response = format_422();
+    return NULL;
+  }
+
+  struct Group *group = group_find_by_id(atol(group_id));
+  if (group == NULL)
+  {
+    *response = format_404();
+    return NULL;
+  }
+
+  if (group->is_member(group, user) != 1)
+  {
+    group_free(group);
+    *response = format_403();
+    return NULL;
+  }
+
+  char *path;
+  if (directory_id != NULL)
+  {
+    long *id = request->arena.alloc(&request->arena, sizeof(long));
+    *id = atol(directory_id);
+    struct Directory *directory = directory_find_by_id(*id);
+    if (directory == NULL || group->has_directory(group, *id) != 1 || (directory->permission == READ && user->id != directory->owner_id && user->id != group->owner_id))
+    {
+      if (directory != NULL)
+        directory_free(directory);
+      group_free(group);
+      *response = format_403(); // The user is not allowed to create a file in the directory
+      return NULL;
+    }
+    path = request->arena.format(&request->arena, "%s/%s", directory->path, name);
+    directory_free(directory);
+    *directory_id_ptr = id;
+  }
+  else
+  {
+    path = request->arena.format(&request->arena, "%s/%s", group->code, name);
+  }
+
+  struct File *file = file_find_by_name(name, group->id, *directory_id_ptr);
+  group_free(group);
+  if (file != NULL)
+  {
+    file_free(file);
+    *response = format_409();
+    return NULL;
+  }
+  return path;
+}
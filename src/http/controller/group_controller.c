@@ -40,11 +40,12 @@ char *create_group(struct HTTPServer *server, struct HTTPRequest *request)
     return format_500();
   }
 
-  char *response = group->to_json(group);
+  struct JSONWriter json = json_response_writer(request);
+  group->to_json(group, &json);
   group_free(group);
   user_free(user);
 
-  return format_200_with_content_type(response, "application/json");
+  return format_200_with_json(request, &json);
 }
 
 char *update_group(struct HTTPServer *server, struct HTTPRequest *request)
@@ -98,10 +99,11 @@ char *update_group(struct HTTPServer *server, struct HTTPRequest *request)
     return format_500();
   }
 
-  char *response = group->to_json(group);
+  struct JSONWriter json = json_response_writer(request);
+  group->to_json(group, &json);
   group_free(group);
   user_free(user);
-  return format_200_with_content_type(response, "application/json");
+  return format_200_with_json(request, &json);
 }
 
 /**
@@ -143,12 +145,13 @@ char *get_group_members(struct HTTPServer *server, struct HTTPRequest *request)
   }
 
   struct LinkedList *members = group->get_members(group);
-  char *response = members->to_json(members, (char *(*)(void *))user->to_json);
+  struct JSONWriter json = json_response_writer(request);
+  members->to_json(members, (void (*)(void *, struct JSONWriter *))user->to_json, &json);
 
   group_free(group);
   user_free(user);
 
-  return format_200_with_content_type(response, "application/json");
+  return format_200_with_json(request, &json);
 }
 
 /**
@@ -244,12 +247,13 @@ char *join_group(struct HTTPServer *server, struct HTTPRequest *request)
     return format_500();
   }
 
-  char *response = group->to_json(group);
+  struct JSONWriter json = json_response_writer(request);
+  group->to_json(group, &json);
 
   group_free(group);
   user_free(user);
 
-  return format_200_with_content_type(response, "application/json");
+  return format_200_with_json(request, &json);
 }
 
 /**
@@ -375,9 +379,13 @@ char *get_my_groups(struct HTTPServer *server, struct HTTPRequest *request)
     return format_401();
   }
 
-  struct LinkedList *groups = group_find_by_member(user->id);
-  char *response = groups->to_json(groups, (char *(*)(void *))group_to_json);
+  struct JSONWriter json = json_response_writer(request);
+  int res = group_write_by_member(user->id, &json);
   user_free(user);
-  linked_list_destructor(groups, (void (*)(void *))group_free);
-  return format_200_with_content_type(response, "application/json");
+  if (res != 0)
+  {
+    request->discard_segments(request);
+    return format_500();
+  }
+  return format_200_with_json(request, &json);
 }
\ No newline at end of file
@@ -0,0 +1,425 @@
+#define _GNU_SOURCE
+
+#include "http/controller/upload_controller.h"
+#include "http/controller/file_controller.h"
+#include "model/upload.h"
+#include "model/file.h"
+#include "http/helper/helper.h"
+#include "setting.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+/* Private methods prototype */
+
+struct Upload *_find_own_upload(char *upload_id, struct User *user, char **response);
+int _append_part(int out, int in, size_t size);
+
+/**
+ * It starts a multipart upload. The parts are then sent with upload_part, in any order and in parallel, and the file
+ * is created once complete_upload is called.
+ *
+ * @param server The server object.
+ * @param request The HTTPRequest object that contains the request information.
+ *
+ * @return A pointer to a string.
+ */
+char *initiate_upload(struct HTTPServer *server, struct HTTPRequest *request)
+{
+  (void)server;
+  char *name = request->body.search(&request->body, "name", 5);
+  char *group_id = request->body.search(&request->body, "group_id", 9);
+  char *directory_id = request->body.search(&request->body, "directory_id", 13);
+
+  if (name == NULL || group_id == NULL)
+  {
+    return format_422();
+  }
+
+  struct User *user = get_user_from_request(request, NULL);
+  if (user == NULL)
+  {
+    return format_401();
+  }
+
+  char *response = NULL;
+  long *directory_id_ptr = NULL;
+  char *path = new_file_path(request, user, name, group_id, directory_id, &directory_id_ptr, &response);
+  if (path == NULL)
+  {
+    user_free(user);
+    return response;
+  }
+
+  struct Upload *upload = upload_new(name, path, user->id, atol(group_id), directory_id_ptr);
+  if (upload->save(upload) != 0)
+  {
+    response = format_500();
+  }
+  else
+  {
+    struct JSONWriter json = json_response_writer(request);
+    upload->to_json(upload, &json);
+    response = format_200_with_json(request, &json);
+  }
+
+  upload_free(upload);
+  user_free(user);
+
+  return response;
+}
+
+/**
+ * It receives one part of a multipart upload. The body is streamed to a temporary file next to the other parts and
+ * renamed into place once complete, so a part sent again after a failure replaces the previous attempt.
+ *
+ * @param server The server object.
+ * @param request The HTTPRequest object that contains the request information.
+ *
+ * @return A pointer to a string.
+ */
+char *upload_part(struct HTTPServer *server, struct HTTPRequest *request)
+{
+  (void)server;
+  char *upload_id = request->query.search(&request->query, "upload_id", 10);
+  char *part_number = request->query.search(&request->query, "part_number", 12);
+
+  char *end = NULL;
+  long number = part_number == NULL ? 0 : strtol(part_number, &end, 10);
+  if (upload_id == NULL || part_number == NULL || *end != '\0' || number < 1 || number > UPLOAD_MAX_PARTS ||
+      request->save_body == NULL)
+  {
+    return format_422();
+  }
+
+  struct User *user = get_user_from_request(request, NULL);
+  if (user == NULL)
+  {
+    return format_401();
+  }
+
+  char *response = NULL;
+  struct Upload *upload = _find_own_upload(upload_id, user, &response);
+  if (upload == NULL)
+  {
+    user_free(user);
+    return response;
+  }
+
+  char temppath[1024];
+  sprintf(temppath, "%s/%s/%ld/.part-XXXXXX", UPLOAD_DIR, UPLOAD_PARTS_DIR, upload->id);
+  int fd = mkstemp(temppath);
+  long long size = fd < 0 ? -1 : request->save_body(request, fd);
+  int error = errno;
+  if (fd >= 0)
+    close(fd);
+
+  char partpath[1024];
+  upload->get_part_path(upload, (int)number, partpath);
+  if (size < 0 || rename(temppath, partpath) != 0)
+  {
+    response = size < 0 ? (error == EFBIG ? format_413() : format_400()) : format_500();
+    if (fd >= 0)
+      unlink(temppath); // It was not renamed into place.
+  }
+  else if (upload->save_part(upload, (int)number, size) != 0)
+  {
+    response = format_500();
+  }
+  else
+  {
+    struct JSONWriter json = json_response_writer(request);
+    json.begin_object(&json);
+    json.integer_field(&json, "part_number", number);
+    json.integer_field(&json, "size", size);
+    json.end_object(&json);
+    response = format_200_with_json(request, &json);
+  }
+
+  upload_free(upload);
+  user_free(user);
+
+  return response;
+}
+
+/**
+ * It lists the parts of a multipart upload received so far, so that an interrupted client knows which parts it still
+ * has to send.
+ *
+ * @param server The server object.
+ * @param request The HTTPRequest object that contains the request information.
+ *
+ * @return A pointer to a string.
+ */
+char *list_upload_parts(struct HTTPServer *server, struct HTTPRequest *request)
+{
+  (void)server;
+  char *upload_id = request->query.search(&request->query, "upload_id", 10);
+  if (upload_id == NULL)
+  {
+    return format_422();
+  }
+
+  struct User *user = get_user_from_request(request, NULL);
+  if (user == NULL)
+  {
+    return format_401();
+  }
+
+  char *response = NULL;
+  struct Upload *upload = _find_own_upload(upload_id, user, &response);
+  if (upload == NULL)
+  {
+    user_free(user);
+    return response;
+  }
+
+  struct LinkedList *parts = upload->get_parts(upload);
+  if (parts == NULL)
+  {
+    response = format_500();
+  }
+  else
+  {
+    struct JSONWriter json = json_response_writer(request);
+    json.begin_object(&json);
+    json.key(&json, "upload");
+    upload->to_json(upload, &json);
+    json.key(&json, "parts");
+    parts->to_json(parts, (void (*)(void *, struct JSONWriter *))upload_part_to_json, &json);
+    json.end_object(&json);
+    response = format_200_with_json(request, &json);
+    linked_list_destructor(parts, NULL);
+    free(parts);
+  }
+
+  upload_free(upload);
+  user_free(user);
+
+  return response;
+}
+
+/**
+ * It completes a multipart upload. The parts, which must be numbered from 1 without gaps, are concatenated into a
+ * temporary file with copy_file_range, so that the data never goes through user space, and the file is renamed into
+ * place and recorded.
+ *
+ * @param server The server object.
+ * @param request The HTTPRequest object that contains the request information.
+ *
+ * @return A pointer to a string.
+ */
+char *complete_upload(struct HTTPServer *server, struct HTTPRequest *request)
+{
+  (void)server;
+  char *upload_id = request->body.search(&request->body, "upload_id", 10);
+  if (upload_id == NULL)
+  {
+    return format_422();
+  }
+
+  struct User *user = get_user_from_request(request, NULL);
+  if (user == NULL)
+  {
+    return format_401();
+  }
+
+  char *response = NULL;
+  struct Upload *upload = _find_own_upload(upload_id, user, &response);
+  if (upload == NULL)
+  {
+    user_free(user);
+    return response;
+  }
+
+  struct LinkedList *parts = upload->get_parts(upload);
+  if (parts == NULL)
+  {
+    upload_free(upload);
+    user_free(user);
+    return format_500();
+  }
+
+  // Parts are listed in order, so the numbers are contiguous if the last one is the count.
+  struct UploadPart *last = parts->retrieve(parts, parts->length - 1);
+  if (last == NULL || last->part_number != parts->length)
+  {
+    linked_list_destructor(parts, NULL);
+    free(parts);
+    upload_free(upload);
+    user_free(user);
+    return format_400();
+  }
+
+  char temppath[1024];
+  sprintf(temppath, "%s/.upload-XXXXXX", UPLOAD_DIR);
+  int fd = mkstemp(temppath);
+  long size = 0;
+  for (struct Node *node = parts->head; fd >= 0 && node != NULL && response == NULL; node = node->next)
+  {
+    struct UploadPart *part = node->data;
+    char partpath[1024];
+    upload->get_part_path(upload, part->part_number, partpath);
+    int part_fd = open(partpath, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (part_fd < 0 || fstat(part_fd, &st) != 0)
+      response = format_500();
+    else if (st.st_size != part->size)
+      response = format_409(); // The part is being sent again
+    else if (_append_part(fd, part_fd, st.st_size) != 0)
+      response = format_500();
+    else
+      size += st.st_size;
+    if (part_fd >= 0)
+      close(part_fd);
+  }
+  if (fd < 0 || (response == NULL && fsync(fd) != 0))
+    response = format_500();
+  if (fd >= 0)
+    close(fd);
+
+  char fullpath[1100];
+  snprintf(fullpath, sizeof(fullpath), "%s/%s", UPLOAD_DIR, upload->path);
+  if (response == NULL && renameat2(AT_FDCWD, temppath, AT_FDCWD, fullpath, RENAME_NOREPLACE) != 0)
+    response = errno == EEXIST ? format_409() : format_500();
+
+  if (response != NULL)
+  {
+    // The parts are kept, so the upload can be completed again.
+    if (fd >= 0)
+      unlink(temppath); // It was not renamed into place.
+  }
+  else
+  {
+    long *directory_id = upload->directory_id != 0 ? &upload->directory_id : NULL;
+    struct File *file = file_new(upload->name, size, user->id, upload->group_id, directory_id);
+    file->path = strdup(upload->path);
+    if (file->save(file) != 0)
+    {
+      remove(fullpath);
+      response = format_500();
+    }
+    else
+    {
+      upload->remove(upload);
+      struct JSONWriter json = json_response_writer(request);
+      file->to_json(file, &json);
+      response = format_200_with_json(request, &json);
+    }
+    file_free(file);
+  }
+
+  linked_list_destructor(parts, NULL);
+  free(parts);
+  upload_free(upload);
+  user_free(user);
+
+  return response;
+}
+
+/**
+ * It aborts a multipart upload and deletes the parts received so far.
+ *
+ * @param server The server object.
+ * @param request The HTTPRequest object that contains the request information.
+ *
+ * @return A pointer to a string.
+ */
+char *abort_upload(struct HTTPServer *server, struct HTTPRequest *request)
+{
+  (void)server;
+  char *upload_id = request->body.search(&request->body, "upload_id", 10);
+  if (upload_id == NULL)
+  {
+    return format_422();
+  }
+
+  struct User *user = get_user_from_request(request, NULL);
+  if (user == NULL)
+  {
+    return format_401();
+  }
+
+  char *response = NULL;
+  struct Upload *upload = _find_own_upload(upload_id, user, &response);
+  if (upload == NULL)
+  {
+    user_free(user);
+    return response;
+  }
+
+  response = upload->remove(upload) != 0 ? format_500() : format_200();
+
+  upload_free(upload);
+  user_free(user);
+
+  return response;
+}
+
+/* Private methods implementation */
+
+/**
+ * It finds a multipart upload started by the user
+ *
+ * @param upload_id The id of the upload, as sent by the client.
+ * @param user The user making the request.
+ * @param response Set to the error response when the upload is not returned.
+ *
+ * @return A pointer to a struct Upload, or NULL.
+ */
+struct Upload *_find_own_upload(char *upload_id, struct User *user, char **response)
+{
+  struct Upload *upload = upload_find_by_id(atol(upload_id));
+  if (upload == NULL)
+  {
+    *response = format_404();
+    return NULL;
+  }
+
+  if (upload->owner_id != user->id)
+  {
+    upload_free(upload);
+    *response = format_403();
+    return NULL;
+  }
+
+  return upload;
+}
+
+/**
+ * It appends a part to the file being assembled. copy_file_range lets the file system share or copy the blocks in the
+ * kernel; sendfile is used where it is not supported, e.g. across file systems.
+ *
+ * @param out The file being assembled.
+ * @param in The part.
+ * @param size The size of the part.
+ *
+ * @return 0 on success, -1 otherwise.
+ */
+int _append_part(int out, int in, size_t size)
+{
+  int use_copy_file_range = 1;
+  while (size > 0)
+  {
+    ssize_t n = use_copy_file_range ? copy_file_range(in, NULL, out, NULL, size, 0) : sendfile(out, in, NULL, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && use_copy_file_range &&
+        (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP))
+    {
+      use_copy_file_range = 0;
+      continue;
+    }
+    if (n <= 0)
+      return -1;
+    size -= n;
+  }
+
+  return 0;
+}
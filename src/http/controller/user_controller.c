@@ -43,14 +43,17 @@ char *login(struct HTTPServer *server, struct HTTPRequest *request)
   struct Session *session = session_new(user->id, NULL);
   session->save(session);
 
-  char *response = malloc(100);
   size_t length = 0;
   char *encoded_token = base64_encode((unsigned char *)session->token, TOKEN_LENGTH, &length);
-  sprintf(response, "{\"token\": \"%.*s\"}", (int)length, encoded_token);
+  struct JSONWriter json = json_response_writer(request);
+  json.begin_object(&json);
+  json.string_field(&json, "token", request->arena.copy(&request->arena, encoded_token, length)); // Not NUL terminated
+  json.end_object(&json);
+  free(encoded_token);
 
   session_free(session);
   user_free(user);
-  return format_200_with_content_type(response, "application/json");
+  return format_200_with_json(request, &json);
 }
 
 /**
@@ -112,9 +115,10 @@ char *get_me_info(struct HTTPServer *server, struct HTTPRequest *request)
     return format_401();
   }
 
-  char *response = user->to_json(user);
+  struct JSONWriter json = json_response_writer(request);
+  user->to_json(user, &json);
   user_free(user);
-  return format_200_with_content_type(response, "application/json");
+  return format_200_with_json(request, &json);
 }
 
 char *get_user_info(struct HTTPServer *server, struct HTTPRequest *request)
@@ -128,9 +132,10 @@ char *get_user_info(struct HTTPServer *server, struct HTTPRequest *request)
   if (user == NULL)
     return format_404();
   
-  char *res = user->to_json(user);
+  struct JSONWriter json = json_response_writer(request);
+  user->to_json(user, &json);
   user_free(user);
-  return format_200_with_content_type(res, "application/json");
+  return format_200_with_json(request, &json);
 }
 
 char *logout(struct HTTPServer *server, struct HTTPRequest *request)
@@ -1,6 +1,7 @@
 
 #include "http/helper/helper.h"
 #include "model/session.h"
+#include "model/session_cache.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -20,108 +21,152 @@ static int mod_table[] = {0, 2, 1};
 
 uint32_t base64_chars_strchr(char chr);
 void build_decoding_table();
+void _append_json_chunk(void *request, char *data, size_t length);
 
 char *format_404()
 {
   return "HTTP/1.1 404 Not Found\r\n"
-         "Connection: close\r\n"
          "Content-Length: 0\r\n\r\n";
 }
 
 char *format_403()
 {
   return "HTTP/1.1 403 Forbidden\r\n"
-         "Connection: close\r\n"
          "Content-Length: 0\r\n\r\n";
 }
 
 char *format_401()
 {
   return "HTTP/1.1 401 Unauthorized\r\n"
-         "Connection: close\r\n"
          "Content-Length: 0\r\n\r\n";
 }
 
 char *format_400()
 {
   return "HTTP/1.1 400 Bad Request\r\n"
-         "Connection: close\r\n"
          "Content-Length: 0\r\n\r\n";
 }
 
 char *format_500()
 {
   return "HTTP/1.1 500 Internal Server Error\r\n"
-         "Connection: close\r\n"
          "Content-Length: 0\r\n\r\n";
 }
 
 char *format_501()
 {
   return "HTTP/1.1 501 Not Implemented\r\n"
-         "Connection: close\r\n"
          "Content-Length: 0\r\n\r\n";
 }
 
 char *format_505()
 {
   return "HTTP/1.1 505 HTTP Version Not Supported\r\n"
-         "Connection: close\r\n"
          "Content-Length: 0\r\n\r\n";
 }
 
 char *format_422()
 {
   return "HTTP/1.1 422 Unprocessable Entity\r\n"
-         "Connection: close\r\n"
+         "Content-Length: 0\r\n\r\n";
+}
+
+char *format_413()
+{
+  return "HTTP/1.1 413 Payload Too Large\r\n"
          "Content-Length: 0\r\n\r\n";
 }
 
 char *format_409()
 {
   return "HTTP/1.1 409 Conflict\r\n"
-         "Connection: close\r\n"
          "Content-Length: 0\r\n\r\n";
 }
 
 char *format_200()
 {
   return "HTTP/1.1 200 OK\r\n"
-         "Connection: close\r\n"
          "Content-Length: 0\r\n\r\n";
 }
 
-char *format_200_with_content(char *content)
+/**
+ * It answers with an HTML page. Only the head is formatted, the page is sent from where it is.
+ *
+ * @param request The request answered; the head is built in its arena and the page appended to its segments.
+ * @param content The page, which must live as long as the request.
+ *
+ * @return The head of the response.
+ */
+char *format_200_with_content(struct HTTPRequest *request, char *content)
 {
-  char *response = malloc(strlen(content) + 100);
-  sprintf(response, "HTTP/1.1 200 OK\r\n"
-                    "Connection: close\r\n"
-                    "Content-Length: %ld\r\n"
-                    "Content-Type: text/html\r\n\r\n%s\r\n",
-          strlen(content), content);
-  return response;
+  return format_200_with_content_type(request, content, "text/html");
 }
 
-char *format_200_with_content_type(char *content, char *content_type)
+/**
+ * It answers with a body of the given media type. Only the head is formatted, the body is sent from where it is.
+ *
+ * @param request The request answered; the head is built in its arena and the body appended to its segments.
+ * @param content The body, which must live as long as the request.
+ * @param content_type The media type of the body.
+ *
+ * @return The head of the response.
+ */
+char *format_200_with_content_type(struct HTTPRequest *request, char *content, char *content_type)
+{
+  size_t length = strlen(content);
+  request->append_data(request, content, length);
+  return request->arena.format(&request->arena, "HTTP/1.1 200 OK\r\n"
+                                                "Content-Length: %zu\r\n"
+                                                "Content-Type: %s\r\n\r\n",
+                               length, content_type);
+}
+
+/**
+ * It answers with a body of the given media type, announcing the given length
+ *
+ * @param request The request answered; the head is built in its arena and the body appended to its segments.
+ * @param content The body, which must live as long as the request.
+ * @param content_type The media type of the body.
+ * @param content_length The length announced.
+ *
+ * @return The head of the response.
+ */
+char *format_200_with_content_type_and_length(struct HTTPRequest *request, char *content, char *content_type, int content_length)
+{
+  request->append_data(request, content, strlen(content));
+  return request->arena.format(&request->arena, "HTTP/1.1 200 OK\r\n"
+                                                "Content-Length: %d\r\n"
+                                                "Content-Type: %s\r\n\r\n",
+                               content_length, content_type);
+}
+
+/**
+ * It creates a writer whose chunks become the body of the response, in the order they fill up
+ *
+ * @param request The request answered.
+ *
+ * @return The writer.
+ */
+struct JSONWriter json_response_writer(struct HTTPRequest *request)
 {
-  char *response = malloc(strlen(content) + 100);
-  sprintf(response, "HTTP/1.1 200 OK\r\n"
-                    "Connection: close\r\n"
-                    "Content-Length: %ld\r\n"
-                    "Content-Type: %s\r\n\r\n%s\r\n",
-          strlen(content), content_type, content);
-  return response;
+  return json_writer_constructor(&request->arena, _append_json_chunk, request);
 }
 
-char *format_200_with_content_type_and_length(char *content, char *content_type, int content_length)
+/**
+ * It answers with the JSON written with a writer from json_response_writer, which is finished here
+ *
+ * @param request The request answered.
+ * @param json The writer.
+ *
+ * @return The head of the response.
+ */
+char *format_200_with_json(struct HTTPRequest *request, struct JSONWriter *json)
 {
-  char *response = malloc(strlen(content) + 100);
-  sprintf(response, "HTTP/1.1 200 OK\r\n"
-                    "Connection: close\r\n"
-                    "Content-Length: %d\r\n"
-                    "Content-Type: %s\r\n\r\n%s\r\n",
-          content_length, content_type, content);
-  return response;
+  json->finish(json);
+  return request->arena.format(&request->arena, "HTTP/1.1 200 OK\r\n"
+                                                "Content-Length: %zu\r\n"
+                                                "Content-Type: application/json\r\n\r\n",
+                               json->length);
 }
 
 struct User *get_user_from_request(struct HTTPRequest *request, char *token)
@@ -133,13 +178,14 @@ struct User *get_user_from_request(struct HTTPRequest *request, char *token)
     return NULL;
   }
 
-  char *token_type = strtok(auth_header, " ");
+  char *save_ptr = NULL;
+  char *token_type = strtok_r(auth_header, " ", &save_ptr);
   if (strcmp(token_type, "Basic") != 0)
   {
     return NULL;
   }
 
-  char *token_value = strtok(NULL, "\0");
+  char *token_value = strtok_r(NULL, "\0", &save_ptr);
   if (token_value == NULL)
   {
     return NULL;
@@ -152,16 +198,36 @@ struct User *get_user_from_request(struct HTTPRequest *request, char *token)
   {
     return NULL;
   }
-  char decoded_token[length + 1];
+  if (length > SESSION_TOKEN_LENGTH)
+  {
+    free(_decoded_token);
+    return NULL;
+  }
+  char decoded_token[SESSION_TOKEN_LENGTH + 1];
   memcpy(decoded_token, _decoded_token, length);
   decoded_token[length] = '\0';
+  free(_decoded_token);
   if (token != NULL)
   {
     strcpy(token, (char *)decoded_token);
   }
+
+  struct User *user = malloc(sizeof(struct User));
+  unsigned long generation;
+  switch (session_cache_get(decoded_token, user, &generation))
+  {
+  case SESSION_CACHE_HIT:
+    return user;
+  case SESSION_CACHE_REJECTED:
+    free(user);
+    return NULL;
+  }
+
   struct Session *session = session_find_by_token((char *)decoded_token);
   if (session == NULL)
   {
+    session_cache_put(decoded_token, NULL, 0, generation);
+    free(user);
     return NULL;
   }
 
@@ -170,11 +236,20 @@ struct User *get_user_from_request(struct HTTPRequest *request, char *token)
   {
     session->delete_session(session);
     session_free(session);
+    free(user);
     return NULL;
   }
-  struct User *user = malloc(sizeof(struct User));
-  memcpy(user, session->get_user(session), sizeof(struct User));
+  struct User *session_user = session->get_user(session);
+  if (session_user == NULL)
+  {
+    session_free(session);
+    free(user);
+    return NULL;
+  }
+  memcpy(user, session_user, sizeof(struct User));
+  time_t session_expiry = session->expires_at(session);
   session_free(session);
+  session_cache_put(decoded_token, user, session_expiry, generation);
 
   return user;
 }
@@ -309,3 +384,15 @@ void base64_cleanup()
 {
   free(decoding_table);
 }
+
+/**
+ * It appends a chunk of JSON to the body of the response
+ *
+ * @param request The request answered.
+ * @param data The chunk, in the arena of the request.
+ * @param length The bytes of the chunk in use.
+ */
+void _append_json_chunk(void *request, char *data, size_t length)
+{
+  ((struct HTTPRequest *)request)->append_data(request, data, length);
+}
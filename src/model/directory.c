@@ -18,11 +18,14 @@ struct User *directory_get_owner(struct Directory *directory);
 struct Group *directory_get_group(struct Directory *directory);
 struct Directory *directory_get_parent(struct Directory *directory);
 struct LinkedList *directory_get_children(struct Directory *directory);
-char *directory_json(struct Directory *directory);
+void directory_json(struct Directory *directory, struct JSONWriter *writer);
 
 void _get_directory_callback(sqlite3_stmt *res, void *arg);
 void _get_directories_callback(sqlite3_stmt *res, void *arg);
 void _get_files_callback(sqlite3_stmt *res, void *arg);
+void _write_directories_callback(sqlite3_stmt *res, void *arg);
+void _write_files_callback(sqlite3_stmt *res, void *arg);
+int _write_nodes(long id, const char *directories_query, const char *files_query, struct JSONWriter *writer);
 struct LinkedList *_directory_get_children_by_id(long id);
 void _file_node_free(void *node);
 
@@ -58,6 +61,8 @@ directory_new(const char *name, long user_id, long group_id, long *parent_id)
   directory->to_json = directory_json;
 
   directory->path = NULL;
+  directory->created_at = NULL;
+  directory->updated_at = NULL;
   directory->_group = NULL;
   directory->_children = NULL;
   directory->_parent = NULL;
@@ -105,7 +110,7 @@ struct Directory *directory_find_by_id(long id)
   char query[] = "SELECT * FROM directories WHERE id = ?";
 
   struct Directory *directory = NULL;
-  int res = pool->exec(pool, _get_directory_callback, &directory, query, 1, convert_long_to_string(id));
+  int res = pool->exec(pool, _get_directory_callback, &directory, query, 1, db_int64(id));
 
   if (res != SQLITE_OK)
   {
@@ -164,11 +169,11 @@ int directory_save(struct Directory *directory)
 
   char query[] = "INSERT INTO directories (name, owner_id, group_id, parent_id, path, permission) VALUES (?, ?, ?, ?, ?, ?)";
 
-  int res = pool->exec(pool, NULL, NULL, query, 6, directory->name,
-                       convert_long_to_string(directory->owner_id), convert_long_to_string(directory->group_id),
-                       directory->parent_id != 0 ? convert_long_to_string(directory->parent_id) : NULL,
-                       directory->path,
-                       convert_int_to_string(directory->permission));
+  int res = pool->exec(pool, NULL, NULL, query, 6, db_text(directory->name),
+                       db_int64(directory->owner_id), db_int64(directory->group_id),
+                       directory->parent_id != 0 ? db_int64(directory->parent_id) : db_null(),
+                       db_text(directory->path),
+                       db_int64(directory->permission));
 
   if (res != SQLITE_OK)
   {
@@ -177,8 +182,9 @@ int directory_save(struct Directory *directory)
     return -1;
   }
   char *current_time = get_current_time();
-  directory->id = sqlite3_last_insert_rowid(pool->db);
+  directory->id = pool->last_insert_rowid(pool);
   directory->created_at = strdup(current_time);
+  directory->updated_at = strdup(current_time);
 
   free(current_time);
   
@@ -202,7 +208,7 @@ int directory_remove(struct Directory *directory)
 
   char query[] = "DELETE FROM directories WHERE id = ?";
 
-  int res = pool->exec(pool, NULL, NULL, query, 1, convert_long_to_string(directory->id));
+  int res = pool->exec(pool, NULL, NULL, query, 1, db_int64(directory->id));
 
   if (res != SQLITE_OK)
   {
@@ -236,8 +242,8 @@ int directory_update(struct Directory *directory)
 
   int res =
       pool->exec(pool, NULL, NULL, query, 2,
-                 convert_int_to_string(directory->permission),
-                 convert_long_to_string(directory->id));
+                 db_int64(directory->permission),
+                 db_int64(directory->id));
 
   if (res != SQLITE_OK)
   {
@@ -319,19 +325,24 @@ struct LinkedList *directory_get_children(struct Directory *directory)
 }
 
 /**
- * It takes a `struct Directory` and returns a JSON string representation of it
+ * It writes a `struct Directory` as a json object
  *
  * @param directory The directory object
+ * @param writer The writer the JSON is written with.
  */
-char *directory_json(struct Directory *directory)
+void directory_json(struct Directory *directory, struct JSONWriter *writer)
 {
-  char *json = malloc(4096);
-  sprintf(json, "{\"id\":%ld,\"name\":\"%s\",\"path\":\"%s\",\"owner_id\":%ld,\"parent_id\":%ld,\"permission\":%d,\"group_id\":%ld,\"created_at\":\"%s\",\"updated_at\":\"%s\"}",
-          directory->id, directory->name, directory->path, directory->owner_id,
-          directory->parent_id != 0 ? directory->parent_id : 0, directory->permission,
-          directory->group_id, directory->created_at, directory->updated_at);
-
-  return json;
+  writer->begin_object(writer);
+  writer->integer_field(writer, "id", directory->id);
+  writer->string_field(writer, "name", directory->name);
+  writer->string_field(writer, "path", directory->path);
+  writer->integer_field(writer, "owner_id", directory->owner_id);
+  writer->integer_field(writer, "parent_id", directory->parent_id);
+  writer->integer_field(writer, "permission", directory->permission);
+  writer->integer_field(writer, "group_id", directory->group_id);
+  writer->string_field(writer, "created_at", directory->created_at);
+  writer->string_field(writer, "updated_at", directory->updated_at);
+  writer->end_object(writer);
 }
 
 struct LinkedList *get_root_node_by_group(long group_id)
@@ -346,14 +357,14 @@ struct LinkedList *get_root_node_by_group(long group_id)
   struct LinkedList result = linked_list_constructor();
   struct LinkedList *res_ptr = malloc(sizeof(struct LinkedList));
   *res_ptr = result;
-  int res = pool->exec(pool, _get_directories_callback, res_ptr, query, 1, convert_long_to_string(group_id));
+  int res = pool->exec(pool, _get_directories_callback, res_ptr, query, 1, db_int64(group_id));
   if (res != SQLITE_OK)
   {
     return NULL;
   }
 
   query = "SELECT * FROM files WHERE directory_id IS NULL AND group_id = ?";
-  res = pool->exec(pool, _get_files_callback, res_ptr, query, 1, convert_long_to_string(group_id));
+  res = pool->exec(pool, _get_files_callback, res_ptr, query, 1, db_int64(group_id));
   if (res != SQLITE_OK)
   {
     return NULL;
@@ -362,6 +373,61 @@ struct LinkedList *get_root_node_by_group(long group_id)
   return res_ptr;
 }
 
+/**
+ * It writes the nodes of a group that are in no directory as a json array, as fnode_to_json writes each node
+ *
+ * @param group_id The id of the group.
+ * @param writer The writer the JSON is written with.
+ *
+ * @return 0 on success, -1 otherwise.
+ */
+int write_root_node_by_group(long group_id, struct JSONWriter *writer)
+{
+  return _write_nodes(group_id, "SELECT * FROM directories WHERE parent_id IS NULL AND group_id = ?",
+                      "SELECT * FROM files WHERE directory_id IS NULL AND group_id = ?", writer);
+}
+
+/**
+ * It writes the children of a directory as a json array, as fnode_to_json writes each node
+ *
+ * @param directory The directory.
+ * @param writer The writer the JSON is written with.
+ *
+ * @return 0 on success, -1 otherwise.
+ */
+int directory_write_children(struct Directory *directory, struct JSONWriter *writer)
+{
+  return _write_nodes(directory->id, "SELECT * FROM directories WHERE parent_id = ? ORDER BY updated_at DESC",
+                      "SELECT * FROM files WHERE directory_id = ? ORDER BY updated_at DESC", writer);
+}
+
+/**
+ * It writes a file node as a json object, the directory or file under "node" and its kind under "type"
+ *
+ * @param node The node.
+ * @param writer The writer the JSON is written with.
+ */
+void fnode_to_json(struct FNode *node, struct JSONWriter *writer)
+{
+  writer->begin_object(writer);
+  switch (node->type)
+  {
+  case FDIRECTORY:
+    writer->key(writer, "node");
+    directory_json(node->node.directory, writer);
+    writer->string_field(writer, "type", "directory");
+    break;
+  case FFILE:
+    writer->key(writer, "node");
+    file_to_json(node->node.file, writer);
+    writer->string_field(writer, "type", "file");
+    break;
+  default:
+    break;
+  }
+  writer->end_object(writer);
+}
+
 /**
  * It frees the memory allocated to a file node
  * 
@@ -443,7 +509,7 @@ void _get_files_callback(sqlite3_stmt *res, void *arg)
   if (sqlite3_column_type(res, 5) != SQLITE_NULL)
   {
     directory_id = malloc(sizeof(long));
-    *directory_id = sqlite3_column_int64(res, 3);
+    *directory_id = sqlite3_column_int64(res, 5);
   }
   struct File *file = file_new(
       (char *)sqlite3_column_text(res, 1), // name
@@ -485,7 +551,7 @@ struct LinkedList *_directory_get_children_by_id(long id)
   *list_ptr = list;
   char *query = "SELECT * FROM directories WHERE parent_id = ? ORDER BY updated_at DESC";
 
-  int res = pool->exec(pool, _get_directories_callback, list_ptr, query, 1, convert_long_to_string(id));
+  int res = pool->exec(pool, _get_directories_callback, list_ptr, query, 1, db_int64(id));
 
   if (res != SQLITE_OK)
   {
@@ -493,11 +559,86 @@ struct LinkedList *_directory_get_children_by_id(long id)
   }
 
   query = "SELECT * FROM files WHERE directory_id = ? ORDER BY updated_at DESC";
-  res = pool->exec(pool, _get_files_callback, list_ptr, query, 1, convert_long_to_string(id));
+  res = pool->exec(pool, _get_files_callback, list_ptr, query, 1, db_int64(id));
 
   if (res != SQLITE_OK)
   {
     return NULL;
   }
   return list_ptr;
+}
+
+/**
+ * It writes the directories then the files one query each finds as a json array. The nodes are written from the
+ * columns of their rows while the rows are read, so they are neither listed nor copied.
+ *
+ * @param id The parameter of both queries.
+ * @param directories_query The query of the directories.
+ * @param files_query The query of the files.
+ * @param writer The writer the JSON is written with.
+ *
+ * @return 0 on success, -1 otherwise.
+ */
+int _write_nodes(long id, const char *directories_query, const char *files_query, struct JSONWriter *writer)
+{
+  struct DatabaseManager *manager = get_db_manager();
+  struct DatabasePool *pool = manager->get_pool(manager, NULL);
+  if (pool == NULL)
+    return -1;
+
+  writer->begin_array(writer);
+  int res = pool->exec(pool, _write_directories_callback, writer, directories_query, 1, db_int64(id));
+  if (res == SQLITE_OK)
+    res = pool->exec(pool, _write_files_callback, writer, files_query, 1, db_int64(id));
+  writer->end_array(writer);
+
+  return res == SQLITE_OK ? 0 : -1;
+}
+
+/**
+ * It writes a directory row as a json node
+ *
+ * @param res The row.
+ * @param arg The writer.
+ */
+void _write_directories_callback(sqlite3_stmt *res, void *arg)
+{
+  struct Directory directory = {
+      .id = sqlite3_column_int64(res, 0),
+      .name = (char *)sqlite3_column_text(res, 1),
+      .permission = sqlite3_column_int(res, 2),
+      .path = (char *)sqlite3_column_text(res, 3),
+      .parent_id = sqlite3_column_int64(res, 4),
+      .group_id = sqlite3_column_int64(res, 5),
+      .owner_id = sqlite3_column_int64(res, 6),
+      .created_at = (char *)sqlite3_column_text(res, 7),
+      .updated_at = (char *)sqlite3_column_text(res, 8),
+  };
+  struct FNode node = {.node.directory = &directory, .type = FDIRECTORY};
+  fnode_to_json(&node, arg);
+}
+
+/**
+ * It writes a file row as a json node
+ *
+ * @param res The row.
+ * @param arg The writer.
+ */
+void _write_files_callback(sqlite3_stmt *res, void *arg)
+{
+  struct File file = {
+      .id = sqlite3_column_int64(res, 0),
+      .name = (char *)sqlite3_column_text(res, 1),
+      .size = sqlite3_column_int64(res, 2),
+      .permission = sqlite3_column_int(res, 3),
+      .path = (char *)sqlite3_column_text(res, 4),
+      .directory_id = sqlite3_column_int64(res, 5),
+      .group_id = sqlite3_column_int64(res, 6),
+      .owner_id = sqlite3_column_int64(res, 7),
+      .modified_by = sqlite3_column_int64(res, 8),
+      .created_at = (char *)sqlite3_column_text(res, 9),
+      .updated_at = (char *)sqlite3_column_text(res, 10),
+  };
+  struct FNode node = {.node.file = &file, .type = FFILE};
+  fnode_to_json(&node, arg);
 }
\ No newline at end of file
@@ -104,7 +104,7 @@ struct File *file_find_by_id(long id)
   char query[] = "SELECT * FROM files WHERE id = ?";
 
   struct File *file = NULL;
-  int res = pool->exec(pool, _get_file_callback, &file, query, 1, convert_long_to_string(id));
+  int res = pool->exec(pool, _get_file_callback, &file, query, 1, db_int64(id));
 
   if (res != SQLITE_OK)
   {
@@ -115,18 +115,26 @@ struct File *file_find_by_id(long id)
 }
 
 /**
- * It takes a pointer to a File struct and returns a JSON string representation of the struct
+ * It writes a file as a json object
  *
  * @param file The file object to be converted to JSON
- *
- * @return A JSON string.
+ * @param writer The writer the JSON is written with.
  */
-char *file_to_json(struct File *file)
+void file_to_json(struct File *file, struct JSONWriter *writer)
 {
-  char *json = malloc(4096);
-  sprintf(json, "{\"id\":%ld,\"name\":\"%s\",\"size\":%ld,\"permission\":%d,\"path\":\"%s\",\"directory_id\":%ld,\"group_id\":%ld,\"owner_id\":%ld,\"modified_by\":%ld,\"created_at\":\"%s\",\"updated_at\":\"%s\"}",
-          file->id, file->name, file->size, file->permission, file->path, file->directory_id, file->group_id, file->owner_id, file->modified_by, file->created_at, file->updated_at);
-  return json;
+  writer->begin_object(writer);
+  writer->integer_field(writer, "id", file->id);
+  writer->string_field(writer, "name", file->name);
+  writer->integer_field(writer, "size", file->size);
+  writer->integer_field(writer, "permission", file->permission);
+  writer->string_field(writer, "path", file->path);
+  writer->integer_field(writer, "directory_id", file->directory_id);
+  writer->integer_field(writer, "group_id", file->group_id);
+  writer->integer_field(writer, "owner_id", file->owner_id);
+  writer->integer_field(writer, "modified_by", file->modified_by);
+  writer->string_field(writer, "created_at", file->created_at);
+  writer->string_field(writer, "updated_at", file->updated_at);
+  writer->end_object(writer);
 }
 
 /**
@@ -152,18 +160,18 @@ int file_save(struct File *file)
 
   char query[] = "INSERT INTO files (name, size, permission, path, directory_id, group_id, owner_id, modified_by) VALUES (?, ?, ?, ?, ?, ?, ?, ?)";
 
-  int res = pool->exec(pool, NULL, NULL, query, 8, file->name,
-                       convert_long_to_string(file->size), convert_long_to_string(file->permission),
-                       file->path, file->directory_id != 0 ? convert_long_to_string(file->directory_id) : NULL,
-                       convert_long_to_string(file->group_id), convert_long_to_string(file->owner_id),
-                       convert_long_to_string(file->modified_by));
+  int res = pool->exec(pool, NULL, NULL, query, 8, db_text(file->name),
+                       db_int64(file->size), db_int64(file->permission),
+                       db_text(file->path), file->directory_id != 0 ? db_int64(file->directory_id) : db_null(),
+                       db_int64(file->group_id), db_int64(file->owner_id),
+                       db_int64(file->modified_by));
 
   if (res != SQLITE_OK)
   {
     return -1;
   }
   char *current_time = get_current_time();
-  file->id = sqlite3_last_insert_rowid(pool->db);
+  file->id = pool->last_insert_rowid(pool);
   file->created_at = strdup(current_time);
   file->updated_at = strdup(current_time);
 
@@ -189,7 +197,7 @@ int file_remove(struct File *file)
 
   char query[] = "DELETE FROM files WHERE id = ?";
 
-  int res = pool->exec(pool, NULL, NULL, query, 1, convert_long_to_string(file->id));
+  int res = pool->exec(pool, NULL, NULL, query, 1, db_int64(file->id));
 
   if (res != SQLITE_OK)
   {
@@ -223,10 +231,10 @@ int file_update(struct File *file)
   char query[] = "UPDATE files SET size = ?, permission = ?, modified_by = ?, updated_at = CURRENT_TIMESTAMP WHERE id = ?";
 
   int res = pool->exec(pool, NULL, NULL, query, 4,
-                       convert_long_to_string(file->size),
-                       convert_long_to_string(file->permission),
-                       convert_long_to_string(file->modified_by),
-                       convert_long_to_string(file->id));
+                       db_int64(file->size),
+                       db_int64(file->permission),
+                       db_int64(file->modified_by),
+                       db_int64(file->id));
 
   if (res != SQLITE_OK)
   {
@@ -319,7 +327,7 @@ void _get_file_callback(sqlite3_stmt *res, void *arg)
   if (sqlite3_column_type(res, 5) != SQLITE_NULL)
   {
     directory_id = malloc(sizeof(long));
-    *directory_id = sqlite3_column_int64(res, 3);
+    *directory_id = sqlite3_column_int64(res, 5);
   }
   struct File *file = file_new(
       (char *)sqlite3_column_text(res, 1), // name
@@ -345,10 +353,10 @@ struct File *file_find_by_name(const char *name, long group_id, long *directory_
   if (pool == NULL)
     return NULL;
 
-  char query[] = "SELECT * FROM files WHERE name = ? AND group_id = ? AND directory_id = ?";
+  char query[] = "SELECT * FROM files WHERE name = ? AND group_id = ? AND directory_id IS ?";
   struct File *file = NULL;
-  int res = pool->exec(pool, _get_file_callback, &file, query, 3, name, convert_long_to_string(group_id),
-                       directory_id != NULL ? convert_long_to_string(*directory_id) : NULL);
+  int res = pool->exec(pool, _get_file_callback, &file, query, 3, db_text(name), db_int64(group_id),
+                       directory_id != NULL ? db_int64(*directory_id) : db_null());
 
   if (res != SQLITE_OK)
   {
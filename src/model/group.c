@@ -24,6 +24,7 @@ void _retreive_code_callback(sqlite3_stmt *res, void *arg);
 void _get_group_members_callback(sqlite3_stmt *res, void *arg);
 void _get_group_callback(sqlite3_stmt *res, void *arg);
 void _get_groups_callback(sqlite3_stmt *res, void *arg);
+void _write_groups_callback(sqlite3_stmt *res, void *arg);
 void _checkable_callback(sqlite3_stmt *res, void *arg);
 
 /* Public member functions */
@@ -54,6 +55,8 @@ group_new(char *name, char *description, char *avatar, long owner_id)
 
   group->owner_id = owner_id;
   group->status = 1;
+  group->code = NULL;
+  group->created_at = NULL;
 
   group->save = group_save;
   group->update = group_update;
@@ -83,6 +86,7 @@ void group_free(struct Group *group)
   free(group->description);
   free(group->avatar);
   free(group->code);
+  free(group->created_at);
   if (group->_owner != NULL)
     user_free(group->_owner);
   if (group->_members != NULL)
@@ -105,18 +109,19 @@ int group_save(struct Group *group)
     return -1;
 
   char *query = "INSERT INTO groups (name, description, avatar, owner_id, status) VALUES (?, ?, ?, ?, ?)";
-  int res = pool->exec(pool, NULL, NULL, query, 5, group->name, group->description, group->avatar, convert_long_to_string(group->owner_id), convert_int_to_string(group->status));
+  int res = pool->exec(pool, NULL, NULL, query, 5, db_text(group->name), db_text(group->description), db_text(group->avatar), db_int64(group->owner_id), db_int64(group->status));
 
   if (res != SQLITE_OK)
     return -1;
 
-  int last_id = sqlite3_last_insert_rowid(pool->db);
+  int last_id = pool->last_insert_rowid(pool);
   group->id = last_id;
+  group->created_at = get_current_time();
 
   // retrive the group code
   query = "SELECT code FROM groups WHERE id = ?";
   char *code = NULL;
-  res = pool->exec(pool, _retreive_code_callback, &code, query, 1, convert_long_to_string(group->id));
+  res = pool->exec(pool, _retreive_code_callback, &code, query, 1, db_int64(group->id));
 
   if (res != SQLITE_OK)
     return -1;
@@ -130,18 +135,18 @@ int group_save(struct Group *group)
   {
     free(folder);
     query = "DELETE FROM groups WHERE id = ?";
-    pool->exec(pool, NULL, NULL, query, 1, convert_long_to_string(group->id));
+    pool->exec(pool, NULL, NULL, query, 1, db_int64(group->id));
     return -1;
   }
   free(folder);
 
   query = "INSERT INTO group_members (group_id, user_id) VALUES (?, ?)";
-  res = pool->exec(pool, NULL, NULL, query, 2, convert_long_to_string(group->id), convert_long_to_string(group->owner_id));
+  res = pool->exec(pool, NULL, NULL, query, 2, db_int64(group->id), db_int64(group->owner_id));
   if (res != SQLITE_OK)
   {
     // rollback
     query = "DELETE FROM groups WHERE id = ?";
-    pool->exec(pool, NULL, NULL, query, 1, convert_long_to_string(group->id));
+    pool->exec(pool, NULL, NULL, query, 1, db_int64(group->id));
     return -1;
   }
   return 0;
@@ -163,7 +168,7 @@ int group_update(struct Group *group)
     return -1;
 
   char *query = "UPDATE groups SET name = ?, description = ?, avatar = ?, status = ? WHERE id = ?";
-  int res = pool->exec(pool, NULL, NULL, query, 5, group->name, group->description, group->avatar, convert_int_to_string(group->status), convert_long_to_string(group->id));
+  int res = pool->exec(pool, NULL, NULL, query, 5, db_text(group->name), db_text(group->description), db_text(group->avatar), db_int64(group->status), db_int64(group->id));
 
   if (res != SQLITE_OK)
     return -1;
@@ -187,7 +192,7 @@ int group_remove(struct Group *group)
 
   char *query = "DELETE FROM groups WHERE id = ?";
 
-  int res = pool->exec(pool, NULL, NULL, query, 1, convert_long_to_string(group->id));
+  int res = pool->exec(pool, NULL, NULL, query, 1, db_int64(group->id));
 
   if (res != SQLITE_OK)
     return -1;
@@ -218,7 +223,7 @@ int group_add_member(struct Group *group, struct User *user)
 
   char *query = "INSERT INTO group_members (group_id, user_id) VALUES (?, ?)";
 
-  int res = pool->exec(pool, NULL, NULL, query, 2, convert_long_to_string(group->id), convert_long_to_string(user->id));
+  int res = pool->exec(pool, NULL, NULL, query, 2, db_int64(group->id), db_int64(user->id));
 
   if (res != SQLITE_OK)
     return -1;
@@ -243,7 +248,7 @@ int group_leave(struct Group *group, struct User *user)
 
   char *query = "DELETE FROM group_members WHERE group_id = ? AND user_id = ?";
 
-  int res = pool->exec(pool, NULL, NULL, query, 2, convert_long_to_string(group->id), convert_long_to_string(user->id));
+  int res = pool->exec(pool, NULL, NULL, query, 2, db_int64(group->id), db_int64(user->id));
 
   if (res != SQLITE_OK)
     return -1;
@@ -292,7 +297,7 @@ struct LinkedList *group_get_members(struct Group *group)
   struct LinkedList members = linked_list_constructor();
   struct LinkedList *members_ptr = malloc(sizeof(struct LinkedList));
   *members_ptr = members;
-  int res = pool->exec(pool, _get_group_members_callback, members_ptr, query, 1, convert_long_to_string(group->id));
+  int res = pool->exec(pool, _get_group_members_callback, members_ptr, query, 1, db_int64(group->id));
 
   if (res != SQLITE_OK)
     return NULL;
@@ -302,17 +307,23 @@ struct LinkedList *group_get_members(struct Group *group)
 }
 
 /**
- * It takes a group and returns a JSON string representing that group
+ * It writes a group as a json object
  *
  * @param group The group to convert to JSON.
- *
- * @return A JSON string representing the group.
+ * @param writer The writer the JSON is written with.
  */
-char *group_to_json(struct Group *group)
+void group_to_json(struct Group *group, struct JSONWriter *writer)
 {
-  char *json = malloc(sizeof(char) * 4096);
-  sprintf(json, "{\"id\":%ld,\"name\":\"%s\",\"description\":\"%s\",\"avatar\":\"%s\",\"status\":%d,\"code\": \"%s\",\"owner_id\":%ld,\"created_at\":\"%s\"}", group->id, group->name, group->description != NULL ? group->description : "", group->avatar != NULL ? group->avatar : "", group->status, group->code, group->owner_id, group->created_at);
-  return json;
+  writer->begin_object(writer);
+  writer->integer_field(writer, "id", group->id);
+  writer->string_field(writer, "name", group->name);
+  writer->string_field(writer, "description", group->description != NULL ? group->description : "");
+  writer->string_field(writer, "avatar", group->avatar != NULL ? group->avatar : "");
+  writer->integer_field(writer, "status", group->status);
+  writer->string_field(writer, "code", group->code);
+  writer->integer_field(writer, "owner_id", group->owner_id);
+  writer->string_field(writer, "created_at", group->created_at);
+  writer->end_object(writer);
 }
 
 /**
@@ -333,7 +344,7 @@ int group_is_member(struct Group *group, struct User *user)
   char *query = "SELECT 1 FROM group_members WHERE group_id = ? AND user_id = ?";
   int is_member = 0;
 
-  int res = pool->exec(pool, _checkable_callback, &is_member, query, 2, convert_long_to_string(group->id), convert_long_to_string(user->id));
+  int res = pool->exec(pool, _checkable_callback, &is_member, query, 2, db_int64(group->id), db_int64(user->id));
 
   if (res != SQLITE_OK)
     return -1;
@@ -351,7 +362,7 @@ int group_has_directory(struct Group *group, long directory_id)
   char *query = "SELECT 1 FROM directories WHERE group_id = ? AND id = ?";
   int has_dir = 0;
 
-  int res = pool->exec(pool, _checkable_callback, &has_dir, query, 2, convert_long_to_string(group->id), convert_long_to_string(directory_id));
+  int res = pool->exec(pool, _checkable_callback, &has_dir, query, 2, db_int64(group->id), db_int64(directory_id));
 
   if (res != SQLITE_OK)
     return -1;
@@ -415,6 +426,27 @@ void _get_groups_callback(sqlite3_stmt *res, void *arg)
   groups->insert(groups, 0, group, sizeof(struct Group));
 }
 
+/**
+ * It writes a group row as a json object
+ *
+ * @param res The row.
+ * @param arg The writer.
+ */
+void _write_groups_callback(sqlite3_stmt *res, void *arg)
+{
+  struct Group group = {
+      .id = sqlite3_column_int64(res, 0),
+      .name = (char *)sqlite3_column_text(res, 1),
+      .description = (char *)sqlite3_column_text(res, 2),
+      .avatar = (char *)sqlite3_column_text(res, 3),
+      .status = sqlite3_column_int(res, 4),
+      .owner_id = sqlite3_column_int64(res, 5),
+      .code = (char *)sqlite3_column_text(res, 6),
+      .created_at = (char *)sqlite3_column_text(res, 7),
+  };
+  group_to_json(&group, arg);
+}
+
 /**
  * It checks if a table
  * exists
@@ -448,7 +480,7 @@ struct Group *group_find_by_id(long id)
 
   struct Group *group = NULL;
 
-  int res = pool->exec(pool, _get_group_callback, &group, query, 1, convert_long_to_string(id));
+  int res = pool->exec(pool, _get_group_callback, &group, query, 1, db_int64(id));
 
   if (res != SQLITE_OK)
     return NULL;
@@ -474,7 +506,7 @@ struct Group *group_find_by_name(char *name)
 
   struct Group *group = NULL;
 
-  int res = pool->exec(pool, _get_group_callback, &group, query, 1, name);
+  int res = pool->exec(pool, _get_group_callback, &group, query, 1, db_text(name));
 
   if (res != SQLITE_OK)
     return NULL;
@@ -500,7 +532,7 @@ struct Group *group_find_by_code(char *code)
 
   struct Group *group = NULL;
 
-  int res = pool->exec(pool, _get_group_callback, &group, query, 1, code);
+  int res = pool->exec(pool, _get_group_callback, &group, query, 1, db_text(code));
 
   if (res != SQLITE_OK)
     return NULL;
@@ -520,10 +552,35 @@ struct LinkedList *group_find_by_member(long member_id)
   struct LinkedList groups = linked_list_constructor();
   struct LinkedList *groups_ptr = malloc(sizeof(struct LinkedList));
   *groups_ptr = groups;
-  int res = pool->exec(pool, _get_groups_callback, groups_ptr, query, 1, convert_long_to_string(member_id));
+  int res = pool->exec(pool, _get_groups_callback, groups_ptr, query, 1, db_int64(member_id));
 
   if (res != SQLITE_OK)
     return NULL;
 
   return groups_ptr;
+}
+
+/**
+ * It writes the groups a user is a member of as a json array. Each group is written from the columns of its row while
+ * the row is read, so the groups are neither listed nor copied.
+ *
+ * @param member_id The id of the user.
+ * @param writer The writer the JSON is written with.
+ *
+ * @return 0 on success, -1 otherwise.
+ */
+int group_write_by_member(long member_id, struct JSONWriter *writer)
+{
+  struct DatabaseManager *manager = get_db_manager();
+  struct DatabasePool *pool = manager->get_pool(manager, NULL);
+  if (pool == NULL)
+    return -1;
+
+  char *query = "SELECT groups.id, name, description, avatar, status, owner_id, code, groups.created_at FROM groups INNER JOIN group_members ON groups.id = group_members.group_id WHERE user_id = ?";
+
+  writer->begin_array(writer);
+  int res = pool->exec(pool, _write_groups_callback, writer, query, 1, db_int64(member_id));
+  writer->end_array(writer);
+
+  return res == SQLITE_OK ? 0 : -1;
 }
\ No newline at end of file
@@ -1,4 +1,7 @@
+#define _GNU_SOURCE
+
 #include "model/session.h"
+#include "model/session_cache.h"
 #include "database/db.h"
 #include "logger/logger.h"
 #include "utils/helper.h"
@@ -11,6 +14,7 @@ int save_session(struct Session *session);
 int delete_session(struct Session *session);
 struct User *get_user(struct Session *session);
 int is_expired(struct Session *session);
+time_t expires_at(struct Session *session);
 
 void _find_session_callback(sqlite3_stmt *res, void *arg);
 void _find_token_callback(sqlite3_stmt *res, void *arg);
@@ -30,13 +34,14 @@ struct Session *session_new(long user_id, char *token)
 {
   struct Session *session = (struct Session *)malloc(sizeof(struct Session));
   session->user_id = user_id;
-  if (token != NULL)
-    session->token = strdup(token);
+  session->token = token != NULL ? strdup(token) : NULL;
+  session->created_at = NULL;
   session->save = save_session;
   session->_user = NULL;
   session->delete_session = delete_session;
   session->get_user = get_user;
   session->is_expired = is_expired;
+  session->expires_at = expires_at;
   return session;
 }
 
@@ -50,6 +55,7 @@ void session_free(struct Session *session)
   if (session->_user != NULL)
     user_free(session->_user);
   free(session->token);
+  free(session->created_at);
   free(session);
 }
 
@@ -71,24 +77,27 @@ int save_session(struct Session *session)
   }
 
   char *sql = "INSERT INTO sessions (user_id) VALUES (?)";
-  int res = pool->exec(pool, NULL, NULL, sql, 1, convert_long_to_string(session->user_id));
+  int res = pool->exec(pool, NULL, NULL, sql, 1, db_int64(session->user_id));
   if (res != SQLITE_OK)
   {
     return -1;
   }
-  int last_id = sqlite3_last_insert_rowid(pool->db);
+  int last_id = pool->last_insert_rowid(pool);
   session->id = last_id;
 
   // retrive token from table
   sql = "SELECT token FROM sessions WHERE id = ?";
   char *token = NULL;
-  res = pool->exec(pool, _find_token_callback, &token, sql, 1, convert_long_to_string(session->id));
+  res = pool->exec(pool, _find_token_callback, &token, sql, 1, db_int64(session->id));
 
   if (res != SQLITE_OK)
   {
     return -1;
   }
   session->token = token;
+  // forget a lookup of the same token that found nothing
+  if (token != NULL)
+    session_cache_invalidate_token(token);
 
   return 0;
 }
@@ -111,11 +120,13 @@ int delete_session(struct Session *session)
   }
 
   char *sql = "DELETE FROM sessions WHERE id = ?";
-  int res = pool->exec(pool, NULL, NULL, sql, 1, convert_long_to_string(session->id));
+  int res = pool->exec(pool, NULL, NULL, sql, 1, db_int64(session->id));
   if (res != SQLITE_OK)
   {
     return -1;
   }
+  if (session->token != NULL)
+    session_cache_invalidate_token(session->token);
   return res;
 }
 
@@ -145,23 +156,30 @@ struct User *get_user(struct Session *session)
 }
 
 /**
- * If the session was created more than 30 days ago, it's expired
+ * If the session has outlived SESSION_LIFETIME, it's expired
  *
  * @param session The session object
  *
- * @return The function is_expired() returns 1 if the session has been created more than 30 days ago, and 0 otherwise.
+ * @return The function is_expired() returns 1 if the session has expired, and 0 otherwise.
  */
 int is_expired(struct Session *session)
 {
-  if (session->created_at == NULL)
-    return 0;
-  time_t now = time(NULL);
-  time_t created_at = time_from_string(session->created_at);
-  double seconds = difftime(now, created_at);
-  if (seconds > 30 * 24 * 60 && 0 > 1)
-    return 1;
-  else
+  time_t expiration = session->expires_at(session);
+  return expiration != 0 && expiration <= time(NULL);
+}
+
+/**
+ * It returns the time the session expires, SESSION_LIFETIME after its creation
+ *
+ * @param session The session object
+ *
+ * @return The time in seconds since the Epoch, or 0 if the session never expires.
+ */
+time_t expires_at(struct Session *session)
+{
+  if (session->created_at == NULL || SESSION_LIFETIME == 0)
     return 0;
+  return time_from_string(session->created_at) + SESSION_LIFETIME;
 }
 
 /**
@@ -183,7 +201,7 @@ struct Session *session_find_by_id(long id)
 
   char *sql = "SELECT id, user_id, token, created_at FROM sessions WHERE id = ?";
   struct Session *session = NULL;
-  int res = pool->exec(pool, _find_session_callback, &session, sql, 1, convert_long_to_string(id));
+  int res = pool->exec(pool, _find_session_callback, &session, sql, 1, db_int64(id));
   if (res != SQLITE_OK)
   {
     return NULL;
@@ -210,7 +228,7 @@ struct Session *session_find_by_token(char *token)
 
   char *sql = "SELECT id, user_id, token, created_at FROM sessions WHERE token = ?";
   struct Session *session = NULL;
-  int res = pool->exec(pool, _find_session_callback, &session, sql, 1, token);
+  int res = pool->exec(pool, _find_session_callback, &session, sql, 1, db_text(token));
   if (res != SQLITE_OK)
   {
     return NULL;
@@ -241,7 +259,7 @@ void _find_token_callback(sqlite3_stmt *res, void *arg)
 }
 
 /**
- * It takes a string in the format "YYYY-MM-DD HH:MM:SS" and returns a time_t value
+ * It takes a string in the format "YYYY-MM-DD HH:MM:SS", in UTC, and returns a time_t value
  *
  * @param str The string to convert to a time_t.
  *
@@ -249,7 +267,7 @@ void _find_token_callback(sqlite3_stmt *res, void *arg)
  */
 time_t time_from_string(char *str)
 {
-  struct tm tm;
+  struct tm tm = {0};
   strptime(str, "%Y-%m-%d %H:%M:%S", &tm);
-  return mktime(&tm);
+  return timegm(&tm); // SQLite writes CURRENT_TIMESTAMP in UTC
 }
@@ -0,0 +1,232 @@
+#include "model/session_cache.h"
+
+#include <pthread.h>
+#include <string.h>
+
+/**
+ * A part of the cache with its own lock. Tokens go in one of SESSION_CACHE_WAYS consecutive slots picked by their
+ * hash, so a lookup reads at most that many entries and the cache never grows. The generation changes whenever an
+ * entry is invalidated, so that a session read from the database before a logout cannot be cached after it.
+ */
+struct SessionCacheShard
+{
+  pthread_mutex_t lock;
+  unsigned long generation;
+  struct SessionCacheEntry entries[SESSION_CACHE_SHARD_SIZE];
+};
+
+/* Private variables */
+
+static struct SessionCacheShard shards[SESSION_CACHE_SHARDS];
+static pthread_once_t shards_once = PTHREAD_ONCE_INIT;
+
+/* Private methods prototype */
+
+void _init_shards(void);
+unsigned long _hash_token(const char *token);
+struct SessionCacheShard *_get_shard(unsigned long hash);
+int _first_slot(unsigned long hash);
+struct SessionCacheEntry *_find_entry(struct SessionCacheShard *shard, const char *token, unsigned long hash);
+
+/* Public methods implements */
+
+/**
+ * It looks a token up in the cache
+ *
+ * @param token The session token.
+ * @param user Where the user of the session is copied on a hit.
+ * @param generation Where the generation to pass to session_cache_put is written on a miss.
+ *
+ * @return SESSION_CACHE_HIT, SESSION_CACHE_REJECTED or SESSION_CACHE_MISS.
+ */
+int session_cache_get(const char *token, struct User *user, unsigned long *generation)
+{
+  pthread_once(&shards_once, _init_shards);
+  unsigned long hash = _hash_token(token);
+  struct SessionCacheShard *shard = _get_shard(hash);
+  time_t now = time(NULL);
+  int result = SESSION_CACHE_MISS;
+
+  pthread_mutex_lock(&shard->lock);
+  struct SessionCacheEntry *entry = _find_entry(shard, token, hash);
+  if (entry != NULL && entry->expires_at > now)
+  {
+    result = entry->found ? SESSION_CACHE_HIT : SESSION_CACHE_REJECTED;
+    if (entry->found)
+      memcpy(user, &entry->user, sizeof(struct User));
+  }
+  *generation = shard->generation;
+  pthread_mutex_unlock(&shard->lock);
+
+  return result;
+}
+
+/**
+ * It caches the result of looking a token up in the database. Nothing is cached if an entry was invalidated since
+ * the lookup missed, as the result may already be stale. A session is trusted for SESSION_CACHE_TTL seconds, but never
+ * past its own expiry.
+ *
+ * @param token The session token.
+ * @param user The user of the session, or NULL if no session has this token.
+ * @param session_expiry When the session expires, 0 if it never does or there is no session.
+ * @param generation The generation session_cache_get returned on the miss.
+ */
+void session_cache_put(const char *token, struct User *user, time_t session_expiry, unsigned long generation)
+{
+  time_t now = time(NULL);
+  time_t expires_at = now + (user != NULL ? SESSION_CACHE_TTL : SESSION_CACHE_NEGATIVE_TTL);
+  if (user != NULL && session_expiry != 0 && session_expiry < expires_at)
+    expires_at = session_expiry;
+  if (strlen(token) > SESSION_TOKEN_LENGTH || expires_at <= now)
+    return;
+  pthread_once(&shards_once, _init_shards);
+  unsigned long hash = _hash_token(token);
+  struct SessionCacheShard *shard = _get_shard(hash);
+
+  pthread_mutex_lock(&shard->lock);
+  if (shard->generation != generation)
+  {
+    pthread_mutex_unlock(&shard->lock);
+    return;
+  }
+  struct SessionCacheEntry *entry = _find_entry(shard, token, hash);
+  if (entry == NULL)
+  {
+    // a free or expired slot, or else the one closest to expiring
+    int first = _first_slot(hash);
+    entry = &shard->entries[first];
+    for (int i = first; i < first + SESSION_CACHE_WAYS; i++)
+    {
+      if (shard->entries[i].token[0] == '\0' || shard->entries[i].expires_at <= now)
+      {
+        entry = &shard->entries[i];
+        break;
+      }
+      if (shard->entries[i].expires_at < entry->expires_at)
+        entry = &shard->entries[i];
+    }
+  }
+  strcpy(entry->token, token);
+  entry->hash = hash;
+  entry->found = user != NULL;
+  if (user != NULL)
+    memcpy(&entry->user, user, sizeof(struct User));
+  entry->expires_at = expires_at;
+  pthread_mutex_unlock(&shard->lock);
+}
+
+/**
+ * It drops a token from the cache, once its session is deleted or created
+ *
+ * @param token The session token.
+ */
+void session_cache_invalidate_token(const char *token)
+{
+  pthread_once(&shards_once, _init_shards);
+  unsigned long hash = _hash_token(token);
+  struct SessionCacheShard *shard = _get_shard(hash);
+
+  pthread_mutex_lock(&shard->lock);
+  struct SessionCacheEntry *entry = _find_entry(shard, token, hash);
+  if (entry != NULL)
+    entry->token[0] = '\0';
+  shard->generation++;
+  pthread_mutex_unlock(&shard->lock);
+}
+
+/**
+ * It drops every session of a user from the cache, once the user is updated or deleted
+ *
+ * @param user_id The id of the user.
+ */
+void session_cache_invalidate_user(long user_id)
+{
+  pthread_once(&shards_once, _init_shards);
+  for (int i = 0; i < SESSION_CACHE_SHARDS; i++)
+  {
+    struct SessionCacheShard *shard = &shards[i];
+    pthread_mutex_lock(&shard->lock);
+    for (int j = 0; j < SESSION_CACHE_SHARD_SIZE; j++)
+    {
+      if (shard->entries[j].found && shard->entries[j].user.id == user_id)
+        shard->entries[j].token[0] = '\0';
+    }
+    shard->generation++;
+    pthread_mutex_unlock(&shard->lock);
+  }
+}
+
+/* Private methods implements */
+
+void _init_shards(void)
+{
+  for (int i = 0; i < SESSION_CACHE_SHARDS; i++)
+  {
+    pthread_mutex_init(&shards[i].lock, NULL);
+    shards[i].generation = 0;
+    memset(shards[i].entries, 0, sizeof(shards[i].entries));
+  }
+}
+
+/**
+ * It hashes a token, with FNV-1a
+ *
+ * @param token The token.
+ *
+ * @return The hash.
+ */
+unsigned long _hash_token(const char *token)
+{
+  unsigned long hash = 14695981039346656037UL;
+  for (const char *c = token; *c != '\0'; c++)
+  {
+    hash ^= (unsigned char)*c;
+    hash *= 1099511628211UL;
+  }
+  return hash;
+}
+
+/**
+ * It returns the shard a token belongs to
+ *
+ * @param hash The hash of the token.
+ *
+ * @return A pointer to a struct SessionCacheShard.
+ */
+struct SessionCacheShard *_get_shard(unsigned long hash)
+{
+  return &shards[hash % SESSION_CACHE_SHARDS];
+}
+
+/**
+ * It returns the first of the SESSION_CACHE_WAYS slots a token may go in, in its shard
+ *
+ * @param hash The hash of the token.
+ *
+ * @return The index of the slot.
+ */
+int _first_slot(unsigned long hash)
+{
+  return (hash / SESSION_CACHE_SHARDS) % (SESSION_CACHE_SHARD_SIZE / SESSION_CACHE_WAYS) * SESSION_CACHE_WAYS;
+}
+
+/**
+ * It finds the entry of a token in its shard, whose lock must be held
+ *
+ * @param shard The shard of the token.
+ * @param token The token.
+ * @param hash The hash of the token.
+ *
+ * @return The entry, expired or not, or NULL if the token is not cached.
+ */
+struct SessionCacheEntry *_find_entry(struct SessionCacheShard *shard, const char *token, unsigned long hash)
+{
+  int first = _first_slot(hash);
+  for (int i = first; i < first + SESSION_CACHE_WAYS; i++)
+  {
+    struct SessionCacheEntry *entry = &shard->entries[i];
+    if (entry->token[0] != '\0' && entry->hash == hash && strcmp(entry->token, token) == 0)
+      return entry;
+  }
+  return NULL;
+}
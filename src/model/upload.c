@@ -0,0 +1,315 @@
+#include "model/upload.h"
+#include "database/db.h"
+#include "utils/helper.h"
+#include "setting.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+
+/* Private methods prototype */
+
+int upload_save(struct Upload *upload);
+int upload_remove(struct Upload *upload);
+int upload_save_part(struct Upload *upload, int part_number, long size);
+struct LinkedList *upload_get_parts(struct Upload *upload);
+void upload_get_part_path(struct Upload *upload, int part_number, char *path);
+
+void _get_upload_callback(sqlite3_stmt *res, void *arg);
+void _get_upload_parts_callback(sqlite3_stmt *res, void *arg);
+
+/* Public methods implementation */
+
+/**
+ * It creates a new multipart upload object and returns it
+ *
+ * @param name The name of the file being uploaded.
+ * @param path The path of the file once the upload is complete, relative to the upload directory.
+ * @param user_id The user id of the user who started the upload
+ * @param group_id The group id of the file
+ * @param directory_id The id of the directory that the file goes in.
+ *
+ * @return A pointer to a struct Upload
+ */
+struct Upload *upload_new(char *name, char *path, long user_id, long group_id, long *directory_id)
+{
+  struct Upload *upload = malloc(sizeof(struct Upload));
+  upload->id = 0;
+  upload->name = strdup(name);
+  upload->path = strdup(path);
+  upload->directory_id = directory_id == NULL ? 0 : *directory_id;
+  upload->group_id = group_id;
+  upload->owner_id = user_id;
+  upload->created_at = NULL;
+
+  upload->save = upload_save;
+  upload->remove = upload_remove;
+  upload->save_part = upload_save_part;
+  upload->get_parts = upload_get_parts;
+  upload->get_part_path = upload_get_part_path;
+  upload->to_json = upload_to_json;
+
+  return upload;
+}
+
+/**
+ * It frees the memory allocated for the upload struct
+ *
+ * @param upload The upload object to free.
+ */
+void upload_free(struct Upload *upload)
+{
+  free(upload->name);
+  free(upload->path);
+  free(upload->created_at);
+  free(upload);
+}
+
+/**
+ * It finds a multipart upload by its id and returns it.
+ *
+ * @param id The id of the upload to find.
+ *
+ * @return A pointer to a struct Upload
+ */
+struct Upload *upload_find_by_id(long id)
+{
+  struct DatabaseManager *manager = get_db_manager();
+  struct DatabasePool *pool = manager->get_pool(manager, NULL);
+  if (pool == NULL)
+    return NULL;
+
+  char query[] = "SELECT * FROM uploads WHERE id = ?";
+
+  struct Upload *upload = NULL;
+  int res = pool->exec(pool, _get_upload_callback, &upload, query, 1, db_int64(id));
+
+  if (res != SQLITE_OK)
+  {
+    return NULL;
+  }
+
+  return upload;
+}
+
+/**
+ * It writes an upload as a json object
+ *
+ * @param upload The upload object to be converted to JSON
+ * @param writer The writer the JSON is written with.
+ */
+void upload_to_json(struct Upload *upload, struct JSONWriter *writer)
+{
+  writer->begin_object(writer);
+  writer->integer_field(writer, "id", upload->id);
+  writer->string_field(writer, "name", upload->name);
+  writer->string_field(writer, "path", upload->path);
+  writer->integer_field(writer, "directory_id", upload->directory_id);
+  writer->integer_field(writer, "group_id", upload->group_id);
+  writer->integer_field(writer, "owner_id", upload->owner_id);
+  writer->string_field(writer, "created_at", upload->created_at);
+  writer->end_object(writer);
+}
+
+/**
+ * It writes an upload part as a json object
+ *
+ * @param part The part to be converted to JSON
+ * @param writer The writer the JSON is written with.
+ */
+void upload_part_to_json(struct UploadPart *part, struct JSONWriter *writer)
+{
+  writer->begin_object(writer);
+  writer->integer_field(writer, "part_number", part->part_number);
+  writer->integer_field(writer, "size", part->size);
+  writer->end_object(writer);
+}
+
+/* Private methods implementation */
+
+/**
+ * It saves a multipart upload to the database and creates the directory its parts are written to
+ *
+ * @param upload The upload object to save
+ *
+ * @return 0 on success, -1 otherwise.
+ */
+int upload_save(struct Upload *upload)
+{
+  struct DatabaseManager *manager = get_db_manager();
+  struct DatabasePool *pool = manager->get_pool(manager, NULL);
+  if (pool == NULL)
+    return -1;
+
+  char query[] = "INSERT INTO uploads (name, path, directory_id, group_id, owner_id) VALUES (?, ?, ?, ?, ?)";
+
+  int res = pool->exec(pool, NULL, NULL, query, 5, db_text(upload->name), db_text(upload->path),
+                       upload->directory_id != 0 ? db_int64(upload->directory_id) : db_null(),
+                       db_int64(upload->group_id), db_int64(upload->owner_id));
+
+  if (res != SQLITE_OK)
+  {
+    return -1;
+  }
+  upload->id = pool->last_insert_rowid(pool);
+  upload->created_at = get_current_time();
+
+  char folder[1024];
+  sprintf(folder, "%s/%s", UPLOAD_DIR, UPLOAD_PARTS_DIR);
+  if (create_directory(folder) != 0 && errno != EEXIST)
+  {
+    upload->remove(upload);
+    return -1;
+  }
+  sprintf(folder, "%s/%s/%ld", UPLOAD_DIR, UPLOAD_PARTS_DIR, upload->id);
+  if (create_directory(folder) != 0 && errno != EEXIST)
+  {
+    upload->remove(upload);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * It removes a multipart upload from the database, along with its parts, and deletes the parts from disk
+ *
+ * @param upload The upload object to remove
+ *
+ * @return 0 on success, -1 otherwise.
+ */
+int upload_remove(struct Upload *upload)
+{
+  struct DatabaseManager *manager = get_db_manager();
+  struct DatabasePool *pool = manager->get_pool(manager, NULL);
+  if (pool == NULL)
+    return -1;
+
+  char query[] = "DELETE FROM uploads WHERE id = ?";
+
+  int res = pool->exec(pool, NULL, NULL, query, 1, db_int64(upload->id));
+
+  if (res != SQLITE_OK)
+  {
+    return -1;
+  }
+  // delete parts from disk
+  char folder[1024];
+  sprintf(folder, "%s/%s/%ld", UPLOAD_DIR, UPLOAD_PARTS_DIR, upload->id);
+  remove_directory(folder);
+
+  return 0;
+}
+
+/**
+ * It records a part of a multipart upload. Uploading a part again replaces it, so a client can retry a part whose
+ * upload failed.
+ *
+ * @param upload The upload object
+ * @param part_number The number of the part, from 1 to UPLOAD_MAX_PARTS
+ * @param size The size of the part
+ *
+ * @return 0 on success, -1 otherwise.
+ */
+int upload_save_part(struct Upload *upload, int part_number, long size)
+{
+  struct DatabaseManager *manager = get_db_manager();
+  struct DatabasePool *pool = manager->get_pool(manager, NULL);
+  if (pool == NULL)
+    return -1;
+
+  char query[] = "INSERT INTO upload_parts (upload_id, part_number, size) VALUES (?, ?, ?) "
+                 "ON CONFLICT (upload_id, part_number) DO UPDATE SET size = excluded.size, updated_at = CURRENT_TIMESTAMP";
+
+  int res = pool->exec(pool, NULL, NULL, query, 3, db_int64(upload->id),
+                       db_int64(part_number), db_int64(size));
+
+  if (res != SQLITE_OK)
+  {
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * It returns the parts of a multipart upload received so far, ordered by part number
+ *
+ * @param upload The upload object
+ *
+ * @return A pointer to a struct LinkedList of struct UploadPart
+ */
+struct LinkedList *upload_get_parts(struct Upload *upload)
+{
+  struct DatabaseManager *manager = get_db_manager();
+  struct DatabasePool *pool = manager->get_pool(manager, NULL);
+  if (pool == NULL)
+    return NULL;
+
+  // The callback inserts at the head, so the rows are read in reverse.
+  char query[] = "SELECT part_number, size FROM upload_parts WHERE upload_id = ? ORDER BY part_number DESC";
+
+  struct LinkedList parts = linked_list_constructor();
+  struct LinkedList *parts_ptr = malloc(sizeof(struct LinkedList));
+  *parts_ptr = parts;
+  int res = pool->exec(pool, _get_upload_parts_callback, parts_ptr, query, 1, db_int64(upload->id));
+
+  if (res != SQLITE_OK)
+  {
+    linked_list_destructor(parts_ptr, NULL);
+    free(parts_ptr);
+    return NULL;
+  }
+
+  return parts_ptr;
+}
+
+/**
+ * It writes the path of a part of a multipart upload
+ *
+ * @param upload The upload object
+ * @param part_number The number of the part
+ * @param path The buffer the path is written to, of at least 1024 bytes
+ */
+void upload_get_part_path(struct Upload *upload, int part_number, char *path)
+{
+  sprintf(path, "%s/%s/%ld/%d", UPLOAD_DIR, UPLOAD_PARTS_DIR, upload->id, part_number);
+}
+
+/**
+ * It takes the result of a query and turns it into an `Upload` object
+ *
+ * @param res The result of the query.
+ * @param arg A pointer to the variable that will hold the result.
+ */
+void _get_upload_callback(sqlite3_stmt *res, void *arg)
+{
+  long directory_id = sqlite3_column_int64(res, 3);
+  struct Upload *upload = upload_new(
+      (char *)sqlite3_column_text(res, 1), // name
+      (char *)sqlite3_column_text(res, 2), // path
+      sqlite3_column_int64(res, 5),        // user_id
+      sqlite3_column_int64(res, 4),        // group_id
+      sqlite3_column_type(res, 3) != SQLITE_NULL ? &directory_id : NULL);
+  upload->id = sqlite3_column_int64(res, 0);
+  upload->created_at = strdup((char *)sqlite3_column_text(res, 6));
+
+  *(struct Upload **)arg = upload;
+}
+
+/**
+ * It takes a row of the upload_parts table and adds it to a list
+ *
+ * @param res The result of the query.
+ * @param arg The list the part is added to.
+ */
+void _get_upload_parts_callback(sqlite3_stmt *res, void *arg)
+{
+  struct LinkedList *parts = (struct LinkedList *)arg;
+
+  struct UploadPart part;
+  part.part_number = sqlite3_column_int(res, 0);
+  part.size = sqlite3_column_int64(res, 1);
+  parts->insert(parts, 0, &part, sizeof(struct UploadPart));
+}
@@ -1,5 +1,6 @@
 
 #include "model/user.h"
+#include "model/session_cache.h"
 #include "database/db.h"
 #include "logger/logger.h"
 #include "utils/helper.h"
@@ -11,7 +12,7 @@
 int save_user(struct User *user);
 int update_user(struct User *user);
 int delete_user(struct User *user);
-char *json_user(struct User *user);
+void json_user(struct User *user, struct JSONWriter *writer);
 
 void _find_user_callback(sqlite3_stmt *res, void *arg);
 
@@ -67,12 +68,12 @@ int save_user(struct User *user)
   }
 
   char *sql = "INSERT INTO users (display_name, username, password) VALUES (?, ?, ?)";
-  int res = pool->exec(pool, NULL, NULL, sql, 3, user->display_name, user->username, user->password);
+  int res = pool->exec(pool, NULL, NULL, sql, 3, db_text(user->display_name), db_text(user->username), db_text(user->password));
   if (res != SQLITE_OK)
   {
     return -1;
   }
-  int last_id = sqlite3_last_insert_rowid(pool->db);
+  int last_id = pool->last_insert_rowid(pool);
   user->id = last_id;
   return 0;
 }
@@ -93,10 +94,11 @@ int update_user(struct User *user)
 
   char *sql = "UPDATE users SET display_name = ?, username = ?, password = ?, status = ? WHERE id = ?";
   int res = pool->exec(pool, NULL, NULL, sql, 5,
-                       user->display_name, user->username, user->password,
-                       convert_long_to_string(user->status), convert_long_to_string(user->id));
+                       db_text(user->display_name), db_text(user->username), db_text(user->password),
+                       db_int64(user->status), db_int64(user->id));
   if (res != SQLITE_OK)
     return -1;
+  session_cache_invalidate_user(user->id);
   return 0;
 }
 
@@ -115,24 +117,27 @@ int delete_user(struct User *user)
     return -1;
 
   char *sql = "DELETE FROM users WHERE id = ?";
-  int res = pool->exec(pool, NULL, NULL, sql, 1, convert_long_to_string(user->id));
+  int res = pool->exec(pool, NULL, NULL, sql, 1, db_int64(user->id));
   if (res != SQLITE_OK)
     return -1;
+  session_cache_invalidate_user(user->id);
   return 0;
 }
 
 /**
- * It takes a user struct, and returns a json string
+ * It writes a user as a json object
  *
  * @param user The user to convert to json
- *
- * @return A json string
+ * @param writer The writer the JSON is written with.
  */
-char *json_user(struct User *user)
+void json_user(struct User *user, struct JSONWriter *writer)
 {
-  char *json = (char *)malloc(1024);
-  sprintf(json, "{\"id\": %ld, \"display_name\": \"%s\", \"username\": \"%s\", \"status\": %d}", user->id, user->display_name, user->username, user->status);
-  return json;
+  writer->begin_object(writer);
+  writer->integer_field(writer, "id", user->id);
+  writer->string_field(writer, "display_name", user->display_name);
+  writer->string_field(writer, "username", user->username);
+  writer->integer_field(writer, "status", user->status);
+  writer->end_object(writer);
 }
 
 /**
@@ -151,7 +156,7 @@ struct User *user_find_by_id(long id)
 
   char *sql = "SELECT id, display_name, username, password, status FROM users WHERE id = ?";
   struct User *user = NULL;
-  int res = pool->exec(pool, _find_user_callback, &user, sql, 1, convert_long_to_string(id));
+  int res = pool->exec(pool, _find_user_callback, &user, sql, 1, db_int64(id));
 
   if (res != SQLITE_OK)
     return NULL;
@@ -167,7 +172,7 @@ struct User *user_find_by_username(const char *username)
 
   char *sql = "SELECT id, display_name, username, password, status FROM users WHERE username = ?";
   struct User *user = NULL;
-  int res = pool->exec(pool, _find_user_callback, &user, sql, 1, username);
+  int res = pool->exec(pool, _find_user_callback, &user, sql, 1, db_text(username));
 
   if (res != SQLITE_OK)
     return NULL;
@@ -1,40 +1,217 @@
 #include "networking/checksum.h"
 
-#define BUFF_SIZE 65536
-
-/* Add up checksum, return value will be filled in checksum filed in header */
-uint16_t checksum_(uint16_t len_udp,
-                   int padding, const uint16_t *temp)
-{
-  uint16_t padd = 0;
-  uint16_t word16;
-  uint64_t sum;
-  static uint8_t buff[BUFF_SIZE];
-  int i;
-  memset(buff, 0, BUFF_SIZE);
-  memcpy(buff, temp, len_udp);
-
-  // take padding into account
-  if ((padding & 1) == 1)
+#include <string.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHECKSUM_X86
+#endif
+
+/* Setting */
+#define CHECKSUM_VECTOR_ROUNDS 4096 // Vectors summed into 32-bit lanes before they are widened, so that none overflows
+
+/* Private variables */
+
+// The kernel summing a buffer, the widest the processor supports
+static uint64_t (*sum_kernel)(const uint8_t *data, size_t length);
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+/* Private methods prototype */
+
+void _pick_kernel(void);
+uint64_t _sum_scalar(const uint8_t *data, size_t length);
+uint64_t _sum_sse2(const uint8_t *data, size_t length);
+uint64_t _sum_avx2(const uint8_t *data, size_t length);
+uint16_t _fold(uint64_t sum);
+
+/* Public methods implements */
+
+void checksum_init(struct Checksum *checksum)
+{
+  checksum->sum = 0;
+  checksum->odd = 0;
+}
+
+/**
+ * It adds a buffer to a checksum. The words are summed in the byte order of the host, which RFC 1071 shows gives the
+ * same sum byte-swapped; a buffer that starts in the middle of a word is summed as if it did not, then swapped.
+ *
+ * @param checksum The checksum.
+ * @param data The buffer, of any alignment.
+ * @param length Its length.
+ */
+void checksum_update(struct Checksum *checksum, const void *data, size_t length)
+{
+  pthread_once(&kernel_once, _pick_kernel);
+  uint16_t sum = _fold(sum_kernel(data, length));
+  if (checksum->odd)
+    sum = (uint16_t)(sum << 8 | sum >> 8);
+  checksum->sum += sum;
+  checksum->odd ^= length & 1;
+}
+
+/**
+ * It finishes a checksum
+ *
+ * @param checksum The checksum.
+ *
+ * @return The one's complement of the sum of the big-endian 16-bit words, the last one padded with a zero byte.
+ */
+uint16_t checksum_final(const struct Checksum *checksum)
+{
+  return (uint16_t)~ntohs(_fold(checksum->sum));
+}
+
+/**
+ * It computes the checksum of a buffer. A packet holding its own checksum is intact if the result is 0.
+ *
+ * @param data The buffer.
+ * @param length Its length.
+ *
+ * @return The checksum, in the byte order of the host.
+ */
+uint16_t checksum_compute(const void *data, size_t length)
+{
+  struct Checksum checksum;
+  checksum_init(&checksum);
+  checksum_update(&checksum, data, length);
+  return checksum_final(&checksum);
+}
+
+/* Private methods implements */
+
+void _pick_kernel(void)
+{
+  sum_kernel = _sum_scalar;
+#ifdef CHECKSUM_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    sum_kernel = _sum_avx2;
+  else if (__builtin_cpu_supports("sse2"))
+    sum_kernel = _sum_sse2;
+#endif
+}
+
+/**
+ * It sums the 16-bit words of a buffer, 8 bytes at a time: the two halves of each 64-bit word go into a 64-bit sum,
+ * which cannot overflow for any buffer that fits in memory.
+ *
+ * @param data The buffer.
+ * @param length Its length; an odd last byte is summed as if followed by a zero.
+ *
+ * @return The sum, not folded.
+ */
+uint64_t _sum_scalar(const uint8_t *data, size_t length)
+{
+  uint64_t sum = 0;
+  for (; length >= 8; data += 8, length -= 8)
+  {
+    uint64_t word;
+    memcpy(&word, data, 8);
+    sum += (word & 0xFFFFFFFF) + (word >> 32);
+  }
+  for (; length >= 2; data += 2, length -= 2)
   {
-    padd = 1;
-    buff[len_udp] = 0;
+    uint16_t word;
+    memcpy(&word, data, 2);
+    sum += word;
   }
+  if (length == 1)
+  {
+    uint8_t last[2] = {data[0], 0};
+    uint16_t word;
+    memcpy(&word, last, 2);
+    sum += word;
+  }
+  return sum;
+}
 
-  // initialize sum to zero
-  sum = 0;
+#ifdef CHECKSUM_X86
 
-  // make 16 bit words out of every two adjacent 8 bit words and
-  // calculate the sum of all 16 bit words
-  for (i = 0; i < len_udp + padd; i = i + 2)
+/**
+ * It sums a buffer 16 bytes at a time: the 16-bit words are widened to 32-bit lanes and summed there, then the lanes
+ * are added to a 64-bit sum every CHECKSUM_VECTOR_ROUNDS vectors.
+ *
+ * @param data The buffer.
+ * @param length Its length.
+ *
+ * @return The sum, not folded.
+ */
+__attribute__((target("sse2"))) uint64_t _sum_sse2(const uint8_t *data, size_t length)
+{
+  const __m128i zero = _mm_setzero_si128();
+  uint64_t sum = 0;
+  while (length >= 16)
+  {
+    __m128i lanes = _mm_setzero_si128();
+    for (int round = 0; round < CHECKSUM_VECTOR_ROUNDS && length >= 16; round++, data += 16, length -= 16)
+    {
+      __m128i words = _mm_loadu_si128((const __m128i *)data);
+      lanes = _mm_add_epi32(lanes, _mm_unpacklo_epi16(words, zero));
+      lanes = _mm_add_epi32(lanes, _mm_unpackhi_epi16(words, zero));
+    }
+    uint32_t parts[4];
+    _mm_storeu_si128((__m128i *)parts, lanes);
+    sum += (uint64_t)parts[0] + parts[1] + parts[2] + parts[3];
+  }
+  return sum + _sum_scalar(data, length);
+}
+
+/**
+ * It sums a buffer 32 bytes at a time, as _sum_sse2 does
+ *
+ * @param data The buffer.
+ * @param length Its length.
+ *
+ * @return The sum, not folded.
+ */
+__attribute__((target("avx2"))) uint64_t _sum_avx2(const uint8_t *data, size_t length)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  uint64_t sum = 0;
+  while (length >= 32)
   {
-    word16 = ((buff[i] << 8) & 0xFF00) + (buff[i + 1] & 0xFF);
-    // cout << hex << (int) buff[i] << " " << (int) buff[i + 1] << " ";
-    sum = sum + (unsigned long)word16;
+    __m256i lanes = _mm256_setzero_si256();
+    for (int round = 0; round < CHECKSUM_VECTOR_ROUNDS && length >= 32; round++, data += 32, length -= 32)
+    {
+      __m256i words = _mm256_loadu_si256((const __m256i *)data);
+      lanes = _mm256_add_epi32(lanes, _mm256_unpacklo_epi16(words, zero));
+      lanes = _mm256_add_epi32(lanes, _mm256_unpackhi_epi16(words, zero));
+    }
+    uint32_t parts[8];
+    _mm256_storeu_si256((__m256i *)parts, lanes);
+    for (int i = 0; i < 8; i++)
+      sum += parts[i];
   }
+  return sum + _sum_scalar(data, length);
+}
+
+#else
+
+uint64_t _sum_sse2(const uint8_t *data, size_t length)
+{
+  return _sum_scalar(data, length);
+}
+
+uint64_t _sum_avx2(const uint8_t *data, size_t length)
+{
+  return _sum_scalar(data, length);
+}
+
+#endif
+
+/**
+ * It folds a sum of 16-bit words to 16 bits, adding the carries back in
+ *
+ * @param sum The sum.
+ *
+ * @return The folded sum.
+ */
+uint16_t _fold(uint64_t sum)
+{
   while (sum >> 16)
     sum = (sum & 0xFFFF) + (sum >> 16);
-  sum = ~sum;
-
-  return ((uint16_t)sum);
+  return (uint16_t)sum;
 }
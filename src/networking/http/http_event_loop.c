@@ -0,0 +1,1000 @@
+#define _GNU_SOURCE
+#include "networking/http/http_event_loop.h"
+#include "networking/http/http_server.h"
+#include "logger/logger.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <linux/errqueue.h>
+#include <poll.h>
+#include <stddef.h>
+
+/* Worker entry point, defined in http_server.c */
+
+void *http_handler(void *arg);
+
+/* A request is embedded in its connection, which this recovers from the request alone. */
+
+#define CONNECTION_OF(request) ((struct HTTPConnection *)((char *)(request) - offsetof(struct HTTPConnection, request)))
+
+/* Public member methods prototypes */
+
+void run_event_loop(struct HTTPEventLoop *loop);
+void complete_connection(struct HTTPEventLoop *loop, struct HTTPConnection *connection);
+
+/* Private member methods prototypes */
+
+void _accept_connections(struct HTTPEventLoop *loop);
+void _read_connection(struct HTTPEventLoop *loop, struct HTTPConnection *connection);
+void _write_connection(struct HTTPEventLoop *loop, struct HTTPConnection *connection);
+int _write_segments(struct HTTPConnection *connection);
+void _reap_zerocopy(struct HTTPConnection *connection);
+void _close_connection(struct HTTPEventLoop *loop, struct HTTPConnection *connection);
+void _drain_completed(struct HTTPEventLoop *loop);
+void _next_request(struct HTTPEventLoop *loop, struct HTTPConnection *connection);
+void _sweep_idle_connections(struct HTTPEventLoop *loop);
+void _dispatch(struct HTTPEventLoop *loop, struct HTTPConnection *connection);
+void _flush_jobs(struct HTTPEventLoop *loop);
+void _reject_connection(struct HTTPEventLoop *loop, struct HTTPConnection *connection, const char *response);
+const char *_accept_body(struct HTTPEventLoop *loop, struct HTTPConnection *connection);
+long long _save_body(struct HTTPRequest *request, int fd);
+long long _save_sized_body(struct HTTPConnection *connection, int fd);
+long long _save_chunked_body(struct HTTPConnection *connection, int fd);
+int _fill_body_buffer(struct HTTPConnection *connection, size_t *position);
+int _wait_readable(struct HTTPConnection *connection);
+int _write_all(int fd, const char *data, size_t length);
+int _set_non_blocking(int fd);
+time_t _monotonic_seconds(void);
+
+/* Constructor */
+
+/**
+ * It creates an event loop around a listening socket: an epoll instance watching the listener and an eventfd that
+ * workers use to hand connections back.
+ *
+ * @param server The server the loop dispatches requests for.
+ * @param listener A listening socket; it is switched to non-blocking mode.
+ *
+ * @return A pointer to the event loop, or NULL on failure.
+ */
+struct HTTPEventLoop *http_event_loop_constructor(struct HTTPServer *server, int listener)
+{
+  struct HTTPEventLoop *loop = malloc(sizeof(struct HTTPEventLoop));
+  loop->server = server;
+  loop->listener = listener;
+  loop->active = 1;
+  loop->has_thread = 0;
+  loop->last_sweep = _monotonic_seconds();
+  loop->done = NULL;
+  loop->connections = NULL;
+  loop->num_jobs = 0;
+  loop->lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+  loop->run = run_event_loop;
+  loop->complete = complete_connection;
+
+  loop->epoll = epoll_create1(EPOLL_CLOEXEC);
+  loop->notify = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (loop->epoll < 0 || loop->notify < 0 || _set_non_blocking(listener) < 0)
+  {
+    log_error("Failed to create event loop: %s", strerror(errno));
+    http_event_loop_destructor(loop);
+    return NULL;
+  }
+
+  // The listener and the eventfd are told apart from connections by their data pointer.
+  struct epoll_event event = {.events = EPOLLIN | EPOLLET, .data.ptr = &loop->listener};
+  epoll_ctl(loop->epoll, EPOLL_CTL_ADD, listener, &event);
+  event.data.ptr = &loop->notify;
+  epoll_ctl(loop->epoll, EPOLL_CTL_ADD, loop->notify, &event);
+
+  return loop;
+}
+
+/**
+ * It stops the loop, waits for its thread, closes every connection still open and frees the loop.
+ *
+ * @param loop The event loop to destroy.
+ */
+void http_event_loop_destructor(struct HTTPEventLoop *loop)
+{
+  loop->active = 0;
+  if (loop->has_thread)
+  {
+    uint64_t one = 1;
+    if (write(loop->notify, &one, sizeof(one)) < 0)
+      log_warn("Failed to wake event loop: %s", strerror(errno));
+    pthread_join(loop->thread, NULL);
+  }
+  while (loop->connections != NULL)
+  {
+    _close_connection(loop, loop->connections);
+  }
+  if (loop->epoll >= 0)
+    close(loop->epoll);
+  if (loop->notify >= 0)
+    close(loop->notify);
+  free(loop);
+}
+
+/* Public member methods implementation */
+
+/**
+ * The reactor: waits for readiness events and advances the connections they belong to.
+ * Completed responses signalled through the eventfd are written after the batch, so that a connection closed
+ * there can never be referenced by a later event of the same batch. Idle connections are swept at the same point.
+ *
+ * @param loop The event loop to run.
+ */
+void run_event_loop(struct HTTPEventLoop *loop)
+{
+  struct epoll_event events[HTTP_MAX_EVENTS];
+  while (loop->active)
+  {
+    int count = epoll_wait(loop->epoll, events, HTTP_MAX_EVENTS, HTTP_SWEEP_INTERVAL);
+    if (count < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      log_error("epoll_wait failed: %s", strerror(errno));
+      return;
+    }
+
+    int has_completed = 0;
+    for (int i = 0; i < count; i++)
+    {
+      void *ptr = events[i].data.ptr;
+      if (ptr == &loop->listener)
+      {
+        _accept_connections(loop);
+        continue;
+      }
+      if (ptr == &loop->notify)
+      {
+        has_completed = 1;
+        continue;
+      }
+
+      struct HTTPConnection *connection = (struct HTTPConnection *)ptr;
+      if (connection->state == CONNECTION_READING)
+        _read_connection(loop, connection);
+      else if (connection->state == CONNECTION_WRITING && (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+        _write_connection(loop, connection);
+      // A connection being processed belongs to a worker; its events are picked up when it comes back.
+    }
+
+    if (has_completed)
+      _drain_completed(loop);
+    _flush_jobs(loop);
+    if (_monotonic_seconds() != loop->last_sweep)
+      _sweep_idle_connections(loop);
+  }
+}
+
+/**
+ * Queues a connection whose response is ready and wakes its loop. Safe to call from any thread.
+ *
+ * @param loop The loop owning the connection.
+ * @param connection The connection to hand back.
+ */
+void complete_connection(struct HTTPEventLoop *loop, struct HTTPConnection *connection)
+{
+  pthread_mutex_lock(&loop->lock);
+  connection->next_done = loop->done;
+  loop->done = connection;
+  pthread_mutex_unlock(&loop->lock);
+
+  uint64_t one = 1;
+  if (write(loop->notify, &one, sizeof(one)) < 0)
+    log_warn("Failed to wake event loop: %s", strerror(errno));
+}
+
+/* Private member methods implementation */
+
+/**
+ * It accepts every pending client on the loop's listener and registers it with epoll.
+ *
+ * @param loop The event loop.
+ */
+void _accept_connections(struct HTTPEventLoop *loop)
+{
+  while (1)
+  {
+    struct sockaddr_in address;
+    socklen_t address_length = sizeof(address);
+    int client = accept4(loop->listener, (struct sockaddr *)&address, &address_length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client < 0)
+    {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        log_error("accept failed: %s", strerror(errno));
+      return;
+    }
+
+    int enable = 1;
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+    struct HTTPConnection *connection = malloc(sizeof(struct HTTPConnection));
+    connection->socket = client;
+    connection->address = address;
+    connection->state = CONNECTION_READING;
+    connection->loop = loop;
+    connection->capacity = HTTP_RECV_BUFFER_SIZE;
+    connection->buffer = malloc(connection->capacity + 1);
+    connection->buffer[0] = '\0';
+    connection->length = 0;
+    connection->request_length = 0;
+    connection->request = http_request_constructor();
+    connection->zerocopy = 0;
+    connection->zerocopy_sent = 0;
+    connection->zerocopy_done = 0;
+#ifdef SO_ZEROCOPY
+    connection->zerocopy = setsockopt(client, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) == 0;
+#endif
+    connection->keep_alive = 0;
+    connection->peer_closed = 0;
+    connection->requests_served = 0;
+    connection->last_active = _monotonic_seconds();
+    connection->body_deadline = 0;
+    connection->next_done = NULL;
+
+    connection->prev = NULL;
+    connection->next = loop->connections;
+    if (loop->connections != NULL)
+      loop->connections->prev = connection;
+    loop->connections = connection;
+
+    struct epoll_event event = {.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = connection};
+    if (epoll_ctl(loop->epoll, EPOLL_CTL_ADD, client, &event) < 0)
+    {
+      log_error("epoll_ctl failed: %s", strerror(errno));
+      _close_connection(loop, connection);
+    }
+  }
+}
+
+/**
+ * It reads everything the socket has to offer and, once a whole request is buffered, hands the connection to the
+ * worker pool. A client that shut down its side still gets the answers to the requests it already sent.
+ *
+ * @param loop The event loop.
+ * @param connection The connection to read from.
+ */
+void _read_connection(struct HTTPEventLoop *loop, struct HTTPConnection *connection)
+{
+  struct HTTPRequest *request = &connection->request;
+  int result = HTTP_PARSE_INCOMPLETE;
+  while (1)
+  {
+    if (connection->length == connection->capacity)
+    {
+      // Parse before growing the buffer: once the headers are in, a streamed body must be left on the socket.
+      connection->buffer[connection->length] = '\0';
+      result = request->parse(request, connection->buffer, connection->length);
+      if (result != HTTP_PARSE_INCOMPLETE)
+        break;
+      if (connection->capacity >= HTTP_MAX_REQUEST_SIZE)
+      {
+        log_warn("Request from %s:%d is too large", inet_ntoa(connection->address.sin_addr), ntohs(connection->address.sin_port));
+        _close_connection(loop, connection);
+        return;
+      }
+      connection->capacity *= 2;
+      connection->buffer = realloc(connection->buffer, connection->capacity + 1);
+    }
+
+    ssize_t received = recv(connection->socket, connection->buffer + connection->length, connection->capacity - connection->length, 0);
+    if (received > 0)
+    {
+      connection->length += received;
+      connection->last_active = _monotonic_seconds();
+      continue;
+    }
+    if (received < 0 && errno == EINTR)
+      continue;
+    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+    if (received == 0)
+    {
+      connection->peer_closed = 1;
+      break;
+    }
+    // The socket failed.
+    _close_connection(loop, connection);
+    return;
+  }
+  if (result == HTTP_PARSE_INCOMPLETE)
+  {
+    connection->buffer[connection->length] = '\0';
+    result = request->parse(request, connection->buffer, connection->length);
+  }
+
+  if (result == HTTP_PARSE_HEADERS)
+  {
+    const char *rejection = _accept_body(loop, connection);
+    if (rejection != NULL)
+    {
+      _reject_connection(loop, connection, rejection);
+      return;
+    }
+    // A streamed body is read by the route, so the request is complete as soon as its headers are.
+    if (request->stream_body)
+      result = HTTP_PARSE_COMPLETE;
+    else if ((result = request->parse(request, connection->buffer, connection->length)) == HTTP_PARSE_INCOMPLETE &&
+             !connection->peer_closed)
+    {
+      // Reading stopped at the end of the headers and the socket may hold more of the body.
+      _read_connection(loop, connection);
+      return;
+    }
+  }
+
+  if (result == HTTP_PARSE_ERROR)
+  {
+    _reject_connection(loop, connection, "HTTP/1.1 400 Bad Request\r\n"
+                                         "Connection: close\r\n"
+                                         "Content-Length: 0\r\n\r\n");
+  }
+  else if (result == HTTP_PARSE_INCOMPLETE)
+  {
+    if (connection->peer_closed)
+      _close_connection(loop, connection);
+  }
+  else
+  {
+    connection->request_length = request->stream_body ? request->header_length : request->length;
+    connection->state = CONNECTION_PROCESSING;
+    _dispatch(loop, connection);
+  }
+}
+
+/**
+ * It writes as much of the response as the socket accepts. Once the response is flushed, and the kernel is done with
+ * the memory it was sent from without a copy, a persistent connection moves on to its next request, any other
+ * connection is closed.
+ *
+ * @param loop The event loop.
+ * @param connection The connection to write to.
+ */
+void _write_connection(struct HTTPEventLoop *loop, struct HTTPConnection *connection)
+{
+  if (connection->zerocopy_done != connection->zerocopy_sent)
+    _reap_zerocopy(connection);
+
+  int result = _write_segments(connection);
+  if (result == 0)
+    return; // Wait for EPOLLOUT.
+  if (result < 0)
+  {
+    _close_connection(loop, connection);
+    return;
+  }
+  if (connection->zerocopy_done != connection->zerocopy_sent)
+    return; // Wait for the completions, which come as EPOLLERR.
+
+  if (connection->keep_alive && !connection->peer_closed)
+    _next_request(loop, connection);
+  else
+    _close_connection(loop, connection);
+}
+
+/**
+ * It sends the segments of the response: the memory segments in a row, head and body alike, are gathered into one
+ * sendmsg call, and file ranges go with sendfile so that file contents go from the page cache to the socket without a
+ * copy through user space. Large gathers are sent with MSG_ZEROCOPY, the kernel then reading the pages in place.
+ *
+ * @param connection The connection to write to.
+ *
+ * @return 1 once every segment is sent, 0 if the socket is full, -1 on failure.
+ */
+int _write_segments(struct HTTPConnection *connection)
+{
+  struct HTTPRequest *request = &connection->request;
+  while (request->segments != NULL)
+  {
+    struct HTTPSegment *segment = request->segments;
+    ssize_t sent;
+    if (segment->data != NULL)
+    {
+      struct iovec parts[HTTP_MAX_IOVECS];
+      int num_parts = 0;
+      size_t total = 0;
+      struct HTTPSegment *cursor = segment;
+      for (; cursor != NULL && cursor->data != NULL && num_parts < HTTP_MAX_IOVECS; cursor = cursor->next)
+      {
+        parts[num_parts].iov_base = cursor->data + cursor->offset;
+        parts[num_parts++].iov_len = cursor->length;
+        total += cursor->length;
+      }
+
+      struct msghdr message = {.msg_iov = parts, .msg_iovlen = num_parts};
+      // Hold back the last packet when more of the response follows, so that it leaves full sized.
+      int flags = MSG_NOSIGNAL | (cursor != NULL ? MSG_MORE : 0);
+#ifdef MSG_ZEROCOPY
+      if (connection->zerocopy && total >= HTTP_ZEROCOPY_MIN)
+        flags |= MSG_ZEROCOPY;
+#endif
+      sent = total > 0 ? sendmsg(connection->socket, &message, flags) : 0;
+      if (sent < 0 && errno == ENOBUFS && (flags & ~(MSG_NOSIGNAL | MSG_MORE)))
+      {
+        connection->zerocopy = 0; // Out of memory to pin the pages: copy from now on.
+        continue;
+      }
+      if (sent >= 0)
+      {
+        if (sent > 0 && (flags & ~(MSG_NOSIGNAL | MSG_MORE)))
+          connection->zerocopy_sent++;
+        // Drop the segments sent in full, and advance into the one sent in part.
+        for (size_t left = sent; request->segments != cursor; request->segments = request->segments->next)
+        {
+          struct HTTPSegment *part = request->segments;
+          size_t taken = part->length < left ? part->length : left;
+          part->offset += taken;
+          part->length -= taken;
+          left -= taken;
+          if (part->length > 0)
+            break;
+        }
+        if (request->segments == NULL)
+          request->last_segment = NULL;
+        if (sent > 0)
+          connection->last_active = _monotonic_seconds();
+        continue;
+      }
+    }
+    else
+    {
+      if (segment->length == 0)
+      {
+        request->segments = segment->next;
+        if (request->segments == NULL)
+          request->last_segment = NULL;
+        continue;
+      }
+      // sendfile advances the offset itself.
+      sent = sendfile(connection->socket, request->file, &segment->offset, segment->length);
+      if (sent == 0)
+        return -1; // The file was truncated after the response announced its length.
+      if (sent > 0)
+      {
+        segment->length -= sent;
+        connection->last_active = _monotonic_seconds();
+        continue;
+      }
+    }
+
+    if (errno == EINTR)
+      continue;
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return 0;
+    return -1;
+  }
+  return 1;
+}
+
+/**
+ * It reads the notifications of the kernel being done with memory sent with MSG_ZEROCOPY. Each one covers a range of
+ * sendmsg calls, numbered from 0 in the order they were made on the socket.
+ *
+ * @param connection The connection whose error queue is read.
+ */
+void _reap_zerocopy(struct HTTPConnection *connection)
+{
+  char control[128];
+  for (;;)
+  {
+    struct msghdr message = {.msg_control = control, .msg_controllen = sizeof(control)};
+    if (recvmsg(connection->socket, &message, MSG_ERRQUEUE) < 0)
+      return; // EAGAIN once the queue is empty.
+    for (struct cmsghdr *header = CMSG_FIRSTHDR(&message); header != NULL; header = CMSG_NXTHDR(&message, header))
+    {
+      if (header->cmsg_level != SOL_IP || header->cmsg_type != IP_RECVERR)
+        continue;
+      struct sock_extended_err *error = (struct sock_extended_err *)CMSG_DATA(header);
+#ifdef SO_EE_ORIGIN_ZEROCOPY
+      if (error->ee_errno == 0 && error->ee_origin == SO_EE_ORIGIN_ZEROCOPY)
+        connection->zerocopy_done += error->ee_data - error->ee_info + 1;
+#else
+      (void)error;
+#endif
+    }
+  }
+}
+
+/**
+ * It unregisters a connection from the loop, closes its socket and frees it.
+ *
+ * @param loop The event loop.
+ * @param connection The connection to close.
+ */
+void _close_connection(struct HTTPEventLoop *loop, struct HTTPConnection *connection)
+{
+  if (connection->prev != NULL)
+    connection->prev->next = connection->next;
+  else
+    loop->connections = connection->next;
+  if (connection->next != NULL)
+    connection->next->prev = connection->prev;
+
+  close(connection->socket);
+  http_request_destructor(&connection->request);
+  free(connection->buffer);
+  free(connection);
+}
+
+/**
+ * It takes every connection the workers handed back and starts writing its response.
+ *
+ * @param loop The event loop.
+ */
+void _drain_completed(struct HTTPEventLoop *loop)
+{
+  uint64_t count;
+  if (read(loop->notify, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    log_warn("Failed to read event loop notification: %s", strerror(errno));
+
+  pthread_mutex_lock(&loop->lock);
+  struct HTTPConnection *connection = loop->done;
+  loop->done = NULL;
+  pthread_mutex_unlock(&loop->lock);
+
+  while (connection != NULL)
+  {
+    struct HTTPConnection *next = connection->next_done;
+    connection->state = CONNECTION_WRITING;
+    _write_connection(loop, connection);
+    connection = next;
+  }
+}
+
+/**
+ * It drops the request that was just answered and starts on the next one. Bytes the client pipelined behind it are
+ * kept, and the socket is read again because edge-triggered events that arrived meanwhile were not acted on.
+ *
+ * @param loop The event loop.
+ * @param connection The connection whose response has been flushed.
+ */
+void _next_request(struct HTTPEventLoop *loop, struct HTTPConnection *connection)
+{
+  http_request_reset(&connection->request);
+
+  connection->length -= connection->request_length;
+  memmove(connection->buffer, connection->buffer + connection->request_length, connection->length);
+  connection->buffer[connection->length] = '\0';
+  connection->request_length = 0;
+  connection->state = CONNECTION_READING;
+  connection->last_active = _monotonic_seconds();
+
+  _read_connection(loop, connection);
+}
+
+/**
+ * It closes the connections that have been idle, or stalled mid-request or mid-response, for longer than the
+ * keep-alive timeout. Connections held by a worker are left alone.
+ *
+ * @param loop The event loop.
+ */
+void _sweep_idle_connections(struct HTTPEventLoop *loop)
+{
+  time_t now = _monotonic_seconds();
+  loop->last_sweep = now;
+  struct HTTPConnection *connection = loop->connections;
+  while (connection != NULL)
+  {
+    struct HTTPConnection *next = connection->next;
+    if (connection->state != CONNECTION_PROCESSING && now - connection->last_active >= HTTP_KEEP_ALIVE_TIMEOUT)
+      _close_connection(loop, connection);
+    connection = next;
+  }
+}
+
+/**
+ * It queues a complete request for the worker pool. Requests are handed over at the end of the loop iteration, in one
+ * batch, so that the workers are woken once for all of them.
+ *
+ * @param loop The event loop.
+ * @param connection The connection whose request is complete.
+ */
+void _dispatch(struct HTTPEventLoop *loop, struct HTTPConnection *connection)
+{
+  if (loop->num_jobs == HTTP_MAX_EVENTS)
+    _flush_jobs(loop);
+  loop->jobs[loop->num_jobs++] = thread_job_constructor(http_handler, connection);
+}
+
+/**
+ * It hands the queued requests to the worker pool.
+ *
+ * @param loop The event loop.
+ */
+void _flush_jobs(struct HTTPEventLoop *loop)
+{
+  if (loop->num_jobs == 0)
+    return;
+  loop->server->pool->add_work_batch(loop->server->pool, loop->jobs, loop->num_jobs);
+  loop->num_jobs = 0;
+}
+
+/**
+ * It answers a request the loop refuses to hand to a worker, then closes the connection.
+ *
+ * @param loop The event loop.
+ * @param connection The connection to reject.
+ * @param response The complete response.
+ */
+void _reject_connection(struct HTTPEventLoop *loop, struct HTTPConnection *connection, const char *response)
+{
+  connection->request.append_data(&connection->request, (char *)response, strlen(response));
+  connection->keep_alive = 0;
+  connection->state = CONNECTION_WRITING;
+  _write_connection(loop, connection);
+}
+
+/**
+ * It decides, once the header block of a request is in, how its body is received: streamed to the route if the route
+ * asked for it, buffered otherwise.
+ *
+ * @param loop The event loop.
+ * @param connection The connection whose request headers were just parsed.
+ *
+ * @return NULL if the body is acceptable, otherwise the response rejecting the request.
+ */
+const char *_accept_body(struct HTTPEventLoop *loop, struct HTTPConnection *connection)
+{
+  struct HTTPRequest *request = &connection->request;
+  size_t max_body_size = http_route_body_limit(loop->server, connection->buffer + request->spans[HTTP_SPAN_URI],
+                                               request->lengths[HTTP_SPAN_URI]);
+  if (max_body_size > 0)
+  {
+    if (request->content_length > max_body_size)
+      return "HTTP/1.1 413 Payload Too Large\r\n"
+             "Connection: close\r\n"
+             "Content-Length: 0\r\n\r\n";
+    // The buffer must not move once the route holds views into it, so the room to decode chunks is made now.
+    if (request->is_chunked && connection->capacity - request->header_length < HTTP_STREAM_BUFFER_SIZE)
+    {
+      connection->capacity = request->header_length + HTTP_STREAM_BUFFER_SIZE;
+      connection->buffer = realloc(connection->buffer, connection->capacity + 1);
+    }
+    request->stream_body = 1;
+    request->max_body_size = max_body_size;
+    request->length = request->header_length;
+    request->save_body = _save_body;
+    return NULL;
+  }
+
+  if (request->is_chunked)
+    return "HTTP/1.1 411 Length Required\r\n"
+           "Connection: close\r\n"
+           "Content-Length: 0\r\n\r\n";
+  if (request->header_length + request->content_length > HTTP_MAX_REQUEST_SIZE)
+    return "HTTP/1.1 413 Payload Too Large\r\n"
+           "Connection: close\r\n"
+           "Content-Length: 0\r\n\r\n";
+  return NULL;
+}
+
+/**
+ * The save_body method of streamed requests. It runs on the worker owning the connection and reads the body from
+ * the socket in bounded memory, whatever its size. A client waiting for "100 Continue" is told to go ahead first.
+ * The worker blocks while the body trickles in, so the whole body must arrive within HTTP_BODY_TIMEOUT seconds.
+ *
+ * @param request The request whose body is streamed.
+ * @param fd The file descriptor the body is written to.
+ *
+ * @return The size of the body, or -1 on failure.
+ */
+long long _save_body(struct HTTPRequest *request, int fd)
+{
+  struct HTTPConnection *connection = CONNECTION_OF(request);
+  if (request->body_consumed)
+  {
+    errno = EALREADY;
+    return -1;
+  }
+
+  char *expect = request->header_fields.search(&request->header_fields, "Expect", sizeof("Expect"));
+  if (expect != NULL && strcasecmp(expect, "100-continue") == 0 && connection->length == request->header_length)
+  {
+    const char *response = "HTTP/1.1 100 Continue\r\n\r\n";
+    if (send(connection->socket, response, strlen(response), MSG_NOSIGNAL) < 0)
+      return -1;
+  }
+
+  connection->body_deadline = _monotonic_seconds() + HTTP_BODY_TIMEOUT;
+  long long size = request->is_chunked ? _save_chunked_body(connection, fd) : _save_sized_body(connection, fd);
+  if (size >= 0)
+    request->body_consumed = 1;
+  return size;
+}
+
+/**
+ * It writes a body of Content-Length bytes: the bytes buffered along with the header block first, then the rest is
+ * spliced from the socket to the file through a pipe without entering user space.
+ *
+ * @param connection The connection owning the request.
+ * @param fd The file descriptor the body is written to.
+ *
+ * @return The size of the body, or -1 on failure.
+ */
+long long _save_sized_body(struct HTTPConnection *connection, int fd)
+{
+  struct HTTPRequest *request = &connection->request;
+  size_t remaining = request->content_length;
+  size_t buffered = connection->length - request->length;
+  size_t taken = buffered < remaining ? buffered : remaining;
+  if (taken > 0 && _write_all(fd, connection->buffer + request->length, taken) < 0)
+    return -1;
+  request->length += taken;
+  remaining -= taken;
+  if (remaining == 0)
+    return request->content_length;
+
+  int pipe_fds[2];
+  if (pipe2(pipe_fds, O_CLOEXEC) < 0)
+    return -1;
+  while (remaining > 0)
+  {
+    size_t wanted = remaining < HTTP_SPLICE_SIZE ? remaining : HTTP_SPLICE_SIZE;
+    ssize_t moved = splice(connection->socket, NULL, pipe_fds[1], NULL, wanted, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (moved < 0 && errno == EINTR)
+      continue;
+    if (moved < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && _wait_readable(connection) == 0)
+      continue;
+    if (moved <= 0)
+    {
+      if (moved == 0)
+        errno = ECONNRESET; // The client went away before sending the whole body.
+      break;
+    }
+
+    remaining -= moved;
+    while (moved > 0)
+    {
+      ssize_t written = splice(pipe_fds[0], NULL, fd, NULL, moved, SPLICE_F_MOVE);
+      if (written < 0 && errno == EINTR)
+        continue;
+      if (written <= 0)
+        break;
+      moved -= written;
+    }
+    if (moved > 0)
+      break;
+  }
+  int error = errno;
+  close(pipe_fds[0]);
+  close(pipe_fds[1]);
+  errno = error;
+  return remaining == 0 ? (long long)request->content_length : -1;
+}
+
+/**
+ * It decodes a chunked body into a file. Chunks are read into the part of the receive buffer after the header block,
+ * which is reused as soon as its bytes are written, and whatever follows the body is left there for the next request.
+ *
+ * @param connection The connection owning the request.
+ * @param fd The file descriptor the body is written to.
+ *
+ * @return The size of the decoded body, or -1 on failure.
+ */
+long long _save_chunked_body(struct HTTPConnection *connection, int fd)
+{
+  struct HTTPRequest *request = &connection->request;
+  size_t position = request->length;
+  long long size = 0;
+  while (1)
+  {
+    // The chunk size line: hexadecimal digits, optionally followed by extensions.
+    char *line_end;
+    while ((line_end = memchr(connection->buffer + position, '\n', connection->length - position)) == NULL)
+    {
+      if (_fill_body_buffer(connection, &position) < 0)
+        return -1;
+    }
+    char *cursor = connection->buffer + position;
+    unsigned long long chunk_size = 0;
+    int digits = 0;
+    for (; isxdigit((unsigned char)*cursor); cursor++, digits++)
+    {
+      if (chunk_size > (ULLONG_MAX >> 4))
+      {
+        errno = EFBIG;
+        return -1;
+      }
+      int digit = isdigit((unsigned char)*cursor) ? *cursor - '0' : tolower((unsigned char)*cursor) - 'a' + 10;
+      chunk_size = (chunk_size << 4) | digit;
+    }
+    if (digits == 0 || (*cursor != ';' && *cursor != '\r' && *cursor != '\n'))
+    {
+      errno = EPROTO;
+      return -1;
+    }
+    position = line_end - connection->buffer + 1;
+    if (chunk_size == 0)
+      break;
+    if (size + chunk_size > request->max_body_size)
+    {
+      errno = EFBIG;
+      return -1;
+    }
+
+    // The chunk data, then the line break closing it.
+    while (chunk_size > 0)
+    {
+      if (position == connection->length && _fill_body_buffer(connection, &position) < 0)
+        return -1;
+      size_t available = connection->length - position;
+      size_t taken = available < chunk_size ? available : chunk_size;
+      if (_write_all(fd, connection->buffer + position, taken) < 0)
+        return -1;
+      position += taken;
+      chunk_size -= taken;
+      size += taken;
+    }
+    while (connection->length - position < 2)
+    {
+      if (_fill_body_buffer(connection, &position) < 0)
+        return -1;
+    }
+    if (memcmp(connection->buffer + position, "\r\n", 2) != 0)
+    {
+      errno = EPROTO;
+      return -1;
+    }
+    position += 2;
+  }
+
+  // Trailer fields are ignored; the body ends with an empty line.
+  while (1)
+  {
+    char *line_end;
+    while ((line_end = memchr(connection->buffer + position, '\n', connection->length - position)) == NULL)
+    {
+      if (_fill_body_buffer(connection, &position) < 0)
+        return -1;
+    }
+    char *line = connection->buffer + position;
+    position = line_end - connection->buffer + 1;
+    if (line == line_end || (line + 1 == line_end && *line == '\r'))
+      break;
+  }
+  request->length = position;
+  return size;
+}
+
+/**
+ * It reads more of a streamed body into the receive buffer, first dropping the bytes before position that were
+ * already used, except for the header block the request views point into.
+ *
+ * @param connection The connection owning the request.
+ * @param position The offset of the first unused byte, updated as bytes are dropped.
+ *
+ * @return 0 once bytes were added, -1 on failure.
+ */
+int _fill_body_buffer(struct HTTPConnection *connection, size_t *position)
+{
+  size_t start = connection->request.header_length;
+  if (*position > start)
+  {
+    memmove(connection->buffer + start, connection->buffer + *position, connection->length - *position);
+    connection->length -= *position - start;
+    *position = start;
+  }
+  if (connection->length == connection->capacity)
+  {
+    errno = EMSGSIZE; // A chunk size line longer than the whole buffer.
+    return -1;
+  }
+
+  while (1)
+  {
+    ssize_t received = recv(connection->socket, connection->buffer + connection->length,
+                            connection->capacity - connection->length, 0);
+    if (received > 0)
+    {
+      connection->length += received;
+      return 0;
+    }
+    if (received == 0)
+    {
+      errno = ECONNRESET;
+      return -1;
+    }
+    if (errno == EINTR)
+      continue;
+    if ((errno == EAGAIN || errno == EWOULDBLOCK) && _wait_readable(connection) == 0)
+      continue;
+    return -1;
+  }
+}
+
+/**
+ * It waits until the socket of a connection whose body is being read is readable, for at most the keep-alive
+ * timeout and never past the deadline of the body.
+ *
+ * @param connection The connection.
+ *
+ * @return 0 if the socket is readable, -1 on timeout or failure.
+ */
+int _wait_readable(struct HTTPConnection *connection)
+{
+  struct pollfd descriptor = {.fd = connection->socket, .events = POLLIN};
+  int ready;
+  do
+  {
+    time_t left = connection->body_deadline - _monotonic_seconds();
+    if (left <= 0)
+    {
+      errno = ETIMEDOUT;
+      return -1;
+    }
+    ready = poll(&descriptor, 1, (left < HTTP_KEEP_ALIVE_TIMEOUT ? left : HTTP_KEEP_ALIVE_TIMEOUT) * 1000);
+  } while (ready < 0 && errno == EINTR);
+  if (ready == 0)
+    errno = ETIMEDOUT;
+  return ready > 0 ? 0 : -1;
+}
+
+/**
+ * It writes a whole buffer to a file descriptor.
+ *
+ * @param fd The file descriptor.
+ * @param data The bytes to write.
+ * @param length The number of bytes.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int _write_all(int fd, const char *data, size_t length)
+{
+  while (length > 0)
+  {
+    ssize_t written = write(fd, data, length);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      return -1;
+    data += written;
+    length -= written;
+  }
+  return 0;
+}
+
+/**
+ * It switches a file descriptor to non-blocking mode.
+ *
+ * @param fd The file descriptor.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int _set_non_blocking(int fd)
+{
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0)
+    return -1;
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/**
+ * It reads the monotonic clock, which unlike the wall clock never jumps.
+ *
+ * @return The current monotonic time in seconds.
+ */
+time_t _monotonic_seconds(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec;
+}
@@ -1,210 +1,502 @@
-
 #include "networking/http/http_request.h"
-#include "data_structures/queue.h"
 #include "logger/logger.h"
 
 #include <stdlib.h>
 #include <string.h>
-#include <stdio.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <unistd.h>
+
+/* Private data types */
+
+/**
+ * The states of the request parser. Each state consumes one byte at a time, so parsing can stop at the end of the
+ * received bytes and resume there once more arrive.
+ */
+enum HTTPParserState
+{
+  PARSE_METHOD,
+  PARSE_URI,
+  PARSE_QUERY,
+  PARSE_VERSION,
+  PARSE_LINE_END,     // A carriage return was seen, the line feed must follow.
+  PARSE_HEADER_START,
+  PARSE_HEADER_KEY,
+  PARSE_VALUE_START,  // Skipping the white space between the colon and the value
+  PARSE_VALUE,
+  PARSE_HEADERS_END,  // The carriage return of the blank line was seen.
+  PARSE_HEADERS_DONE, // The header block is done and not yet reported.
+  PARSE_BODY          // The header block is reported, waiting for the body.
+};
+
+/* Public member methods prototypes */
+
+int parse_request(struct HTTPRequest *request, char *buffer, size_t length);
+void bind_request(struct HTTPRequest *request, char *buffer);
+void *search_fields(struct HTTPFields *fields, void *key, unsigned long key_size);
+void append_data(struct HTTPRequest *request, char *data, size_t length);
+void append_file(struct HTTPRequest *request, off_t offset, size_t length);
+void prepend_data(struct HTTPRequest *request, char *data, size_t length);
+void discard_segments(struct HTTPRequest *request);
 
 /* Private member methods prototypes */
 
-void extract_request_line_fields(struct HTTPRequest *request, char *request_line);
-void extract_request_query(struct HTTPRequest *request, char *query_string);
-void extract_header_fields(struct HTTPRequest *request, char *header_fields);
-void extract_body(struct HTTPRequest *request, char *body);
+struct HTTPFields http_fields_constructor(int ignore_case);
+int end_header_field(struct HTTPRequest *request, char *buffer, size_t end);
+void split_fields(struct HTTPFields *fields, struct HTTPString string);
+struct HTTPString make_string(char *buffer, size_t offset, size_t length);
+void append_segment(struct HTTPRequest *request, char *data, off_t offset, size_t length);
 
 /* Constructor */
 
 /**
- * Creates an initialized instance of an HTTPRequest using a properly formatted string.
- *
- * @param request_string The HTTP request string
+ * Creates an empty HTTPRequest ready to be fed by its parse method.
  *
  * @return A struct HTTPRequest
  */
-struct HTTPRequest http_request_constructor(char *request_string)
+struct HTTPRequest http_request_constructor(void)
 {
   struct HTTPRequest request;
-  // Convert the request string literal and replace the blank line with a vertical |
-  char requested[strlen(request_string)];
-  strcpy(requested, request_string);
-
-  for (size_t i = 0; i < strlen(requested) - 2; i++)
-  {
-    if (requested[i] == '\r' && requested[i + 1] == '\n' && requested[i + 2] == '\r' && requested[i + 3] == '\n')
-    {
-      requested[i + 3] = '|';
-      i += 3;
-    }
-  }
-  // Separate the request string into its components
-  char *request_line = strtok(requested, "\n");
-  char *header_fields = strtok(NULL, "|");
-  char *body = strtok(NULL, "\0");
-
-  // Parse each section as needed
-  extract_request_line_fields(&request, request_line);
-  extract_header_fields(&request, header_fields);
-  extract_body(&request, body);
-
+  memset(&request, 0, sizeof(request));
+  request.header_fields = http_fields_constructor(1);
+  request.query = http_fields_constructor(0);
+  request.body = http_fields_constructor(0);
+  request.params = http_fields_constructor(0);
+  request.state = PARSE_METHOD;
+  request.segments = NULL;
+  request.last_segment = NULL;
+  request.file = -1;
+  request.arena = arena_constructor(HTTP_ARENA_BLOCK);
+  request.parse = parse_request;
+  request.bind = bind_request;
+  request.append_data = append_data;
+  request.append_file = append_file;
+  request.prepend_data = prepend_data;
+  request.discard_segments = discard_segments;
   return request;
 }
 
 /**
- * It takes a pointer to a `struct HTTPRequest` and frees all the memory associated with it
+ * The views of a request point into the receive buffer, and everything the request allocated while it was answered,
+ * response segments included, is in its arena: freeing the arena and closing the file releases it all. The request is
+ * left empty.
  *
  * @param request The HTTPRequest struct to be destructed.
  */
 void http_request_destructor(struct HTTPRequest *request)
 {
-  dictionary_destructor(&request->request_line, NULL, NULL);
-  dictionary_destructor(&request->header_fields, NULL, NULL);
-  dictionary_destructor(&request->body, NULL, NULL);
-  dictionary_destructor(&request->query, NULL, NULL);
+  arena_destructor(&request->arena);
+  if (request->file >= 0)
+    close(request->file);
+  *request = http_request_constructor();
 }
 
-/* Private member methods implementation */
-
 /**
- * Parses out the request line to retrieve the method, uri, and http version.
+ * It empties a request as http_request_destructor does, for the next request of the same connection. The arena is
+ * reset rather than freed, so a keep-alive connection answers request after request from the same block.
  *
- * @param request The HTTPRequest object that we're going to insert the request line fields into.
- * @param request_line The request line from the HTTP request.
+ * @param request The HTTPRequest struct to be reset.
  */
-void extract_request_line_fields(struct HTTPRequest *request, char *request_line)
+void http_request_reset(struct HTTPRequest *request)
 {
-  char fields[strlen(request_line)];
-  strcpy(fields, request_line);
-  char *method = strtok(fields, " ");
-  char *path = strtok(NULL, " ");
-  char *http_version = strtok(NULL, "\0");
-  // Insert the results into the request object as a dictionary.
-  struct Dictionary request_line_dict = dictionary_constructor(compare_string_keys);
-  request_line_dict.insert(&request_line_dict, "method", sizeof("method"), method, sizeof(char[strlen(method)]));
-  char *uri = strtok(path, "?");
-  char *query_string = strtok(NULL, "\0");
-  extract_request_query(request, query_string);
-
-  request_line_dict.insert(&request_line_dict, "uri", sizeof("uri"), uri, sizeof(char[strlen(uri)]));
-  request_line_dict.insert(&request_line_dict, "http_version", sizeof("http_version"), http_version, sizeof(char[strlen(http_version)]));
-
-  request->request_line = request_line_dict;
+  struct Arena arena = request->arena;
+  arena_reset(&arena);
+  if (request->file >= 0)
+    close(request->file);
+  *request = http_request_constructor();
+  request->arena = arena;
 }
 
+/* Public member methods implementation */
+
 /**
- * Parses out the header fields.
+ * It advances the parser over the bytes that arrived since the previous call. Only offsets are recorded, as the
+ * caller may grow (and move) the buffer between calls.
  *
- * @param request A pointer to the HTTPRequest structure that you need to fill in.
- * @param header_fields The header fields string, which is the part of the request after the first line and before the
- * blank line.
+ * @param request The request being parsed.
+ * @param buffer The receive buffer, starting with the first byte of the request.
+ * @param length The number of bytes in the buffer.
+ *
+ * @return HTTP_PARSE_COMPLETE, HTTP_PARSE_INCOMPLETE or HTTP_PARSE_ERROR.
  */
-void extract_header_fields(struct HTTPRequest *request, char *header_fields)
+int parse_request(struct HTTPRequest *request, char *buffer, size_t length)
 {
-  char fields[strlen(header_fields)];
-  strcpy(fields, header_fields);
-
-  // Save each line of the input into a queue
-  struct Queue headers = queue_constructor();
-  char *field = strtok(fields, "\n");
-  while (field)
-  {
-    headers.push(&headers, field, sizeof(char[strlen(field)]));
-    field = strtok(NULL, "\n");
-  }
-
-  // Init the request's dictionary header_fields
-  request->header_fields = dictionary_constructor(compare_string_keys);
-  char *header = (char *)headers.peek(&headers);
-  while (header)
+  size_t i = request->position;
+  for (; i < length && request->state < PARSE_HEADERS_DONE; i++)
   {
-    char *key = strtok(header, ":");
-    char *value = strtok(NULL, "\0");
-    if (value)
+    char c = buffer[i];
+    switch (request->state)
     {
-      if (value[0] == ' ')
+    case PARSE_METHOD:
+      if (c == ' ')
+      {
+        if (i == request->mark)
+          return HTTP_PARSE_ERROR;
+        request->spans[HTTP_SPAN_METHOD] = request->mark;
+        request->lengths[HTTP_SPAN_METHOD] = i - request->mark;
+        request->mark = i + 1;
+        request->state = PARSE_URI;
+      }
+      else if (!isupper((unsigned char)c) || i - request->mark >= HTTP_MAX_METHOD_LENGTH)
+        return HTTP_PARSE_ERROR;
+      break;
+
+    case PARSE_URI:
+      if (c == ' ' || c == '?')
       {
-        value++; // Remove the leading white space
+        if (i == request->mark)
+          return HTTP_PARSE_ERROR;
+        request->spans[HTTP_SPAN_URI] = request->mark;
+        request->lengths[HTTP_SPAN_URI] = i - request->mark;
+        // Without a question mark the query is the empty string ending where the uri does.
+        request->spans[HTTP_SPAN_QUERY] = c == '?' ? i + 1 : i;
+        request->lengths[HTTP_SPAN_QUERY] = 0;
+        request->mark = i + 1;
+        request->state = c == '?' ? PARSE_QUERY : PARSE_VERSION;
       }
-      if (value[strlen(value) - 1] == '\r')
+      else if (c == '\r' || c == '\n' || c == '\0')
+        return HTTP_PARSE_ERROR;
+      break;
+
+    case PARSE_QUERY:
+      if (c == ' ')
+      {
+        request->lengths[HTTP_SPAN_QUERY] = i - request->mark;
+        request->mark = i + 1;
+        request->state = PARSE_VERSION;
+      }
+      else if (c == '\r' || c == '\n' || c == '\0')
+        return HTTP_PARSE_ERROR;
+      break;
+
+    case PARSE_VERSION:
+      if (c == '\r' || c == '\n')
       {
-        value[strlen(value) - 1] = '\0'; // Remove the trailing carriage return
+        request->spans[HTTP_SPAN_VERSION] = request->mark;
+        request->lengths[HTTP_SPAN_VERSION] = i - request->mark;
+        if (request->lengths[HTTP_SPAN_VERSION] != 8 || strncmp(buffer + request->mark, "HTTP/1.", 7) != 0)
+          return HTTP_PARSE_ERROR;
+        request->state = c == '\r' ? PARSE_LINE_END : PARSE_HEADER_START;
       }
-      request->header_fields.insert(&request->header_fields, key, sizeof(char[strlen(key) + 1]), value, sizeof(char[strlen(value) + 1]));
+      break;
+
+    case PARSE_LINE_END:
+      if (c != '\n')
+        return HTTP_PARSE_ERROR;
+      request->state = PARSE_HEADER_START;
+      break;
+
+    case PARSE_HEADER_START:
+      if (c == '\r')
+        request->state = PARSE_HEADERS_END;
+      else if (c == '\n')
+      {
+        request->header_length = i + 1;
+        request->state = PARSE_HEADERS_DONE;
+      }
+      else if (c == ' ' || c == '\t' || c == ':' || request->header_fields.count == HTTP_MAX_FIELDS)
+        return HTTP_PARSE_ERROR; // Folded lines are obsolete and not supported.
+      else
+      {
+        request->mark = i;
+        request->state = PARSE_HEADER_KEY;
+      }
+      break;
+
+    case PARSE_HEADER_KEY:
+      if (c == ':')
+      {
+        request->key_offsets[request->header_fields.count] = request->mark;
+        request->key_lengths[request->header_fields.count] = i - request->mark;
+        request->state = PARSE_VALUE_START;
+      }
+      else if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+        return HTTP_PARSE_ERROR;
+      break;
+
+    case PARSE_VALUE_START:
+      if (c == ' ' || c == '\t')
+        break;
+      request->mark = i;
+      request->state = PARSE_VALUE;
+      // The first byte of the value is handled like any other.
+      /* fall through */
+
+    case PARSE_VALUE:
+      if (c == '\r' || c == '\n')
+      {
+        if (end_header_field(request, buffer, i) < 0)
+          return HTTP_PARSE_ERROR;
+        request->state = c == '\r' ? PARSE_LINE_END : PARSE_HEADER_START;
+      }
+      break;
+
+    case PARSE_HEADERS_END:
+      if (c != '\n')
+        return HTTP_PARSE_ERROR;
+      request->header_length = i + 1;
+      request->state = PARSE_HEADERS_DONE;
+      break;
     }
-    headers.pop(&headers, NULL);
-    header = (char *)headers.peek(&headers);
   }
+  request->position = i;
 
-  queue_destructor(&headers, NULL);
+  if (request->state == PARSE_HEADERS_DONE)
+  {
+    // A body framed by both headers could be read two ways by two servers, so it is refused.
+    if (request->is_chunked && request->has_content_length)
+      return HTTP_PARSE_ERROR;
+    request->state = PARSE_BODY;
+    return HTTP_PARSE_HEADERS;
+  }
+  if (request->state != PARSE_BODY || request->is_chunked ||
+      length < request->header_length + request->content_length)
+    return HTTP_PARSE_INCOMPLETE;
+  request->length = request->header_length + request->content_length;
+  return HTTP_PARSE_COMPLETE;
 }
 
 /**
- * Parses the body according to the content type specified in the header fields.
+ * It resolves the recorded offsets against the buffer of a complete request and NUL terminates every view in place,
+ * overwriting the delimiters that follow them. The query and a form encoded body are split into fields the same way.
  *
- * @param request The HTTPRequest struct that we're extracting the body from.
- * @param body The body of the request.
+ * @param request A request whose parse method returned HTTP_PARSE_COMPLETE.
+ * @param buffer The buffer the request was parsed from; unless the body is streamed, the byte at request->length is
+ * overwritten.
  */
-void extract_body(struct HTTPRequest *request, char *body)
+void bind_request(struct HTTPRequest *request, char *buffer)
 {
-  char *content_type = (char *)request->header_fields.search(&request->header_fields, "Content-Type", sizeof("Content-Type"));
-  struct Dictionary body_dict = dictionary_constructor(compare_string_keys);
-  if (content_type)
+  request->method = make_string(buffer, request->spans[HTTP_SPAN_METHOD], request->lengths[HTTP_SPAN_METHOD]);
+  request->uri = make_string(buffer, request->spans[HTTP_SPAN_URI], request->lengths[HTTP_SPAN_URI]);
+  request->query_string = make_string(buffer, request->spans[HTTP_SPAN_QUERY], request->lengths[HTTP_SPAN_QUERY]);
+  request->http_version = make_string(buffer, request->spans[HTTP_SPAN_VERSION], request->lengths[HTTP_SPAN_VERSION]);
+  if (!request->stream_body)
+    request->content = make_string(buffer, request->header_length, request->content_length);
+
+  for (int i = 0; i < request->header_fields.count; i++)
   {
-    struct Queue fields = queue_constructor();
-    char *field = strtok(body, "&");
-    while (field)
-    {
-      field[strlen(field)] = '\0'; // Remove the trailing carriage return
-      fields.push(&fields, field, sizeof(char[strlen(field) + 1]));
-      field = strtok(NULL, "&");
-    }
+    struct HTTPField *field = &request->header_fields.fields[i];
+    field->key = make_string(buffer, request->key_offsets[i], request->key_lengths[i]);
+    field->value = make_string(buffer, request->value_offsets[i], request->value_lengths[i]);
+  }
 
-    field = fields.peek(&fields);
-    while (field)
-    {
-      char *key = strtok(field, "=");
-      char *value = strtok(NULL, "\0");
-      // Remove unnecessary leading white space.
-      if (value[0] == ' ')
-      {
-        value++;
-      }
-      body_dict.insert(&body_dict, key, sizeof(char[strlen(key)+1]), value, sizeof(char[strlen(value)+1]));
-      fields.pop(&fields, NULL);
-      field = fields.peek(&fields);
-    }
-    queue_destructor(&fields, NULL);
+  split_fields(&request->query, request->query_string);
+  char *content_type = request->header_fields.search(&request->header_fields, "Content-Type", sizeof("Content-Type"));
+  if (!request->stream_body && content_type != NULL && strncasecmp(content_type, "application/x-www-form-urlencoded", 33) == 0)
+    split_fields(&request->body, request->content);
+}
+
+/**
+ * It finds a field by its key.
+ *
+ * @param fields The fields to search.
+ * @param key The NUL terminated key.
+ * @param key_size Unused, see struct HTTPFields.
+ *
+ * @return The NUL terminated value, or NULL if there is no such field.
+ */
+void *search_fields(struct HTTPFields *fields, void *key, unsigned long key_size)
+{
+  (void)key_size;
+  size_t length = strlen((char *)key);
+  for (int i = 0; i < fields->count; i++)
+  {
+    struct HTTPField *field = &fields->fields[i];
+    if (field->key.length != length || field->key.data == NULL)
+      continue;
+    if (fields->ignore_case ? strncasecmp(field->key.data, key, length) == 0 : memcmp(field->key.data, key, length) == 0)
+      return field->value.data;
   }
-  request->body = body_dict;
+  return NULL;
+}
+
+/**
+ * It appends bytes in memory to the response body.
+ *
+ * @param request The request being answered.
+ * @param data The bytes, in the arena of the request or static.
+ * @param length The number of bytes.
+ */
+void append_data(struct HTTPRequest *request, char *data, size_t length)
+{
+  append_segment(request, data, 0, length);
+}
+
+/**
+ * It appends a range of request->file to the response body.
+ *
+ * @param request The request being answered.
+ * @param offset The offset of the first byte.
+ * @param length The number of bytes.
+ */
+void append_file(struct HTTPRequest *request, off_t offset, size_t length)
+{
+  append_segment(request, NULL, offset, length);
+}
+
+/**
+ * It puts bytes in memory in front of the response.
+ *
+ * @param request The request being answered.
+ * @param data The bytes, in the arena of the request or static.
+ * @param length The number of bytes.
+ */
+void prepend_data(struct HTTPRequest *request, char *data, size_t length)
+{
+  struct HTTPSegment *segment = request->arena.alloc(&request->arena, sizeof(struct HTTPSegment));
+  segment->data = data;
+  segment->offset = 0;
+  segment->length = length;
+  segment->next = request->segments;
+  request->segments = segment;
+  if (request->last_segment == NULL)
+    request->last_segment = segment;
+}
+
+/**
+ * It drops the segments of the response queued so far. Their memory stays in the arena until the request ends.
+ *
+ * @param request The request being answered.
+ */
+void discard_segments(struct HTTPRequest *request)
+{
+  request->segments = NULL;
+  request->last_segment = NULL;
+}
+
+/* Private member methods implementation */
+
+/**
+ * Creates an empty set of fields.
+ *
+ * @param ignore_case Whether keys are compared case insensitively.
+ *
+ * @return A struct HTTPFields
+ */
+struct HTTPFields http_fields_constructor(int ignore_case)
+{
+  struct HTTPFields fields;
+  fields.count = 0;
+  fields.ignore_case = ignore_case;
+  fields.search = search_fields;
+  return fields;
 }
 
-void extract_request_query(struct HTTPRequest *request, char *query_string)
+/**
+ * It records a header field whose value ends at the given offset, and reads the framing of the body from it.
+ *
+ * @param request The request being parsed.
+ * @param buffer The receive buffer.
+ * @param end The offset of the line break ending the value.
+ *
+ * @return 0 on success, -1 if the field makes the request malformed.
+ */
+int end_header_field(struct HTTPRequest *request, char *buffer, size_t end)
 {
-  struct Dictionary query_dict = dictionary_constructor(compare_string_keys);
-  struct Queue fields = queue_constructor();
-  char *field = strtok(query_string, "&");
-  while (field)
+  int index = request->header_fields.count;
+  size_t start = request->mark;
+  while (end > start && (buffer[end - 1] == ' ' || buffer[end - 1] == '\t'))
+    end--;
+  request->value_offsets[index] = start;
+  request->value_lengths[index] = end - start;
+  request->header_fields.count++;
+
+  char *key = buffer + request->key_offsets[index];
+  size_t key_length = request->key_lengths[index];
+  if (key_length == 14 && strncasecmp(key, "Content-Length", 14) == 0)
   {
-    fields.push(&fields, field, sizeof(char[strlen(field)]));
-    field = strtok(NULL, "&");
+    size_t content_length = 0;
+    if (start == end)
+      return -1;
+    for (size_t i = start; i < end; i++)
+    {
+      if (!isdigit((unsigned char)buffer[i]) || content_length > (SIZE_MAX - 9) / 10)
+        return -1;
+      content_length = content_length * 10 + (buffer[i] - '0');
+    }
+    if (request->has_content_length && request->content_length != content_length)
+      return -1;
+    request->content_length = content_length;
+    request->has_content_length = 1;
+  }
+  else if (key_length == 17 && strncasecmp(key, "Transfer-Encoding", 17) == 0)
+  {
+    // Only a body sent in chunks is understood; other codings cannot be framed.
+    if (end - start != 7 || strncasecmp(buffer + start, "chunked", 7) != 0)
+      return -1;
+    request->is_chunked = 1;
   }
+  return 0;
+}
 
-  field = fields.peek(&fields);
-  while (field)
+/**
+ * It splits a string of key=value pairs separated by ampersands into fields, in place.
+ *
+ * @param fields The fields to fill.
+ * @param string The bound string to split.
+ */
+void split_fields(struct HTTPFields *fields, struct HTTPString string)
+{
+  char *cursor = string.data;
+  char *end = string.data + string.length;
+  while (cursor < end && fields->count < HTTP_MAX_FIELDS)
   {
-    char *key = strtok(field, "=");
-    char *value = strtok(NULL, "\0");
-    // Remove unnecessary leading white space.
-    if (value[0] == ' ')
+    char *separator = memchr(cursor, '&', end - cursor);
+    char *field_end = separator != NULL ? separator : end;
+    if (field_end > cursor)
     {
-      value++;
+      char *equals = memchr(cursor, '=', field_end - cursor);
+      char *value = equals != NULL ? equals + 1 : field_end;
+      char *key_end = equals != NULL ? equals : field_end;
+      // Remove unnecessary leading white space.
+      if (value < field_end && *value == ' ')
+        value++;
+
+      struct HTTPField *field = &fields->fields[fields->count++];
+      field->key = (struct HTTPString){cursor, key_end - cursor};
+      field->value = (struct HTTPString){value, field_end - value};
+      *key_end = '\0';
+      *field_end = '\0';
     }
-    query_dict.insert(&query_dict, key, sizeof(char[strlen(key)+1]), value, sizeof(char[strlen(value)+1]));
-    fields.pop(&fields, NULL);
-    field = fields.peek(&fields);
+    cursor = field_end + 1;
   }
-  queue_destructor(&fields, NULL);
+}
+
+/**
+ * It makes a view of the buffer and NUL terminates it.
+ *
+ * @param buffer The buffer.
+ * @param offset The offset of the first character.
+ * @param length The number of characters.
+ *
+ * @return The view.
+ */
+struct HTTPString make_string(char *buffer, size_t offset, size_t length)
+{
+  struct HTTPString string = {buffer + offset, length};
+  string.data[length] = '\0';
+  return string;
+}
 
-  request->query = query_dict;
+/**
+ * It adds a segment at the end of the response body.
+ *
+ * @param request The request being answered.
+ * @param data The bytes of a memory segment, NULL for a file segment.
+ * @param offset The file offset of a file segment.
+ * @param length The number of bytes.
+ */
+void append_segment(struct HTTPRequest *request, char *data, off_t offset, size_t length)
+{
+  struct HTTPSegment *segment = request->arena.alloc(&request->arena, sizeof(struct HTTPSegment));
+  segment->data = data;
+  segment->offset = offset;
+  segment->length = length;
+  segment->next = NULL;
+  if (request->last_segment != NULL)
+    request->last_segment->next = segment;
+  else
+    request->segments = segment;
+  request->last_segment = segment;
 }
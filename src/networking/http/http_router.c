@@ -0,0 +1,438 @@
+#include "networking/http/http_router.h"
+#include "networking/http/http_request.h"
+#include "logger/logger.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Public member methods prototypes */
+
+struct HTTPRoute *add_route(struct HTTPRouter *router, const char *pattern, unsigned int methods,
+                            char *(*callback)(struct HTTPServer *server, struct HTTPRequest *request));
+struct HTTPRoute *find_route(struct HTTPRouter *router, const char *pattern);
+void freeze_routes(struct HTTPRouter *router);
+const struct HTTPRoute *match_route(const struct HTTPRouter *router, const char *path, size_t length,
+                                    struct HTTPRequest *request);
+
+/* Private methods prototype */
+
+const char *_segment_at(const char *pattern, int depth, int *length);
+int _is_param(const char *segment, int length);
+int _compare_segments(const char *first, int first_length, const char *second, int second_length);
+void _build_node(struct HTTPRouter *router, int index, int *routes, int count, int depth);
+int _match_node(const struct HTTPRouter *router, int index, const char *segment, const char *end,
+                const char **values, size_t *lengths, int num_values);
+void _bind_params(const struct HTTPRoute *route, const char **values, size_t *lengths, struct HTTPRequest *request);
+
+/* Constructor and destructor */
+
+/**
+ * It creates an empty router
+ *
+ * @return A struct HTTPRouter
+ */
+struct HTTPRouter http_router_constructor(void)
+{
+  struct HTTPRouter router;
+  router.routes = NULL;
+  router.num_routes = 0;
+  router.capacity = 0;
+  router.frozen = 0;
+  router.nodes = NULL;
+  router.num_nodes = 0;
+  router.add = add_route;
+  router.find = find_route;
+  router.freeze = freeze_routes;
+  router.match = match_route;
+  return router;
+}
+
+/**
+ * It frees the routes and the compiled table
+ *
+ * @param router The router.
+ */
+void http_router_destructor(struct HTTPRouter *router)
+{
+  for (int i = 0; i < router->num_routes; i++)
+    free(router->routes[i].pattern);
+  free(router->routes);
+  free(router->nodes);
+  router->routes = NULL;
+  router->nodes = NULL;
+  router->num_routes = 0;
+  router->num_nodes = 0;
+}
+
+/* Public member methods implements */
+
+/**
+ * It adds a route. The pattern is copied.
+ *
+ * @param router The router.
+ * @param pattern The path of the route, starting with a slash; a segment between braces is a parameter.
+ * @param methods The methods allowed, one bit (1 << HTTPMethods) each.
+ * @param callback The function answering the requests of the route.
+ *
+ * @return The route, to set its metadata, or NULL if the router is frozen or the pattern is invalid.
+ */
+struct HTTPRoute *add_route(struct HTTPRouter *router, const char *pattern, unsigned int methods,
+                            char *(*callback)(struct HTTPServer *server, struct HTTPRequest *request))
+{
+  if (router->frozen)
+  {
+    log_warn("Cannot add route %s: the routes are frozen", pattern);
+    return NULL;
+  }
+  if (pattern[0] != '/')
+  {
+    log_warn("Cannot add route %s: it does not start with a slash", pattern);
+    return NULL;
+  }
+  struct HTTPRoute *route = find_route(router, pattern);
+  if (route != NULL)
+  {
+    // registering a pattern again replaces it, as inserting it in the dictionary of routes did
+    route->methods = methods;
+    route->callback = callback;
+    return route;
+  }
+
+  int num_segments = 0, num_params = 0, length;
+  for (const char *segment; (segment = _segment_at(pattern, num_segments, &length)) != NULL; num_segments++)
+    num_params += _is_param(segment, length);
+  if (num_params > HTTP_MAX_ROUTE_PARAMS)
+  {
+    log_warn("Cannot add route %s: more than %d parameters", pattern, HTTP_MAX_ROUTE_PARAMS);
+    return NULL;
+  }
+
+  if (router->num_routes == router->capacity)
+  {
+    router->capacity = router->capacity == 0 ? 16 : router->capacity * 2;
+    router->routes = realloc(router->routes, sizeof(struct HTTPRoute) * router->capacity);
+  }
+  route = &router->routes[router->num_routes++];
+  route->pattern = strdup(pattern);
+  route->num_segments = num_segments;
+  route->methods = methods;
+  route->require_auth = 0;
+  route->max_body_size = 0;
+  route->callback = callback;
+  return route;
+}
+
+/**
+ * It finds the route added with a pattern
+ *
+ * @param router The router.
+ * @param pattern The pattern, as it was added.
+ *
+ * @return The route, or NULL if there is none.
+ */
+struct HTTPRoute *find_route(struct HTTPRouter *router, const char *pattern)
+{
+  for (int i = 0; i < router->num_routes; i++)
+  {
+    if (strcmp(router->routes[i].pattern, pattern) == 0)
+      return &router->routes[i];
+  }
+  return NULL;
+}
+
+/**
+ * It compiles the routes into the table match walks. A table holds at most one node per segment of each pattern,
+ * plus the root, so it is allocated once.
+ *
+ * @param router The router.
+ */
+void freeze_routes(struct HTTPRouter *router)
+{
+  if (router->frozen)
+    return;
+  int max_nodes = 1;
+  int *routes = malloc(sizeof(int) * (router->num_routes + 1));
+  for (int i = 0; i < router->num_routes; i++)
+  {
+    max_nodes += router->routes[i].num_segments;
+    routes[i] = i;
+  }
+  router->nodes = malloc(sizeof(struct HTTPRouteNode) * max_nodes);
+  router->num_nodes = 1;
+  router->nodes[0].label = "";
+  router->nodes[0].label_length = 0;
+  _build_node(router, 0, routes, router->num_routes, 0);
+  free(routes);
+  router->frozen = 1;
+  log_info("Compiled %d routes into %d nodes", router->num_routes, router->num_nodes);
+}
+
+/**
+ * It finds the route of a path. Literal segments win over parameters: /file/info is served by /file/info rather than
+ * /file/{id} whichever was added first.
+ *
+ * @param router The router.
+ * @param path The path of the request, without the query.
+ * @param length Its length.
+ * @param request The request whose params are set from the parameters of the route, or NULL.
+ *
+ * @return The route, or NULL if no route matches.
+ */
+const struct HTTPRoute *match_route(const struct HTTPRouter *router, const char *path, size_t length,
+                                    struct HTTPRequest *request)
+{
+  if (!router->frozen || length == 0 || path[0] != '/')
+    return NULL;
+  const char *values[HTTP_MAX_ROUTE_PARAMS];
+  size_t lengths[HTTP_MAX_ROUTE_PARAMS];
+  int index = _match_node(router, 0, path + 1, path + length, values, lengths, 0);
+  if (index < 0)
+    return NULL;
+  const struct HTTPRoute *route = &router->routes[index];
+  if (request != NULL)
+    _bind_params(route, values, lengths, request);
+  return route;
+}
+
+/* Public helper functions */
+
+/**
+ * It gives the code of a method without comparing it to every method name
+ *
+ * @param method The method, NUL terminated.
+ *
+ * @return Its HTTPMethods code, or 0 if it is unknown.
+ */
+int http_method_code(const char *method)
+{
+  switch (method[0])
+  {
+  case 'G':
+    return strcmp(method, "GET") == 0 ? GET : 0;
+  case 'P':
+    if (method[1] == 'O')
+      return strcmp(method, "POST") == 0 ? POST : 0;
+    if (method[1] == 'U')
+      return strcmp(method, "PUT") == 0 ? PUT : 0;
+    return strcmp(method, "PATCH") == 0 ? PATCH : 0;
+  case 'D':
+    return strcmp(method, "DELETE") == 0 ? DELETE : 0;
+  case 'H':
+    return strcmp(method, "HEAD") == 0 ? HEAD : 0;
+  case 'O':
+    return strcmp(method, "OPTIONS") == 0 ? OPTIONS : 0;
+  case 'T':
+    return strcmp(method, "TRACE") == 0 ? TRACE : 0;
+  case 'C':
+    return strcmp(method, "CONNECT") == 0 ? CONNECT : 0;
+  default:
+    return 0;
+  }
+}
+
+/* Private methods implements */
+
+/**
+ * It finds a segment of a pattern: the parts between the slashes after the first one, so that / has one empty segment
+ * and /a/ has two
+ *
+ * @param pattern The pattern, NUL terminated and starting with a slash.
+ * @param depth The index of the segment.
+ * @param length Set to the length of the segment.
+ *
+ * @return The first character of the segment, or NULL if the pattern has fewer segments.
+ */
+const char *_segment_at(const char *pattern, int depth, int *length)
+{
+  const char *segment = pattern + 1;
+  for (int i = 0; i < depth; i++)
+  {
+    segment = strchr(segment, '/');
+    if (segment == NULL)
+      return NULL;
+    segment++;
+  }
+  const char *end = strchr(segment, '/');
+  *length = end != NULL ? (int)(end - segment) : (int)strlen(segment);
+  return segment;
+}
+
+int _is_param(const char *segment, int length)
+{
+  return length >= 2 && segment[0] == '{' && segment[length - 1] == '}';
+}
+
+/**
+ * It orders segments by length, then by their bytes, which is all binary search needs
+ *
+ * @return A negative number, zero or a positive number, as strcmp.
+ */
+int _compare_segments(const char *first, int first_length, const char *second, int second_length)
+{
+  if (first_length != second_length)
+    return first_length - second_length;
+  return memcmp(first, second, first_length);
+}
+
+/**
+ * It fills a node of the table with the routes going through it, and its children recursively. The children of a
+ * node are given contiguous slots before any of them is filled.
+ *
+ * @param router The router.
+ * @param index The node.
+ * @param routes The routes whose first depth segments lead to the node; sorted in place.
+ * @param count Their number.
+ * @param depth The number of segments leading to the node.
+ */
+void _build_node(struct HTTPRouter *router, int index, int *routes, int count, int depth)
+{
+  struct HTTPRouteNode *node = &router->nodes[index];
+  node->route = -1;
+  node->first_child = router->num_nodes;
+  node->num_children = 0;
+  node->param_child = -1;
+
+  // The routes ending here come first, then the literal segments in order, then the parameters.
+  const char *segments[count];
+  int lengths[count], kinds[count];
+  for (int i = 0; i < count; i++)
+  {
+    segments[i] = _segment_at(router->routes[routes[i]].pattern, depth, &lengths[i]);
+    kinds[i] = segments[i] == NULL ? 0 : _is_param(segments[i], lengths[i]) ? 2 : 1;
+  }
+  for (int i = 1; i < count; i++)
+  {
+    for (int j = i; j > 0; j--)
+    {
+      int order = kinds[j - 1] != kinds[j] ? kinds[j - 1] - kinds[j]
+                  : kinds[j] == 1        ? _compare_segments(segments[j - 1], lengths[j - 1], segments[j], lengths[j])
+                                         : 0;
+      if (order <= 0)
+        break;
+      int route = routes[j], length = lengths[j], kind = kinds[j];
+      const char *segment = segments[j];
+      routes[j] = routes[j - 1], lengths[j] = lengths[j - 1], kinds[j] = kinds[j - 1], segments[j] = segments[j - 1];
+      routes[j - 1] = route, lengths[j - 1] = length, kinds[j - 1] = kind, segments[j - 1] = segment;
+    }
+  }
+
+  int first = 0;
+  while (first < count && kinds[first] == 0)
+  {
+    if (node->route >= 0)
+      log_warn("Route %s is shadowed by %s", router->routes[routes[first]].pattern, router->routes[node->route].pattern);
+    else
+      node->route = routes[first];
+    first++;
+  }
+
+  // slots for the children, literal ones first
+  int groups[count + 1], num_groups = 0;
+  for (int i = first; i < count; i++)
+  {
+    if (i == first || kinds[i] != kinds[i - 1] || (kinds[i] == 1 && _compare_segments(segments[i - 1], lengths[i - 1], segments[i], lengths[i]) != 0))
+      groups[num_groups++] = i;
+  }
+  groups[num_groups] = count;
+  router->num_nodes += num_groups;
+  for (int g = 0; g < num_groups; g++)
+  {
+    int child = node->first_child + g;
+    if (kinds[groups[g]] == 2)
+      node->param_child = child;
+    else
+      node->num_children++;
+    router->nodes[child].label = segments[groups[g]];
+    router->nodes[child].label_length = lengths[groups[g]];
+  }
+  for (int g = 0; g < num_groups; g++)
+    _build_node(router, node->first_child + g, routes + groups[g], groups[g + 1] - groups[g], depth + 1);
+}
+
+/**
+ * It matches the rest of a path from a node of the table, trying the literal child of the segment before the
+ * parameter child
+ *
+ * @param router The router.
+ * @param index The node matched so far.
+ * @param segment The next segment of the path, or NULL when the path ends at the node.
+ * @param end The end of the path.
+ * @param values The values of the parameters matched so far.
+ * @param lengths Their lengths.
+ * @param num_values Their number.
+ *
+ * @return The index of the route, or -1 if none matches.
+ */
+int _match_node(const struct HTTPRouter *router, int index, const char *segment, const char *end,
+                const char **values, size_t *lengths, int num_values)
+{
+  const struct HTTPRouteNode *node = &router->nodes[index];
+  if (segment == NULL)
+    return node->route;
+
+  const char *slash = memchr(segment, '/', end - segment);
+  int length = (int)((slash != NULL ? slash : end) - segment);
+  const char *next = slash != NULL ? slash + 1 : NULL;
+
+  int low = node->first_child, high = node->first_child + node->num_children - 1;
+  while (low <= high)
+  {
+    int middle = (low + high) / 2;
+    const struct HTTPRouteNode *child = &router->nodes[middle];
+    int order = _compare_segments(child->label, child->label_length, segment, length);
+    if (order == 0)
+    {
+      int route = _match_node(router, middle, next, end, values, lengths, num_values);
+      if (route >= 0)
+        return route;
+      break;
+    }
+    if (order < 0)
+      low = middle + 1;
+    else
+      high = middle - 1;
+  }
+
+  if (node->param_child >= 0 && length > 0 && num_values < HTTP_MAX_ROUTE_PARAMS)
+  {
+    values[num_values] = segment;
+    lengths[num_values] = length;
+    return _match_node(router, node->param_child, next, end, values, lengths, num_values + 1);
+  }
+  return -1;
+}
+
+/**
+ * It sets the path parameters of a request: the names are views into the pattern of the route, the values are copied
+ * into the request, NUL terminated. Values that do not fit are left out.
+ *
+ * @param route The route matched.
+ * @param values The values of its parameters, in the order of the pattern.
+ * @param lengths Their lengths.
+ * @param request The request.
+ */
+void _bind_params(const struct HTTPRoute *route, const char **values, size_t *lengths, struct HTTPRequest *request)
+{
+  struct HTTPFields *params = &request->params;
+  params->count = 0;
+  size_t used = 0;
+  int length;
+  const char *segment;
+  for (int depth = 0, i = 0; (segment = _segment_at(route->pattern, depth, &length)) != NULL; depth++)
+  {
+    if (!_is_param(segment, length))
+      continue;
+    if (used + lengths[i] + 1 <= sizeof(request->params_buffer))
+    {
+      struct HTTPField *field = &params->fields[params->count++];
+      field->key.data = (char *)segment + 1;
+      field->key.length = length - 2;
+      field->value.data = request->params_buffer + used;
+      field->value.length = lengths[i];
+      memcpy(field->value.data, values[i], lengths[i]);
+      field->value.data[lengths[i]] = '\0';
+      used += lengths[i] + 1;
+    }
+    i++;
+  }
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include "networking/http/http_server.h"
 #include "systems.h"
 #include "logger/logger.h"
@@ -7,6 +8,10 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/stat.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
@@ -14,41 +19,25 @@
 
 void http_launch(struct HTTPServer *server);
 void *http_handler(void *arg);
+void *http_event_loop_thread(void *arg);
 
 void register_routes(struct HTTPServer *server, char *(*callback)(struct HTTPServer *server, struct HTTPRequest *request), char *uri, int num_methods, ...);
+void stream_body(struct HTTPServer *server, char *uri, size_t max_body_size);
+void require_auth(struct HTTPServer *server, char *uri);
 
 /* Public helper functions */
 
-char *_404(size_t *size);
-char *_400(size_t *size);
+char *_401(size_t *size);
+char *_404(struct Arena *arena, size_t *size);
+char *_400(struct Arena *arena, size_t *size);
 char *_455(size_t *size);
 const char *get_content_type(const char *uri);
-char *server_resource(char *uri, size_t *size);
+char *server_resource(struct HTTPRequest *request, char *uri, size_t *size);
+int parse_ranges(const char *range, off_t file_size, off_t *starts, off_t *ends);
+char *content_disposition(struct Arena *arena, const char *filename);
 
-int is_match_method(char *method, int methods[9]);
-
-/* Private data types */
-
-/**
- * The client server struct is used as an argument for the handler method.
- * By necessity, handler takes one void pointer as an argument, but both the client address and server reference are required.
- */
-struct ClientServer
-{
-  int client;                // The client socket
-  struct HTTPServer *server; // The server instance
-};
-
-/**
- * The route struct is stored in the HTTPServer.routes dictionary as an encapsulation of the methods, uri, and function associated with a given route.
- */
-struct Route
-{
-  int methods[9]; // The HTTP methods that are allowed for this route
-  char *uri;      // The URI that this route is for
-  // The callback function that will be called when this route is requested
-  char *(*route_callback)(struct HTTPServer *server, struct HTTPRequest *request);
-};
+int wants_keep_alive(struct HTTPRequest *request);
+void queue_response(struct HTTPRequest *request, char *response, size_t size, int keep_alive);
 
 /* Constructor */
 
@@ -63,18 +52,22 @@ struct Route
 struct HTTPServer http_server_constructor(u_long interface, int port)
 {
   struct HTTPServer server;
-  server.server = server_constructor(AF_INET, SOCK_STREAM, 0, interface, port, 255);
-  server.routes = dictionary_constructor(compare_string_keys);
+  server.server = server_constructor(AF_INET, SOCK_STREAM, 0, interface, port, SOMAXCONN);
+  server.router = http_router_constructor();
   server.register_routes = register_routes;
+  server.stream_body = stream_body;
+  server.require_auth = require_auth;
   server.launch = http_launch;
   server.pool = NULL;
+  server.loops = NULL;
+  server.num_loops = 0;
   log_info("Http server initialized on port %s:%ld", inet_ntoa(server.server.address.sin_addr), ntohs(server.server.address.sin_port));
 
   return server;
 }
 
 /**
- * It's a wrapper around the server destructor that also destroys the routes dictionary
+ * It's a wrapper around the server destructor that also destroys the routes
  *
  * @param server The server object.
  */
@@ -82,185 +75,298 @@ void http_server_destructor(struct HTTPServer *server)
 {
   if (server->pool != NULL)
     thread_pool_destructor(server->pool);
+  for (int i = 0; i < server->num_loops; i++)
+  {
+    // The first loop shares the server's own socket, which server_destructor closes.
+    if (i > 0)
+      close(server->loops[i]->listener);
+    http_event_loop_destructor(server->loops[i]);
+  }
+  free(server->loops);
   server_destructor(&server->server);
-  dictionary_destructor(&server->routes, NULL, NULL);
+  http_router_destructor(&server->router);
 }
 
 /**
- * Adds a specified route to the dictionary associated with a given HTTP server.
+ * Adds a specified route to the router of a given HTTP server. Routes are registered before the server is launched.
  *
  * @param server The server to register the route with.
  * @param callback The function to be called when the route is accessed.
- * @param uri The URI to register.
+ * @param uri The URI to register; a segment between braces, e.g. /file/{id}, is a path parameter of the request.
  * @param num_methods The number of methods that the route should be registered for.
  */
 void register_routes(struct HTTPServer *server, char *(*callback)(struct HTTPServer *server, struct HTTPRequest *request), char *uri, int num_methods, ...)
 {
-  struct Route route;
   // Iterate over the list of methods provided.
+  unsigned int mask = 0;
   va_list methods;
   va_start(methods, num_methods);
   for (int i = 0; i < num_methods; i++)
   {
-    route.methods[i] = va_arg(methods, int);
+    mask |= 1u << va_arg(methods, int);
+  }
+  va_end(methods);
+  server->router.add(&server->router, uri, mask, callback);
+}
+
+/**
+ * It marks a registered route as reading its request body itself. The event loop hands such requests to a worker as
+ * soon as their header block is in, and the route streams the body with request->save_body.
+ *
+ * @param server A pointer to the HTTPServer struct.
+ * @param uri The URI of a registered route.
+ * @param max_body_size The largest body the route accepts.
+ */
+void stream_body(struct HTTPServer *server, char *uri, size_t max_body_size)
+{
+  struct HTTPRoute *route = server->router.find(&server->router, uri);
+  if (route == NULL)
+  {
+    log_warn("Cannot stream the body of %s: no such route", uri);
+    return;
+  }
+  route->max_body_size = max_body_size;
+}
+
+/**
+ * It marks a registered route as only served to authenticated clients: requests without an Authorization header are
+ * answered 401 by the server, without running the route. The route still checks the credentials themselves.
+ *
+ * @param server A pointer to the HTTPServer struct.
+ * @param uri The URI of a registered route.
+ */
+void require_auth(struct HTTPServer *server, char *uri)
+{
+  struct HTTPRoute *route = server->router.find(&server->router, uri);
+  if (route == NULL)
+  {
+    log_warn("Cannot require authentication for %s: no such route", uri);
+    return;
   }
-  // Register the URI.
-  char buffer[strlen(uri)];
-  route.uri = buffer;
-  strcpy(route.uri, uri);
-  // Copy the desired function.
-  route.route_callback = callback;
-  // Save the route in the server's dictionary.
-  server->routes.insert(&server->routes, uri, sizeof(char[strlen(uri)]), &route, sizeof(route));
+  route->require_auth = 1;
+}
+
+/**
+ * It looks up how large a body the route of a URI takes streamed.
+ *
+ * @param server A pointer to the HTTPServer struct.
+ * @param uri The URI, not NUL terminated.
+ * @param length The length of the URI.
+ *
+ * @return The largest body the route streams, or 0 if its bodies are buffered.
+ */
+size_t http_route_body_limit(struct HTTPServer *server, const char *uri, size_t length)
+{
+  const struct HTTPRoute *route = server->router.match(&server->router, uri, length, NULL);
+  return route != NULL ? route->max_body_size : 0;
 }
 
 /**
- * It creates a thread pool, accepts a client, and passes the client off to the thread pool
+ * It creates the worker pool and one event loop per core, each accepting on its own SO_REUSEPORT listener.
+ * The first loop runs in the calling thread, so this function does not return while the server is up.
  *
  * @param server A pointer to the HTTPServer struct.
  */
 void http_launch(struct HTTPServer *server)
 {
   log_info("Http server launched... Waiting for clients...");
-  // Initialize a thread pool to handle clients.
-  struct ThreadPool *thread_pool = thread_pool_constructor(20);
-  server->pool = thread_pool;
-  // Cast some of the member variables from the server.
-  struct sockaddr *sock_addr = (struct sockaddr *)&server->server.address;
-  socklen_t address_length = (socklen_t)sizeof(server->server.address);
-  // An infinite loop allows the server to continuously accept new clients.
-  while (1)
+  // Writes to a socket closed by the peer must fail with EPIPE instead of killing the process.
+  signal(SIGPIPE, SIG_IGN);
+  // The routes never change from now on, so that every worker matches them without locks.
+  server->router.freeze(&server->router);
+  // Initialize a thread pool to run the route callbacks.
+  server->pool = thread_pool_constructor(HTTP_NUM_WORKERS);
+
+  long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int num_loops = num_cores > 0 ? (int)num_cores : 1;
+  server->loops = malloc(sizeof(struct HTTPEventLoop *) * num_loops);
+  server->num_loops = 0;
+  for (int i = 0; i < num_loops; i++)
+  {
+    int listener = i == 0 ? server->server.socket : server_reuseport_socket(&server->server);
+    if (listener < 0)
+    {
+      log_warn("Failed to open listener for event loop %d", i);
+      break;
+    }
+    struct HTTPEventLoop *loop = http_event_loop_constructor(server, listener);
+    if (loop == NULL)
+    {
+      if (i > 0)
+        close(listener);
+      break;
+    }
+    server->loops[server->num_loops++] = loop;
+  }
+  if (server->num_loops == 0)
+  {
+    log_fatal("Failed to start any event loop");
+    return;
+  }
+  log_info("Http server running %d event loops", server->num_loops);
+
+  for (int i = 1; i < server->num_loops; i++)
   {
-    // Create an instance of the ClientServer struct.
-    struct ClientServer *client_server = malloc(sizeof(struct ClientServer));
-    // Accept an incoming connection.
-    client_server->client = accept(server->server.socket, sock_addr, &address_length);
-    client_server->server = server;
-    // Pass the client off to the thread pool.
-    struct ThreadJob job = thread_job_constructor(http_handler, client_server);
-    thread_pool->add_work(thread_pool, job);
+    struct HTTPEventLoop *loop = server->loops[i];
+    if (pthread_create(&loop->thread, NULL, http_event_loop_thread, loop) == 0)
+      loop->has_thread = 1;
+    else
+      log_error("Failed to start event loop %d", i);
   }
+  server->loops[0]->run(server->loops[0]);
+}
+
+/**
+ * The thread function of the additional event loops.
+ *
+ * @param arg A pointer to the HTTPEventLoop to run.
+ *
+ * @return NULL.
+ */
+void *http_event_loop_thread(void *arg)
+{
+  struct HTTPEventLoop *loop = (struct HTTPEventLoop *)arg;
+  loop->run(loop);
+  return NULL;
 }
 
 /**
- * The handler is used in a multithreaded environment to handle incoming connections.
+ * The handler runs on a worker thread once the event loop has buffered a complete request. It dispatches the request
+ * to its route, decides whether the connection is kept alive and hands it back to the loop, which writes the response.
  *
- * @param arg A pointer to a ClientServer struct.
+ * @param arg A pointer to the HTTPConnection holding the request.
  *
  * @return A pointer to a void.
  */
 void *http_handler(void *arg)
 {
-  // Cast the argument back to a ClientServer struct.
-  struct ClientServer *client_server = (struct ClientServer *)arg;
-  // Read the client's request.
-  char request_string[60000];
-  // int bytes_received = 0;
-  // while (recv(client_server->client, request_string, 60000, 0) > 0)
-  //   bytes_received += strlen(request_string);
-  ssize_t byte_received = recv(client_server->client, request_string, 60000, 0);
-  struct timeval tv;
-  tv.tv_sec = 0;
-  tv.tv_usec = 50000;
-  setsockopt(client_server->client, SOL_SOCKET, SO_RCVTIMEO, (const char *)&tv, sizeof tv);
-  while ((byte_received = recv(client_server->client, request_string+byte_received, 60000, 0)) > 0)
-  {
-    log_trace("Received more %ld bytes", byte_received);
-  }
-  log_trace("Request: %s", request_string);
-  // Parse the request string into a usable format.
-  struct HTTPRequest request = http_request_constructor(request_string);
-  // Extract the URI from the request.
-  char *uri = request.request_line.search(&request.request_line, "uri", sizeof("uri"));
-  char *method = request.request_line.search(&request.request_line, "method", sizeof("method"));
-  // Find the corresponding route in the server's dictionary.
-  // log
+  struct HTTPConnection *connection = (struct HTTPConnection *)arg;
+  struct HTTPServer *server = connection->loop->server;
+  struct HTTPRequest *request = &connection->request;
+  log_trace("Request: %.*s", (int)connection->request_length, connection->buffer);
+  // Binding the request NUL terminates it in place, overwriting the first byte of any request pipelined behind a
+  // buffered body, which is put back once the route is done with the request.
+  char pipelined = connection->buffer[connection->request_length];
+  request->bind(request, connection->buffer);
+  char *uri = request->uri.data;
+  char *method = request->method.data;
+  char address[INET_ADDRSTRLEN];
   log_info(
-      "Request from %s:%ld - method: %s - route: %s",
-      inet_ntoa(client_server->server->server.address.sin_addr),
-      ntohs(client_server->server->server.address.sin_port), method, uri);
-
-  struct Route *route = client_server->server->routes.search(&client_server->server->routes, uri, sizeof(char[strlen(uri)]));
-  // Process the request and respond to the client.
+      "Request from %s:%d - method: %s - route: %s",
+      inet_ntop(AF_INET, &connection->address.sin_addr, address, sizeof(address)),
+      ntohs(connection->address.sin_port), method, uri);
+
+  // Find the corresponding route, and the parameters of its path.
+  const struct HTTPRoute *route = server->router.match(&server->router, uri, request->uri.length, request);
+  // Process the request and prepare the response for the event loop.
+  // Responses are string literals or live in the arena of the request, which goes with it.
   char *response;
   size_t response_size;
 
   if (route)
   {
-    if (is_match_method(method, route->methods))
+    if (!(route->methods & (1u << http_method_code(method))))
     {
-      response = route->route_callback(client_server->server, &request);
-      response_size = sizeof(char[strlen(response)]);
+      response = _455(&response_size);
+    }
+    else if (route->require_auth && request->header_fields.search(&request->header_fields, "Authorization", sizeof("Authorization")) == NULL)
+    {
+      response = _401(&response_size);
     }
     else
     {
-      response = _455(&response_size);
+      response = route->callback(server, request);
+      response_size = strlen(response);
     }
   }
   else
   {
-    response = server_resource(uri, &response_size);
+    response = server_resource(request, uri, &response_size);
   }
-  write(client_server->client, response, response_size);
-  write(client_server->client, response, sizeof(char[strlen(response)]));
-  close(client_server->client);
-  // Free the ClientServer object.
-  free(client_server);
 
-  http_request_destructor(&request);
+  if (request->stream_body)
+    connection->request_length = request->length; // Up to where the route read the body.
+  else
+    connection->buffer[connection->request_length] = pipelined;
+
+  connection->requests_served++;
+  connection->keep_alive = wants_keep_alive(request) && connection->requests_served < HTTP_KEEP_ALIVE_MAX;
+  // The rest of a body the route did not read cannot be told apart from the next request.
+  if (request->stream_body && !request->body_consumed)
+    connection->keep_alive = 0;
+  queue_response(request, response, response_size, connection->keep_alive);
 
+  connection->loop->complete(connection->loop, connection);
   return NULL;
 }
 
 /**
  * Joins the contents of multiple files into one.
  *
+ * @param arena The arena the contents are copied into.
  * @param num_templates The number of templates to render.
  *
- * @return A pointer to the first character in the buffer.
+ * @return A pointer to the first character of the NUL terminated contents.
  */
-char *render_template(int num_templates, ...)
+char *render_template(struct Arena *arena, int num_templates, ...)
 {
-  // Create a buffer to store the data in.
-  char *buffer = malloc(30000);
-  int buffer_position = 0;
-  char c;
-  FILE *file;
-  // Iterate over the files given as arguments.
+  // Size the buffer for all the files first, then read each one into it.
+  size_t total = 0;
   va_list files;
   va_start(files, num_templates);
-  // Read the contents of each file into the buffer.
   for (int i = 0; i < num_templates; i++)
   {
-    char *path = va_arg(files, char *);
-    file = fopen(path, "r");
+    struct stat status;
+    if (stat(va_arg(files, char *), &status) == 0 && S_ISREG(status.st_mode))
+      total += status.st_size;
+  }
+  va_end(files);
+
+  char *buffer = arena->alloc(arena, total + 1);
+  size_t buffer_position = 0;
+  va_start(files, num_templates);
+  for (int i = 0; i < num_templates; i++)
+  {
+    FILE *file = fopen(va_arg(files, char *), "r");
     if (file == NULL)
       continue;
-    while ((c = fgetc(file)) != EOF)
-    {
-      buffer[buffer_position] = c;
-      buffer_position += 1;
-    }
+    buffer_position += fread(buffer + buffer_position, 1, total - buffer_position, file);
+    fclose(file);
   }
   va_end(files);
+  buffer[buffer_position] = '\0';
   return buffer;
 }
 
+/**
+ * It answers a request of a route requiring authentication that carries no credentials
+ *
+ * @param size the pointer to the size of the response
+ *
+ * @return A pointer to a string that is the 401 response.
+ */
+char *_401(size_t *size)
+{
+  char *response = "HTTP/1.1 401 Unauthorized\r\n"
+                   "Content-Length: 0\r\n\r\n";
+  *size = strlen(response);
+  return response;
+}
+
 /**
  * It takes a pointer to a size_t, and returns a pointer to a char
  *
+ * @param arena The arena of the request, the response is built in.
  * @param size the pointer to the size of the response
  *
  * @return A pointer to a string that is the 404 response.
  */
-char *_404(size_t *size)
+char *_404(struct Arena *arena, size_t *size)
 {
-  const char *c404 = "HTTP/1.1 404 Not Found\r\n"
-                     "Connection: close\r\n"
-                     "Content-Length: ";
-  char *template_response = render_template(1, "public/404.html");
-  char *response = malloc(strlen(template_response) + strlen(c404) + 10);
-  sprintf(response, "%s%ld\r\n\r\n%s", c404, strlen(template_response), template_response);
+  char *template_response = render_template(arena, 1, "public/404.html");
+  char *response = arena->format(arena, "HTTP/1.1 404 Not Found\r\n"
+                                        "Content-Length: %zu\r\n\r\n%s",
+                                 strlen(template_response), template_response);
   *size = strlen(response);
   return response;
 }
@@ -268,30 +374,25 @@ char *_404(size_t *size)
 /**
  * It takes a pointer to a size_t, and returns a pointer to a string
  *
+ * @param arena The arena of the request, the response is built in.
  * @param size the pointer to the size of the response
  *
  * @return A pointer to a string that is the response to a 400 error.
  */
-char *_400(size_t *size)
+char *_400(struct Arena *arena, size_t *size)
 {
-  const char *c400 = "HTTP/1.1 400 Bad Request\r\n"
-                     "Connection: close\r\n"
-                     "Content-Length: ";
-  char *template_response = render_template(1, "public/400.html");
-  char *response = malloc(strlen(template_response) + strlen(c400) + 10);
-  sprintf(response, "%s%ld\r\n\r\n%s", c400, strlen(template_response), template_response);
+  char *template_response = render_template(arena, 1, "public/400.html");
+  char *response = arena->format(arena, "HTTP/1.1 400 Bad Request\r\n"
+                                        "Content-Length: %zu\r\n\r\n%s",
+                                 strlen(template_response), template_response);
   *size = strlen(response);
   return response;
 }
 
 char *_455(size_t *size)
 {
-  const char *c455 = "HTTP/1.1 455 Method Not Allowed\r\n"
-                     "Connection: close\r\n"
-                     "Content-Length: 0\r\n\r\n";
-
-  char *response = malloc(strlen(c455) + 10);
-  sprintf(response, "%s", c455);
+  char *response = "HTTP/1.1 455 Method Not Allowed\r\n"
+                   "Content-Length: 0\r\n\r\n";
   *size = strlen(response);
   return response;
 }
@@ -342,97 +443,307 @@ const char *get_content_type(const char *uri)
 }
 
 /**
- * It reads the file from the disk and returns it as a string
+ * It answers with a file from the public directory, streamed by the event loop.
  *
+ * @param request The request being answered.
  * @param uri The URI of the request.
  * @param size The size of the response.
  *
- * @return A pointer to a buffer containing the HTTP response.
+ * @return A pointer to a buffer containing the HTTP response header.
  */
-char *server_resource(char *uri, size_t *size)
+char *server_resource(struct HTTPRequest *request, char *uri, size_t *size)
 {
   if (strcmp(uri, "/") == 0)
     uri = "/index.html";
 
   if (strlen(uri) > 100)
-    return _400(size);
+    return _400(&request->arena, size);
 
   if (strstr(uri, ".."))
-    return _404(size);
+    return _404(&request->arena, size);
 
   char full_path[128];
   sprintf(full_path, "public%s", uri);
 
-  FILE *fp = fopen(full_path, "rb");
+  int file = open(full_path, O_RDONLY | O_CLOEXEC);
+  if (file < 0)
+    return _404(&request->arena, size);
 
-  if (!fp)
+  char *response = serve_file(request, file, get_content_type(full_path), NULL);
+  if (response == NULL)
+    return _404(&request->arena, size);
+  *size = strlen(response);
+  return response;
+}
+
+/**
+ * It answers a request with a file. The body is not copied: the file is attached to the request and its ranges are
+ * sent with sendfile once the header is out. Range requests are honoured, unless an If-Range validator no longer
+ * matches the file, with a single part or a multipart/byteranges 206 response.
+ *
+ * @param request The request being answered; it takes ownership of the file.
+ * @param file A file descriptor open for reading.
+ * @param content_type The media type of the file.
+ * @param filename The name offered for saving the file, or NULL to let the client display it.
+ *
+ * @return The response header, in the arena of the request, or NULL if the file is not a regular file.
+ */
+char *serve_file(struct HTTPRequest *request, int file, const char *content_type, const char *filename)
+{
+  struct stat status;
+  if (fstat(file, &status) < 0 || !S_ISREG(status.st_mode))
   {
-    return _404(size);
+    close(file);
+    return NULL;
   }
+  off_t file_size = status.st_size;
+  int is_head = request->method.data != NULL && strcmp(request->method.data, "HEAD") == 0;
 
-  size_t file_size = get_file_size(full_path);
+  char etag[48];
+  sprintf(etag, "\"%lx-%lx\"", (unsigned long)status.st_mtime, (unsigned long)file_size);
+  char last_modified[32];
+  struct tm time;
+  strftime(last_modified, sizeof(last_modified), "%a, %d %b %Y %H:%M:%S GMT", gmtime_r(&status.st_mtime, &time));
 
-  if (file_size > 1048500) // 1MB
-    return _400(size);
+  // Only a strong validator equal to the current one keeps the range meaningful.
+  off_t starts[HTTP_MAX_RANGES], ends[HTTP_MAX_RANGES];
+  int num_ranges = 0;
+  char *range = request->header_fields.search(&request->header_fields, "Range", sizeof("Range"));
+  char *if_range = request->header_fields.search(&request->header_fields, "If-Range", sizeof("If-Range"));
+  if (range != NULL && (if_range == NULL || strcmp(if_range, etag) == 0 || strcmp(if_range, last_modified) == 0))
+    num_ranges = parse_ranges(range, file_size, starts, ends);
 
-  const char *content_type = get_content_type(full_path);
-#define BSIZE 1048576 // 1MB
-#define USIZE 1024
-  char *buffer = malloc(BSIZE);
-  sprintf(buffer, "HTTP/1.1 200 OK\r\n");
-  sprintf(buffer + strlen(buffer), "Connection: close\r\n");
-  sprintf(buffer + strlen(buffer), "Content-Length: %ld\r\n", file_size);
-  sprintf(buffer + strlen(buffer), "Content-Type: %s\r\n\r\n", content_type);
+  char *disposition = filename != NULL ? content_disposition(&request->arena, filename) : "";
 
-  *size = strlen(buffer);
+  char *response;
+  if (num_ranges < 0)
+  {
+    response = request->arena.format(&request->arena, "HTTP/1.1 416 Range Not Satisfiable\r\n"
+                                                      "Content-Range: bytes */%lld\r\n"
+                                                      "Content-Length: 0\r\n\r\n",
+                                     (long long)file_size);
+    close(file);
+    return response;
+  }
 
-  char temp[USIZE];
-  int r = fread(temp, 1, USIZE, fp);
-  while (r)
+  request->file = file;
+  if (num_ranges == 0)
   {
-    memcpy(buffer + *size, temp, r);
-    *size += r;
-    r = fread(temp, 1, USIZE, fp);
+    response = request->arena.format(&request->arena, "HTTP/1.1 200 OK\r\n"
+                                                      "Content-Length: %lld\r\n"
+                                                      "Content-Type: %s\r\n"
+                                                      "Accept-Ranges: bytes\r\n"
+                                                      "ETag: %s\r\n"
+                                                      "Last-Modified: %s\r\n"
+                                                      "%s\r\n",
+                                     (long long)file_size, content_type, etag, last_modified, disposition);
+    if (!is_head && file_size > 0)
+      request->append_file(request, 0, file_size);
   }
-  fclose(fp);
-  return buffer;
+  else if (num_ranges == 1)
+  {
+    response = request->arena.format(&request->arena, "HTTP/1.1 206 Partial Content\r\n"
+                                                      "Content-Length: %lld\r\n"
+                                                      "Content-Range: bytes %lld-%lld/%lld\r\n"
+                                                      "Content-Type: %s\r\n"
+                                                      "Accept-Ranges: bytes\r\n"
+                                                      "ETag: %s\r\n"
+                                                      "Last-Modified: %s\r\n"
+                                                      "%s\r\n",
+                                     (long long)(ends[0] - starts[0] + 1), (long long)starts[0], (long long)ends[0],
+                                     (long long)file_size, content_type, etag, last_modified, disposition);
+    if (!is_head)
+      request->append_file(request, starts[0], ends[0] - starts[0] + 1);
+  }
+  else
+  {
+    // Each part is preceded by its own header block; the closing delimiter ends the body.
+    char boundary[40];
+    sprintf(boundary, "%016lx%08lx", (unsigned long)status.st_mtime ^ (unsigned long)status.st_ino, (unsigned long)file_size);
+    long long content_length = 0;
+    for (int i = 0; i < num_ranges; i++)
+    {
+      char *part = request->arena.format(&request->arena, "\r\n--%s\r\n"
+                                                          "Content-Type: %s\r\n"
+                                                          "Content-Range: bytes %lld-%lld/%lld\r\n\r\n",
+                                         boundary, content_type, (long long)starts[i], (long long)ends[i],
+                                         (long long)file_size);
+      size_t part_length = strlen(part);
+      content_length += part_length + (ends[i] - starts[i] + 1);
+      if (is_head)
+        continue;
+      request->append_data(request, part, part_length);
+      request->append_file(request, starts[i], ends[i] - starts[i] + 1);
+    }
+    char *closing = request->arena.format(&request->arena, "\r\n--%s--\r\n", boundary);
+    size_t closing_length = strlen(closing);
+    content_length += closing_length;
+    if (!is_head)
+      request->append_data(request, closing, closing_length);
+
+    response = request->arena.format(&request->arena, "HTTP/1.1 206 Partial Content\r\n"
+                                                      "Content-Length: %lld\r\n"
+                                                      "Content-Type: multipart/byteranges; boundary=%s\r\n"
+                                                      "Accept-Ranges: bytes\r\n"
+                                                      "ETag: %s\r\n"
+                                                      "Last-Modified: %s\r\n"
+                                                      "%s\r\n",
+                                     content_length, boundary, etag, last_modified, disposition);
+  }
+  return response;
+}
+
+/**
+ * It builds the Content-Disposition header offering a name to save a file under. The name comes from the database
+ * and may hold any byte: a name of printable ASCII without quotes or backslashes is sent quoted, any other one
+ * percent-encoded as UTF-8 (RFC 5987), so that no byte of it can end the header line.
+ *
+ * @param arena The arena the header is built in.
+ * @param filename The name.
+ *
+ * @return The header line with its CRLF, or an empty string if the name is too long to be offered.
+ */
+char *content_disposition(struct Arena *arena, const char *filename)
+{
+  static const char hex[] = "0123456789ABCDEF";
+  size_t length = strlen(filename);
+  if (length == 0 || length > 255)
+    return "";
+
+  int plain = 1;
+  for (const unsigned char *c = (const unsigned char *)filename; *c != '\0' && plain; c++)
+    plain = *c >= 0x20 && *c < 0x7f && *c != '"' && *c != '\\';
+  if (plain)
+    return arena->format(arena, "Content-Disposition: attachment; filename=\"%s\"\r\n", filename);
+
+  char *header = arena->alloc(arena, sizeof("Content-Disposition: attachment; filename*=UTF-8''\r\n") + 3 * length);
+  char *cursor = header + sprintf(header, "Content-Disposition: attachment; filename*=UTF-8''");
+  for (const unsigned char *c = (const unsigned char *)filename; *c != '\0'; c++)
+  {
+    // The attr-chars of RFC 5987 go as they are, any other byte as %XX.
+    if ((*c >= '0' && *c <= '9') || (*c >= 'A' && *c <= 'Z') || (*c >= 'a' && *c <= 'z') || strchr("!#$&+-.^_`|~", *c) != NULL)
+      *cursor++ = *c;
+    else
+    {
+      *cursor++ = '%';
+      *cursor++ = hex[*c >> 4];
+      *cursor++ = hex[*c & 0xf];
+    }
+  }
+  strcpy(cursor, "\r\n");
+  return header;
 }
 
 /**
- * It takes a string and an array of integers, and returns 1 if the string matches one of the integers in the array
+ * It parses the value of a Range header into inclusive byte ranges of a file. Ranges past the end of the file are
+ * dropped and the others clamped to it.
  *
- * @param method The HTTP method to match.
- * @param methods an array of ints that represent the HTTP methods that are allowed for this route.
+ * @param range The value of the Range header.
+ * @param file_size The size of the file.
+ * @param starts The first byte of each range.
+ * @param ends The last byte of each range.
  *
- * @return The return value is the code of the method.
+ * @return The number of ranges, 0 if the header is malformed or asks for too many ranges and must be ignored, -1 if
+ * no range is satisfiable.
  */
-int is_match_method(char *method, int methods[9])
+int parse_ranges(const char *range, off_t file_size, off_t *starts, off_t *ends)
 {
-  int code;
-  if (strcmp(method, "GET") == 0)
-    code = GET;
-  if (strcmp(method, "POST") == 0)
-    code = POST;
-  if (strcmp(method, "PUT") == 0)
-    code = PUT;
-  if (strcmp(method, "DELETE") == 0)
-    code = DELETE;
-  if (strcmp(method, "HEAD") == 0)
-    code = HEAD;
-  if (strcmp(method, "OPTIONS") == 0)
-    code = OPTIONS;
-  if (strcmp(method, "CONNECT") == 0)
-    code = CONNECT;
-  if (strcmp(method, "TRACE") == 0)
-    code = TRACE;
-  if (strcmp(method, "PATCH") == 0)
-    code = PATCH;
-
-  for (int i = 0; i < 9; i++)
+  if (strncmp(range, "bytes=", 6) != 0)
+    return 0;
+  const char *cursor = range + 6;
+  int num_specs = 0, num_ranges = 0;
+  while (1)
   {
-    if (methods[i] == code)
-      return 1;
+    while (*cursor == ' ' || *cursor == '\t')
+      cursor++;
+    if (++num_specs > HTTP_MAX_RANGES)
+      return 0;
+
+    char *end;
+    long long first = -1, last = -1;
+    if (*cursor >= '0' && *cursor <= '9')
+    {
+      first = strtoll(cursor, &end, 10);
+      cursor = end;
+    }
+    if (*cursor++ != '-')
+      return 0;
+    if (*cursor >= '0' && *cursor <= '9')
+    {
+      last = strtoll(cursor, &end, 10);
+      cursor = end;
+    }
+
+    if (first < 0)
+    {
+      // A suffix range: the last bytes of the file.
+      if (last < 0)
+        return 0;
+      if (last > 0 && file_size > 0)
+      {
+        starts[num_ranges] = last < file_size ? file_size - last : 0;
+        ends[num_ranges++] = file_size - 1;
+      }
+    }
+    else
+    {
+      if (last >= 0 && last < first)
+        return 0;
+      if (first < file_size)
+      {
+        starts[num_ranges] = first;
+        ends[num_ranges++] = last < 0 || last >= file_size ? file_size - 1 : last;
+      }
+    }
+
+    while (*cursor == ' ' || *cursor == '\t')
+      cursor++;
+    if (*cursor == '\0')
+      break;
+    if (*cursor++ != ',')
+      return 0;
   }
+  return num_ranges > 0 ? num_ranges : -1;
+}
+
+/**
+ * It tells whether the client wants the connection kept open after the response: HTTP/1.1 connections persist
+ * unless the client asks to close them, HTTP/1.0 connections only persist when the client asks for it.
+ *
+ * @param request The parsed request.
+ *
+ * @return 1 if the connection should be kept alive, 0 otherwise.
+ */
+int wants_keep_alive(struct HTTPRequest *request)
+{
+  char *connection = request->header_fields.search(&request->header_fields, "Connection", sizeof("Connection"));
+
+  if (strcmp(request->http_version.data, "HTTP/1.1") == 0)
+    return connection == NULL || strcasestr(connection, "close") == NULL;
+  return connection != NULL && strcasestr(connection, "keep-alive") != NULL;
+}
 
-  return 0;
+/**
+ * It puts the head of a response in front of the body segments the route appended, with the Connection header
+ * right after its status line. Nothing is copied: the status line and the rest of the response are sent from where
+ * the route left them, the header from a static fragment.
+ *
+ * @param request The request being answered.
+ * @param response The response returned by the route, without a Connection header; static or in the arena.
+ * @param size The size of the response.
+ * @param keep_alive Whether the connection is kept open after the response.
+ */
+void queue_response(struct HTTPRequest *request, char *response, size_t size, int keep_alive)
+{
+  static char keep_alive_header[] = "Connection: keep-alive\r\n";
+  static char close_header[] = "Connection: close\r\n";
+  char *status_end = memchr(response, '\n', size);
+  size_t status_length = status_end != NULL ? (size_t)(status_end - response) + 1 : 0;
+
+  request->prepend_data(request, response + status_length, size - status_length);
+  if (keep_alive)
+    request->prepend_data(request, keep_alive_header, sizeof(keep_alive_header) - 1);
+  else
+    request->prepend_data(request, close_header, sizeof(close_header) - 1);
+  request->prepend_data(request, response, status_length);
 }
@@ -53,6 +53,10 @@ struct Server server_constructor(int domain, int service, int protocol, u_long i
     printf("Failed to create socket...\n");
     exit(1);
   }
+  // Servers may open extra sockets on the same port (see server_reuseport_socket).
+  int enable = 1;
+  setsockopt(server.socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+  setsockopt(server.socket, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable));
   // Attempt to bind the socket to the network.
   if (bind(server.socket, (struct sockaddr *)&server.address, sizeof(server.address)) < 0)
   {
@@ -68,6 +72,32 @@ struct Server server_constructor(int domain, int service, int protocol, u_long i
   return server;
 }
 
+/**
+ * It opens another socket bound to the same address as the server with SO_REUSEPORT, so that several threads can
+ * serve the port independently and the kernel balances clients between them.
+ *
+ * @param server The server whose address should be shared.
+ *
+ * @return The new socket file descriptor, or -1 on failure.
+ */
+int server_reuseport_socket(struct Server *server)
+{
+  int sock = socket(server->domain, server->service, server->protocol);
+  if (sock < 0)
+    return -1;
+
+  int enable = 1;
+  if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) < 0 ||
+      setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0 ||
+      bind(sock, (struct sockaddr *)&server->address, sizeof(server->address)) < 0 ||
+      (server->service == SOCK_STREAM && listen(sock, server->backlog) < 0))
+  {
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
 /**
  * It creates a socket, binds it to a port, and listens for connections
  *
@@ -0,0 +1,110 @@
+#include "networking/tftp/tftp_assembly.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+
+/**
+ * A file being uploaded in parts, by transfers with the "range" option that may run on every event loop. The file is
+ * created by the first part; the next ones may only write into it while some part is running or for
+ * TFTP_ASSEMBLY_LINGER seconds after, so that a range upload never opens a file uploaded otherwise.
+ */
+struct TFTPAssembly
+{
+  char *path;                 // The path of the file
+  int parts;                  // The number of parts being received
+  time_t ended_at;            // When the last part ended
+  struct TFTPAssembly *next;  // The next file being assembled
+};
+
+/* Private variables */
+
+static struct TFTPAssembly *assemblies = NULL;
+static pthread_mutex_t assemblies_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Private methods prototype */
+
+struct TFTPAssembly *_find_assembly(const char *path, time_t now);
+
+/* Public methods implements */
+
+/**
+ * It opens a file to write a part of it
+ *
+ * @param path The path of the file.
+ *
+ * @return The file descriptor, or -1 with errno set; EEXIST means the file exists and is not being assembled.
+ */
+int tftp_assembly_join(const char *path)
+{
+  time_t now = time(NULL);
+  pthread_mutex_lock(&assemblies_lock);
+  struct TFTPAssembly *assembly = _find_assembly(path, now);
+  int fd = open(path, O_WRONLY | O_CLOEXEC | (assembly == NULL ? O_CREAT | O_EXCL : 0), 0644);
+  if (fd >= 0)
+  {
+    if (assembly == NULL)
+    {
+      assembly = malloc(sizeof(struct TFTPAssembly));
+      assembly->path = strdup(path);
+      assembly->parts = 0;
+      assembly->next = assemblies;
+      assemblies = assembly;
+    }
+    assembly->parts++;
+  }
+  pthread_mutex_unlock(&assemblies_lock);
+  return fd;
+}
+
+/**
+ * It tells that a part of a file ended, received or not
+ *
+ * @param path The path of the file, as given to tftp_assembly_join.
+ */
+void tftp_assembly_leave(const char *path)
+{
+  time_t now = time(NULL);
+  pthread_mutex_lock(&assemblies_lock);
+  struct TFTPAssembly *assembly = _find_assembly(path, now);
+  if (assembly != NULL && assembly->parts > 0)
+  {
+    assembly->parts--;
+    assembly->ended_at = now;
+  }
+  pthread_mutex_unlock(&assemblies_lock);
+}
+
+/* Private methods implements */
+
+/**
+ * It finds the assembly of a file, whose lock must be held, and drops the assemblies that are over on the way
+ *
+ * @param path The path of the file.
+ * @param now The current time.
+ *
+ * @return The assembly, or NULL if the file is not being assembled.
+ */
+struct TFTPAssembly *_find_assembly(const char *path, time_t now)
+{
+  struct TFTPAssembly **link = &assemblies;
+  struct TFTPAssembly *found = NULL;
+  while (*link != NULL)
+  {
+    struct TFTPAssembly *assembly = *link;
+    if (assembly->parts == 0 && now - assembly->ended_at > TFTP_ASSEMBLY_LINGER)
+    {
+      *link = assembly->next;
+      free(assembly->path);
+      free(assembly);
+      continue;
+    }
+    if (strcmp(assembly->path, path) == 0)
+      found = assembly;
+    link = &assembly->next;
+  }
+  return found;
+}
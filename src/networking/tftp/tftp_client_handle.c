@@ -1,805 +1,1253 @@
+#define _GNU_SOURCE
 #include "networking/tftp/tftp_client_handle.h"
-#include "networking/checksum.h"
-#include "setting.h"
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <netdb.h>
-#include <arpa/inet.h>
+#include "networking/tftp/tftp_event_loop.h"
+#include "networking/tftp/tftp_server.h"
+#include "networking/tftp/tftp_assembly.h"
+
+#include <stdlib.h>
+#include <limits.h>
 #include <string.h>
-#include <time.h>
-#include <math.h>
+#include <strings.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <ctype.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <stdio.h>
+#include <arpa/inet.h>
+#include <time.h>
 
-int __compare_address(const struct sockaddr_in *a1, const struct sockaddr_in *a2)
-{
-  if (a1->sin_addr.s_addr == a2->sin_addr.s_addr && a1->sin_port == a2->sin_port)
-    return (1);
-  return (0);
-}
-
-int _read_header(TFTPHeader *header, Packet *packet)
-{
-  TFTPHeader *tmp = (TFTPHeader *)packet;
-  header->checksum = tmp->checksum;
-  header->opcode = tmp->opcode;
-  return (0);
-}
-
-int _read_packet(uint8_t *dest, Packet *packet, uint16_t size)
-{
-  memcpy(dest, packet->data, size);
-  return (0);
-}
+/* The options a handler acknowledged, as returned by __map_options */
 
-TFTPOptions *_process_option(TFTPClientHandler *handler, uint8_t *options);
-void __map_options(TFTPClientHandler *handler, TFTPOptions *options);
-void free_options(TFTPOptions *options);
+#define OPTION_BLKSIZE 1
+#define OPTION_WINDOWSIZE 2
+#define OPTION_SACK 4
+#define OPTION_RANGE 8
+#define OPTION_TSIZE 16
+#define OPTION_OFFSET 32
+#define OPTION_ROLLOVER 64
 
-void __recv_rq(TFTPClientHandler *handler, uint16_t *opcode, char *file_name, char *file_mode);
-PacketBuffer *_recv_packet_mul(TFTPClientHandler *handler, uint16_t *opcodes, int min_data_length,
-                               int handle_timeout);
-PacketBuffer *_recv(TFTPClientHandler *handler, int handle_timeout);
-PacketBuffer *_recv_packet(TFTPClientHandler *handler, uint16_t opcode, int min_data_length, int handle_timeout);
-PacketBuffer *_recv_data(TFTPClientHandler *handler, int handle_timeout);
-int _recv_ack(TFTPClientHandler *handler, int handle_timeout, int *block_id);
-void _recv_file(TFTPClientHandler *handler, const char *filename);
+#define WINDOW_MAP_BITS (TFTP_WINDOW_MAP_WORDS * 64)
 
-void _send_err(TFTPClientHandler *handler, int error_code, char *error_message, struct sockaddr_in *addr);
-void _send(TFTPClientHandler *handler, const uint8_t *data, ssize_t data_len, struct sockaddr_in *addr);
-void _send_ack(TFTPClientHandler *handler, int block_number);
-void _send_oack(TFTPClientHandler *handler, TFTPOptions *options);
-void _send_file(TFTPClientHandler *handler, const char *filename, ssize_t buff_size);
-void _send_data(TFTPClientHandler *handler, const uint8_t *data, ssize_t data_len, int block_id);
-int __send_blocks(TFTPClientHandler *handler, const uint8_t *buffer, ssize_t buff_size, int outer_block_id, int inner_block_id);
-void __resend_last_packet(TFTPClientHandler *handler);
+/* Private methods prototype */
 
-char *_error_occurred(TFTPClientHandler *handler, int error_code, char *error_message, struct sockaddr_in *addr);
-void _check_error(TFTPClientHandler *handler, PacketBuffer *packet, uint16_t *expected_opcodes);
-void _terminate(TFTPClientHandler *handler, int error_code, const char *message, char *error_message);
+TFTPOptions *_process_option(const uint8_t *options, size_t length, TFTPOptions *storage, int capacity);
+int __map_options(TFTPClientHandler *handler, TFTPOptions *options);
 
-void __handle_read(TFTPClientHandler *handler, const char *file_name);
-void __handle_write(TFTPClientHandler *handler, const char *file_name);
+int __handle_read(TFTPClientHandler *handler, int accepted);
+int __handle_write(TFTPClientHandler *handler, int accepted);
+int _recv_ack(TFTPClientHandler *handler, const uint8_t *packet, size_t length);
+int _recv_data(TFTPClientHandler *handler, const uint8_t *packet, size_t length);
 
-TFTPClientHandler *create_handler(const uint8_t *initial_buffer, size_t buffer_size, struct sockaddr_in *client_address, struct TFTPServer *server)
+int __send_blocks(TFTPClientHandler *handler);
+int __resend_holes(TFTPClientHandler *handler);
+long _pace(TFTPClientHandler *handler, long block);
+void _update_rate(TFTPClientHandler *handler);
+int _send_data(TFTPClientHandler *handler, long block);
+void _send_ack(TFTPClientHandler *handler, long block);
+void _send_oack(TFTPClientHandler *handler, int accepted);
+void __resend_last_packet(TFTPClientHandler *handler);
+int _terminate(TFTPClientHandler *handler, TFTPErrorCodes error_code, const char *message);
+int _is_safe_path(const char *file_name);
+int _publish_upload(TFTPClientHandler *handler);
+int _parse_size(const char *value, off_t *size);
+
+void _start_timing(TFTPClientHandler *handler, long block);
+void _sample_rtt(TFTPClientHandler *handler);
+int _timeout(TFTPClientHandler *handler);
+long _now_us(void);
+int _map_test(const uint64_t *map, long index);
+void _map_set(uint64_t *map, long index);
+void _map_shift(uint64_t *map, long count);
+long _map_leading(const uint64_t *map);
+long _map_last(const uint64_t *map);
+uint16_t _wire_block(const TFTPClientHandler *handler, long block);
+long _unwrap_block(const TFTPClientHandler *handler, long base, uint16_t wire);
+
+/* Public methods implements */
+
+/**
+ * It starts a transfer from the request that opened it: it checks the request, negotiates the options and sends the
+ * first packet. When the request is refused, the client gets an error and no handler is created.
+ *
+ * @param loop The event loop that will serve the transfer.
+ * @param packet The request, checksum included.
+ * @param length The length of the request.
+ * @param client_address The address of the client.
+ *
+ * @return A pointer to the handler, or NULL if the request was refused.
+ */
+TFTPClientHandler *create_handler(struct TFTPEventLoop *loop, const uint8_t *packet, size_t length, const struct sockaddr_in *client_address)
 {
-  TFTPClientHandler *handler = (TFTPClientHandler *)malloc(sizeof(TFTPClientHandler));
-  handler->__packet_buffer = malloc(sizeof(Packet));
-  handler->__last_packet = malloc(sizeof(Packet));
+  uint16_t opcode;
+  memcpy(&opcode, packet + 2, 2);
+  opcode = ntohs(opcode);
+
+  // filename \0 mode \0 [option \0 value \0]...
+  const char *file_name = (const char *)packet + sizeof(TFTPHeader);
+  const uint8_t *end = packet + length;
+  const uint8_t *mode = memchr(file_name, '\0', end - (const uint8_t *)file_name);
+  const uint8_t *options = mode == NULL ? NULL : memchr(mode + 1, '\0', end - mode - 1);
+  if (options == NULL || *file_name == '\0')
+  {
+    send_error(loop, client_address, ILLEGAL_OPERATION, "Invalid request");
+    return NULL;
+  }
+  mode++;
+  options++;
+  if (strcasecmp((const char *)mode, "octet") != 0)
+  {
+    send_error(loop, client_address, ILLEGAL_OPERATION, "Only octet mode is supported");
+    return NULL;
+  }
+  if (!_is_safe_path(file_name))
+  {
+    send_error(loop, client_address, ACCESS_VIOLATION, "Invalid file name");
+    return NULL;
+  }
+
+  // a handler of a finished transfer, if the loop kept one
+  TFTPClientHandler *handler = loop->spare_handlers;
+  if (handler != NULL)
+  {
+    loop->spare_handlers = handler->_next;
+    loop->num_spare_handlers--;
+  }
+  else
+    handler = malloc(sizeof(TFTPClientHandler));
+  handler->addr = *client_address;
+  handler->loop = loop;
+  handler->opcode = opcode;
+  handler->fd = -1;
+  handler->file_size = 0;
+  handler->map = NULL;
+  handler->_range_start = 0;
+  handler->_range_end = -1;
+  handler->_assembling = 0;
+  handler->_tsize = -1;
+  handler->_upload_path[0] = '\0';
   handler->_block_size = BLOCK_SIZE;
   handler->_window_size = 1;
-  handler->_check_addr = 1;
-  handler->_addr = client_address;
-  handler->server = tftp_server_constructor(server->server.interface, 0, server->is_allow_upload, server->upload_dir);
-
-  struct sockaddr_in sin;
-  socklen_t len = sizeof(sin);
-  if (getsockname(handler->server.server.socket, (struct sockaddr *)&sin, &len) == -1)
-    perror("getsockname");
+  handler->_rollover = 0;
+  handler->_acked = 0;
+  handler->_sent = 0;
+  handler->_total = 0;
+  handler->_highest = 0;
+  handler->_recover = 0;
+  handler->_in_recovery = 0;
+  handler->_dup_acks = 0;
+  handler->_cwnd = 1;
+  handler->_paced = 0;
+  tftp_pacer_init(&handler->_pacer, loop->server->transfer_rate);
+  handler->_received = 0;
+  handler->_last_block = 0;
+  handler->_pending = 0;
+  handler->_gap_acked = 0;
+  handler->_sack = 0;
+  memset(handler->_window_map, 0, sizeof(handler->_window_map));
+  handler->_retries = 0;
+  handler->_timed_block = 0;
+  handler->_timed_at = 0;
+  handler->_srtt = -1;
+  handler->_rttvar = 0;
+  handler->_rto = TIMEOUT_MILLISECONDS;
+  handler->_last_length = 0;
+  handler->_next = NULL;
+  handler->_timer_prev = NULL;
+  handler->_timer_next = NULL;
+  handler->_timer_tick = -1;
+
+  int result = TFTP_FINISHED;
+  if (snprintf(handler->path, sizeof(handler->path), "%s/%s", loop->server->upload_dir, file_name) >= (int)sizeof(handler->path))
+  {
+    result = _terminate(handler, ACCESS_VIOLATION, "File name too long");
+  }
   else
   {
-    log_info("Incoming connection from (%s, %d). Binding at (%s, %d)", inet_ntoa(client_address->sin_addr), ntohs(client_address->sin_port), inet_ntoa(sin.sin_addr), ntohs(sin.sin_port));
-
-    // send new socket port to client
-    uint16_t new_port = sin.sin_port;
-    uint8_t *buffer = malloc(6);
-    bzero(buffer, 6);
-    memcpy(buffer + 2, ACK, 2);
-    memcpy(buffer + 4, &new_port, 2);
+    TFTPOptions storage[TFTP_MAX_OPTIONS];
+    TFTPOptions *requested = _process_option(options, end - options, storage, TFTP_MAX_OPTIONS);
+    int accepted = __map_options(handler, requested);
+
+    log_info("Client (%s:%d): Request %s file %s.", inet_ntoa(client_address->sin_addr), ntohs(client_address->sin_port),
+             opcode == OPCODE_RRQ ? "get" : "put", file_name);
+    if (accepted < 0)
+      result = _terminate(handler, INVALID_OPTIONS, "Invalid options received");
+    else if (opcode == OPCODE_RRQ)
+      result = __handle_read(handler, accepted);
+    else
+      result = __handle_write(handler, accepted);
+  }
 
-    uint16_t checksum = htons(checksum_(6, 0, (uint16_t *)buffer));
-    memcpy(buffer, &checksum, 2);
-    size_t byte_sent = sendto(server->server.socket, buffer, 6, 0, (struct sockaddr *)client_address, sizeof(struct sockaddr_in));
-    if (byte_sent < 1)
-    {
-      log_error("sendto() failed. (%s)", strerror(errno));
-      return NULL;
-    }
+  if (result == TFTP_FINISHED)
+  {
+    free_handler(handler);
+    return NULL;
+  }
+  return handler;
+}
 
-    free(buffer);
+/**
+ * It moves a transfer forward with a packet its client sent
+ *
+ * @param handler The transfer.
+ * @param packet The packet, checksum included.
+ * @param length The length of the packet.
+ *
+ * @return TFTP_CONTINUE, or TFTP_FINISHED once the transfer is over.
+ */
+int handle_packet(TFTPClientHandler *handler, const uint8_t *packet, size_t length)
+{
+  uint16_t opcode;
+  memcpy(&opcode, packet + 2, 2);
+  opcode = ntohs(opcode);
 
-    // recv ack
-    struct sockaddr_in peer_addr;
-    socklen_t peer_addr_len = sizeof(peer_addr);
-    buffer = malloc(6);
-    ssize_t byte_received = recvfrom(handler->server.server.socket, buffer, 6, 0, (struct sockaddr *)&peer_addr, &peer_addr_len);
-    if (byte_received < 1)
+  switch (opcode)
+  {
+  case OPCODE_RRQ:
+  case OPCODE_WRQ:
+    // The client did not get our answer to its request yet.
+    if (handler->state == HANDLER_WAIT_OACK_ACK || (handler->state == HANDLER_RECEIVING && handler->_received == 0))
+      __resend_last_packet(handler);
+    else if (handler->state == HANDLER_SENDING && handler->_acked == 0)
     {
-      log_error("recvfrom() failed. (%s)", strerror(errno));
-      return NULL;
+      handler->_sent = 0;
+      return __send_blocks(handler);
     }
-    free(buffer);
+    return TFTP_CONTINUE;
+  case OPCODE_ACK:
+    if (handler->opcode == OPCODE_RRQ)
+      return _recv_ack(handler, packet, length);
+    return TFTP_CONTINUE;
+  case OPCODE_DATA:
+    if (handler->opcode == OPCODE_WRQ)
+      return _recv_data(handler, packet, length);
+    return TFTP_CONTINUE;
+  case OPCODE_ERROR:
+    log_warn("Client (%s:%d): Transfer of %s aborted by the client.", inet_ntoa(handler->addr.sin_addr), ntohs(handler->addr.sin_port), handler->path);
+    return TFTP_FINISHED;
+  default:
+    return _terminate(handler, ILLEGAL_OPERATION, "Invalid opcode");
   }
+}
 
-  struct timeval timeout = {.tv_sec = TIMEOUT_SECOND, .tv_usec = TIMEOUT_USECOND};
-  if (setsockopt(handler->server.server.socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0)
-    perror("setsockopt set receive timeout failed\n");
-  else if (setsockopt(handler->server.server.socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0)
-    perror("setsockopt set send timeout failed\n");
-
-  if (initial_buffer != NULL)
+/**
+ * It handles the expiry of a transfer's timer: what was sent since the client last answered is sent again, with the
+ * retransmission timeout doubled, until MAX_RETRIES timeouts in a row end the transfer.
+ *
+ * @param handler The transfer.
+ *
+ * @return TFTP_CONTINUE, or TFTP_FINISHED once the transfer is over.
+ */
+int handle_timeout(TFTPClientHandler *handler)
+{
+  if (handler->state == HANDLER_DALLYING)
+    return TFTP_FINISHED;
+  if (handler->_paced)
+  {
+    handler->_paced = 0;
+    return __send_blocks(handler);
+  }
+  if (++handler->_retries > MAX_RETRIES)
   {
-    TFTPHeader *tmp = (TFTPHeader *)initial_buffer;
-    handler->__packet_buffer->packet.header.checksum = tmp->checksum;
-    handler->__packet_buffer->packet.header.opcode = tmp->opcode;
-    handler->__packet_buffer->client_address = client_address;
-    memcpy(handler->__packet_buffer->packet.data, initial_buffer + sizeof(TFTPHeader), buffer_size - sizeof(TFTPHeader));
-    handler->__packet_buffer->data_len = buffer_size - sizeof(TFTPHeader);
-    memcpy(handler->__packet_buffer->_raw_data, initial_buffer, buffer_size);
+    log_error("Client (%s:%d): Transfer of %s timed out.", inet_ntoa(handler->addr.sin_addr), ntohs(handler->addr.sin_port), handler->path);
+    return _terminate(handler, UNKNOWN, "Timed out");
   }
 
-  return handler;
+  log_debug("Client (%s:%d): Timeout, retrying... (%d/%d)", inet_ntoa(handler->addr.sin_addr), ntohs(handler->addr.sin_port), handler->_retries, MAX_RETRIES);
+  // Karn: the answer to a packet sent again says nothing of the round trip.
+  handler->_timed_at = 0;
+  if (handler->state == HANDLER_SENDING)
+  {
+    // go back to the first block not acknowledged, skipping those the client said it has
+    handler->_in_recovery = 0;
+    handler->_dup_acks = 0;
+    handler->_cwnd = 1;
+    _update_rate(handler);
+    handler->_sent = handler->_acked;
+    return __send_blocks(handler);
+  }
+  handler->_pending = 0;
+  if (handler->state == HANDLER_RECEIVING && handler->_received > 0)
+    _send_ack(handler, handler->_received);
+  else
+    __resend_last_packet(handler);
+  handler->loop->arm_timer(handler->loop, handler, _timeout(handler));
+  return TFTP_CONTINUE;
 }
 
+/**
+ * It frees a handler and closes its file. Up to TFTP_SPARE_HANDLERS handlers are kept by the loop instead, for the
+ * transfers to come.
+ *
+ * @param handler The handler to free.
+ */
 void free_handler(TFTPClientHandler *handler)
 {
-  tftp_server_destructor(&handler->server);
-  free(handler->__packet_buffer);
-  free(handler->__last_packet);
-  free(handler);
-}
+  if (handler->map != NULL)
+  {
+    // Queued blocks still point into the mapping.
+    handler->loop->flush(handler->loop);
+    munmap((void *)handler->map, handler->file_size);
+  }
+  if (handler->fd >= 0)
+    close(handler->fd);
+  if (handler->_assembling)
+    tftp_assembly_leave(handler->path);
 
-char *_error_occurred(TFTPClientHandler *handler, int error_code, char *error_message, struct sockaddr_in *addr)
-{
-  if (error_message == NULL)
+  struct TFTPEventLoop *loop = handler->loop;
+  if (loop->num_spare_handlers >= TFTP_SPARE_HANDLERS)
   {
-    error_message = get_message(error_code);
+    free(handler);
+    return;
   }
-  _send_err(handler, error_code, error_message, addr);
-  return error_message;
+  handler->_next = loop->spare_handlers;
+  loop->spare_handlers = handler;
+  loop->num_spare_handlers++;
 }
 
-void _terminate(TFTPClientHandler *handler, int error_code, const char *message, char *error_message)
+/**
+ * It sends an error packet to a client
+ *
+ * @param loop The event loop whose socket sends the packet.
+ * @param address The address of the client.
+ * @param error_code The TFTP error code.
+ * @param message The message of the error.
+ */
+void send_error(struct TFTPEventLoop *loop, const struct sockaddr_in *address, TFTPErrorCodes error_code, const char *message)
 {
-  error_message = _error_occurred(handler, error_code, error_message, NULL);
-  tftp_server_destructor(&handler->server);
-
-  log_error("Terminated with error %d: %s; cause: %s", error_code, error_message, message);
-  longjmp(handler->buf, 1);
+  size_t message_length = strnlen(message, TFTP_CONTROL_PACKET_SIZE - 7);
+  uint8_t *packet = loop->reserve(loop, 7 + message_length);
+  uint16_t code = htons((uint16_t)error_code);
+
+  memcpy(packet + 2, ERROR, 2);
+  memcpy(packet + 4, &code, 2);
+  memcpy(packet + 6, message, message_length);
+  packet[6 + message_length] = '\0';
+  loop->queue(loop, address, packet, 7 + message_length);
 }
 
-void _check_error(TFTPClientHandler *handler, PacketBuffer *packet_buffer, uint16_t *expected_opcodes)
+/* Private methods implements */
+
+/**
+ * It starts serving a read request: it opens and maps the file, then sends the OACK if options were acknowledged,
+ * or the first window of blocks otherwise. Files of the upload directory are replaced, never truncated in place, so
+ * the mapping stays valid; a file that cannot be mapped is read with pread. With the "range" option, only the bytes of
+ * the range are sent, as if they were the whole file; a range past the end of the file is cut there. The "offset"
+ * option resumes a download: it is the range from the offset to the end of the file.
+ *
+ * @param handler The transfer.
+ * @param accepted The options acknowledged by __map_options.
+ *
+ * @return TFTP_CONTINUE, or TFTP_FINISHED if the request was refused.
+ */
+int __handle_read(TFTPClientHandler *handler, int accepted)
 {
-  if (packet_buffer->packet.header.opcode == *(uint16_t *)ERROR)
+  handler->fd = open(handler->path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (handler->fd < 0 || fstat(handler->fd, &st) < 0 || !S_ISREG(st.st_mode))
+    return _terminate(handler, FILE_NOT_FOUND, "File not found");
+
+  handler->file_size = st.st_size;
+  // a file larger than the address space is read with pread
+  if (handler->file_size > 0 && (uint64_t)handler->file_size <= SIZE_MAX)
   {
-    uint16_t error_code = *(uint16_t *)(packet_buffer->packet.data);
-    uint8_t *error_message = malloc(packet_buffer->data_len - 2);
-    memcpy(error_message, packet_buffer->packet.data + 2, packet_buffer->data_len - 2);
-    log_error("%s - %s", get_message(error_code), error_message);
-    longjmp(handler->buf, 1);
+    void *map = mmap(NULL, handler->file_size, PROT_READ, MAP_SHARED, handler->fd, 0);
+    if (map != MAP_FAILED)
+    {
+      madvise(map, handler->file_size, MADV_SEQUENTIAL);
+      handler->map = map;
+    }
   }
-
-  // check opcode in expected opcodes
-  uint16_t *tmp = expected_opcodes;
-  while (*tmp != 0)
+  if (handler->_range_start > handler->file_size)
+    return _terminate(handler, INVALID_OPTIONS, "Range not satisfiable");
+  if (handler->_range_end < 0 || handler->_range_end > handler->file_size)
+    handler->_range_end = handler->file_size;
+  if ((handler->_range_end - handler->_range_start) / handler->_block_size >= LONG_MAX)
+    return _terminate(handler, ILLEGAL_OPERATION, "File too large");
+  handler->_total = (handler->_range_end - handler->_range_start) / handler->_block_size + 1;
+  if (accepted & OPTION_TSIZE)
+    handler->_tsize = handler->_range_end - handler->_range_start;
+  handler->_cwnd = handler->_window_size;
+
+  if (accepted != 0)
   {
-    if (packet_buffer->packet.header.opcode == *tmp)
-      return;
-    tmp++;
+    handler->state = HANDLER_WAIT_OACK_ACK;
+    _start_timing(handler, 0);
+    _send_oack(handler, accepted);
+    handler->loop->arm_timer(handler->loop, handler, _timeout(handler));
+    return TFTP_CONTINUE;
   }
-  char message[17 + packet_buffer->data_len];
-  sprintf(message, "Invalid packet: ");
-  memcpy(message + 17, packet_buffer->packet.data, packet_buffer->data_len);
-  _terminate(handler, ILLEGAL_OPERATION, message, NULL);
+  handler->state = HANDLER_SENDING;
+  return __send_blocks(handler);
 }
 
-PacketBuffer *_recv(TFTPClientHandler *handler, int handle_timeout)
+/**
+ * It starts serving a write request: it creates the file, then acknowledges the request with the OACK if options were
+ * acknowledged, or with ACK 0 otherwise. The file is written as "<path>.part" and renamed once complete, so that an
+ * interrupted upload can be resumed: the "offset" option continues it from the offset asked, or from the end of what
+ * was received if that is less, and the OACK tells which. With the "range" option, the request uploads a part of the
+ * file: several parts, on as many transfers, write into the same file, which the first one creates. With "tsize",
+ * the space of the file is reserved first.
+ *
+ * @param handler The transfer.
+ * @param accepted The options acknowledged by __map_options.
+ *
+ * @return TFTP_CONTINUE, or TFTP_FINISHED if the request was refused.
+ */
+int __handle_write(TFTPClientHandler *handler, int accepted)
 {
-  PacketBuffer *result = NULL;
-  if (handler->__packet_buffer != NULL)
+  if (handler->loop->server->is_allow_upload == 0)
+    return _terminate(handler, ACCESS_VIOLATION, "Upload not allowed");
+
+  if (accepted & OPTION_RANGE)
   {
-    result = handler->__packet_buffer;
-    handler->__packet_buffer = NULL;
-    return result;
+    strcpy(handler->_upload_path, handler->path);
+    handler->fd = tftp_assembly_join(handler->path);
+    handler->_assembling = handler->fd >= 0;
   }
+  else if (access(handler->path, F_OK) == 0)
+    return _terminate(handler, FILE_ALREADY_EXISTS, "File already exists");
   else
   {
-    ssize_t bytes_received = 0;
-    result = malloc(sizeof(PacketBuffer));
-    struct sockaddr_in client_address;
-    socklen_t client_len = sizeof(client_address);
-
-    uint8_t data[BUF_SIZE];
-
-    if (handle_timeout == 0)
-    {
-
-      struct timeval timeout = {.tv_sec = 0, .tv_usec = 0};
-      if (setsockopt(handler->server.server.socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0)
-        perror("setsockopt set receive timeout failed\n");
-      else if (setsockopt(handler->server.server.socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0)
-        perror("setsockopt set send timeout failed\n");
-      bytes_received = recvfrom(handler->server.server.socket, data, BUF_SIZE, 0,
-                                (struct sockaddr *)&client_address, &client_len);
-      result->client_address = &client_address;
-      if (bytes_received == -1)
-      {
-        if (errno == EAGAIN || errno == EWOULDBLOCK)
-        {
-          log_error("Timeout");
-        }
-        perror("recvfrom1");
-        return NULL;
-      }
-    }
-    else
-    {
-      struct timeval timeout = {.tv_sec = TIMEOUT_SECOND, .tv_usec = TIMEOUT_USECOND};
-      if (setsockopt(handler->server.server.socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0)
-        perror("setsockopt set receive timeout failed\n");
-      else if (setsockopt(handler->server.server.socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0)
-        perror("setsockopt set send timeout failed\n");
+    sprintf(handler->_upload_path, "%s.part", handler->path);
+    handler->fd = open(handler->_upload_path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+  }
+  if (handler->fd < 0)
+  {
+    if (errno == EEXIST)
+      return _terminate(handler, FILE_ALREADY_EXISTS, "File already exists");
+    return _terminate(handler, ACCESS_VIOLATION, "Cannot create file");
+  }
 
-      int retries = 0;
+  if (!handler->_assembling)
+  {
+    // Another transfer may be writing the same file; the lock goes with the descriptor.
+    struct stat st;
+    if (flock(handler->fd, LOCK_EX | LOCK_NB) < 0)
+      return _terminate(handler, ACCESS_VIOLATION, "File being uploaded");
+    if (fstat(handler->fd, &st) < 0)
+      return _terminate(handler, UNKNOWN, "Unknown error");
+    if (!(accepted & OPTION_OFFSET) || handler->_range_start > st.st_size)
+      handler->_range_start = (accepted & OPTION_OFFSET) ? st.st_size : 0;
+    if (ftruncate(handler->fd, handler->_range_start) < 0)
+      return _terminate(handler, UNKNOWN, "Unknown error");
+    if (handler->_range_start > 0)
+      log_info("Client (%s:%d): Resuming upload of %s at byte %lld.", inet_ntoa(handler->addr.sin_addr), ntohs(handler->addr.sin_port),
+               handler->path, (long long)handler->_range_start);
+  }
+  if (handler->_tsize > handler->_range_start &&
+      fallocate(handler->fd, FALLOC_FL_KEEP_SIZE, handler->_range_start, handler->_tsize - handler->_range_start) < 0 &&
+      (errno == ENOSPC || errno == EFBIG))
+    return _terminate(handler, DISK_FULL, "Disk full");
+
+  handler->state = HANDLER_RECEIVING;
+  if (accepted != 0)
+    _send_oack(handler, accepted);
+  else
+    _send_ack(handler, 0);
+  _start_timing(handler, 1);
+  handler->loop->arm_timer(handler->loop, handler, _timeout(handler));
+  return TFTP_CONTINUE;
+}
 
-      while (retries <= MAX_RETRIES)
-      {
-        bytes_received = recvfrom(handler->server.server.socket, data, BUF_SIZE, 0,
-                                  (struct sockaddr *)&client_address, &client_len);
-        result->client_address = &client_address;
-        if (bytes_received == -1)
-        {
-          if (errno == EAGAIN || errno == EWOULDBLOCK)
-          {
-            log_error("Timeout, retrying... (%d/%d)", retries, MAX_RETRIES);
-            retries++;
-            if (retries <= MAX_RETRIES)
-            {
-              __resend_last_packet(handler);
-            }
-            continue;
-          }
-          else
-          {
-            perror("recvfrom");
-            return NULL;
-          }
-        }
-        else
-          break;
-      }
+/**
+ * It handles an ACK of a read request. An ACK that moves the window but stops short of the highest block sent means
+ * the client lost the block after it: the holes of the window are sent again at once, rather than on timeout. Until
+ * they are acknowledged, they are only sent again after TFTP_DUP_ACKS ACKs in a row that acknowledge nothing new. With the "sack" option, the ACK also tells which
+ * blocks after it the client has, and only the missing ones are sent again; without it, sending goes back to the
+ * block after the ACK.
+ *
+ * @param handler The transfer.
+ * @param packet The packet, checksum included.
+ * @param length The length of the packet.
+ *
+ * @return TFTP_CONTINUE, or TFTP_FINISHED once the last block is acknowledged.
+ */
+int _recv_ack(TFTPClientHandler *handler, const uint8_t *packet, size_t length)
+{
+  if (length < sizeof(TFTPHeader) + 2)
+    return TFTP_CONTINUE;
+  uint16_t block;
+  memcpy(&block, packet + sizeof(TFTPHeader), 2);
+  block = ntohs(block);
 
-      if (retries > MAX_RETRIES)
-      {
-        return NULL;
-      }
-    }
-    TFTPHeader *header = malloc(sizeof(TFTPHeader));
-    _read_header(header, (Packet *)data);
-    result->packet.header.checksum = ntohs(header->checksum);
-    result->packet.header.opcode = ntohs(header->opcode);
-    bzero(result->packet.data, BUF_SIZE - sizeof(TFTPHeader));
-    _read_packet(result->packet.data, (Packet *)data, bytes_received - sizeof(TFTPHeader));
-    result->data_len = bytes_received - sizeof(TFTPHeader);
-    bzero(result->_raw_data, BUF_SIZE);
-    memcpy(result->_raw_data, data, bytes_received);
+  if (handler->state == HANDLER_WAIT_OACK_ACK)
+  {
+    if (block != 0)
+      return TFTP_CONTINUE;
+    if (handler->_timed_at != 0)
+      _sample_rtt(handler);
+    handler->state = HANDLER_SENDING;
+    handler->_retries = 0;
+    return __send_blocks(handler);
   }
 
-  return result;
-}
+  long acked = _unwrap_block(handler, handler->_acked, block);
+  if (acked < 0 || acked > handler->_highest)
+    return TFTP_CONTINUE;
 
-PacketBuffer *_recv_packet_mul(TFTPClientHandler *handler, uint16_t *opcodes, int min_data_length,
-                               int handle_timeout)
-{
-  PacketBuffer *packet_buffer;
-  while (1)
+  int advanced = acked > handler->_acked;
+  if (advanced)
   {
-    packet_buffer = _recv(handler, handle_timeout);
-    if (packet_buffer == NULL)
+    if (handler->_timed_at != 0 && handler->_timed_block <= acked)
+      _sample_rtt(handler);
+    _map_shift(handler->_window_map, acked - handler->_acked);
+    if (!handler->_in_recovery)
     {
-      if (handle_timeout != 0)
-      {
-        log_error("Client %s: Timeout, no more retries.", inet_ntoa(handler->_addr->sin_addr));
-        free_handler(handler);
-        longjmp(handler->buf, 1);
-      }
-      else
-      {
-        return NULL;
-      }
+      // additive increase: a block more per window acknowledged
+      handler->_cwnd += (double)(acked - handler->_acked) / handler->_cwnd;
+      if (handler->_cwnd > handler->_window_size)
+        handler->_cwnd = handler->_window_size;
+      _update_rate(handler);
     }
-    if (handler->_check_addr == 0 || __compare_address(packet_buffer->client_address, handler->_addr) == 1)
-      break;
-    log_warn("Invalid TID: (%s, %hd) (expected: (%s, %hd))", inet_ntoa(packet_buffer->client_address->sin_addr),
-             ntohs(packet_buffer->client_address->sin_port), inet_ntoa(handler->_addr->sin_addr),
-             ntohs(handler->_addr->sin_port));
-    _error_occurred(handler, UNKNOWN_TRANSFER_ID, NULL, packet_buffer->client_address);
+    handler->_acked = acked;
+    if (handler->_sent < acked)
+      handler->_sent = acked;
+    handler->_retries = 0;
+    handler->_dup_acks = 0;
+    if (handler->_in_recovery && handler->_acked >= handler->_recover)
+      handler->_in_recovery = 0;
   }
+  else
+    handler->_dup_acks++;
 
-  if (!handler->_check_addr)
+  if (handler->_acked == handler->_total)
   {
-    handler->_addr = packet_buffer->client_address;
-    handler->_check_addr = 1;
+    log_info("Client (%s:%d): Sent file %s.", inet_ntoa(handler->addr.sin_addr), ntohs(handler->addr.sin_port), handler->path);
+    return TFTP_FINISHED;
   }
 
-  _check_error(handler, packet_buffer, opcodes);
-  if (packet_buffer->data_len < min_data_length)
+  if (handler->_sack)
   {
-    char message[22 + min_data_length];
-    sprintf(message, "Packet too short: %s", packet_buffer->packet.data);
-    _terminate(handler, ILLEGAL_OPERATION, message, NULL);
+    // bit i, from the most significant bit of the first byte, is block acked + 1 + i
+    const uint8_t *bitmap = packet + sizeof(TFTPHeader) + 2;
+    size_t bytes = length - sizeof(TFTPHeader) - 2;
+    for (size_t i = 0; i < bytes && i < WINDOW_MAP_BITS / 8; i++)
+      for (int j = 0; j < 8; j++)
+        if ((bitmap[i] & (0x80 >> j)) && (handler->_acked + 1 + (long)(i * 8 + j) <= handler->_highest))
+          _map_set(handler->_window_map, i * 8 + j);
   }
-  // return value
-  return packet_buffer;
-}
 
-void __recv_rq(TFTPClientHandler *handler, uint16_t *opcode, char *file_name, char *file_mode)
-{
-  uint16_t *opcodes;
-  opcodes = malloc(2 * sizeof(uint16_t));
-  opcodes[0] = *(uint16_t *)RRQ;
-  opcodes[1] = *(uint16_t *)WRQ;
-
-  PacketBuffer *packet_buffer = _recv_packet_mul(handler, opcodes, 2, 1);
-
-  if (opcode == NULL)
+  // A duplicate ACK alone may just be the answer to a block received twice (Sorcerer's Apprentice).
+  if (handler->_acked < handler->_highest && ((advanced && !handler->_in_recovery) || handler->_dup_acks >= TFTP_DUP_ACKS))
   {
-    opcode = malloc(2);
+    if (__resend_holes(handler) < 0)
+      return _terminate(handler, UNKNOWN, "Cannot read file");
   }
-  *opcode = packet_buffer->packet.header.opcode;
+  return __send_blocks(handler);
+}
 
-  // get file name
-  uint8_t *data = packet_buffer->packet.data;
-  if (file_name == NULL)
+/**
+ * It handles a DATA packet of a write request. Blocks are written at their offset as soon as they arrive, in order or
+ * not, as long as they fall in the window, and acknowledged once a window is complete in order or a gap is filled.
+ * The first block out of order is answered with an ACK of the last block received in order, so that the client
+ * resends from there; with the "sack" option, that ACK also tells which blocks after it were received.
+ *
+ * @param handler The transfer.
+ * @param packet The packet, checksum included.
+ * @param length The length of the packet.
+ *
+ * @return TFTP_CONTINUE, or TFTP_FINISHED if the file cannot be written.
+ */
+int _recv_data(TFTPClientHandler *handler, const uint8_t *packet, size_t length)
+{
+  if (length < sizeof(TFTPHeader) + 2)
+    return TFTP_CONTINUE;
+  uint16_t block;
+  memcpy(&block, packet + sizeof(TFTPHeader), 2);
+  block = ntohs(block);
+  const uint8_t *data = packet + sizeof(TFTPHeader) + 2;
+  size_t data_length = length - sizeof(TFTPHeader) - 2;
+
+  if (handler->state == HANDLER_DALLYING)
   {
-    file_name = malloc(strlen((char *)data) + 1);
+    // The client did not get the last ACK.
+    if (block == _wire_block(handler, handler->_received))
+      __resend_last_packet(handler);
+    return TFTP_CONTINUE;
   }
-  strcpy(file_name, (char *)data);
-
-  data += strlen(file_name) + 1;
-  if (file_mode == NULL)
+  if (data_length > (size_t)handler->_block_size)
+    return _terminate(handler, ILLEGAL_OPERATION, "Block too large");
+
+  // Its distance from the next block expected in order; blocks already written come out far ahead.
+  long number = _unwrap_block(handler, handler->_received + 1, block);
+  if (number < 0)
+    return TFTP_CONTINUE;
+  long index = number - handler->_received - 1;
+  if (index >= handler->_window_size || index >= WINDOW_MAP_BITS)
   {
-    file_mode = malloc(strlen((char *)data) + 1);
+    if (!handler->_gap_acked)
+    {
+      _send_ack(handler, handler->_received);
+      handler->_gap_acked = 1;
+      handler->_pending = 0;
+    }
+    return TFTP_CONTINUE;
   }
-  // log_info("Filename: %s", file_name);
-  strcpy(file_mode, (char *)data);
-  data += strlen(file_mode) + 1;
-
-  // check file mode
-  if (strcmp(file_mode, "octet") != 0)
+  if (_map_test(handler->_window_map, index) || (handler->_last_block != 0 && number > handler->_last_block))
+    return TFTP_CONTINUE;
+
+  off_t offset = handler->_range_start + (off_t)(number - 1) * handler->_block_size;
+  if (handler->_range_end >= 0 && offset + (off_t)data_length > handler->_range_end)
+    return _terminate(handler, ILLEGAL_OPERATION, "Block out of range");
+  size_t written = 0;
+  while (written < data_length)
   {
-    _terminate(handler, ILLEGAL_OPERATION, "Only octet mode is supported.", NULL);
+    ssize_t ret = pwrite(handler->fd, data + written, data_length - written, offset + written);
+    if (ret < 0)
+    {
+      int error = errno;
+      // the other parts of a file uploaded in parts may still be written
+      if (!handler->_assembling)
+        unlink(handler->_upload_path);
+      if (error == EFBIG || error == ENOSPC)
+        return _terminate(handler, DISK_FULL, "Disk full");
+      return _terminate(handler, UNKNOWN, "Unknown error");
+    }
+    written += ret;
   }
-  size_t current_len = ((size_t)2 + strlen(file_mode) + strlen(file_name));
-  if ((int)current_len != (int)packet_buffer->data_len)
+  _map_set(handler->_window_map, index);
+  if (data_length < (size_t)handler->_block_size)
+    handler->_last_block = number;
+
+  if (index > 0)
   {
-    TFTPOptions *options = _process_option(handler, data);
-    if (options != NULL)
+    if (!handler->_gap_acked)
     {
-      __map_options(handler, options);
-      _send_oack(handler, options);
-      if (*opcode == *(uint16_t *)RRQ)
-        _recv_ack(handler, 1, NULL);
-
-      free_options(options);
+      _send_ack(handler, handler->_received);
+      handler->_gap_acked = 1;
+      handler->_pending = 0;
+      handler->loop->arm_timer(handler->loop, handler, _timeout(handler));
     }
+    return TFTP_CONTINUE;
   }
-}
 
-int _recv_ack(TFTPClientHandler *handler, int handle_timeout, int *block_id)
-{
-  PacketBuffer *packet_buffer = _recv_packet(handler, *(uint16_t *)ACK, 2, handle_timeout);
-  // checksum
-  if (checksum_(packet_buffer->data_len + sizeof(TFTPHeader), 0, (uint16_t *)packet_buffer->_raw_data) != 0)
+  if (handler->_timed_at != 0 && handler->_timed_block == number)
+    _sample_rtt(handler);
+  // The block may fill a gap: the blocks received after it are now in order too.
+  long count = _map_leading(handler->_window_map);
+  _map_shift(handler->_window_map, count);
+  handler->_received += count;
+  handler->_pending += count;
+  handler->_gap_acked = 0;
+  handler->_retries = 0;
+  if (handler->_received == handler->_last_block)
   {
-    return -1;
+    if (_publish_upload(handler) < 0)
+    {
+      if (errno != EEXIST)
+        return _terminate(handler, UNKNOWN, "Cannot save file");
+      unlink(handler->_upload_path);
+      return _terminate(handler, FILE_ALREADY_EXISTS, "File already exists");
+    }
+    _send_ack(handler, handler->_received);
+    close(handler->fd);
+    handler->fd = -1;
+    handler->state = HANDLER_DALLYING;
+    log_info("Client (%s:%d): Received file %s.", inet_ntoa(handler->addr.sin_addr), ntohs(handler->addr.sin_port), handler->path);
+    handler->loop->arm_timer(handler->loop, handler, TIMEOUT_MILLISECONDS);
+    return TFTP_CONTINUE;
   }
-  int id = (int)ntohs((*(uint16_t *)packet_buffer->packet.data));
-  if (block_id != NULL)
+  // A block filling a gap is acknowledged at once: the client may only be resending the blocks missing.
+  if (handler->_pending >= handler->_window_size || count > 1)
   {
-    *block_id = id;
+    _send_ack(handler, handler->_received);
+    handler->_pending = 0;
+    _start_timing(handler, handler->_received + 1);
   }
-  return 0;
-}
-
-PacketBuffer *_recv_data(TFTPClientHandler *handler, int handle_timeout)
-{
-  PacketBuffer *packet_buffer = _recv_packet(handler, *(uint16_t *)DATA, 2, handle_timeout);
-  uint16_t block_16 = *(uint16_t *)packet_buffer->packet.data;
-  packet_buffer->block_id = (int)ntohs(block_16);
-  memcpy(packet_buffer->packet.data, packet_buffer->packet.data + 2, packet_buffer->data_len - 2);
-  packet_buffer->data_len -= 2;
-  return packet_buffer;
-}
-
-PacketBuffer *_recv_packet(TFTPClientHandler *handler, uint16_t opcode, int min_data_length, int handle_timeout)
-{
-  uint16_t *opcodes = malloc(1 * sizeof(uint16_t));
-  opcodes[0] = ntohs(opcode);
-
-  return _recv_packet_mul(handler, opcodes, min_data_length, handle_timeout);
+  handler->loop->arm_timer(handler->loop, handler, _timeout(handler));
+  return TFTP_CONTINUE;
 }
 
-void _recv_file(TFTPClientHandler *handler, const char *filename)
+/**
+ * It sends the blocks of the window not sent yet, but those the client said it has, and waits for their ACK
+ *
+ * @param handler The transfer.
+ *
+ * @return TFTP_CONTINUE, or TFTP_FINISHED if the file cannot be read.
+ */
+int __send_blocks(TFTPClientHandler *handler)
 {
-  int last_id = 0;
-
-  FILE *file = fopen(filename, "wb");
-
-  if (file == NULL)
-  {
-    _terminate(handler, ACCESS_VIOLATION, "Cannot create file", NULL);
-  }
-
-  int retries = 0;
-  while (retries <= MAX_RETRIES)
+  while (handler->_sent < handler->_acked + handler->_window_size && handler->_sent < handler->_total)
   {
-    int start_last_id = last_id;
-    for (int i = 0; i < handler->_window_size; i++)
+    long block = handler->_sent + 1;
+    if (!_map_test(handler->_window_map, block - handler->_acked - 1))
     {
-      PacketBuffer *packet_buffer = _recv_data(handler, 0);
-      if (packet_buffer == NULL)
+      long wait = _pace(handler, block);
+      if (wait > 0)
       {
-        // timeout
-        if (last_id == start_last_id)
-        {
-          retries++;
-          break;
-        }
-        else
-          retries = 0;
+        handler->_paced = 1;
+        handler->loop->arm_timer(handler->loop, handler, (int)((wait + 999) / 1000));
+        return TFTP_CONTINUE;
       }
-      else
+      if (_send_data(handler, block) < 0)
+        return _terminate(handler, UNKNOWN, "Cannot read file");
+      if (block > handler->_highest)
       {
-        if (checksum_(packet_buffer->data_len + 2 + sizeof(TFTPHeader), 0, (uint16_t *)packet_buffer->_raw_data) != 0)
-        {
-          // break to send ack of pre packet
-          log_warn("Packet with wrong checksum. Require resend block %d.", last_id);
-          break;
-        }
-        if (packet_buffer->block_id == last_id + 1)
-        {
-          last_id = packet_buffer->block_id;
-          size_t bytes_written = fwrite(packet_buffer->packet.data, 1, packet_buffer->data_len, file);
-          if (bytes_written != (size_t)packet_buffer->data_len)
-          {
-            // remove file
-            fclose(file);
-            remove(filename);
-            if (errno == EFBIG || errno == ENOSPC)
-              _terminate(handler, DISK_FULL, "Disk full", NULL);
-            else
-              _terminate(handler, UNKNOWN, "Unknown error", NULL);
-          }
-
-          if (packet_buffer->block_id == BUF_SIZE)
-            last_id = -1;
-
-          if (packet_buffer->data_len < handler->_block_size)
-          {
-            _send_ack(handler, last_id);
-            fclose(file);
-            return;
-          }
-        }
+        // Time the latest block: the ACK of a window comes right after its last block, however long it was paced.
+        handler->_highest = block;
+        _start_timing(handler, block);
       }
+      else if (block == handler->_timed_block)
+        handler->_timed_at = 0; // Karn: its ACK would not tell which copy it answers
     }
-
-    if (retries <= MAX_RETRIES)
-      _send_ack(handler, last_id == -1 ? BUF_SIZE : last_id);
+    handler->_sent++;
   }
+  handler->_paced = 0;
+  handler->loop->arm_timer(handler->loop, handler, _timeout(handler));
+  return TFTP_CONTINUE;
 }
 
-void _send(TFTPClientHandler *handler, const uint8_t *data, ssize_t data_len, struct sockaddr_in *addr)
+/**
+ * It sends again the blocks of the window the client lost. Without the "sack" option, it cannot know which, so
+ * sending goes back to the block after the last one acknowledged; with it, only the blocks missing before the last one
+ * the client has are sent.
+ *
+ * @param handler The transfer.
+ *
+ * @return 0 on success, -1 if the file cannot be read.
+ */
+int __resend_holes(TFTPClientHandler *handler)
 {
-  if (addr == NULL)
+  handler->_in_recovery = 1;
+  handler->_recover = handler->_highest;
+  handler->_dup_acks = 0;
+  // multiplicative decrease
+  handler->_cwnd = handler->_cwnd / 2 > 1 ? handler->_cwnd / 2 : 1;
+  _update_rate(handler);
+  if (!handler->_sack)
   {
-    addr = handler->_addr;
+    handler->_sent = handler->_acked;
+    return 0;
   }
-  // add checksum
-  uint16_t checksum = htons(checksum_(data_len, data_len % 2, (uint16_t *)data));
-  uint8_t *buffer = malloc(data_len + 2);
-  memcpy(buffer, &checksum, 2);
-  memcpy(buffer + 2, data, data_len);
 
-  PacketBuffer *last_packet = malloc(sizeof(PacketBuffer));
-  last_packet->client_address = addr;
-  memcpy(last_packet->packet.data, data, data_len);
-
-  handler->__last_packet = last_packet;
-
-  int retries = 0;
-
-  while (retries <= MAX_RETRIES)
+  log_trace("Client (%s:%d): Resending the holes after block %ld.", inet_ntoa(handler->addr.sin_addr), ntohs(handler->addr.sin_port), handler->_acked);
+  long last = _map_last(handler->_window_map);
+  for (long i = 0; (i <= last || i == 0) && handler->_acked + 1 + i <= handler->_highest; i++)
   {
-    ssize_t byte_sent = sendto(handler->server.server.socket, buffer, data_len + 2, 0,
-                               (struct sockaddr *)addr, sizeof(struct sockaddr_in));
-    if (byte_sent == -1)
-    {
-      if (errno == EAGAIN || errno == EWOULDBLOCK)
-      {
-        log_error("Timeout, retrying... (%d/%d)", retries, MAX_RETRIES);
-        retries++;
-        continue;
-      }
-      else
-      {
-        perror("sendto");
-        free_handler(handler);
-        longjmp(handler->buf, 1);
-      }
-    }
-    else
-    {
-      return;
-    }
+    if (_map_test(handler->_window_map, i))
+      continue;
+    if (_send_data(handler, handler->_acked + 1 + i) < 0)
+      return -1;
+    if (handler->_acked + 1 + i == handler->_timed_block)
+      handler->_timed_at = 0;
   }
-
-  log_error("Client %s: Timeout, no more retries.", inet_ntoa(addr->sin_addr));
-  free_handler(handler);
-  longjmp(handler->buf, 1);
+  return 0;
 }
 
-void _send_oack(TFTPClientHandler *handler, TFTPOptions *options)
+/**
+ * It asks the pacers of the transfer and of the server whether a block may be sent now, and charges them for it if so
+ *
+ * @param handler The transfer.
+ * @param block The number of the block.
+ *
+ * @return The microseconds to wait before the block may be sent, 0 if it was charged and may be sent now.
+ */
+long _pace(TFTPClientHandler *handler, long block)
 {
-  uint8_t buffer[BUF_SIZE];
-  memcpy(buffer, OACK, 2);
-  int len = 2;
-  TFTPOptions *current = options;
-  while (current != NULL)
-  {
-    len += sprintf((char *)buffer + len, "%s%c%s%c", current->name, 0, current->value, 0);
-    current = current->next;
-  }
+  struct TFTPPacer *shared = handler->loop->server->pacer;
+  if (handler->_pacer.rate <= 0 && shared->rate <= 0)
+    return 0;
+
+  long now = _now_us();
+  long wait = tftp_pacer_delay(&handler->_pacer, now);
+  long shared_wait = tftp_pacer_delay(shared, now);
+  if (wait > 0 || shared_wait > 0)
+    return wait > shared_wait ? wait : shared_wait;
 
-  _send(handler, buffer, len, NULL);
+  off_t remaining = handler->_range_end - handler->_range_start - (off_t)(block - 1) * handler->_block_size;
+  size_t bytes = sizeof(TFTPHeader) + 2 + (remaining < handler->_block_size ? (size_t)remaining : (size_t)handler->_block_size);
+  tftp_pacer_charge(&handler->_pacer, bytes, now);
+  tftp_pacer_charge(shared, bytes, now);
+  return 0;
 }
 
-void _send_err(TFTPClientHandler *handler, int error_code, char *error_message, struct sockaddr_in *addr)
+/**
+ * It sets the rate of the transfer's pacer: the rate configured for transfers, lowered to a congestion window per
+ * round trip once losses shrank the window. While the window is whole, the ACKs alone clock the transfer.
+ *
+ * @param handler The transfer.
+ */
+void _update_rate(TFTPClientHandler *handler)
 {
-  char error_message_bytes[BUF_SIZE];
-  uint16_t error_code_bytes = (uint16_t)error_code;
-  memcpy(error_message_bytes, ERROR, 2);
-  memcpy(error_message_bytes + 2, &error_code_bytes, 2);
-  sprintf(error_message_bytes + 4, "%s%c", error_message, (uint8_t)0);
-  _send(handler, (uint8_t *)error_message_bytes, strlen(error_message) + 5, addr);
+  long rate = handler->loop->server->transfer_rate;
+  if (handler->_srtt > 0 && handler->_cwnd < handler->_window_size)
+  {
+    long window_rate = (long)(handler->_cwnd * handler->_block_size * 1000000.0 / handler->_srtt) + 1;
+    if (rate <= 0 || window_rate < rate)
+      rate = window_rate;
+  }
+  handler->_pacer.rate = rate;
 }
 
-void _send_file(TFTPClientHandler *handler, const char *filename, ssize_t buff_size)
+/**
+ * It queues a block of the file: its header is built in the send ring of the loop, and its data is sent straight from
+ * the mapping, or read into the ring after the header when the file is not mapped.
+ *
+ * @param handler The transfer.
+ * @param block The number of the block, from 1.
+ *
+ * @return 0 on success, -1 if the file cannot be read.
+ */
+int _send_data(TFTPClientHandler *handler, long block)
 {
-  int outer_block_id = 0,
-      block_id = 0;
-  int ack_block_id, last_block_id;
-  int byte_read = 0;
-
-  FILE *file = fopen(filename, "rb");
-  uint8_t buffer[handler->_block_size * handler->_window_size];
-
-  size_t need = (size_t)(handler->_block_size * handler->_window_size);
-  while (1)
+  struct TFTPEventLoop *loop = handler->loop;
+  size_t header_length = sizeof(TFTPHeader) + 2;
+  uint16_t block_16 = htons(_wire_block(handler, block));
+  off_t offset = handler->_range_start + (off_t)(block - 1) * handler->_block_size;
+  off_t remaining = handler->_range_end - offset;
+  size_t length = remaining < handler->_block_size ? (size_t)remaining : (size_t)handler->_block_size;
+
+  uint8_t *packet = loop->reserve(loop, header_length + (handler->map != NULL ? 0 : length));
+  memcpy(packet + 2, DATA, 2);
+  memcpy(packet + 4, &block_16, 2);
+  if (handler->map != NULL)
   {
-    byte_read = fread(buffer, 1, need, file);
-    if (byte_read < 0)
-    {
-      _terminate(handler, ACCESS_VIOLATION, "Cannot read file", NULL);
-    }
-    if (__send_blocks(handler, buffer, buff_size, outer_block_id, block_id) == 0)
-    {
-      fclose(file);
-      return;
-    }
+    loop->queue_slice(loop, &handler->addr, packet, header_length, handler->map + offset, length);
+    return 0;
+  }
 
-    // receive ack
-    if (_recv_ack(handler, 0, &ack_block_id) == -1)
-    {
-      fclose(file);
-      _terminate(handler, INVALID_CHECKSUM, "Checksum invalid for ack when send file", NULL);
-    }
-    last_block_id = block_id + handler->_window_size;
-    if ((last_block_id >= ack_block_id && ack_block_id >= block_id) || (ack_block_id <= (last_block_id % BUF_SIZE) && ack_block_id < block_id))
-    {
-      // If received ACK is a reply to one of the blocks sent
-      // sent the next batch of blocks, else re-send
-      if (ack_block_id < block_id)
-        outer_block_id++;
-      block_id = ack_block_id;
-    }
+  size_t done = 0;
+  while (done < length)
+  {
+    ssize_t ret = pread(handler->fd, packet + header_length + done, length - done, offset + done);
+    if (ret <= 0)
+      return -1;
+    done += ret;
   }
+  loop->queue(loop, &handler->addr, packet, header_length + length);
+  return 0;
 }
 
-int __send_blocks(TFTPClientHandler *handler, const uint8_t *buffer, ssize_t buff_size, int outer_block_id, int inner_block_id)
+/**
+ * It sends an ACK, kept to be sent again on timeout. With the "sack" option, the blocks received after it follow, one
+ * bit each from the most significant bit of the first byte, when there are any.
+ *
+ * @param handler The transfer.
+ * @param block The number of the last block received in order.
+ */
+void _send_ack(TFTPClientHandler *handler, long block)
 {
-  int i = 0, local_blkid,
-      blk_size = handler->_block_size;
+  uint16_t block_16 = htons(_wire_block(handler, block));
+  memcpy(handler->_last_packet + 2, ACK, 2);
+  memcpy(handler->_last_packet + 4, &block_16, 2);
+  handler->_last_length = sizeof(TFTPHeader) + 2;
+  if (handler->_sack && _map_last(handler->_window_map) >= 0)
+  {
+    uint8_t *bitmap = handler->_last_packet + handler->_last_length;
+    size_t bytes = (handler->_window_size + 7) / 8;
+    memset(bitmap, 0, bytes);
+    for (int i = 0; i < handler->_window_size; i++)
+      if (_map_test(handler->_window_map, i))
+        bitmap[i / 8] |= 0x80 >> (i % 8);
+    handler->_last_length += bytes;
+  }
+  __resend_last_packet(handler);
+}
 
-  for (i = 0; i < handler->_window_size; i++)
+/**
+ * It sends the OACK of the options acknowledged, kept to be sent again on timeout
+ *
+ * @param handler The transfer.
+ * @param accepted The options acknowledged by __map_options.
+ */
+void _send_oack(TFTPClientHandler *handler, int accepted)
+{
+  uint8_t *packet = handler->_last_packet;
+  size_t length = sizeof(TFTPHeader);
+  memcpy(packet + 2, OACK, 2);
+  if (accepted & OPTION_BLKSIZE)
+    length += sprintf((char *)packet + length, "blksize%c%d", '\0', handler->_block_size) + 1;
+  if (accepted & OPTION_WINDOWSIZE)
+    length += sprintf((char *)packet + length, "windowsize%c%d", '\0', handler->_window_size) + 1;
+  if (accepted & OPTION_SACK)
+    length += sprintf((char *)packet + length, "sack%c1", '\0') + 1;
+  if (accepted & OPTION_RANGE)
   {
-    local_blkid = outer_block_id * BUF_SIZE + inner_block_id + i;
-    if ((local_blkid * blk_size) > buff_size)
-    {
-      if (i == 0)
-        return 0;
-      else
-        break;
-    }
-    ssize_t data_len_rest = buff_size - (local_blkid * blk_size);
-    ssize_t data_len_send = data_len_rest < blk_size ? data_len_rest : blk_size;
-    uint8_t *data = malloc(data_len_send);
-    memcpy(data, buffer + (i * blk_size), data_len_send);
-    _send_data(handler, data, data_len_send, (local_blkid + 1) % BUF_SIZE);
+    length += sprintf((char *)packet + length, "range%c%lld-", '\0', (long long)handler->_range_start);
+    if (handler->_range_end > handler->_range_start)
+      length += sprintf((char *)packet + length, "%lld", (long long)handler->_range_end - 1);
+    length++;
   }
+  if (accepted & OPTION_TSIZE)
+    length += sprintf((char *)packet + length, "tsize%c%lld", '\0', (long long)handler->_tsize) + 1;
+  if (accepted & OPTION_OFFSET)
+    length += sprintf((char *)packet + length, "offset%c%lld", '\0', (long long)handler->_range_start) + 1;
+  if (accepted & OPTION_ROLLOVER)
+    length += sprintf((char *)packet + length, "rollover%c%d", '\0', handler->_rollover) + 1;
+  handler->_last_length = length;
+  __resend_last_packet(handler);
+}
 
-  return 1;
+void __resend_last_packet(TFTPClientHandler *handler)
+{
+  handler->loop->send(handler->loop, &handler->addr, handler->_last_packet, handler->_last_length);
 }
 
-void _send_data(TFTPClientHandler *handler, const uint8_t *data, ssize_t data_len, int block_id)
+/**
+ * It ends a transfer with an error sent to the client
+ *
+ * @param handler The transfer.
+ * @param error_code The TFTP error code.
+ * @param message The message of the error.
+ *
+ * @return TFTP_FINISHED.
+ */
+int _terminate(TFTPClientHandler *handler, TFTPErrorCodes error_code, const char *message)
 {
-  char *data_bytes = malloc(data_len + 4);
-  memcpy(data_bytes, DATA, 2);
-  uint16_t block_16 = ntohs((uint16_t)block_id);
-  memcpy(data_bytes + 2, &block_16, 2);
-  memcpy(data_bytes + 4, data, data_len);
-  _send(handler, (uint8_t *)data_bytes, data_len + 4, NULL);
+  log_error("Client (%s:%d): %s (%s).", inet_ntoa(handler->addr.sin_addr), ntohs(handler->addr.sin_port), message, handler->path);
+  send_error(handler->loop, &handler->addr, error_code, message);
+  return TFTP_FINISHED;
 }
 
-void _send_ack(TFTPClientHandler *handler, int block_number)
+/**
+ * It moves a complete upload from "<path>.part" to its path, unless a file appeared there since the upload started
+ *
+ * @param handler The transfer.
+ *
+ * @return 0 on success, -1 otherwise.
+ */
+int _publish_upload(TFTPClientHandler *handler)
 {
-  char *ack_bytes = malloc(4);
-  memcpy(ack_bytes, ACK, 2);
-  uint16_t block_16 = htons((uint16_t)block_number);
-  memcpy(ack_bytes + 2, &block_16, 2);
-  _send(handler, (uint8_t *)ack_bytes, 4, NULL);
+  if (handler->_assembling)
+    return 0;
+  if (renameat2(AT_FDCWD, handler->_upload_path, AT_FDCWD, handler->path, RENAME_NOREPLACE) == 0)
+    return 0;
+  // file systems without RENAME_NOREPLACE
+  if (errno == EINVAL && link(handler->_upload_path, handler->path) == 0)
+    return unlink(handler->_upload_path);
+  return -1;
 }
 
-void __resend_last_packet(TFTPClientHandler *handler)
+/**
+ * It reads the value of a size option
+ *
+ * @param value The value.
+ * @param size Where the size is written.
+ *
+ * @return 0 on success, -1 if the value is not a size.
+ */
+int _parse_size(const char *value, off_t *size)
 {
-  _send(handler, handler->__last_packet->packet.data, handler->__last_packet->data_len, NULL);
+  char *end;
+  errno = 0;
+  long long result = strtoll(value, &end, 10);
+  if (end == value || *end != '\0' || result < 0 || errno != 0)
+    return -1;
+  *size = result;
+  return 0;
 }
 
-int handle_client(TFTPClientHandler *handler)
+/**
+ * It checks that a requested file name stays in the upload directory
+ *
+ * @param file_name The file name of the request.
+ *
+ * @return 1 if it does, 0 otherwise.
+ */
+int _is_safe_path(const char *file_name)
 {
-  uint16_t opcode;
-  char file_name[100];
-  char file_mode[10];
+  if (file_name[0] == '/')
+    return 0;
+  for (const char *part = file_name; part != NULL; part = strchr(part, '/'))
+  {
+    if (*part == '/')
+      part++;
+    if (strncmp(part, "..", 2) == 0 && (part[2] == '/' || part[2] == '\0'))
+      return 0;
+  }
+  return 1;
+}
 
-  if (!setjmp(handler->buf))
+/**
+ * It reads the options of a request: pairs of NUL-terminated names and values
+ *
+ * @param options The options, after the mode of the request.
+ * @param length Their length.
+ * @param storage Where the options read are kept, so that none is allocated.
+ * @param capacity The number of options it holds.
+ *
+ * @return A list of options, NULL if there is none. Options that do not fit are dropped.
+ */
+TFTPOptions *_process_option(const uint8_t *options, size_t length, TFTPOptions *storage, int capacity)
+{
+  int count = 0;
+  TFTPOptions *head = NULL, *current = NULL;
+  const uint8_t *end = options + length;
+  while (options < end && isprint((int)*options) != 0)
   {
-    __recv_rq(handler, &opcode, file_name, file_mode);
+    const uint8_t *value = memchr(options, '\0', end - options);
+    const uint8_t *next = value == NULL ? NULL : memchr(value + 1, '\0', end - value - 1);
+    if (next == NULL)
+      break;
+    value++;
 
-    if (opcode == *(uint16_t *)RRQ)
+    if (count < capacity && value - options <= (long)sizeof(current->name) && next - value < (long)sizeof(current->value))
     {
-      log_info("Client (%s:%d): Request get file %s.", inet_ntoa(handler->_addr->sin_addr), ntohs(handler->_addr->sin_port), file_name);
-      __handle_read(handler, file_name);
+      TFTPOptions *option = &storage[count++];
+      option->next = NULL;
+      strcpy(option->name, (const char *)options);
+      strcpy(option->value, (const char *)value);
+      if (head == NULL)
+        head = option;
+      else
+        current->next = option;
+      current = option;
     }
-    else if (opcode == *(uint16_t *)WRQ)
+    options = next + 1;
+  }
+
+  return head;
+}
+
+/**
+ * It applies the options of a request. Unknown options are ignored, as RFC 2347 asks.
+ *
+ * @param handler The transfer.
+ * @param options The options of the request.
+ *
+ * @return The options acknowledged (OPTION_* flags), or -1 if one has an invalid value.
+ */
+int __map_options(TFTPClientHandler *handler, TFTPOptions *options)
+{
+  int accepted = 0;
+  for (TFTPOptions *current = options; current != NULL; current = current->next)
+  {
+    if (strcasecmp(current->name, "blksize") == 0)
     {
-      log_info("Client (%s:%d): Request put file %s.", inet_ntoa(handler->_addr->sin_addr), ntohs(handler->_addr->sin_port), file_name);
-      __handle_write(handler, file_name);
+      handler->_block_size = atoi(current->value);
+      if (handler->_block_size < 8 || handler->_block_size > MAX_BLOCK_SIZE)
+        return -1;
+      accepted |= OPTION_BLKSIZE;
     }
-    else
+    else if (strcasecmp(current->name, "windowsize") == 0)
+    {
+      handler->_window_size = atoi(current->value);
+      if (handler->_window_size < 1 || handler->_window_size > MAX_WINDOW_SIZE)
+        return -1;
+      accepted |= OPTION_WINDOWSIZE;
+    }
+    else if (strcasecmp(current->name, "sack") == 0 && strcmp(current->value, "1") == 0)
     {
-      _terminate(handler, ILLEGAL_OPERATION, "Invalid opcode", NULL);
+      handler->_sack = 1;
+      accepted |= OPTION_SACK;
+    }
+    else if (strcasecmp(current->name, "range") == 0)
+    {
+      // first-last, in bytes and inclusive as HTTP ranges are, or first- for the rest of the file
+      char *end;
+      long long first = strtoll(current->value, &end, 10);
+      if (end == current->value || *end != '-' || first < 0)
+        return -1;
+      handler->_range_start = first;
+      if (end[1] != '\0')
+      {
+        char *value = end + 1;
+        long long last = strtoll(value, &end, 10);
+        if (end == value || *end != '\0' || last < first)
+          return -1;
+        handler->_range_end = last + 1;
+      }
+      accepted |= OPTION_RANGE;
+    }
+    else if (strcasecmp(current->name, "tsize") == 0)
+    {
+      if (_parse_size(current->value, &handler->_tsize) < 0)
+        return -1;
+      accepted |= OPTION_TSIZE;
+    }
+    else if (strcasecmp(current->name, "offset") == 0)
+    {
+      if (_parse_size(current->value, &handler->_range_start) < 0)
+        return -1;
+      accepted |= OPTION_OFFSET;
+    }
+    else if (strcasecmp(current->name, "rollover") == 0)
+    {
+      if (strcmp(current->value, "0") != 0 && strcmp(current->value, "1") != 0)
+        return -1;
+      handler->_rollover = current->value[0] - '0';
+      accepted |= OPTION_ROLLOVER;
     }
-
-    return 0;
   }
-  else
-  {
+  // an offset resumes the whole file, not a part of it
+  if ((accepted & OPTION_RANGE) && (accepted & OPTION_OFFSET))
     return -1;
-  }
+  return accepted;
 }
 
-void __handle_read(TFTPClientHandler *handler, const char *file_name)
+/**
+ * It starts timing the round trip of a packet
+ *
+ * @param handler The transfer.
+ * @param block The block whose ACK, or whose DATA on a write request, ends the round trip.
+ */
+void _start_timing(TFTPClientHandler *handler, long block)
 {
+  handler->_timed_block = block;
+  handler->_timed_at = _now_us();
+}
 
-  FILE *fileptr;
-  long filelen;
-
-  char full_path[128];
-  sprintf(full_path, "%s/%s", UPLOAD_DIR, file_name);
-  if (access(full_path, F_OK) != 0)
+/**
+ * It ends the round trip being timed and updates the retransmission timeout with it, as RFC 6298 does
+ *
+ * @param handler The transfer.
+ */
+void _sample_rtt(TFTPClientHandler *handler)
+{
+  long rtt = _now_us() - handler->_timed_at;
+  handler->_timed_at = 0;
+  if (handler->_srtt < 0)
   {
-    _terminate(handler, FILE_NOT_FOUND, "File not found", NULL);
+    handler->_srtt = rtt;
+    handler->_rttvar = rtt / 2;
   }
-
-  fileptr = fopen(full_path, "rb"); // Open the file in binary mode
-  if (fileptr == NULL)
+  else
   {
-    _terminate(handler, FILE_NOT_FOUND, "File not found", NULL);
+    handler->_rttvar = (3 * handler->_rttvar + labs(handler->_srtt - rtt)) / 4;
+    handler->_srtt = (7 * handler->_srtt + rtt) / 8;
   }
 
-  fseek(fileptr, 0, SEEK_END); // Jump to the end of the file
-  filelen = ftell(fileptr);    // Get the current byte offset in the file
-  rewind(fileptr);             // Jump back to the beginning of the file
-
-  fclose(fileptr); // Close the file
+  // The timer wheel cannot wait less than a tick.
+  long variation = 4 * handler->_rttvar > TFTP_TIMER_TICK * 1000 ? 4 * handler->_rttvar : TFTP_TIMER_TICK * 1000;
+  long rto = (handler->_srtt + variation + 999) / 1000;
+  handler->_rto = rto < TFTP_MIN_RTO ? TFTP_MIN_RTO : rto > TFTP_MAX_RTO ? TFTP_MAX_RTO : (int)rto;
+  _update_rate(handler);
+}
 
-  _send_file(handler, full_path, filelen);
+/**
+ * It returns the time to wait for the client: the retransmission timeout, doubled for each timeout in a row. As Linux
+ * does, the backoff ends as soon as the client answers, rather than at the next round trip timed.
+ *
+ * @param handler The transfer.
+ *
+ * @return The timeout, in milliseconds.
+ */
+int _timeout(TFTPClientHandler *handler)
+{
+  long timeout = (long)handler->_rto << (handler->_retries < 16 ? handler->_retries : 16);
+  return timeout < TFTP_MAX_RTO ? (int)timeout : TFTP_MAX_RTO;
 }
 
-void __handle_write(TFTPClientHandler *handler, const char *file_name)
+long _now_us(void)
 {
-  if (handler->server.is_allow_upload == 0)
-  {
-    _terminate(handler, ACCESS_VIOLATION, "Upload not allowed", NULL);
-  }
-  char full_path[1024];
-  sprintf(full_path, "%s/%s", UPLOAD_DIR, file_name);
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000L + now.tv_nsec / 1000;
+}
 
-  if (access(full_path, F_OK) == 0)
-  {
-    _terminate(handler, FILE_ALREADY_EXISTS, "File already exists", NULL);
-  }
+/**
+ * It tells whether a block is set in a bitmap of the window
+ *
+ * @param map The bitmap, whose bit i is the block i + 1 after the one acknowledged.
+ * @param index The bit.
+ *
+ * @return 1 if it is set, 0 otherwise or if it is out of the bitmap.
+ */
+int _map_test(const uint64_t *map, long index)
+{
+  if (index < 0 || index >= WINDOW_MAP_BITS)
+    return 0;
+  return (map[index / 64] >> (index % 64)) & 1;
+}
 
-  _send_ack(handler, 0);
-  _recv_file(handler, full_path);
+void _map_set(uint64_t *map, long index)
+{
+  if (index >= 0 && index < WINDOW_MAP_BITS)
+    map[index / 64] |= (uint64_t)1 << (index % 64);
 }
 
-TFTPOptions *_process_option(TFTPClientHandler *handler, uint8_t *options)
+/**
+ * It drops the first bits of a bitmap of the window, as the block acknowledged moves forward
+ *
+ * @param map The bitmap.
+ * @param count The number of blocks the window moved.
+ */
+void _map_shift(uint64_t *map, long count)
 {
-  if (options == NULL)
+  long words = count / 64;
+  int bits = count % 64;
+  for (int i = 0; i < TFTP_WINDOW_MAP_WORDS; i++)
   {
-    return NULL;
-  }
-  TFTPOptions *head = NULL, *current;
-  uint8_t *tmp = options;
-  while (isprint((int)*tmp) != 0)
-  {
-    TFTPOptions *option = malloc(sizeof(TFTPOptions));
-    option->next = NULL;
-    strcpy(option->name, (char *)tmp);
-    tmp = tmp + strlen((char *)tmp) + 1;
-
-    if (tmp == NULL)
-    {
-      _terminate(handler, ILLEGAL_OPERATION, "Invalid options received", NULL);
-    }
-    else
-    {
-      strcpy(option->value, (char *)tmp);
-      tmp = tmp + strlen((char *)tmp) + 1;
-    }
-
-    if (head == NULL)
-    {
-      head = option;
-      current = option;
-    }
-    else
-    {
-      current->next = option;
-      current = option;
-    }
+    uint64_t low = i + words < TFTP_WINDOW_MAP_WORDS ? map[i + words] : 0;
+    uint64_t high = i + words + 1 < TFTP_WINDOW_MAP_WORDS ? map[i + words + 1] : 0;
+    map[i] = bits == 0 ? low : (low >> bits) | (high << (64 - bits));
   }
-
-  return head;
 }
 
-void __map_options(TFTPClientHandler *handler, TFTPOptions *options)
+/**
+ * It counts the bits set in a row from the first one of a bitmap of the window
+ *
+ * @param map The bitmap.
+ *
+ * @return The number of bits.
+ */
+long _map_leading(const uint64_t *map)
 {
-  TFTPOptions *current = options;
-
-  while (current != NULL)
+  long count = 0;
+  for (int i = 0; i < TFTP_WINDOW_MAP_WORDS; i++)
   {
-    if (strcmp(current->name, "blksize") == 0)
-    {
-      handler->_block_size = atoi(current->value);
-      if (handler->_block_size < 0 || handler->_block_size > 65464)
-      {
-        _terminate(handler, ILLEGAL_OPERATION, "Invalid block size", NULL);
-      }
-    }
-
-    if (strcmp(current->name, "windowsize") == 0)
-    {
-      handler->_window_size = atoi(current->value);
-      if (handler->_window_size < 0 || handler->_window_size > 255)
-      {
-        _terminate(handler, ILLEGAL_OPERATION, "Invalid window size", NULL);
-      }
-    }
-
-    current = current->next;
+    if (map[i] != UINT64_MAX)
+      return count + __builtin_ctzll(~map[i]);
+    count += 64;
   }
+  return count;
 }
 
-void free_options(TFTPOptions *options)
+/**
+ * It finds the last bit set of a bitmap of the window
+ *
+ * @param map The bitmap.
+ *
+ * @return The index of the bit, or -1 if none is set.
+ */
+long _map_last(const uint64_t *map)
 {
-  TFTPOptions *current = options;
-  while (current != NULL)
+  for (int i = TFTP_WINDOW_MAP_WORDS - 1; i >= 0; i--)
   {
-    TFTPOptions *tmp = current;
-    current = current->next;
-    free(tmp);
+    if (map[i] != 0)
+      return i * 64 + 63 - __builtin_clzll(map[i]);
   }
+  return -1;
+}
+
+/**
+ * It gives the number a block has on the wire. Blocks are counted from 1 for the whole transfer, however large the
+ * file; their 16-bit number wraps around to 0 after 65535, or to 1 with the "rollover" option.
+ *
+ * @param handler The transfer.
+ * @param block The number of the block in the transfer, 0 for the ACK of the OACK.
+ *
+ * @return Its number in a packet, in the byte order of the host.
+ */
+uint16_t _wire_block(const TFTPClientHandler *handler, long block)
+{
+  if (handler->_rollover == 0 || block == 0)
+    return (uint16_t)block;
+  return (uint16_t)((block - 1) % 65535 + 1);
+}
+
+/**
+ * It finds the block of the transfer a number read on the wire stands for: the first one from a base with that
+ * number. Windows are much smaller than 65535 blocks, so only blocks already done or far ahead are mistaken, and
+ * those are out of the window anyway.
+ *
+ * @param handler The transfer.
+ * @param base The first block the number may stand for.
+ * @param wire The number in the packet, in the byte order of the host.
+ *
+ * @return The number of the block in the transfer, or -1 if no block has that number on the wire.
+ */
+long _unwrap_block(const TFTPClientHandler *handler, long base, uint16_t wire)
+{
+  if (handler->_rollover == 0)
+    return base + (uint16_t)(wire - (uint16_t)base);
+  // after 65535 comes 1: the blocks from 1 are numbered modulo 65535
+  if (wire == 0)
+    return base == 0 ? 0 : -1;
+  if (base == 0)
+    base = 1;
+  return base + ((long)wire - 1 - (base - 1) % 65535 + 65535) % 65535;
 }
@@ -0,0 +1,624 @@
+#define _GNU_SOURCE
+#include "networking/tftp/tftp_event_loop.h"
+#include "networking/tftp/tftp_server.h"
+#include "networking/checksum.h"
+#include "logger/logger.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/udp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+/* Public member methods prototypes */
+
+void run_tftp_event_loop(struct TFTPEventLoop *loop);
+int send_packet(struct TFTPEventLoop *loop, const struct sockaddr_in *address, uint8_t *packet, size_t length);
+uint8_t *reserve_packet(struct TFTPEventLoop *loop, size_t length);
+void queue_packet(struct TFTPEventLoop *loop, const struct sockaddr_in *address, uint8_t *packet, size_t length);
+void queue_slice(struct TFTPEventLoop *loop, const struct sockaddr_in *address, uint8_t *header, size_t header_length,
+                 const uint8_t *data, size_t data_length);
+void flush_packets(struct TFTPEventLoop *loop);
+void arm_timer(struct TFTPEventLoop *loop, TFTPClientHandler *handler, int milliseconds);
+
+/* Private member methods prototypes */
+
+void _receive_packets(struct TFTPEventLoop *loop);
+void _dispatch_packet(struct TFTPEventLoop *loop, uint8_t *packet, size_t length, const struct sockaddr_in *address);
+int _prepare_messages(struct TFTPEventLoop *loop, int first);
+size_t _path_segment(const struct sockaddr_in *address);
+TFTPClientHandler *_find_transfer(struct TFTPEventLoop *loop, const struct sockaddr_in *address);
+void _add_transfer(struct TFTPEventLoop *loop, TFTPClientHandler *handler);
+void _remove_transfer(struct TFTPEventLoop *loop, TFTPClientHandler *handler);
+void _push_piece(struct TFTPEventLoop *loop, const void *data, size_t length);
+unsigned int _hash_address(const struct sockaddr_in *address);
+void _disarm_timer(struct TFTPEventLoop *loop, TFTPClientHandler *handler);
+void _expire_timers(struct TFTPEventLoop *loop);
+long _current_tick(void);
+
+/* Constructor */
+
+/**
+ * It creates an event loop around a UDP socket: an epoll instance watching the socket and an eventfd used to stop
+ * the loop.
+ *
+ * @param server The server the loop serves transfers for.
+ * @param socket A bound UDP socket; it is switched to non-blocking mode.
+ *
+ * @return A pointer to the event loop, or NULL on failure.
+ */
+struct TFTPEventLoop *tftp_event_loop_constructor(struct TFTPServer *server, int socket)
+{
+  struct TFTPEventLoop *loop = malloc(sizeof(struct TFTPEventLoop));
+  loop->server = server;
+  loop->socket = socket;
+  loop->active = 1;
+  loop->has_thread = 0;
+  loop->gso = 0;
+  loop->num_transfers = 0;
+  loop->spare_handlers = NULL;
+  loop->num_spare_handlers = 0;
+  loop->ring_used = 0;
+  loop->num_queued = 0;
+  loop->num_pieces = 0;
+  loop->received = malloc(sizeof(struct mmsghdr) * TFTP_RECV_BATCH);
+  loop->messages = malloc(sizeof(struct mmsghdr) * TFTP_SEND_BATCH);
+  memset(loop->transfers, 0, sizeof(loop->transfers));
+  memset(loop->timers, 0, sizeof(loop->timers));
+  loop->tick = _current_tick();
+  loop->run = run_tftp_event_loop;
+  loop->send = send_packet;
+  loop->reserve = reserve_packet;
+  loop->queue = queue_packet;
+  loop->queue_slice = queue_slice;
+  loop->flush = flush_packets;
+  loop->arm_timer = arm_timer;
+
+  loop->epoll = epoll_create1(EPOLL_CLOEXEC);
+  loop->notify = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  int flags = fcntl(socket, F_GETFL, 0);
+  if (loop->epoll < 0 || loop->notify < 0 || flags < 0 || fcntl(socket, F_SETFL, flags | O_NONBLOCK) < 0)
+  {
+    log_error("Failed to create event loop: %s", strerror(errno));
+    tftp_event_loop_destructor(loop);
+    return NULL;
+  }
+
+  // All the transfers of the loop share the socket: small default buffers would drop packets under load.
+  int size = TFTP_SOCKET_BUFFER;
+  setsockopt(socket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  setsockopt(socket, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+  // Kernels that know UDP_SEGMENT split a window of blocks sent as one datagram themselves.
+  int segment = 0;
+  socklen_t segment_len = sizeof(segment);
+  loop->gso = getsockopt(socket, SOL_UDP, UDP_SEGMENT, &segment, &segment_len) == 0;
+
+  for (int i = 0; i < TFTP_RECV_BATCH; i++)
+  {
+    loop->receive_iov[i].iov_base = loop->buffers[i];
+    loop->receive_iov[i].iov_len = BUF_SIZE;
+    memset(&loop->received[i].msg_hdr, 0, sizeof(struct msghdr));
+    loop->received[i].msg_hdr.msg_name = &loop->senders[i];
+    loop->received[i].msg_hdr.msg_iov = &loop->receive_iov[i];
+    loop->received[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  struct epoll_event event = {.events = EPOLLIN, .data.ptr = &loop->socket};
+  epoll_ctl(loop->epoll, EPOLL_CTL_ADD, socket, &event);
+  event.data.ptr = &loop->notify;
+  epoll_ctl(loop->epoll, EPOLL_CTL_ADD, loop->notify, &event);
+
+  return loop;
+}
+
+/**
+ * It stops the loop, waits for its thread, drops every transfer still running and frees the loop.
+ *
+ * @param loop The event loop to destroy.
+ */
+void tftp_event_loop_destructor(struct TFTPEventLoop *loop)
+{
+  loop->active = 0;
+  if (loop->has_thread)
+  {
+    uint64_t one = 1;
+    if (write(loop->notify, &one, sizeof(one)) < 0)
+      log_warn("Failed to wake event loop: %s", strerror(errno));
+    pthread_join(loop->thread, NULL);
+  }
+  for (int i = 0; i < TFTP_TRANSFER_BUCKETS; i++)
+  {
+    while (loop->transfers[i] != NULL)
+      _remove_transfer(loop, loop->transfers[i]);
+  }
+  while (loop->spare_handlers != NULL)
+  {
+    TFTPClientHandler *handler = loop->spare_handlers;
+    loop->spare_handlers = handler->_next;
+    free(handler);
+  }
+  if (loop->epoll >= 0)
+    close(loop->epoll);
+  if (loop->notify >= 0)
+    close(loop->notify);
+  free(loop->received);
+  free(loop->messages);
+  free(loop);
+}
+
+/* Public member methods implementation */
+
+/**
+ * The reactor: waits for datagrams and hands them to their transfers, then runs the timers that expired. The packets
+ * this queued are sent together at the end of each turn. The loop only wakes up on ticks while it has transfers.
+ *
+ * @param loop The event loop to run.
+ */
+void run_tftp_event_loop(struct TFTPEventLoop *loop)
+{
+  struct epoll_event events[TFTP_MAX_EVENTS];
+  while (loop->active)
+  {
+    int timeout = loop->num_transfers > 0 ? TFTP_TIMER_TICK : -1;
+    int count = epoll_wait(loop->epoll, events, TFTP_MAX_EVENTS, timeout);
+    if (count < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      log_error("epoll_wait failed: %s", strerror(errno));
+      return;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+      if (events[i].data.ptr == &loop->socket)
+        _receive_packets(loop);
+    }
+    _expire_timers(loop);
+    loop->flush(loop);
+  }
+}
+
+/**
+ * It queues a copy of a packet, so that the packet itself can be reused or freed right away
+ *
+ * @param loop The event loop.
+ * @param address The address of the client.
+ * @param packet The packet, whose first two bytes are left for the checksum.
+ * @param length The length of the packet, checksum included.
+ *
+ * @return 0.
+ */
+int send_packet(struct TFTPEventLoop *loop, const struct sockaddr_in *address, uint8_t *packet, size_t length)
+{
+  uint8_t *copy = loop->reserve(loop, length);
+  memcpy(copy, packet, length);
+  loop->queue(loop, address, copy, length);
+  return 0;
+}
+
+/**
+ * It returns room for a packet in the send ring, sending the queued packets first if the ring or the queue is full
+ *
+ * @param loop The event loop.
+ * @param length The maximum length of the packet, at most BUF_SIZE.
+ *
+ * @return A pointer to the room, valid until the packet is queued.
+ */
+uint8_t *reserve_packet(struct TFTPEventLoop *loop, size_t length)
+{
+  if (loop->ring_used + length > TFTP_SEND_RING_SIZE || loop->num_queued == TFTP_SEND_BATCH)
+    loop->flush(loop);
+  return loop->ring + loop->ring_used;
+}
+
+/**
+ * It fills the checksum of a packet built in the send ring and queues it
+ *
+ * @param loop The event loop.
+ * @param address The address of the client.
+ * @param packet The packet, as returned by reserve_packet.
+ * @param length The length of the packet, checksum included.
+ */
+void queue_packet(struct TFTPEventLoop *loop, const struct sockaddr_in *address, uint8_t *packet, size_t length)
+{
+  uint16_t checksum = htons(checksum_compute(packet + 2, length - 2));
+  memcpy(packet, &checksum, 2);
+
+  loop->first_piece[loop->num_queued] = loop->num_pieces;
+  _push_piece(loop, packet, length);
+  loop->lengths[loop->num_queued] = length;
+  loop->destinations[loop->num_queued] = *address;
+  loop->num_queued++;
+  loop->ring_used = packet + length - loop->ring;
+}
+
+/**
+ * It queues a packet made of a header built in the send ring and of data left where it is, such as a slice of a
+ * mapped file, which must stay readable until the queue is flushed. The data is never copied by the loop.
+ *
+ * @param loop The event loop.
+ * @param address The address of the client.
+ * @param header The header, as returned by reserve_packet.
+ * @param header_length The length of the header, checksum included.
+ * @param data The data following the header.
+ * @param data_length The length of the data.
+ */
+void queue_slice(struct TFTPEventLoop *loop, const struct sockaddr_in *address, uint8_t *header, size_t header_length,
+                 const uint8_t *data, size_t data_length)
+{
+  struct Checksum sum;
+  checksum_init(&sum);
+  checksum_update(&sum, header + 2, header_length - 2);
+  checksum_update(&sum, data, data_length);
+  uint16_t checksum = htons(checksum_final(&sum));
+  memcpy(header, &checksum, 2);
+
+  loop->first_piece[loop->num_queued] = loop->num_pieces;
+  _push_piece(loop, header, header_length);
+  _push_piece(loop, data, data_length);
+  loop->lengths[loop->num_queued] = header_length + data_length;
+  loop->destinations[loop->num_queued] = *address;
+  loop->num_queued++;
+  loop->ring_used = header + header_length - loop->ring;
+}
+
+/**
+ * It sends the queued packets with sendmmsg. Packets of the same size to the same client, as the blocks of a window
+ * are, go out as one UDP GSO datagram the kernel splits. Packets the socket cannot take right now are dropped, as if
+ * they were lost: the timers of their transfers send them again. A message that fails for another reason is skipped,
+ * and the rest of the batch, which may be for other clients, is still sent.
+ *
+ * @param loop The event loop.
+ */
+void flush_packets(struct TFTPEventLoop *loop)
+{
+  int first = 0;
+  while (first < loop->num_queued)
+  {
+    int count = _prepare_messages(loop, first);
+    int sent = 0;
+    int regroup = 0;
+    while (sent < count)
+    {
+      int ret = sendmmsg(loop->socket, loop->messages + sent, count - sent, 0);
+      if (ret >= 0)
+      {
+        sent += ret;
+        continue;
+      }
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        log_debug("Dropped %d packets: %s", loop->num_queued - loop->first_queued[sent], strerror(errno));
+        break;
+      }
+      if (loop->messages[sent].msg_hdr.msg_controllen > 0 && (errno == EIO || errno == EMSGSIZE || errno == EINVAL))
+      {
+        // The device cannot checksum GSO datagrams, or the path shrank below the segment: send the packets one by
+        // one from now on.
+        log_warn("UDP segmentation offload is unavailable: %s", strerror(errno));
+        loop->gso = 0;
+        first = loop->first_queued[sent];
+        regroup = 1;
+        break;
+      }
+      if (errno == ENOBUFS)
+        log_debug("Dropped a message: %s", strerror(errno));
+      else
+        log_error("sendmmsg() failed. (%s)", strerror(errno));
+      sent++;
+    }
+    if (!regroup)
+      break;
+  }
+  loop->num_queued = 0;
+  loop->num_pieces = 0;
+  loop->ring_used = 0;
+}
+
+/**
+ * It arms the timer of a transfer, replacing the one it had. The timer is rounded up to the next tick of the wheel.
+ *
+ * @param loop The event loop of the transfer.
+ * @param handler The transfer.
+ * @param milliseconds The delay after which handle_timeout is called.
+ */
+void arm_timer(struct TFTPEventLoop *loop, TFTPClientHandler *handler, int milliseconds)
+{
+  _disarm_timer(loop, handler);
+  long tick = _current_tick() + (milliseconds + TFTP_TIMER_TICK - 1) / TFTP_TIMER_TICK;
+  if (tick <= loop->tick)
+    tick = loop->tick + 1;
+
+  TFTPClientHandler **slot = &loop->timers[tick & (TFTP_TIMER_SLOTS - 1)];
+  handler->_timer_tick = tick;
+  handler->_timer_prev = NULL;
+  handler->_timer_next = *slot;
+  if (*slot != NULL)
+    (*slot)->_timer_prev = handler;
+  *slot = handler;
+}
+
+/* Private member methods implementation */
+
+/**
+ * It reads every datagram waiting on the socket, in batches.
+ *
+ * @param loop The event loop.
+ */
+void _receive_packets(struct TFTPEventLoop *loop)
+{
+  while (1)
+  {
+    // the rest of the descriptions was set once for all by the constructor
+    for (int i = 0; i < TFTP_RECV_BATCH; i++)
+      loop->received[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    int count = recvmmsg(loop->socket, loop->received, TFTP_RECV_BATCH, MSG_DONTWAIT, NULL);
+    if (count < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        log_error("recvmmsg() failed. (%s)", strerror(errno));
+      return;
+    }
+    for (int i = 0; i < count; i++)
+    {
+      if (loop->received[i].msg_len >= sizeof(TFTPHeader))
+        _dispatch_packet(loop, loop->buffers[i], loop->received[i].msg_len, &loop->senders[i]);
+    }
+    if (count < TFTP_RECV_BATCH)
+      return;
+  }
+}
+
+/**
+ * It hands a datagram to the transfer of its sender, or starts a transfer if it is a request. DATA and ACK packets
+ * whose checksum is wrong are dropped, as if they were lost.
+ *
+ * @param loop The event loop.
+ * @param packet The datagram.
+ * @param length The length of the datagram.
+ * @param address The address of its sender.
+ */
+void _dispatch_packet(struct TFTPEventLoop *loop, uint8_t *packet, size_t length, const struct sockaddr_in *address)
+{
+  uint16_t opcode;
+  memcpy(&opcode, packet + 2, 2);
+  opcode = ntohs(opcode);
+
+  if ((opcode == OPCODE_DATA || opcode == OPCODE_ACK) && checksum_compute(packet, length) != 0)
+  {
+    log_warn("Packet with wrong checksum from %s:%d.", inet_ntoa(address->sin_addr), ntohs(address->sin_port));
+    return;
+  }
+
+  TFTPClientHandler *handler = _find_transfer(loop, address);
+  // A finished upload only waits for a resent last block; a new request from the same port replaces it.
+  if (handler != NULL && handler->state == HANDLER_DALLYING && (opcode == OPCODE_RRQ || opcode == OPCODE_WRQ))
+  {
+    _remove_transfer(loop, handler);
+    handler = NULL;
+  }
+
+  if (handler == NULL)
+  {
+    if (opcode != OPCODE_RRQ && opcode != OPCODE_WRQ)
+    {
+      if (opcode != OPCODE_ERROR)
+        send_error(loop, address, UNKNOWN_TRANSFER_ID, get_message(UNKNOWN_TRANSFER_ID));
+      return;
+    }
+    if (loop->num_transfers >= TFTP_MAX_TRANSFERS)
+    {
+      send_error(loop, address, UNKNOWN, "Server busy");
+      return;
+    }
+    handler = create_handler(loop, packet, length, address);
+    if (handler != NULL)
+      _add_transfer(loop, handler);
+    return;
+  }
+
+  if (handle_packet(handler, packet, length) == TFTP_FINISHED)
+    _remove_transfer(loop, handler);
+}
+
+/**
+ * It finds the transfer of a client
+ *
+ * @param loop The event loop.
+ * @param address The address of the client.
+ *
+ * @return The transfer, or NULL if the client has none.
+ */
+TFTPClientHandler *_find_transfer(struct TFTPEventLoop *loop, const struct sockaddr_in *address)
+{
+  TFTPClientHandler *handler = loop->transfers[_hash_address(address)];
+  while (handler != NULL &&
+         (handler->addr.sin_addr.s_addr != address->sin_addr.s_addr || handler->addr.sin_port != address->sin_port))
+    handler = handler->_next;
+  return handler;
+}
+
+void _add_transfer(struct TFTPEventLoop *loop, TFTPClientHandler *handler)
+{
+  // Segments larger than the path MTU fail to send (EMSGSIZE) rather than being fragmented.
+  handler->_gso_segment = loop->gso ? _path_segment(&handler->addr) : 0;
+  unsigned int bucket = _hash_address(&handler->addr);
+  handler->_next = loop->transfers[bucket];
+  loop->transfers[bucket] = handler;
+  loop->num_transfers++;
+}
+
+/**
+ * It drops a transfer from the loop and frees it
+ *
+ * @param loop The event loop.
+ * @param handler The transfer.
+ */
+void _remove_transfer(struct TFTPEventLoop *loop, TFTPClientHandler *handler)
+{
+  TFTPClientHandler **link = &loop->transfers[_hash_address(&handler->addr)];
+  while (*link != handler)
+    link = &(*link)->_next;
+  *link = handler->_next;
+  loop->num_transfers--;
+
+  _disarm_timer(loop, handler);
+  free_handler(handler);
+}
+
+/**
+ * It describes the queued packets from the first one given for sendmmsg, grouping them into GSO datagrams when the
+ * socket supports it: a group holds packets to one client, all of the size of the first but the last, which may be
+ * shorter. The kernel joins the pieces of a message before cutting it into segments.
+ *
+ * @param loop The event loop.
+ * @param first The first queued packet to describe.
+ *
+ * @return The number of messages.
+ */
+int _prepare_messages(struct TFTPEventLoop *loop, int first)
+{
+  int count = 0;
+  for (int i = first; i < loop->num_queued; count++)
+  {
+    size_t segment = loop->lengths[i];
+    size_t total = segment;
+    int end = i + 1;
+    // Only the packets of a transfer are grouped, and only when each fits the path to its client whole.
+    TFTPClientHandler *transfer = loop->gso ? _find_transfer(loop, &loop->destinations[i]) : NULL;
+    size_t limit = transfer != NULL ? transfer->_gso_segment : 0;
+    while (segment <= limit && end < loop->num_queued && end - i < TFTP_GSO_SEGMENTS &&
+           loop->lengths[end] <= segment && loop->lengths[end - 1] == segment &&
+           total + loop->lengths[end] <= TFTP_GSO_MAX_BYTES &&
+           loop->destinations[end].sin_addr.s_addr == loop->destinations[i].sin_addr.s_addr &&
+           loop->destinations[end].sin_port == loop->destinations[i].sin_port)
+      total += loop->lengths[end++];
+
+    struct msghdr *message = &loop->messages[count].msg_hdr;
+    message->msg_name = &loop->destinations[i];
+    message->msg_namelen = sizeof(struct sockaddr_in);
+    message->msg_iov = &loop->pieces[loop->first_piece[i]];
+    message->msg_iovlen = (end < loop->num_queued ? loop->first_piece[end] : loop->num_pieces) - loop->first_piece[i];
+    message->msg_control = NULL;
+    message->msg_controllen = 0;
+    message->msg_flags = 0;
+    if (end - i > 1)
+    {
+      message->msg_control = loop->controls[count];
+      message->msg_controllen = sizeof(loop->controls[count]);
+      struct cmsghdr *control = CMSG_FIRSTHDR(message);
+      control->cmsg_level = SOL_UDP;
+      control->cmsg_type = UDP_SEGMENT;
+      control->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+      uint16_t segment_16 = segment;
+      memcpy(CMSG_DATA(control), &segment_16, sizeof(segment_16));
+    }
+    loop->first_queued[count] = i;
+    i = end;
+  }
+  return count;
+}
+
+/**
+ * It finds the largest packet the path to a client carries without fragmenting it, from the MTU of the route a
+ * socket connected to the client gets. The socket of the loop is not connected, so it cannot tell.
+ *
+ * @param address The address of the client.
+ *
+ * @return The size, or 0 if it cannot be known.
+ */
+size_t _path_segment(const struct sockaddr_in *address)
+{
+  int probe = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (probe < 0)
+    return 0;
+  int mtu = 0;
+  socklen_t mtu_len = sizeof(mtu);
+  if (connect(probe, (const struct sockaddr *)address, sizeof(*address)) != 0 ||
+      getsockopt(probe, IPPROTO_IP, IP_MTU, &mtu, &mtu_len) != 0)
+    mtu = 0;
+  close(probe);
+  return mtu > TFTP_UDP_OVERHEAD ? (size_t)(mtu - TFTP_UDP_OVERHEAD) : 0;
+}
+
+void _push_piece(struct TFTPEventLoop *loop, const void *data, size_t length)
+{
+  loop->pieces[loop->num_pieces].iov_base = (void *)data;
+  loop->pieces[loop->num_pieces].iov_len = length;
+  loop->num_pieces++;
+}
+
+unsigned int _hash_address(const struct sockaddr_in *address)
+{
+  unsigned int hash = (address->sin_addr.s_addr ^ ((unsigned int)address->sin_port << 16)) * 2654435761u;
+  return (hash >> 16) & (TFTP_TRANSFER_BUCKETS - 1);
+}
+
+void _disarm_timer(struct TFTPEventLoop *loop, TFTPClientHandler *handler)
+{
+  if (handler->_timer_tick < 0)
+    return;
+  if (handler->_timer_prev != NULL)
+    handler->_timer_prev->_timer_next = handler->_timer_next;
+  else
+    loop->timers[handler->_timer_tick & (TFTP_TIMER_SLOTS - 1)] = handler->_timer_next;
+  if (handler->_timer_next != NULL)
+    handler->_timer_next->_timer_prev = handler->_timer_prev;
+  handler->_timer_prev = NULL;
+  handler->_timer_next = NULL;
+  handler->_timer_tick = -1;
+}
+
+/**
+ * It runs the timers of the ticks elapsed since the last call. A slot also holds timers of later turns of the wheel,
+ * which are left in place.
+ *
+ * @param loop The event loop.
+ */
+void _expire_timers(struct TFTPEventLoop *loop)
+{
+  long now = _current_tick();
+  // After a long stall, one turn of the wheel visits every slot.
+  if (now - loop->tick > TFTP_TIMER_SLOTS)
+    loop->tick = now - TFTP_TIMER_SLOTS;
+
+  while (loop->tick < now)
+  {
+    loop->tick++;
+    TFTPClientHandler *handler = loop->timers[loop->tick & (TFTP_TIMER_SLOTS - 1)];
+    while (handler != NULL)
+    {
+      TFTPClientHandler *next = handler->_timer_next;
+      if (handler->_timer_tick <= now)
+      {
+        _disarm_timer(loop, handler);
+        if (handle_timeout(handler) == TFTP_FINISHED)
+          _remove_transfer(loop, handler);
+      }
+      handler = next;
+    }
+  }
+}
+
+/**
+ * It returns the current tick of the timer wheels, from a monotonic clock
+ *
+ * @return The number of TFTP_TIMER_TICK milliseconds elapsed since an arbitrary point.
+ */
+long _current_tick(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec * 1000 + now.tv_nsec / 1000000) / TFTP_TIMER_TICK;
+}
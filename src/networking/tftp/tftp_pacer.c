@@ -0,0 +1,51 @@
+#include "networking/tftp/tftp_pacer.h"
+
+/**
+ * It sets a pacer up, with a full bucket
+ *
+ * @param pacer The pacer.
+ * @param rate The bytes per second it lets through, 0 for no limit.
+ */
+void tftp_pacer_init(struct TFTPPacer *pacer, long rate)
+{
+  pacer->rate = rate;
+  atomic_init(&pacer->full, 0);
+}
+
+/**
+ * It tells how long to wait before a packet may be sent
+ *
+ * @param pacer The pacer.
+ * @param now The current time, in microseconds of the monotonic clock.
+ *
+ * @return The microseconds to wait, 0 if the packet may be sent now.
+ */
+long tftp_pacer_delay(struct TFTPPacer *pacer, long now)
+{
+  if (pacer->rate <= 0)
+    return 0;
+  long ahead = atomic_load_explicit(&pacer->full, memory_order_relaxed) - now - TFTP_PACING_BURST * 1000L;
+  return ahead > 0 ? ahead : 0;
+}
+
+/**
+ * It takes the tokens of a packet sent from the bucket. The bucket may go in debt by a packet, which the next ones
+ * wait for.
+ *
+ * @param pacer The pacer.
+ * @param bytes The size of the packet.
+ * @param now The current time, in microseconds of the monotonic clock.
+ */
+void tftp_pacer_charge(struct TFTPPacer *pacer, size_t bytes, long now)
+{
+  if (pacer->rate <= 0)
+    return;
+  long cost = (long)(bytes * 1000000.0 / pacer->rate);
+  long full = atomic_load_explicit(&pacer->full, memory_order_relaxed);
+  long next;
+  do
+  {
+    // An idle bucket refills up to its depth, no further.
+    next = (full > now ? full : now) + cost;
+  } while (!atomic_compare_exchange_weak_explicit(&pacer->full, &full, next, memory_order_relaxed, memory_order_relaxed));
+}
@@ -1,25 +1,17 @@
 
 #include "networking/tftp/tftp_server.h"
 #include "networking/tftp/header.h"
-#include "networking/tftp/tftp_client_handle.h"
-#include "systems/thread_pool.h"
+#include "networking/tftp/tftp_event_loop.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 
 void tftp_launch(struct TFTPServer *server);
-void *tftp_handler(void *arg);
-
-/* The client server struct is used as an argument for the handler method. */
-struct ClientServer
-{
-  uint8_t *data;                     // The data received from the client
-  size_t bytes_received;             // The number of bytes received from the client
-  struct sockaddr_in client_address; // The address of the client
-  struct TFTPServer *server;         // The server instance
-};
+void *tftp_event_loop_thread(void *arg);
 
 /* Constructor */
 
@@ -41,18 +33,22 @@ tftp_server_constructor(u_long interface, int port, char is_allow_upload, char *
   tftp_server.is_allow_upload = is_allow_upload;
   strcpy(tftp_server.upload_dir, upload_dir);
   tftp_server.launch = tftp_launch;
-  tftp_server.thread_pool = NULL;
+  tftp_server.loops = NULL;
+  tftp_server.num_loops = 0;
+  tftp_server.transfer_rate = 0;
+  tftp_server.total_rate = 0;
+  tftp_server.pacer = NULL;
 
   log_info("TFTP Server is initialized at %s:%d", inet_ntoa(tftp_server.server.address.sin_addr), ntohs(tftp_server.server.address.sin_port));
   return tftp_server;
 }
 
 /**
- * It creates a thread pool, then waits for connections and adds a job to the thread pool for each connection
+ * It creates one event loop per core, each with its own SO_REUSEPORT socket on the server's port: the kernel hashes
+ * the address of a client to pick the socket, so all the packets of a transfer reach the same loop. The first loop
+ * runs in the calling thread, so this function does not return while the server is up.
  *
  * @param server The server instance.
- *
- * @return A pointer to the newly created TFTPServer struct.
  */
 void tftp_launch(struct TFTPServer *server)
 {
@@ -61,34 +57,47 @@ void tftp_launch(struct TFTPServer *server)
     log_fatal("Server is not initialized");
     return;
   }
-  // Initialize a thread pool to handle clients.
-  struct ThreadPool *thread_pool = thread_pool_constructor(10);
-  server->thread_pool = thread_pool;
-  struct sockaddr_in client_address;
-  socklen_t client_len = sizeof(client_address);
-  uint8_t data[BUF_SIZE];
 
-  log_info("TFTP server launched... Waiting for connections...");
-  while (1)
-  {
-    size_t bytes_received = recvfrom(server->server.socket, data, BUF_SIZE, 0,
-                                     (struct sockaddr *)&client_address, &client_len);
+  server->pacer = malloc(sizeof(struct TFTPPacer));
+  tftp_pacer_init(server->pacer, server->total_rate);
 
-    if (bytes_received < 1)
+  long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int num_loops = num_cores > 0 ? (int)num_cores : 1;
+  server->loops = malloc(sizeof(struct TFTPEventLoop *) * num_loops);
+  server->num_loops = 0;
+  for (int i = 0; i < num_loops; i++)
+  {
+    int socket = i == 0 ? server->server.socket : server_reuseport_socket(&server->server);
+    if (socket < 0)
     {
-      log_error("connection closed by client");
-      continue;
+      log_warn("Failed to open socket for event loop %d", i);
+      break;
     }
-    // Create an instance of the ClientServer struct.
-    struct ClientServer *client_server = malloc(sizeof(struct ClientServer));
-    client_server->data = data;
-    client_server->bytes_received = bytes_received;
-    client_server->client_address = client_address;
-    client_server->server = server;
+    struct TFTPEventLoop *loop = tftp_event_loop_constructor(server, socket);
+    if (loop == NULL)
+    {
+      if (i > 0)
+        close(socket);
+      break;
+    }
+    server->loops[server->num_loops++] = loop;
+  }
+  if (server->num_loops == 0)
+  {
+    log_fatal("Failed to start any event loop");
+    return;
+  }
+  log_info("TFTP server launched with %d event loops... Waiting for connections...", server->num_loops);
 
-    struct ThreadJob job = thread_job_constructor(tftp_handler, client_server);
-    thread_pool->add_work(thread_pool, job);
+  for (int i = 1; i < server->num_loops; i++)
+  {
+    struct TFTPEventLoop *loop = server->loops[i];
+    if (pthread_create(&loop->thread, NULL, tftp_event_loop_thread, loop) == 0)
+      loop->has_thread = 1;
+    else
+      log_error("Failed to start event loop %d", i);
   }
+  server->loops[0]->run(server->loops[0]);
 }
 
 /**
@@ -98,31 +107,28 @@ void tftp_launch(struct TFTPServer *server)
  */
 void tftp_server_destructor(struct TFTPServer *server)
 {
-  if (server->thread_pool != NULL)
-    thread_pool_destructor(server->thread_pool);
+  for (int i = 0; i < server->num_loops; i++)
+  {
+    // The first loop shares the server's own socket, which server_destructor closes.
+    if (i > 0)
+      close(server->loops[i]->socket);
+    tftp_event_loop_destructor(server->loops[i]);
+  }
+  free(server->loops);
+  free(server->pacer);
   server_destructor(&server->server);
 }
 
 /**
- * It creates a handler for the client, handles the client, and then frees the handler
+ * The thread function of the additional event loops.
  *
- * @param arg A pointer to a struct ClientServer.
+ * @param arg A pointer to the TFTPEventLoop to run.
  *
- * @return The return value is a pointer to the thread.
+ * @return NULL.
  */
-void *tftp_handler(void *arg)
+void *tftp_event_loop_thread(void *arg)
 {
-  struct ClientServer *client_server = (struct ClientServer *)arg;
-  TFTPClientHandler *handler = create_handler(client_server->data, client_server->bytes_received, &client_server->client_address, client_server->server);
-  if (handler == NULL)
-  {
-    log_error("Failed to create handler");
-  }
-  else
-  {
-    if (handle_client(handler) == 0)
-      log_info("Closing connection with %s:%d! Done request", inet_ntoa(client_server->client_address.sin_addr), ntohs(client_server->client_address.sin_port));
-    free_handler(handler);
-  }
+  struct TFTPEventLoop *loop = (struct TFTPEventLoop *)arg;
+  loop->run(loop);
   return NULL;
 }
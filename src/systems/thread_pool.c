@@ -1,13 +1,83 @@
+#define _GNU_SOURCE
+
 #include "systems/thread_pool.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+
+/* Private data types */
+
+/**
+ * The storage of a worker's deque. It is replaced by one twice as large when full; thieves may still be reading the
+ * old one, so it is kept until the pool is destroyed.
+ */
+struct ThreadDequeArray
+{
+  long size;                          // The number of slots (a power of two)
+  struct ThreadJob *jobs;             // The slots, indexed modulo size
+  struct ThreadDequeArray *previous;  // The array this one replaced
+};
+
+/**
+ * A worker thread and its Chase-Lev deque. Only the worker pushes and pops at the bottom; any thread steals at the
+ * top. Workers sit on cache lines of their own so that stealing does not slow the owner down.
+ */
+struct ThreadWorker
+{
+  _Alignas(64) atomic_long top;                   // The index of the oldest job, advanced by thieves
+  atomic_long bottom;                             // The index after the newest job
+  _Atomic(struct ThreadDequeArray *) array;       // The slots
+  struct ThreadPool *thread_pool;                 // The pool the worker belongs to
+  unsigned int seed;                              // Picks the first victim to steal from
+};
+
+/**
+ * A slot of the submission ring. Its sequence tells producers and consumers whose turn it is, so that neither needs a
+ * lock (Vyukov's bounded MPMC queue).
+ */
+struct ThreadJobSlot
+{
+  atomic_size_t sequence;
+  struct ThreadJob job;
+};
+
+/**
+ * The ring jobs submitted from outside the pool go through.
+ */
+struct ThreadJobRing
+{
+  _Alignas(64) atomic_size_t head; // The next slot to take a job from
+  _Alignas(64) atomic_size_t tail; // The next slot to put a job in
+  struct ThreadJobSlot slots[THREAD_POOL_QUEUE_SIZE];
+};
+
+/* The worker running on the current thread, NULL outside of any pool */
+static _Thread_local struct ThreadWorker *current_worker = NULL;
 
 /* PRIVATE MEMBER PROTOTYES */
 void *generic_thread_function(void *arg);
 void add_work(struct ThreadPool *thread_pool, struct ThreadJob job);
+void add_work_batch(struct ThreadPool *thread_pool, struct ThreadJob *jobs, int count);
 void wait(struct ThreadPool *thread_pool);
 
+void _submit(struct ThreadPool *thread_pool, struct ThreadJob job);
+void _release(struct ThreadPool *thread_pool, long count);
+int _claim(struct ThreadPool *thread_pool);
+int _try_claim(struct ThreadPool *thread_pool);
+void _find_job(struct ThreadWorker *worker, struct ThreadJob *job);
+void _finish(struct ThreadPool *thread_pool);
+
+void _deque_push(struct ThreadWorker *worker, struct ThreadJob job);
+int _deque_pop(struct ThreadWorker *worker, struct ThreadJob *job);
+int _deque_steal(struct ThreadWorker *worker, struct ThreadJob *job);
+struct ThreadDequeArray *_deque_array(long size);
+
+int _queue_push(struct ThreadJobRing *ring, struct ThreadJob job);
+int _queue_pop(struct ThreadJobRing *ring, struct ThreadJob *job);
+
 /* Construstors */
 
 /**
@@ -18,25 +88,81 @@ void wait(struct ThreadPool *thread_pool);
  * @return A struct ThreadPool
  */
 struct ThreadPool *thread_pool_constructor(int num_threads)
+{
+  return thread_pool_constructor_with_options(num_threads, 0);
+}
+
+/**
+ * It creates a thread pool with the specified number of threads and options, and returns a struct ThreadPool
+ *
+ * @param num_threads The number of threads to create in the thread pool.
+ * @param options THREAD_POOL_PIN_CPUS to pin each worker to a CPU, or 0.
+ *
+ * @return A struct ThreadPool
+ */
+struct ThreadPool *thread_pool_constructor_with_options(int num_threads, int options)
 {
   struct ThreadPool *thread_pool = malloc(sizeof(struct ThreadPool));
   thread_pool->num_threads = num_threads;
-  thread_pool->active = 1;
-  thread_pool->work = queue_constructor();
-
-  // Initialize the pthread muteces
+  atomic_init(&thread_pool->active, 1);
+  atomic_init(&thread_pool->available, 0);
+  atomic_init(&thread_pool->pending, 0);
+  atomic_init(&thread_pool->sleeping, 0);
   thread_pool->lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
   thread_pool->signal = (pthread_cond_t)PTHREAD_COND_INITIALIZER;
-  pthread_mutex_lock(&thread_pool->lock);
-  thread_pool->pool = malloc(sizeof(pthread_t[num_threads]));
+  thread_pool->idle = (pthread_cond_t)PTHREAD_COND_INITIALIZER;
+  thread_pool->add_work = add_work;
+  thread_pool->add_work_batch = add_work_batch;
+  thread_pool->wait_all = wait;
+
+  thread_pool->queue = aligned_alloc(64, sizeof(struct ThreadJobRing));
+  atomic_init(&thread_pool->queue->head, 0);
+  atomic_init(&thread_pool->queue->tail, 0);
+  for (size_t i = 0; i < THREAD_POOL_QUEUE_SIZE; i++)
+  {
+    atomic_init(&thread_pool->queue->slots[i].sequence, i);
+  }
 
+  thread_pool->workers = aligned_alloc(64, sizeof(struct ThreadWorker[num_threads]));
   for (int i = 0; i < num_threads; i++)
   {
-    pthread_create(&thread_pool->pool[i], NULL, generic_thread_function, thread_pool);
+    struct ThreadWorker *worker = &thread_pool->workers[i];
+    atomic_init(&worker->top, 0);
+    atomic_init(&worker->bottom, 0);
+    atomic_init(&worker->array, _deque_array(THREAD_POOL_DEQUE_SIZE));
+    worker->thread_pool = thread_pool;
+    worker->seed = i + 1;
+  }
+
+  // The CPUs the process may run on, which pinned workers are spread over.
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  int num_cpus = 0;
+  if ((options & THREAD_POOL_PIN_CPUS) && sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+    num_cpus = CPU_COUNT(&allowed);
+
+  thread_pool->pool = malloc(sizeof(pthread_t[num_threads]));
+  for (int i = 0; i < num_threads; i++)
+  {
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    if (num_cpus > 0)
+    {
+      // Find the (i mod num_cpus)-th allowed CPU.
+      int cpu = -1;
+      for (int seen = -1; seen < i % num_cpus;)
+      {
+        if (CPU_ISSET(++cpu, &allowed))
+          seen++;
+      }
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      CPU_SET(cpu, &cpus);
+      pthread_attr_setaffinity_np(&attributes, sizeof(cpus), &cpus);
+    }
+    pthread_create(&thread_pool->pool[i], &attributes, generic_thread_function, &thread_pool->workers[i]);
+    pthread_attr_destroy(&attributes);
   }
-  pthread_mutex_unlock(&thread_pool->lock);
-  thread_pool->add_work = add_work;
-  thread_pool->wait_all = wait;
   return thread_pool;
 }
 
@@ -59,25 +185,38 @@ struct ThreadJob thread_job_constructor(void *(*job)(void *arg), void *arg)
 /* destructor */
 
 /**
- * It sets the active flag to 0, signals all the threads to wake up, waits for them to finish, and then frees the thread
- * pool
+ * It waits for the jobs already added to finish, stops the threads and frees the thread pool. Jobs added afterwards
+ * are dropped.
  *
  * @param thread_pool The thread pool to be destroyed.
  */
 void thread_pool_destructor(struct ThreadPool *thread_pool)
 {
-  thread_pool->active = 0;
+  thread_pool->wait_all(thread_pool);
+
+  pthread_mutex_lock(&thread_pool->lock);
+  atomic_store(&thread_pool->active, 0);
+  pthread_cond_broadcast(&thread_pool->signal);
+  pthread_mutex_unlock(&thread_pool->lock);
   for (int i = 0; i < thread_pool->num_threads; i++)
   {
-    pthread_cond_signal(&thread_pool->signal);
+    pthread_join(thread_pool->pool[i], NULL);
   }
+
   for (int i = 0; i < thread_pool->num_threads; i++)
   {
-    pthread_cancel(thread_pool->pool[i]);
-    pthread_join(thread_pool->pool[i], NULL);
+    struct ThreadDequeArray *array = atomic_load(&thread_pool->workers[i].array);
+    while (array != NULL)
+    {
+      struct ThreadDequeArray *previous = array->previous;
+      free(array->jobs);
+      free(array);
+      array = previous;
+    }
   }
+  free(thread_pool->workers);
+  free(thread_pool->queue);
   free(thread_pool->pool);
-  queue_destructor(&thread_pool->work, NULL);
   free(thread_pool);
 }
 
@@ -88,61 +227,396 @@ void thread_pool_destructor(struct ThreadPool *thread_pool)
  * execute its contents.
  * This make the pool dynamic - any function can be passed as a job.
  *
- * @param arg The argument passed to the thread function.
+ * @param arg The worker the thread runs.
  *
  * @return A pointer void.
  */
 void *generic_thread_function(void *arg)
 {
-  struct ThreadPool *thread_pool = (struct ThreadPool *)arg;
+  struct ThreadWorker *worker = (struct ThreadWorker *)arg;
+  struct ThreadPool *thread_pool = worker->thread_pool;
+  current_worker = worker;
+
   struct ThreadJob job;
-  while (thread_pool->active == 1)
+  while (_claim(thread_pool))
   {
-    // Lock the work queue.
-    pthread_mutex_lock(&thread_pool->lock);
-    // Wait for work to be added to the queue.
-    pthread_cond_wait(&thread_pool->signal, &thread_pool->lock);
-    // Get the job from the queue.
-    struct ThreadJob *thread_job = (struct ThreadJob *)thread_pool->work.peek(&thread_pool->work);
-    // Unlock the work queue.
-    if (thread_job)
-    {
-      job = *thread_job;
-      thread_pool->work.pop(&thread_pool->work, NULL);
-    }
-    pthread_mutex_unlock(&thread_pool->lock);
-    // Execute the job.
-    if (thread_job != NULL)
-    {
-      job.job(job.arg);
-    }
+    _find_job(worker, &job);
+    job.job(job.arg);
+    _finish(thread_pool);
   }
   return NULL;
 }
 
 /**
- * Adds work to the queue in a thread safe way.
+ * Adds work to the pool in a thread safe way. A job added by a job of the same pool goes to the deque of the worker
+ * running it, any other to the submission ring.
  *
  * @param thread_pool The thread pool to add the work to.
  * @param thread_job The job to be added to the queue.
  */
 void add_work(struct ThreadPool *thread_pool, struct ThreadJob thread_job)
 {
-  pthread_mutex_lock(&thread_pool->lock);
-  thread_pool->work.push(&thread_pool->work, &thread_job, sizeof(thread_job));
-  pthread_cond_signal(&thread_pool->signal);
-  pthread_mutex_unlock(&thread_pool->lock);
+  if (!atomic_load(&thread_pool->active))
+    return;
+  atomic_fetch_add(&thread_pool->pending, 1);
+  _submit(thread_pool, thread_job);
+  _release(thread_pool, 1);
 }
 
 /**
- * Waits for all the threads in the pool to finish their current jobs.
+ * Adds several jobs to the pool at once, paying for the wake-up of the workers once.
+ *
+ * @param thread_pool The thread pool to add the work to.
+ * @param thread_jobs The jobs to be added.
+ * @param count The number of jobs.
+ */
+void add_work_batch(struct ThreadPool *thread_pool, struct ThreadJob *thread_jobs, int count)
+{
+  if (count <= 0 || !atomic_load(&thread_pool->active))
+    return;
+  atomic_fetch_add(&thread_pool->pending, count);
+  for (int i = 0; i < count; i++)
+  {
+    _submit(thread_pool, thread_jobs[i]);
+  }
+  _release(thread_pool, count);
+}
+
+/**
+ * Waits for all the jobs of the pool, those added while waiting included, to finish.
  *
  * @param thread_pool The thread pool to wait for.
  */
 void wait(struct ThreadPool *thread_pool)
 {
-  while (thread_pool->active == 1 && thread_pool->work.list.length > 0)
+  pthread_mutex_lock(&thread_pool->lock);
+  while (atomic_load(&thread_pool->pending) > 0)
   {
-    pthread_cond_wait(&thread_pool->signal, &thread_pool->lock);
+    pthread_cond_wait(&thread_pool->idle, &thread_pool->lock);
+  }
+  pthread_mutex_unlock(&thread_pool->lock);
+}
+
+/* Private member methods */
+
+/**
+ * It stores a job where a worker will find it. When the submission ring is full the caller yields until a worker
+ * makes room, which slows producers down to the pace of the pool.
+ *
+ * @param thread_pool The thread pool.
+ * @param job The job.
+ */
+void _submit(struct ThreadPool *thread_pool, struct ThreadJob job)
+{
+  if (current_worker != NULL && current_worker->thread_pool == thread_pool)
+  {
+    _deque_push(current_worker, job);
+    return;
+  }
+  while (!_queue_push(thread_pool->queue, job))
+  {
+    sched_yield();
+  }
+}
+
+/**
+ * It makes stored jobs available to the workers and wakes as many sleeping workers as there are new jobs.
+ *
+ * @param thread_pool The thread pool.
+ * @param count The number of new jobs.
+ */
+void _release(struct ThreadPool *thread_pool, long count)
+{
+  // Sequentially consistent, like the sleeper's update of sleeping followed by its read of available: at least one
+  // of the two sees the other, so a worker never sleeps through a job.
+  atomic_fetch_add(&thread_pool->available, count);
+  int sleeping = atomic_load(&thread_pool->sleeping);
+  if (sleeping == 0)
+    return;
+
+  pthread_mutex_lock(&thread_pool->lock);
+  for (long i = 0; i < count && i < sleeping; i++)
+  {
+    pthread_cond_signal(&thread_pool->signal);
+  }
+  pthread_mutex_unlock(&thread_pool->lock);
+}
+
+/**
+ * It reserves one of the available jobs for the calling worker, sleeping until there is one.
+ *
+ * @param thread_pool The thread pool.
+ *
+ * @return 1 once a job is reserved, 0 when the pool is stopped.
+ */
+int _claim(struct ThreadPool *thread_pool)
+{
+  while (1)
+  {
+    for (int i = 0; i < THREAD_POOL_SPIN; i++)
+    {
+      if (_try_claim(thread_pool))
+        return 1;
+    }
+
+    pthread_mutex_lock(&thread_pool->lock);
+    atomic_fetch_add(&thread_pool->sleeping, 1);
+    while (atomic_load(&thread_pool->available) <= 0 && atomic_load(&thread_pool->active))
+    {
+      pthread_cond_wait(&thread_pool->signal, &thread_pool->lock);
+    }
+    atomic_fetch_sub(&thread_pool->sleeping, 1);
+    pthread_mutex_unlock(&thread_pool->lock);
+
+    if (_try_claim(thread_pool))
+      return 1;
+    if (!atomic_load(&thread_pool->active))
+      return 0;
+  }
+}
+
+/**
+ * It reserves one of the available jobs if there is any.
+ *
+ * @param thread_pool The thread pool.
+ *
+ * @return 1 if a job was reserved, 0 otherwise.
+ */
+int _try_claim(struct ThreadPool *thread_pool)
+{
+  long available = atomic_load_explicit(&thread_pool->available, memory_order_relaxed);
+  while (available > 0)
+  {
+    if (atomic_compare_exchange_weak(&thread_pool->available, &available, available - 1))
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ * It takes a job for a worker that reserved one: from its own deque first, then from the submission ring, moving a
+ * batch of jobs to the deque for the other workers to steal, and last from the deques of the other workers. A reserved
+ * job always exists, but may be on its way from the ring to a deque, so the search goes on until it is found.
+ *
+ * @param worker The worker.
+ * @param job Set to the job.
+ */
+void _find_job(struct ThreadWorker *worker, struct ThreadJob *job)
+{
+  struct ThreadPool *thread_pool = worker->thread_pool;
+  while (1)
+  {
+    if (_deque_pop(worker, job))
+      return;
+
+    if (_queue_pop(thread_pool->queue, job))
+    {
+      struct ThreadJob extra;
+      for (int i = 1; i < THREAD_POOL_BATCH && _queue_pop(thread_pool->queue, &extra); i++)
+      {
+        _deque_push(worker, extra);
+      }
+      return;
+    }
+
+    worker->seed ^= worker->seed << 13;
+    worker->seed ^= worker->seed >> 17;
+    worker->seed ^= worker->seed << 5;
+    int first = worker->seed % thread_pool->num_threads;
+    for (int i = 0; i < thread_pool->num_threads; i++)
+    {
+      struct ThreadWorker *victim = &thread_pool->workers[(first + i) % thread_pool->num_threads];
+      if (victim != worker && _deque_steal(victim, job))
+        return;
+    }
+    sched_yield();
+  }
+}
+
+/**
+ * It accounts for a finished job and wakes the threads waiting for the pool to be idle.
+ *
+ * @param thread_pool The thread pool.
+ */
+void _finish(struct ThreadPool *thread_pool)
+{
+  if (atomic_fetch_sub(&thread_pool->pending, 1) == 1)
+  {
+    pthread_mutex_lock(&thread_pool->lock);
+    pthread_cond_broadcast(&thread_pool->idle);
+    pthread_mutex_unlock(&thread_pool->lock);
+  }
+}
+
+/**
+ * It pushes a job at the bottom of a worker's deque, growing it if full. Only the worker itself may push.
+ *
+ * @param worker The worker owning the deque.
+ * @param job The job.
+ */
+void _deque_push(struct ThreadWorker *worker, struct ThreadJob job)
+{
+  long bottom = atomic_load_explicit(&worker->bottom, memory_order_relaxed);
+  long top = atomic_load_explicit(&worker->top, memory_order_acquire);
+  struct ThreadDequeArray *array = atomic_load_explicit(&worker->array, memory_order_relaxed);
+  if (bottom - top > array->size - 1)
+  {
+    struct ThreadDequeArray *larger = _deque_array(array->size * 2);
+    for (long i = top; i < bottom; i++)
+    {
+      larger->jobs[i & (larger->size - 1)] = array->jobs[i & (array->size - 1)];
+    }
+    larger->previous = array;
+    atomic_store_explicit(&worker->array, larger, memory_order_release);
+    array = larger;
+  }
+  // Thieves may read the slot concurrently (see _deque_steal), hence the atomic stores.
+  struct ThreadJob *slot = &array->jobs[bottom & (array->size - 1)];
+  __atomic_store_n(&slot->job, job.job, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->arg, job.arg, __ATOMIC_RELAXED);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&worker->bottom, bottom + 1, memory_order_relaxed);
+}
+
+/**
+ * It pops the newest job of a worker's deque. Only the worker itself may pop.
+ *
+ * @param worker The worker owning the deque.
+ * @param job Set to the job.
+ *
+ * @return 1 if a job was popped, 0 if the deque is empty or a thief took the last job.
+ */
+int _deque_pop(struct ThreadWorker *worker, struct ThreadJob *job)
+{
+  long bottom = atomic_load_explicit(&worker->bottom, memory_order_relaxed) - 1;
+  struct ThreadDequeArray *array = atomic_load_explicit(&worker->array, memory_order_relaxed);
+  atomic_store_explicit(&worker->bottom, bottom, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  long top = atomic_load_explicit(&worker->top, memory_order_relaxed);
+
+  if (top > bottom)
+  {
+    atomic_store_explicit(&worker->bottom, bottom + 1, memory_order_relaxed);
+    return 0;
+  }
+  *job = array->jobs[bottom & (array->size - 1)];
+  if (top < bottom)
+    return 1;
+
+  // The last job: race the thieves for it.
+  int won = atomic_compare_exchange_strong_explicit(&worker->top, &top, top + 1, memory_order_seq_cst,
+                                                    memory_order_relaxed);
+  atomic_store_explicit(&worker->bottom, bottom + 1, memory_order_relaxed);
+  return won;
+}
+
+/**
+ * It steals the oldest job of a worker's deque. Any thread may steal.
+ *
+ * @param worker The worker owning the deque.
+ * @param job Set to the job.
+ *
+ * @return 1 if a job was stolen, 0 if the deque is empty or another thread took the job first.
+ */
+int _deque_steal(struct ThreadWorker *worker, struct ThreadJob *job)
+{
+  long top = atomic_load_explicit(&worker->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  long bottom = atomic_load_explicit(&worker->bottom, memory_order_acquire);
+  if (top >= bottom)
+    return 0;
+
+  // The slot can only be overwritten once top has moved on, in which case the copy is thrown away below.
+  struct ThreadDequeArray *array = atomic_load_explicit(&worker->array, memory_order_acquire);
+  struct ThreadJob *slot = &array->jobs[top & (array->size - 1)];
+  struct ThreadJob stolen;
+  stolen.job = __atomic_load_n(&slot->job, __ATOMIC_RELAXED);
+  stolen.arg = __atomic_load_n(&slot->arg, __ATOMIC_RELAXED);
+  if (!atomic_compare_exchange_strong_explicit(&worker->top, &top, top + 1, memory_order_seq_cst,
+                                               memory_order_relaxed))
+    return 0;
+  *job = stolen;
+  return 1;
+}
+
+/**
+ * It allocates the slots of a deque.
+ *
+ * @param size The number of slots (a power of two).
+ *
+ * @return A pointer to a struct ThreadDequeArray.
+ */
+struct ThreadDequeArray *_deque_array(long size)
+{
+  struct ThreadDequeArray *array = malloc(sizeof(struct ThreadDequeArray));
+  array->size = size;
+  array->jobs = malloc(sizeof(struct ThreadJob[size]));
+  array->previous = NULL;
+  return array;
+}
+
+/**
+ * It puts a job in the submission ring. Any thread may push.
+ *
+ * @param ring The ring.
+ * @param job The job.
+ *
+ * @return 1 if the job was added, 0 if the ring is full.
+ */
+int _queue_push(struct ThreadJobRing *ring, struct ThreadJob job)
+{
+  size_t position = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  struct ThreadJobSlot *slot;
+  while (1)
+  {
+    slot = &ring->slots[position & (THREAD_POOL_QUEUE_SIZE - 1)];
+    size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+    if (difference == 0)
+    {
+      if (atomic_compare_exchange_weak_explicit(&ring->tail, &position, position + 1, memory_order_relaxed,
+                                                memory_order_relaxed))
+        break;
+    }
+    else if (difference < 0)
+      return 0;
+    else
+      position = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  }
+  slot->job = job;
+  atomic_store_explicit(&slot->sequence, position + 1, memory_order_release);
+  return 1;
+}
+
+/**
+ * It takes the oldest job out of the submission ring. Any thread may pop.
+ *
+ * @param ring The ring.
+ * @param job Set to the job.
+ *
+ * @return 1 if a job was taken, 0 if the ring is empty.
+ */
+int _queue_pop(struct ThreadJobRing *ring, struct ThreadJob *job)
+{
+  size_t position = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  struct ThreadJobSlot *slot;
+  while (1)
+  {
+    slot = &ring->slots[position & (THREAD_POOL_QUEUE_SIZE - 1)];
+    size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+    if (difference == 0)
+    {
+      if (atomic_compare_exchange_weak_explicit(&ring->head, &position, position + 1, memory_order_relaxed,
+                                                memory_order_relaxed))
+        break;
+    }
+    else if (difference < 0)
+      return 0;
+    else
+      position = atomic_load_explicit(&ring->head, memory_order_relaxed);
   }
+  *job = slot->job;
+  atomic_store_explicit(&slot->sequence, position + THREAD_POOL_QUEUE_SIZE, memory_order_release);
+  return 1;
 }
@@ -9,62 +9,6 @@
 #include <dirent.h>
 #include <unistd.h>
 
-/**
- * It takes an integer and returns a string
- *
- * @param i The integer to convert to a string.
- *
- * @return A pointer to a string.
- */
-char *convert_int_to_string(int i)
-{
-  char *str = (char *)malloc(10);
-  sprintf(str, "%d", i);
-  return str;
-}
-
-/**
- * It takes a float and returns a string
- *
- * @param f The float value to be converted to a string.
- *
- * @return A pointer to a string.
- */
-char *convert_float_to_string(float f)
-{
-  char *str = (char *)malloc(10);
-  sprintf(str, "%f", f);
-  return str;
-}
-
-/**
- * It takes a double and returns a string
- *
- * @param d The double value to convert to a string.
- *
- * @return A pointer to a string.
- */
-char *convert_double_to_string(double d)
-{
-  char *str = (char *)malloc(10);
-  sprintf(str, "%lf", d);
-  return str;
-}
-
-/**
- * It takes a long integer and returns a string representation of that integer
- *
- * @param l The long to convert to a string.
- *
- * @return A pointer to a string.
- */
-char *convert_long_to_string(long l)
-{
-  char *str = (char *)malloc(10);
-  sprintf(str, "%ld", l);
-  return str;
-}
-
 /**
  * It returns the current time in a string format
  *
@@ -73,12 +17,12 @@ char *convert_long_to_string(long l)
 char *get_current_time()
 {
   time_t rawtime;
-  struct tm *timeinfo;
+  struct tm timeinfo;
 
   time(&rawtime);
-  timeinfo = localtime(&rawtime);
+  localtime_r(&rawtime, &timeinfo);
   char *time = malloc(20);
-  strftime(time, 20, "%Y-%m-%d %H:%M:%S", timeinfo);
+  strftime(time, 20, "%Y-%m-%d %H:%M:%S", &timeinfo);
   return time;
 }
 
@@ -0,0 +1,330 @@
+#include "utils/json_writer.h"
+
+#include <string.h>
+
+/* Private member methods prototypes */
+
+void _next_json_chunk(struct JSONWriter *writer, size_t length);
+void _write_json(struct JSONWriter *writer, const char *data, size_t length);
+void _write_json_string(struct JSONWriter *writer, const char *value);
+void _separate_json(struct JSONWriter *writer);
+
+/* Public member methods prototypes */
+
+void begin_object_json(struct JSONWriter *writer);
+void end_object_json(struct JSONWriter *writer);
+void begin_array_json(struct JSONWriter *writer);
+void end_array_json(struct JSONWriter *writer);
+void key_json(struct JSONWriter *writer, const char *name);
+void string_json(struct JSONWriter *writer, const char *value);
+void integer_json(struct JSONWriter *writer, long value);
+void string_field_json(struct JSONWriter *writer, const char *name, const char *value);
+void integer_field_json(struct JSONWriter *writer, const char *name, long value);
+char *finish_json(struct JSONWriter *writer);
+
+/* Constructor */
+
+/**
+ * It creates a writer with nothing written
+ *
+ * @param arena The arena chunks are taken from, usually the one of the request.
+ * @param sink The function each full chunk is handed to, or NULL to grow a single string.
+ * @param target The first argument of the sink.
+ *
+ * @return A writer.
+ */
+struct JSONWriter json_writer_constructor(struct Arena *arena, void (*sink)(void *target, char *data, size_t length), void *target)
+{
+  struct JSONWriter writer;
+  writer.length = 0;
+  writer.arena = arena;
+  writer.chunk = NULL;
+  writer.used = 0;
+  writer.size = 0;
+  writer.sink = sink;
+  writer.target = target;
+  writer.need_comma = 0;
+  writer.begin_object = begin_object_json;
+  writer.end_object = end_object_json;
+  writer.begin_array = begin_array_json;
+  writer.end_array = end_array_json;
+  writer.key = key_json;
+  writer.string = string_json;
+  writer.integer = integer_json;
+  writer.string_field = string_field_json;
+  writer.integer_field = integer_field_json;
+  writer.finish = finish_json;
+  return writer;
+}
+
+/* Public member methods implementation */
+
+/**
+ * It opens an object
+ *
+ * @param writer The writer.
+ */
+void begin_object_json(struct JSONWriter *writer)
+{
+  _separate_json(writer);
+  _write_json(writer, "{", 1);
+  writer->need_comma = 0;
+}
+
+/**
+ * It closes the object being written
+ *
+ * @param writer The writer.
+ */
+void end_object_json(struct JSONWriter *writer)
+{
+  _write_json(writer, "}", 1);
+  writer->need_comma = 1;
+}
+
+/**
+ * It opens an array
+ *
+ * @param writer The writer.
+ */
+void begin_array_json(struct JSONWriter *writer)
+{
+  _separate_json(writer);
+  _write_json(writer, "[", 1);
+  writer->need_comma = 0;
+}
+
+/**
+ * It closes the array being written
+ *
+ * @param writer The writer.
+ */
+void end_array_json(struct JSONWriter *writer)
+{
+  _write_json(writer, "]", 1);
+  writer->need_comma = 1;
+}
+
+/**
+ * It writes the name of the next member of the object being written
+ *
+ * @param writer The writer.
+ * @param name The name, escaped as strings are.
+ */
+void key_json(struct JSONWriter *writer, const char *name)
+{
+  _separate_json(writer);
+  _write_json_string(writer, name);
+  _write_json(writer, ":", 1);
+  writer->need_comma = 0;
+}
+
+/**
+ * It writes a string value
+ *
+ * @param writer The writer.
+ * @param value The string, or NULL for null.
+ */
+void string_json(struct JSONWriter *writer, const char *value)
+{
+  _separate_json(writer);
+  if (value != NULL)
+    _write_json_string(writer, value);
+  else
+    _write_json(writer, "null", 4);
+  writer->need_comma = 1;
+}
+
+/**
+ * It writes an integer value. The digits are produced from the last one, into a buffer large enough for any long.
+ *
+ * @param writer The writer.
+ * @param value The integer.
+ */
+void integer_json(struct JSONWriter *writer, long value)
+{
+  char digits[20];
+  size_t position = sizeof(digits);
+  unsigned long magnitude = value < 0 ? 0UL - (unsigned long)value : (unsigned long)value;
+  do
+  {
+    digits[--position] = '0' + magnitude % 10;
+    magnitude /= 10;
+  } while (magnitude > 0);
+  if (value < 0)
+    digits[--position] = '-';
+
+  _separate_json(writer);
+  _write_json(writer, digits + position, sizeof(digits) - position);
+  writer->need_comma = 1;
+}
+
+/**
+ * It writes a member of the object being written whose value is a string
+ *
+ * @param writer The writer.
+ * @param name The name of the member.
+ * @param value The string, or NULL for null.
+ */
+void string_field_json(struct JSONWriter *writer, const char *name, const char *value)
+{
+  key_json(writer, name);
+  string_json(writer, value);
+}
+
+/**
+ * It writes a member of the object being written whose value is an integer
+ *
+ * @param writer The writer.
+ * @param name The name of the member.
+ * @param value The integer.
+ */
+void integer_field_json(struct JSONWriter *writer, const char *name, long value)
+{
+  key_json(writer, name);
+  integer_json(writer, value);
+}
+
+/**
+ * It ends the output. A writer with a sink hands it the chunk being filled; one without NUL terminates its string.
+ *
+ * @param writer The writer.
+ *
+ * @return The JSON, in the arena, for a writer without a sink; NULL otherwise.
+ */
+char *finish_json(struct JSONWriter *writer)
+{
+  if (writer->sink != NULL)
+  {
+    if (writer->used > 0)
+      writer->sink(writer->target, writer->chunk, writer->used);
+    writer->chunk = NULL;
+    writer->used = 0;
+    writer->size = 0;
+    return NULL;
+  }
+
+  if (writer->used == writer->size)
+    _next_json_chunk(writer, 0);
+  writer->chunk[writer->used] = '\0';
+  return writer->chunk;
+}
+
+/* Private member methods implementation */
+
+/**
+ * It makes room for more output. With a sink, the full chunk is handed over and a new one taken; without, the string
+ * is moved to a chunk at least twice as large, with a byte left for the NUL.
+ *
+ * @param writer The writer.
+ * @param length The bytes about to be written.
+ */
+void _next_json_chunk(struct JSONWriter *writer, size_t length)
+{
+  if (writer->sink != NULL)
+  {
+    if (writer->used > 0)
+      writer->sink(writer->target, writer->chunk, writer->used);
+    writer->chunk = writer->arena->alloc(writer->arena, JSON_CHUNK_SIZE);
+    writer->used = 0;
+    writer->size = JSON_CHUNK_SIZE;
+    return;
+  }
+
+  size_t size = writer->size > 0 ? writer->size * 2 : 256;
+  while (size < writer->used + length + 1)
+    size *= 2;
+  char *chunk = writer->arena->alloc(writer->arena, size);
+  if (writer->used > 0)
+    memcpy(chunk, writer->chunk, writer->used);
+  writer->chunk = chunk;
+  writer->size = size;
+}
+
+/**
+ * It copies bytes to the output, across as many chunks as they take
+ *
+ * @param writer The writer.
+ * @param data The bytes.
+ * @param length The number of bytes.
+ */
+void _write_json(struct JSONWriter *writer, const char *data, size_t length)
+{
+  writer->length += length;
+  while (length > 0)
+  {
+    if (writer->used == writer->size)
+      _next_json_chunk(writer, length);
+    size_t taken = writer->size - writer->used < length ? writer->size - writer->used : length;
+    memcpy(writer->chunk + writer->used, data, taken);
+    writer->used += taken;
+    data += taken;
+    length -= taken;
+  }
+}
+
+/**
+ * It writes a string between quotes, escaping quotes, backslashes and control characters. The runs of bytes that need
+ * no escape are copied at once.
+ *
+ * @param writer The writer.
+ * @param value The NUL terminated string.
+ */
+void _write_json_string(struct JSONWriter *writer, const char *value)
+{
+  static const char hex[] = "0123456789abcdef";
+  _write_json(writer, "\"", 1);
+  const char *run = value;
+  for (const char *cursor = value; *cursor != '\0'; cursor++)
+  {
+    unsigned char c = *cursor;
+    if (c >= 0x20 && c != '"' && c != '\\')
+      continue;
+
+    _write_json(writer, run, cursor - run);
+    run = cursor + 1;
+    char escape[6] = {'\\', (char)c, 0, 0, 0, 0};
+    size_t length = 2;
+    switch (c)
+    {
+    case '"':
+    case '\\':
+      break;
+    case '\b':
+      escape[1] = 'b';
+      break;
+    case '\f':
+      escape[1] = 'f';
+      break;
+    case '\n':
+      escape[1] = 'n';
+      break;
+    case '\r':
+      escape[1] = 'r';
+      break;
+    case '\t':
+      escape[1] = 't';
+      break;
+    default:
+      memcpy(escape + 1, "u00", 3);
+      escape[4] = hex[c >> 4];
+      escape[5] = hex[c & 0xf];
+      length = 6;
+      break;
+    }
+    _write_json(writer, escape, length);
+  }
+  _write_json(writer, run, strlen(run));
+  _write_json(writer, "\"", 1);
+}
+
+/**
+ * It writes the comma between a value and the one before it in the same container
+ *
+ * @param writer The writer.
+ */
+void _separate_json(struct JSONWriter *writer)
+{
+  if (writer->need_comma)
+    _write_json(writer, ",", 1);
+}
@@ -1,53 +1,127 @@
+// Checks the checksum against the byte-pair implementation it replaced, then measures its throughput.
+// gcc -O2 -I includes tests/checksum.c src/networking/checksum.c -lpthread -o checksum_test && ./checksum_test
+
+#include "networking/checksum.h"
+
 #include <stdio.h>
-#include <arpa/inet.h>
-#include <string.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+// The kernels of src/networking/checksum.c, private there
+uint64_t _sum_scalar(const uint8_t *data, size_t length);
+uint64_t _sum_sse2(const uint8_t *data, size_t length);
+uint64_t _sum_avx2(const uint8_t *data, size_t length);
+uint16_t _fold(uint64_t sum);
+
+#define MAX_LENGTH 65536
 
-uint16_t checksum_(uint16_t len_udp,
-                   int padding, const uint16_t *temp)
+// The checksum as it was: the packet is copied into a static buffer, then summed a byte pair at a time.
+uint16_t reference_checksum(const uint8_t *data, size_t length)
 {
-  uint16_t padd = 0;
-  uint16_t word16;
-  uint64_t sum;
-  static u_char buff[65536];
-  int i;
-  memset(buff, 0, 65536);
-  memcpy(buff, temp, len_udp);
-
-  // take padding into account
-  if ((padding & 1) == 1)
-  {
-    padd = 1;
-    buff[len_udp] = 0;
-  }
+  static uint8_t buff[MAX_LENGTH + 1];
+  uint64_t sum = 0;
+  memset(buff, 0, sizeof(buff));
+  memcpy(buff, data, length);
+  for (size_t i = 0; i < length; i += 2)
+    sum += ((buff[i] << 8) & 0xFF00) + (buff[i + 1] & 0xFF);
+  while (sum >> 16)
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  return (uint16_t)~sum;
+}
+
+uint16_t kernel_checksum(uint64_t (*kernel)(const uint8_t *, size_t), const uint8_t *data, size_t length)
+{
+  uint16_t sum = ntohs(_fold(kernel(data, length)));
+  return (uint16_t)~sum;
+}
 
-  // initialize sum to zero
-  sum = 0;
+double now_seconds()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
 
-  // make 16 bit words out of every two adjacent 8 bit words and
-  // calculate the sum of all 16 bit words
-  for (i = 0; i < len_udp + padd; i = i + 2)
+void test_correctness(uint8_t *buffer)
+{
+  uint64_t (*kernels[])(const uint8_t *, size_t) = {_sum_scalar, _sum_sse2, _sum_avx2};
+  for (int i = 0; i < 20000; i++)
   {
-    word16 = ((buff[i] << 8) & 0xFF00) + (buff[i + 1] & 0xFF);
-    // cout << hex << (int) buff[i] << " " << (int) buff[i + 1] << " ";
-    sum = sum + (unsigned long)word16;
+    size_t offset = rand() % 64;
+    size_t length = i < 100 ? (size_t)i : (size_t)rand() % (MAX_LENGTH - 64);
+    const uint8_t *data = buffer + offset;
+    uint16_t expected = reference_checksum(data, length);
+
+    assert(checksum_compute(data, length) == expected);
+    for (int k = 0; k < 3; k++)
+      assert(kernel_checksum(kernels[k], data, length) == expected);
+
+    // split anywhere, odd parts included
+    struct Checksum checksum;
+    checksum_init(&checksum);
+    size_t first = length == 0 ? 0 : rand() % (length + 1);
+    size_t second = first + (length - first == 0 ? 0 : rand() % (length - first + 1));
+    checksum_update(&checksum, data, first);
+    checksum_update(&checksum, data + first, second - first);
+    checksum_update(&checksum, data + second, length - second);
+    assert(checksum_final(&checksum) == expected);
   }
-  while (sum >> 16)
-    sum = (sum & 0xFFFF) + (sum >> 16);
-  printf("Sum: %d\n", sum);
-  sum = ~sum;
 
-  return ((uint16_t)sum);
+  // all ones, so that every carry is taken
+  uint8_t *ones = malloc(MAX_LENGTH);
+  memset(ones, 0xFF, MAX_LENGTH);
+  assert(checksum_compute(ones, MAX_LENGTH) == reference_checksum(ones, MAX_LENGTH));
+  assert(checksum_compute(ones, MAX_LENGTH - 1) == reference_checksum(ones, MAX_LENGTH - 1));
+  free(ones);
+
+  // a packet holding its own checksum sums to 0
+  uint8_t packet[7] = {0, 0, 0, 3, 'a', 'b', 'c'};
+  uint16_t sum = htons(checksum_compute(packet + 2, sizeof(packet) - 2));
+  memcpy(packet, &sum, 2);
+  assert(checksum_compute(packet, sizeof(packet)) == 0);
+  printf("correctness: ok\n");
+}
+
+void benchmark(uint8_t *buffer, size_t length)
+{
+  size_t rounds = (256 << 20) / length;
+  volatile uint16_t sink = 0;
+
+  double start = now_seconds();
+  for (size_t i = 0; i < rounds / 8; i++)
+    sink += reference_checksum(buffer, length);
+  double reference = now_seconds() - start;
+
+  start = now_seconds();
+  for (size_t i = 0; i < rounds; i++)
+    sink += checksum_compute(buffer, length);
+  double vectorized = now_seconds() - start;
+
+  start = now_seconds();
+  for (size_t i = 0; i < rounds; i++)
+    sink += kernel_checksum(_sum_scalar, buffer, length);
+  double scalar = now_seconds() - start;
+
+  double megabytes = (double)rounds * length / (1 << 20);
+  printf("%6zu bytes: reference %8.0f MB/s, scalar %8.0f MB/s, checksum_compute %8.0f MB/s\n", length,
+         megabytes / 8 / reference, megabytes / scalar, megabytes / vectorized);
+  (void)sink;
 }
 
 int main()
 {
-  char *a = calloc(5, 1);
-  strcpy(a, "abc");
-  uint16_t b = checksum_(5, 1, (uint16_t *)a);
-  // add check sum to a
-  uint16_t c = htons(b);
-  memcpy(a + 3, &b, 2);
-  assert(checksum_(5, 1, (uint16_t *)a) == 0);
+  uint8_t *buffer = malloc(MAX_LENGTH);
+  srand(42);
+  for (int i = 0; i < MAX_LENGTH; i++)
+    buffer[i] = rand();
+
+  test_correctness(buffer);
+  size_t lengths[] = {4, 516, 1432, 8196, 65468};
+  for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+    benchmark(buffer, lengths[i]);
+  free(buffer);
+  return 0;
 }
@@ -1,367 +1,204 @@
+// Checks the Dictionary and the reset of an Arena, then times the Dictionary against the binary search tree of
+// entries it replaced, with route-like string keys and integer keys. Build it against the library, from the root of
+// the repository:
+// make && gcc -O2 -I includes tests/datastruct.c programlib.a -lpthread -lm -o datastruct && ./datastruct
+
+#include "data_structures/dictionary.h"
+#include "data_structures/binary_search_tree.h"
+#include "data_structures/linked_list.h"
+#include "data_structures/arena.h"
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <assert.h>
+#include <time.h>
 
-struct Node
-{
-  void *data; // The data is stored as a void pointer - casting is required for proper access.
-  // A pointer to the next node in the chain.
-  struct Node *next;
-  struct Node *prev;
-};
-
-// Creating a new node with the data and size passed in.
-struct Node node_constructor(void *data, unsigned long size);
-// Freeing the memory allocated for the node.
-void node_destructor(struct Node *node);
-
-struct LinkedList
-{
-  /* Public variables */
-
-  struct Node *head; // Head points to the first node in the chain.
-  int length;        // Length refers to the number of nodes in the chain.
-
-  /* Public methods */
-
-  // Insert adds new items to the chain at a specified location - this function creates the new nodes.
-  void (*insert)(struct LinkedList *list, int index, void *data, unsigned long size);
-  // Remove an item from the chain at a specified location and deal allocation of memory.
-  void (*remove)(struct LinkedList *list, int index);
-  // Get the data from a node at a specified location.
-  void *(*retrieve)(struct LinkedList *list, int index);
-  // Sorting and searching the list (bubble sort).
-  void (*sort)(struct LinkedList *list, int (*compare)(void *a, void *b));
-  // Binary search. (requires sorted list)
-  short (*search)(struct LinkedList *list, void *query, int (*compare)(void *a, void *b));
-};
-
-// Creating a new linked list.
-struct LinkedList linked_list_constructor(void);
-// Freeing the memory allocated for the linked list.
-void linked_list_destructor(struct LinkedList *list);
-
-/**
- * It takes a pointer to some data and the size of that data, and returns a node with that data
- *
- * @param data The data to be stored in the node.
- * @param size The size of the data you want to store in the node.
- *
- * @return A node.
- */
-struct Node node_constructor(void *data, unsigned long size)
-{
-  if (size < 1)
-  {
-    fprintf(stderr, "Error: Invalid data size for node...\n");
-    exit(1);
-  }
-
-  struct Node node;
-  node.data = malloc(size);
-  memcpy(node.data, data, size);
-  node.next = NULL;
-  node.prev = NULL;
-
-  return node;
-}
-
-/**
- * It frees the memory allocated for the data and the node itself
- *
- * @param node The node to destroy.
- */
-void node_destructor(struct Node *node)
-{
-  free(node->data);
-  free(node);
-}
-
-/* Private member methods prototypes */
-
-struct Node *create_node_ll(void *data, unsigned long size);
-void destroy_node_ll(struct Node *node);
+#define NUM_KEYS 100000
+#define KEY_SIZE 48
+#define ROUNDS 5
 
-/* Public member methods prototypes */
+static char keys[NUM_KEYS][KEY_SIZE];
 
-struct Node *iterate_ll(struct LinkedList *list, int index);
-void insert_ll(struct LinkedList *list, int index, void *data, unsigned long size);
-void remove_node_ll(struct LinkedList *list, int index);
-void *retrieve_ll(struct LinkedList *list, int index);
-void bubble_sort_ll(struct LinkedList *list, int (*compare)(void *a, void *b));
-short binary_search_ll(struct LinkedList *list, void *query, int (*compare)(void *a, void *b));
-
-/* Constructor */
-
-/**
- * It creates a new linked list and returns it
- *
- * @return A struct LinkedList
- */
-struct LinkedList linked_list_constructor()
+static double now()
 {
-  struct LinkedList new_list;
-  // init data
-  new_list.head = NULL;
-  new_list.length = 0;
-
-  // init methods
-  new_list.insert = insert_ll;
-  new_list.remove = remove_node_ll;
-  new_list.retrieve = retrieve_ll;
-  new_list.sort = bubble_sort_ll;
-  new_list.search = binary_search_ll;
-
-  return new_list;
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
 }
 
-/**
- * This function removes all the elements from the list.
- *
- * @param list The list to be destructed.
- */
-void linked_list_destructor(struct LinkedList *list)
+static int compare_int_keys(void *entry_one, void *entry_two)
 {
-  for (int i = 0; i < list->length; i++)
-  {
-    list->remove(list, 0);
-  }
+  int one = *(int *)((struct Entry *)entry_one)->key;
+  int two = *(int *)((struct Entry *)entry_two)->key;
+  return one > two ? 1 : one < two ? -1 : 0;
 }
 
-/* Private methods */
-
-/**
- * The create_node function creates a new node to add to the chain
- * by allocating space on the heap and calling the node constructor.
- *
- * @param data The data that you want to store in the node.
- * @param size The size of the data that you want to store in the node.
- *
- * @return A pointer to a Node struct.
- */
-struct Node *create_node_ll(void *data, unsigned long size)
+static void count_entry(void *key, void *value, void *arg)
 {
-  struct Node *new_node = (struct Node *)malloc(sizeof(struct Node));
-  *new_node = node_constructor(data, size);
-
-  return new_node;
+  int *expected = arg;
+  char name[KEY_SIZE];
+  snprintf(name, sizeof(name), "/key/%d", *expected);
+  assert(strcmp(key, name) == 0);
+  assert(*(int *)value == *expected);
+  (*expected)++;
 }
 
-/**
- * The destroy_node function removes a node by deallocating it's memory address.
- * This simply renames the node destructor function.
- *
- * @param node The node to be destroyed.
- */
-void destroy_node_ll(struct Node *node)
+static size_t string_size(void *key)
 {
-  node_destructor(node);
+  return strlen(key) + 1;
 }
 
-/**
- * Iterate through the linked list until you reach the index specified
- * by the user, then return the node at that index.
- *
- * @param list The linked list to iterate over
- * @param index The index of the node you want to retrieve.
- *
- * @return A pointer to the node at the specified index.
- */
-struct Node *iterate_ll(struct LinkedList *list, int index)
+static void test_linked_list()
 {
-  // Confirm the user has specified a valid index
-  if (index < 0 || index >= list->length)
-  {
-    return NULL;
-  }
-
-  // Create a cursor node for iteration
-  struct Node *cursor = list->head;
-  for (int i = 0; i < index; i++)
-  {
-    cursor = cursor->next;
-  }
-
-  return cursor;
+  struct LinkedList list = linked_list_constructor();
+  list.insert(&list, 0, "Hello", 6);
+  list.insert(&list, 1, "World", 6);
+  assert(strcmp(list.retrieve(&list, 0), "Hello") == 0);
+  assert(strcmp(list.retrieve(&list, 1), "World") == 0);
+  linked_list_destructor(&list, NULL);
 }
 
-/* Public methods */
-
-/**
- * The insert function puts a new node in the chain.
- *
- * @param list the list to insert into
- * @param index the index at which to insert the new node
- * @param data the data to be inserted into the list
- * @param size the size of the data to be stored in the node
- */
-void insert_ll(struct LinkedList *list, int index, void *data, unsigned long size)
+static void test_arena_reset()
 {
-  // Create a new node to be inserted
-  struct Node *node_to_insert = create_node_ll(data, size);
-  // Check if the node will be the new head of the list
-  if (index == 0)
-  {
-    // insert to head
-    node_to_insert->next = list->head;
-    list->head = node_to_insert;
-  }
-  else
-  {
-    // find the item in the list immediately before the desired index
-    struct Node *cursor = iterate_ll(list, index - 1);
-    if (!cursor)
-    {
-      return;
-    }
-    // set the node's next pointer to the node at the desired index
-    node_to_insert->next = cursor->next;
-    // set the cursor's next to the new node
-    cursor->next = node_to_insert;
-  }
-  // increment the length of the list
-  list->length++;
+  struct Arena arena = arena_constructor(1024);
+  for (int i = 0; i < 100; i++)
+    arena.copy(&arena, "a string filling blocks", 23);
+  arena.alloc(&arena, 4096);
+  struct ArenaBlock *first = arena.blocks;
+
+  // One block of the regular size is kept, emptied, and the next allocations come from it.
+  arena_reset(&arena);
+  assert(arena.blocks != NULL && arena.blocks->next == NULL);
+  assert(arena.blocks->size == arena.block_size && arena.blocks->used == 0);
+  assert(arena.blocks == first);
+  char *copy = arena.copy(&arena, "again", 5);
+  assert(copy == (char *)first->data && strcmp(copy, "again") == 0);
+
+  // An arena holding only a large allocation keeps nothing.
+  arena_reset(&arena);
+  arena_destructor(&arena);
+  arena.alloc(&arena, 4096);
+  arena_reset(&arena);
+  assert(arena.blocks == NULL);
+  arena_destructor(&arena);
 }
 
-/**
- * The remove function removes a node from the linked list.
- *
- * @param list The list to remove the node from
- * @param index the index of the item to remove
- *
- * @return The node at the given index
- */
-void remove_node_ll(struct LinkedList *list, int index)
+static void test_string_keys()
 {
-  // Check if the item being removed is the head
-  if (index == 0)
+  struct Dictionary dictionary = dictionary_constructor(compare_string_keys);
+  int value = 1;
+  assert(dictionary.search(&dictionary, "missing", 8) == NULL);
+
+  // The size of a string key may or may not count its NUL, as server.c and db.c each do.
+  dictionary.insert(&dictionary, "/login", strlen("/login"), &value, sizeof(value));
+  assert(*(int *)dictionary.search(&dictionary, "/login", strlen("/login") + 1) == 1);
+  assert(*(int *)dictionary.search(&dictionary, "/login", strlen("/login")) == 1);
+  assert(dictionary.search(&dictionary, "/logi", strlen("/logi")) == NULL);
+  assert(dictionary.search(&dictionary, "/login/", strlen("/login/")) == NULL);
+
+  // A key already there keeps its value.
+  value = 2;
+  dictionary.insert(&dictionary, "/login", strlen("/login") + 1, &value, sizeof(value));
+  assert(*(int *)dictionary.search(&dictionary, "/login", strlen("/login")) == 1);
+  assert(dictionary.length == 1);
+
+  // Long keys go to the arena, and the table grows many times; the order of insertion is kept.
+  for (int i = 0; i < NUM_KEYS; i++)
+    dictionary.insert(&dictionary, keys[i], strlen(keys[i]) + 1, &i, sizeof(i));
+  assert(dictionary.length == NUM_KEYS + 1);
+  for (int i = 0; i < NUM_KEYS; i++)
+    assert(*(int *)dictionary.search(&dictionary, keys[i], strlen(keys[i]) + 1) == i);
+  dictionary_destructor(&dictionary, NULL, NULL);
+
+  struct Dictionary ordered = dictionary_constructor(compare_string_keys);
+  for (int i = 0; i < 1000; i++)
   {
-    struct Node *node_to_remove = list->head;
-    if (node_to_remove)
-    {
-      list->head = node_to_remove->next;
-      destroy_node_ll(node_to_remove);
-    }
-    else
-    {
-      return;
-    }
+    char name[KEY_SIZE];
+    snprintf(name, sizeof(name), "/key/%d", i);
+    ordered.insert(&ordered, name, strlen(name) + 1, &i, sizeof(i));
   }
-  else
-  {
-    // find the item in the list immediately before the desired index
-    struct Node *cursor = iterate_ll(list, index - 1);
-    if (!cursor)
-    {
-      return;
-    }
-    struct Node *node_to_remove = cursor->next;
-    cursor->next = node_to_remove->next;
-    destroy_node_ll(node_to_remove);
-  }
-  // decrement the length of the list
-  list->length--;
+  int expected = 0;
+  ordered.iterate(&ordered, string_size, count_entry, &expected);
+  assert(expected == 1000);
+  dictionary_destructor(&ordered, NULL, NULL);
 }
 
-/**
- * Iterate to the desired node, and return the data.
- *
- * @param list the linked list to retrieve from
- * @param index the index of the node to retrieve
- *
- * @return The data stored in the node at the given index.
- */
-void *retrieve_ll(struct LinkedList *list, int index)
+static void test_binary_keys()
 {
-  // find the desired node
-  struct Node *cursor = iterate_ll(list, index);
-  if (cursor)
+  struct Dictionary dictionary = dictionary_constructor(compare_int_keys);
+  for (int i = 0; i < NUM_KEYS; i++)
   {
-    return cursor->data;
+    int value = -i;
+    dictionary.insert(&dictionary, &i, sizeof(i), &value, sizeof(value));
   }
-  return NULL;
+  for (int i = 0; i < NUM_KEYS; i++)
+    assert(*(int *)dictionary.search(&dictionary, &i, sizeof(i)) == -i);
+  int missing = NUM_KEYS;
+  assert(dictionary.search(&dictionary, &missing, sizeof(missing)) == NULL);
+  dictionary_destructor(&dictionary, NULL, NULL);
 }
 
-/**
- * The sort function is used to sort data in the list.
- * Note that this is a permanent change and items added after sorting will not themselves be sorted.
- * Bubble sort algorithm is used.
- *
- * @param list The list to sort.
- * @param compare A function that takes two void pointers and returns an integer 1, 0 or -1.
- */
-void bubble_sort_ll(struct LinkedList *list, int (*compare)(void *a, void *b))
+static void free_entry(void *data)
 {
-  for (struct Node *i = list->retrieve(list, 0); i; i = i->next)
-  {
-    for (struct Node *j = i->next; j; j = j->next)
-    {
-      if (compare(i->data, j->data) > 0)
-      {
-        void *temp = i->data;
-        i->data = j->data;
-        j->data = temp;
-      }
-    }
-  }
+  entry_destructor(data, NULL, NULL);
 }
 
-/**
- * It takes a linked list, a query, and a comparison function, and returns 1 if the query is in the list, and 0 if it is
- * not
- *
- * @param list The linked list to search.
- * @param query The data to search for.
- * @param compare a function that takes two void pointers and returns 1 if the first is greater than the second, -1 if the
- * first is less than the second, and 0 if they are equal.
- *
- * @return A short int.
- */
-short binary_search_ll(struct LinkedList *list, void *query, int (*compare)(void *a, void *b))
+static void benchmark()
 {
-  int position = list->length / 2;
-  int min_checked = 0;
-  int max_checked = list->length;
-  while (max_checked > min_checked)
+  double tree_insert = 0, tree_search = 0, hash_insert = 0, hash_search = 0;
+  long found = 0;
+  for (int round = 0; round < ROUNDS; round++)
   {
-    void *data = list->retrieve(list, position);
-    if (compare(data, query) == 1)
-    {
-      max_checked = position;
-      if (position != (min_checked + position) / 2)
-      {
-        position = (min_checked + position) / 2;
-      }
-      else
-      {
-        break;
-      }
-    }
-    else if (compare(data, query) == -1)
+    // The reference is the dictionary as it was: entries in a binary search tree, compared with strcmp.
+    struct BinarySearchTree tree = binary_search_tree_constructor(compare_string_keys);
+    double start = now();
+    for (int i = 0; i < NUM_KEYS; i++)
     {
-      min_checked = position;
-      if (position != (max_checked + position) / 2)
-      {
-        position = (max_checked + position) / 2;
-      }
-      else
-      {
-        break;
-      }
+      struct Entry entry = entry_constructor(keys[i], strlen(keys[i]) + 1, &i, sizeof(i));
+      tree.insert(&tree, &entry, sizeof(entry));
     }
-    else
+    tree_insert += now() - start;
+    start = now();
+    for (int i = 0; i < NUM_KEYS; i++)
     {
-      return 1;
+      struct Entry query = {keys[i], NULL};
+      found += tree.search(&tree, &query) != NULL;
     }
+    tree_search += now() - start;
+    binary_search_tree_destructor(&tree, free_entry);
+
+    struct Dictionary dictionary = dictionary_constructor(compare_string_keys);
+    start = now();
+    for (int i = 0; i < NUM_KEYS; i++)
+      dictionary.insert(&dictionary, keys[i], strlen(keys[i]) + 1, &i, sizeof(i));
+    hash_insert += now() - start;
+    start = now();
+    for (int i = 0; i < NUM_KEYS; i++)
+      found += dictionary.search(&dictionary, keys[i], strlen(keys[i]) + 1) != NULL;
+    hash_search += now() - start;
+    dictionary_destructor(&dictionary, NULL, NULL);
   }
-  return 0;
+  assert(found == 2L * ROUNDS * NUM_KEYS);
+
+  double scale = 1e9 / ((double)ROUNDS * NUM_KEYS);
+  printf("%-24s %12s %12s\n", "", "insert ns", "search ns");
+  printf("%-24s %12.1f %12.1f\n", "binary search tree", tree_insert * scale, tree_search * scale);
+  printf("%-24s %12.1f %12.1f\n", "hash table", hash_insert * scale, hash_search * scale);
 }
 
 int main()
 {
-  struct LinkedList list = linked_list_constructor();
-  list.insert(&list, 0, "Hello", 6);
-  list.insert(&list, 1, "World", 6);
-
-  printf("%s %s\n", list.retrieve(&list, 0), list.retrieve(&list, 1));
+  // Keys shaped like the paths of routes and the names of pools, in random order so the tree stays balanced enough.
+  srand(1);
+  for (int i = 0; i < NUM_KEYS; i++)
+    snprintf(keys[i], KEY_SIZE, i % 2 ? "/api/v1/user/%d/files/%d" : "pool_%d_%d", rand(), i);
+
+  test_linked_list();
+  test_arena_reset();
+  test_string_keys();
+  test_binary_keys();
+  printf("All dictionary and arena checks passed\n");
+  benchmark();
+  return 0;
 }
@@ -0,0 +1,93 @@
+// Checks the heads serve_file writes for a file offered under a long non-ASCII name, with and without ranges. Build it
+// against the library, from the root of the repository:
+// make && gcc -O2 -I includes tests/serve_file.c programlib.a -L libs -lpthread -lm -l:sqlite3.a -ldl -o serve_file && ./serve_file
+
+#include "networking/http/http_server.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+
+// Parses a GET request carrying the given Range header, or none, into the request.
+static void make_request(struct HTTPRequest *request, char *buffer, size_t size, const char *range)
+{
+  if (range != NULL)
+    snprintf(buffer, size, "GET /file/download HTTP/1.1\r\nHost: x\r\nRange: %s\r\n\r\n", range);
+  else
+    snprintf(buffer, size, "GET /file/download HTTP/1.1\r\nHost: x\r\n\r\n");
+  *request = http_request_constructor();
+  assert(request->parse(request, buffer, strlen(buffer)) == HTTP_PARSE_HEADERS);
+  assert(request->parse(request, buffer, strlen(buffer)) == HTTP_PARSE_COMPLETE);
+  request->bind(request, buffer);
+}
+
+static int open_file(void)
+{
+  char path[] = "/tmp/serve_fileXXXXXX";
+  int file = mkstemp(path);
+  assert(file >= 0);
+  unlink(path);
+  assert(write(file, "0123456789", 10) == 10);
+  return file;
+}
+
+// The head is one header per line, each ending with CRLF, the last line empty; no other CR or LF.
+static void check_head(const char *head, const char *status, const char *encoded)
+{
+  assert(strncmp(head, status, strlen(status)) == 0);
+  size_t length = strlen(head);
+  assert(length >= 4 && strcmp(head + length - 4, "\r\n\r\n") == 0);
+  for (size_t i = 0; i < length; i++)
+  {
+    if (head[i] == '\r')
+      assert(head[i + 1] == '\n');
+    if (head[i] == '\n')
+      assert(i > 0 && head[i - 1] == '\r');
+  }
+  char *disposition = strstr(head, "Content-Disposition: attachment; filename*=UTF-8''");
+  assert(disposition != NULL);
+  disposition += strlen("Content-Disposition: attachment; filename*=UTF-8''");
+  assert(strncmp(disposition, encoded, strlen(encoded)) == 0);
+  assert(strncmp(disposition + strlen(encoded), "\r\n", 2) == 0);
+}
+
+int main()
+{
+  // 255 bytes, each percent-encoded: a header of more than 765 bytes.
+  char name[256], encoded[3 * 256];
+  for (int i = 0; i < 85; i++)
+  {
+    memcpy(name + 3 * i, "\xc3\xa9 ", 3);
+    memcpy(encoded + 9 * i, "%C3%A9%20", 9);
+  }
+  name[255] = '\0';
+  encoded[765] = '\0';
+
+  const char *ranges[] = {NULL, "bytes=2-5", "bytes=0-1,4-4,8-"};
+  const char *statuses[] = {"HTTP/1.1 200 OK\r\n", "HTTP/1.1 206 Partial Content\r\n", "HTTP/1.1 206 Partial Content\r\n"};
+  for (int i = 0; i < 3; i++)
+  {
+    char buffer[256];
+    struct HTTPRequest request;
+    make_request(&request, buffer, sizeof(buffer), ranges[i]);
+    char *head = serve_file(&request, open_file(), "application/octet-stream", name);
+    assert(head != NULL);
+    check_head(head, statuses[i], encoded);
+    if (i == 1)
+      assert(strstr(head, "Content-Range: bytes 2-5/10\r\n") != NULL && strstr(head, "Content-Length: 4\r\n") != NULL);
+    http_request_destructor(&request);
+  }
+
+  // A name the quoted form can carry is sent as it is.
+  char buffer[256];
+  struct HTTPRequest request;
+  make_request(&request, buffer, sizeof(buffer), "bytes=0-0");
+  char *head = serve_file(&request, open_file(), "text/plain", "notes 2024.txt");
+  assert(strstr(head, "Content-Disposition: attachment; filename=\"notes 2024.txt\"\r\n\r\n") != NULL);
+  http_request_destructor(&request);
+
+  printf("All serve_file checks passed\n");
+  return 0;
+}
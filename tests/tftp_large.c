@@ -0,0 +1,226 @@
+// Transfers sparse files larger than 4 GB and 65535 blocks through a running TFTP server, both ways of rolling block
+// numbers over, and checks every byte. Run it from the directory of the server, which serves ./upload on port 8069:
+// gcc -O2 -I includes tests/tftp_large.c src/networking/checksum.c -lpthread -o tftp_large && ./tftp_large
+
+#define _GNU_SOURCE
+#include "networking/checksum.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+
+#define PORT 8069
+#define PACKET_SIZE 65536
+#define WINDOW 32
+#define LARGE_SIZE 5000000000LL // Past 4 GB, and past 65535 blocks of the largest size
+
+int sock;
+struct sockaddr_in server;
+
+// The number of a block on the wire: after 65535 comes 0, or 1 with rollover
+uint16_t wire_block(long long block, int rollover)
+{
+  if (rollover == 0 || block == 0)
+    return (uint16_t)block;
+  return (uint16_t)((block - 1) % 65535 + 1);
+}
+
+void send_packet(uint8_t *packet, size_t length, const struct sockaddr_in *to)
+{
+  memset(packet, 0, 2);
+  uint16_t sum = htons(checksum_compute(packet + 2, length - 2));
+  memcpy(packet, &sum, 2);
+  assert(sendto(sock, packet, length, 0, (const struct sockaddr *)to, sizeof(*to)) == (ssize_t)length);
+}
+
+ssize_t receive_packet(uint8_t *packet, struct sockaddr_in *from)
+{
+  socklen_t length = sizeof(*from);
+  return recvfrom(sock, packet, PACKET_SIZE, 0, (struct sockaddr *)from, &length);
+}
+
+// Sends a request: name, mode, then the options, given as "name", "value" pairs ending with NULL
+void send_request(uint16_t opcode, const char *name, const char **options)
+{
+  uint8_t packet[512];
+  uint16_t op = htons(opcode);
+  memcpy(packet + 2, &op, 2);
+  size_t length = 4;
+  length += sprintf((char *)packet + length, "%s", name) + 1;
+  length += sprintf((char *)packet + length, "octet") + 1;
+  for (int i = 0; options[i] != NULL; i++)
+    length += sprintf((char *)packet + length, "%s", options[i]) + 1;
+  send_packet(packet, length, &server);
+}
+
+void send_ack(struct sockaddr_in *to, uint16_t block)
+{
+  uint8_t packet[6] = {0, 0, 0, 4};
+  block = htons(block);
+  memcpy(packet + 4, &block, 2);
+  send_packet(packet, sizeof(packet), to);
+}
+
+uint16_t read_u16(const uint8_t *bytes)
+{
+  uint16_t value;
+  memcpy(&value, bytes, 2);
+  return ntohs(value);
+}
+
+// Downloads a file and checks each block against the file itself, from a byte on
+void download(const char *name, const char **options, int block_size, int rollover, long long start, long long size)
+{
+  int fd = open(name, O_RDONLY);
+  assert(fd >= 0);
+  uint8_t *packet = malloc(PACKET_SIZE), *expected = malloc(PACKET_SIZE);
+  struct sockaddr_in peer = server;
+  send_request(1, strrchr(name, '/') + 1, options);
+
+  long long received = 0, bytes = 0;
+  int last = 0, pending = 0;
+  while (!last)
+  {
+    ssize_t length = receive_packet(packet, &peer);
+    if (length < 0)
+    {
+      send_ack(&peer, wire_block(received, rollover));
+      continue;
+    }
+    uint16_t opcode = read_u16(packet + 2);
+    assert(opcode != 5);
+    if (opcode == 6)
+    {
+      send_ack(&peer, 0);
+      continue;
+    }
+    if (read_u16(packet + 4) != wire_block(received + 1, rollover))
+      continue;
+    length -= 6;
+    assert(pread(fd, expected, length, start + bytes) == length);
+    assert(memcmp(packet + 6, expected, length) == 0);
+    received++;
+    bytes += length;
+    last = length < block_size;
+    if (++pending == WINDOW || last)
+    {
+      send_ack(&peer, wire_block(received, rollover));
+      pending = 0;
+    }
+  }
+  assert(bytes == size);
+  printf("download %s from %lld: %lld bytes in %lld blocks, rollover %d: ok\n", name, start, bytes, received, rollover);
+  free(packet);
+  free(expected);
+  close(fd);
+}
+
+// Uploads a buffer, a window at a time, and waits for the server to keep it
+void upload(const char *name, const char **options, const uint8_t *data, long long size, int block_size, int rollover)
+{
+  uint8_t *packet = malloc(PACKET_SIZE);
+  struct sockaddr_in peer;
+  send_request(2, name, options);
+  ssize_t length = receive_packet(packet, &peer);
+  assert(length > 0 && read_u16(packet + 2) == 6);
+
+  long long total = size / block_size + 1, acked = 0;
+  while (acked < total)
+  {
+    for (long long block = acked + 1; block <= acked + WINDOW && block <= total; block++)
+    {
+      long long offset = (block - 1) * block_size;
+      size_t part = size - offset < block_size ? (size_t)(size - offset) : (size_t)block_size;
+      uint16_t number = htons(wire_block(block, rollover));
+      memcpy(packet + 2, "\0\3", 2);
+      memcpy(packet + 4, &number, 2);
+      memcpy(packet + 6, data + offset, part);
+      send_packet(packet, 6 + part, &peer);
+    }
+    while ((length = receive_packet(packet, &peer)) > 0)
+    {
+      assert(read_u16(packet + 2) == 4);
+      // the ACK is of a block of the window just sent
+      for (long long block = acked; block <= acked + WINDOW; block++)
+        if (wire_block(block, rollover) == read_u16(packet + 4))
+        {
+          acked = block;
+          break;
+        }
+      break;
+    }
+  }
+  free(packet);
+}
+
+void check_file(const char *path, long long offset, const uint8_t *data, long long size)
+{
+  uint8_t *copy = malloc(size);
+  int fd = open(path, O_RDONLY);
+  assert(fd >= 0 && pread(fd, copy, size, offset) == size && memcmp(copy, data, size) == 0);
+  close(fd);
+  free(copy);
+}
+
+int main()
+{
+  sock = socket(AF_INET, SOCK_DGRAM, 0);
+  struct timeval timeout = {0, 200000};
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  int buffer_size = 4 << 20; // a window of the largest blocks
+  setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+  server.sin_family = AF_INET;
+  server.sin_port = htons(PORT);
+  server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  // a sparse file, with a few marks so that blocks differ
+  const char *large = "upload/large_sparse.bin";
+  int fd = open(large, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  assert(fd >= 0 && ftruncate(fd, LARGE_SIZE) == 0);
+  long long marks[] = {0, 65464LL * 65535 - 3, 65464LL * 65536, 4294967295LL, 4294967296LL + 12345, LARGE_SIZE - 7};
+  for (size_t i = 0; i < sizeof(marks) / sizeof(marks[0]); i++)
+    assert(pwrite(fd, "marked!", 7, marks[i]) == 7);
+  close(fd);
+
+  const char *rollover_0[] = {"blksize", "65464", "windowsize", "32", NULL};
+  const char *rollover_1[] = {"blksize", "65464", "windowsize", "32", "rollover", "1", NULL};
+  const char *past_4gb[] = {"blksize", "1024", "windowsize", "32", "range", "4294967000-4294977000", NULL};
+  download(large, rollover_0, 65464, 0, 0, LARGE_SIZE);
+  download(large, rollover_1, 65464, 1, 0, LARGE_SIZE);
+  download(large, past_4gb, 1024, 0, 4294967000LL, 10001);
+  unlink(large);
+
+  // 8-byte blocks roll over within half a megabyte
+  long long size = 8LL * 70000 + 5;
+  uint8_t *data = malloc(size);
+  for (long long i = 0; i < size; i++)
+    data[i] = rand();
+  const char *small_0[] = {"blksize", "8", "windowsize", "32", NULL};
+  const char *small_1[] = {"blksize", "8", "windowsize", "32", "rollover", "1", NULL};
+  upload("rollover_0.bin", small_0, data, size, 8, 0);
+  upload("rollover_1.bin", small_1, data, size, 8, 1);
+  usleep(100000);
+  check_file("upload/rollover_0.bin", 0, data, size);
+  check_file("upload/rollover_1.bin", 0, data, size);
+  unlink("upload/rollover_0.bin");
+  unlink("upload/rollover_1.bin");
+  printf("upload across 65535 blocks, both rollovers: ok\n");
+
+  // a part written past 4 GB
+  const char *part[] = {"blksize", "1024", "windowsize", "32", "range", "5000000000-5000009999", NULL};
+  upload("part_4gb.bin", part, data, 10000, 1024, 0);
+  usleep(100000);
+  check_file("upload/part_4gb.bin", 5000000000LL, data, 10000);
+  unlink("upload/part_4gb.bin");
+  printf("upload of a part past 4 GB: ok\n");
+
+  free(data);
+  close(sock);
+  return 0;
+}